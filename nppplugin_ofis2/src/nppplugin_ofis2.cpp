@@ -405,6 +405,8 @@ namespace {
 	HWND edit_handle = 0;
 	HWND list_handle = 0;
 
+	String title; // as in the dialog resource
+
 	ui_aux::listview::column filelist_columns[] = {
 		{	ui_aux::listview::column::CT_PROPERTIONAL, 30, L"Name"	},
 		{	ui_aux::listview::column::CT_PROPERTIONAL, 50, L"Path"	},
@@ -424,6 +426,7 @@ namespace {
 	void filelist_setup_columns();
 	void filelist_fit_columns();
 	void filelist_update_activeset();
+	void title_update_indexing(bool indexing, unsigned progress);
 
 	void icon_setup_titlebar(HWND h)
 	{
@@ -498,6 +501,8 @@ namespace npp_plugin_ofis2
 		memcpy(&record_data[0], buffer, datasize);
 
 		filerecords = FileRecords(&record_data[0]);
+
+		title_update_indexing(sr.indexing != 0, sr.indexing_progress);
 #if 0
 		if(sr.userdata) {
 			const wchar_t *searchstring = (const wchar_t*)sr.userdata;
@@ -692,6 +697,23 @@ namespace {
 		}
 	}
 
+	// results are partial while the solution is indexed, say so in the title
+	void title_update_indexing(bool indexing, unsigned progress)
+	{
+		if(!indexing) {
+			::SetWindowText(self_handle, title.c_str());
+			return;
+		}
+
+		wchar_t b[64];
+		_snwprintf(b, sizeof(b)/sizeof(*b), L" - indexing %u%%, results are partial", progress);
+		b[sizeof(b)/sizeof(*b)-1] = 0;
+
+		String t(title);
+		t += b;
+		::SetWindowText(self_handle, t.c_str());
+	}
+
 	void filelist_clear_ui()
 	{
 		::SendMessage(list_handle, LVM_SETITEMCOUNT, 0, 0);
@@ -785,6 +807,10 @@ namespace {
 
 		list_handle = ::GetDlgItem(hwnd, IDC_OFIS2_LIST);
 
+		wchar_t b[256] = {0};
+		::GetWindowText(hwnd, b, sizeof(b)/sizeof(*b));
+		title = b;
+
 		DWORD ex_style = ListView_GetExtendedListViewStyle(list_handle) | LVS_EX_FULLROWSELECT | LVS_EX_DOUBLEBUFFER | LVS_EX_GRIDLINES;
 		ListView_SetExtendedListViewStyle(list_handle, ex_style);
 
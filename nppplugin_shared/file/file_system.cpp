@@ -1,8 +1,17 @@
 #include "file_system.h"
-#include <Windows.h>
+
+#if defined(_WIN32)
+	#include <Windows.h>
+#else
+	#include "string/string_utils.h"
+
+	#include <stdio.h>
+	#include <unistd.h> // unlink
+#endif
 
 namespace npp {
 	namespace file_system {
+#if defined(_WIN32)
 
 		unsigned filesize(const wchar_t *path)
 		{
@@ -35,8 +44,10 @@ namespace npp {
 			}
 
 			DWORD len = size64.LowPart;
-			if(len > destination_size)
+			if(len > destination_size) {
 				CloseHandle(h);
+				return 0;
+			}
 
 			unsigned read_bytes = 0;
 
@@ -67,5 +78,63 @@ namespace npp {
 			return res;
 		}
 
+		bool remove(const wchar_t *path)
+		{
+			return DeleteFile(path) != 0;
+		}
+#else
+		namespace {
+			struct File {
+				File(const wchar_t *path, const char *mode) : f(fopen(string_util::from_wide(path).c_str(), mode)) {}
+				~File() { if(f) fclose(f); }
+
+				FILE *f;
+			};
+
+			unsigned size_of(FILE *f)
+			{
+				if(fseek(f, 0, SEEK_END) != 0)
+					return 0;
+
+				const long size = ftell(f);
+				fseek(f, 0, SEEK_SET);
+				return (size > 0 && (unsigned long)size <= 0xffffffffu ? (unsigned)size : 0);
+			}
+		}
+
+		unsigned filesize(const wchar_t *path)
+		{
+			File file(path, "rb");
+			return (file.f ? size_of(file.f) : 0);
+		}
+
+		unsigned read(const wchar_t *path, void *destination, unsigned destination_size)
+		{
+			File file(path, "rb");
+			if(!file.f)
+				return 0;
+
+			const unsigned len = size_of(file.f);
+			if(len > destination_size)
+				return 0;
+
+			return (fread(destination, 1, len, file.f) == len ? len : 0);
+		}
+
+		unsigned write(const wchar_t *path, const void *data, unsigned data_size)
+		{
+			File file(path, "wb");
+			if(!file.f)
+				return 0;
+
+			return ((fwrite(data, 1, data_size, file.f) == data_size && fflush(file.f) == 0) ? data_size : 0);
+		}
+
+		bool remove(const wchar_t *path)
+		{
+			return unlink(string_util::from_wide(path).c_str()) == 0;
+		}
+#endif
+
 	} // filesystem
 } // npp
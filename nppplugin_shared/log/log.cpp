@@ -0,0 +1,657 @@
+#include "log.h"
+
+#include "thread/thread.h"
+#include "thread/futex.h"
+#include "thread/event_count.h"
+#include "thread/critical_section.h"
+
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <wchar.h>
+
+#ifdef _WIN32
+	#include <Windows.h> // OutputDebugStringA
+#endif
+
+namespace npp {
+	namespace log {
+		std::atomic<unsigned char> category_levels[NUM_CATEGORIES];
+
+		namespace {
+#ifdef _DEBUG
+			const Level DEFAULT_LEVEL = LEVEL_DEBUG;
+#else
+			const Level DEFAULT_LEVEL = LEVEL_WARNING;
+#endif
+			const unsigned QUEUE_SIZE = 1024;	// slots, power of two
+			const unsigned SLOT_SIZE = 256;		// bytes
+			const unsigned MAX_ARGS = 12;
+
+			const char *LEVEL_NAMES[LEVEL_OFF+1] = { "trace", "debug", "info", "warning", "error", "off" };
+			const char *CATEGORY_NAMES[NUM_CATEGORIES] = { "general", "repo", "parser", "search", "monitor", "hub", "ui" };
+
+			struct LevelsInit {
+				LevelsInit()
+				{
+					for(unsigned i=0; i<NUM_CATEGORIES; ++i)
+						category_levels[i].store((unsigned char)DEFAULT_LEVEL, std::memory_order_relaxed);
+				}
+			} levels_init;
+
+			enum ArgType {
+				ARG_SIGNED = 0,
+				ARG_UNSIGNED,
+				ARG_DOUBLE,
+				ARG_POINTER,
+				ARG_STRING,		// unsigned short length + bytes
+				ARG_WSTRING,	// unsigned short length (in characters) + wchar_t's
+				ARG_TRUNCATED	// did not fit
+			};
+
+			struct SlotHeader {
+				std::atomic<unsigned> sequence;
+				unsigned char level;
+				unsigned char category;
+				unsigned char num_args;
+				unsigned char types[MAX_ARGS];
+				unsigned thread;
+				const char *format;
+				unsigned long long time_us;
+			};
+
+			const unsigned PAYLOAD_SIZE = SLOT_SIZE-sizeof(SlotHeader);
+
+			// a log message, the arguments are packed into 'payload' (see 'ArgType')
+			struct Slot : SlotHeader {
+				char payload[PAYLOAD_SIZE];
+			};
+
+			std::atomic<unsigned> next_thread_index(1);
+			thread_local unsigned thread_index = 0;
+
+			inline unsigned long long now_us()
+			{
+				return (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			}
+
+			void append_format(std::string &out, const char *format, ...)
+			{
+				char buffer[256];
+
+				va_list args;
+				va_start(args, format);
+				int n = vsnprintf(buffer, sizeof(buffer), format, args);
+				va_end(args);
+
+				if(n < 0)
+					return;
+
+				if((unsigned)n < sizeof(buffer)) {
+					out.append(buffer, n);
+					return;
+				}
+
+				std::vector<char> large(n+1);
+				va_start(args, format);
+				vsnprintf(&large[0], large.size(), format, args);
+				va_end(args);
+				out.append(&large[0], n);
+			}
+
+			void append_utf8(std::string &out, const wchar_t *s, unsigned length)
+			{
+				for(unsigned i=0; i<length; ++i) {
+					unsigned c = (unsigned)s[i];
+
+					// utf-16 surrogate pair (wchar_t is 16 bits on windows)
+					if(c >= 0xD800 && c <= 0xDBFF && i+1 < length) {
+						const unsigned low = (unsigned)s[i+1];
+						if(low >= 0xDC00 && low <= 0xDFFF) {
+							c = 0x10000+((c-0xD800) << 10)+(low-0xDC00);
+							++i;
+						}
+					}
+
+					if(c < 0x80) {
+						out += (char)c;
+					} else if(c < 0x800) {
+						out += (char)(0xC0 | (c >> 6));
+						out += (char)(0x80 | (c & 0x3F));
+					} else if(c < 0x10000) {
+						out += (char)(0xE0 | (c >> 12));
+						out += (char)(0x80 | ((c >> 6) & 0x3F));
+						out += (char)(0x80 | (c & 0x3F));
+					} else {
+						out += (char)(0xF0 | (c >> 18));
+						out += (char)(0x80 | ((c >> 12) & 0x3F));
+						out += (char)(0x80 | ((c >> 6) & 0x3F));
+						out += (char)(0x80 | (c & 0x3F));
+					}
+				}
+			}
+
+			// reads the packed arguments of a slot back, in order
+			struct ArgReader {
+				ArgReader(const Slot &s) : slot(s), index(0), offset(0) {}
+
+				bool next(unsigned &type, unsigned long long &value, double &d, const char *&data, unsigned &length)
+				{
+					if(index >= slot.num_args)
+						return false;
+
+					type = slot.types[index++];
+					if(type == ARG_STRING || type == ARG_WSTRING) {
+						unsigned short l;
+						memcpy(&l, slot.payload+offset, sizeof(l));
+						offset += sizeof(l);
+
+						data = slot.payload+offset;
+						length = l;
+						offset += l*(type == ARG_STRING ? sizeof(char) : sizeof(wchar_t));
+					} else if(type == ARG_DOUBLE) {
+						memcpy(&d, slot.payload+offset, sizeof(d));
+						offset += sizeof(d);
+					} else if(type != ARG_TRUNCATED) {
+						memcpy(&value, slot.payload+offset, sizeof(value));
+						offset += sizeof(value);
+					}
+					return true;
+				}
+
+				const Slot &slot;
+				unsigned index;
+				unsigned offset;
+			};
+
+			inline bool is_one_of(char c, const char *set)
+			{
+				return c && strchr(set, c) != 0;
+			}
+
+			// one conversion ('spec' holds flags, width and precision, no length modifier)
+			void format_argument(std::string &out, std::string &spec, char conversion, ArgReader &args)
+			{
+				unsigned type = 0; unsigned long long value = 0; double d = 0; const char *data = 0; unsigned length = 0;
+				if(!args.next(type, value, d, data, length)) {
+					out += "<missing>";
+					return;
+				}
+
+				const bool integer_conversion = is_one_of(conversion, "diouxXc");
+				const bool float_conversion = is_one_of(conversion, "fFeEgGaA");
+
+				switch(type) {
+				case ARG_SIGNED:
+				case ARG_UNSIGNED:
+					if(conversion == 'c') {
+						spec += 'c';
+						append_format(out, spec.c_str(), (int)value);
+					} else if(float_conversion) {
+						spec += conversion;
+						append_format(out, spec.c_str(), (type == ARG_SIGNED ? (double)(long long)value : (double)value));
+					} else if(integer_conversion && conversion != 'd' && conversion != 'i') {
+						spec += "ll"; spec += conversion;
+						append_format(out, spec.c_str(), value);
+					} else if(type == ARG_SIGNED || conversion == 'd' || conversion == 'i') {
+						spec += "lld";
+						append_format(out, spec.c_str(), (long long)value);
+					} else {
+						spec += "llu";
+						append_format(out, spec.c_str(), value);
+					}
+					break;
+				case ARG_DOUBLE:
+					spec += (float_conversion ? conversion : 'g');
+					append_format(out, spec.c_str(), d);
+					break;
+				case ARG_POINTER:
+					append_format(out, "0x%llx", value);
+					break;
+				case ARG_STRING:
+				case ARG_WSTRING: {
+						std::string s;
+						if(type == ARG_STRING) {
+							s.assign(data, length);
+						} else {
+							// NOTE : copied out, the payload is not aligned for wchar_t
+							std::vector<wchar_t> w(length+1);
+							memcpy(&w[0], data, length*sizeof(wchar_t));
+							append_utf8(s, &w[0], length);
+						}
+
+						spec += 's';
+						append_format(out, spec.c_str(), s.c_str());
+					}
+					break;
+				default:
+					out += "<truncated>";
+					break;
+				}
+			}
+
+			void format_message(const Slot &slot, unsigned long long start_us, std::string &out)
+			{
+				const unsigned long long t = (slot.time_us > start_us ? slot.time_us-start_us : 0);
+				append_format(out, "[%llu.%06llu][%s][%s][t%u] ", t/1000000, t%1000000, LEVEL_NAMES[slot.level], CATEGORY_NAMES[slot.category], slot.thread);
+
+				ArgReader args(slot);
+				std::string spec;
+
+				const char *p = slot.format;
+				while(*p) {
+					if(*p != '%') {
+						out += *p++;
+						continue;
+					}
+
+					if(p[1] == '%') {
+						out += '%';
+						p += 2;
+						continue;
+					}
+
+					++p;
+					spec = "%";
+					while(is_one_of(*p, "-+ #0"))
+						spec += *p++;
+					while(is_one_of(*p, "0123456789"))
+						spec += *p++;
+					if(*p == '.') {
+						spec += *p++;
+						while(is_one_of(*p, "0123456789"))
+							spec += *p++;
+					}
+
+					// length modifiers are dropped, the argument carries its type
+					while(true) {
+						if(p[0] == 'I' && ((p[1] == '6' && p[2] == '4') || (p[1] == '3' && p[2] == '2')))
+							p += 3;
+						else if(is_one_of(*p, "hlLzjtqI"))
+							++p;
+						else
+							break;
+					}
+
+					if(!*p)
+						break;
+
+					const char conversion = *p++;
+					format_argument(out, spec, (conversion == 'S' ? 's' : conversion), args);
+				}
+
+				// messages end with exactly one newline
+				while(!out.empty() && out[out.size()-1] == '\n')
+					out.erase(out.size()-1);
+				out += '\n';
+			}
+
+			/*
+			 *	Bounded multi producer queue (D. Vyukov), one consumer (the sink thread).
+			 *	A slot is free for position 'p' when its sequence is 'p', and holds a
+			 *	message for 'p' when it is 'p+1'.
+			 */
+			struct Sink {
+				Sink() : enqueue_position(0), dequeue_position(0), written(0), dropped(0), stopped(false), stop_requested(false), finished(false), debugger(true), file(0), start_us(now_us())
+				{
+					for(unsigned i=0; i<QUEUE_SIZE; ++i)
+						slots[i].sequence.store(i, std::memory_order_relaxed);
+
+					// NOTE : lives as long as the process (or until 'shutdown')
+					Thread *t = thread_create(sink_tf, this);
+					thread_start(t);
+					thread_stop(t);
+					thread_destroy(t);
+				}
+
+				Slot *claim(unsigned &position)
+				{
+					if(stopped.load(std::memory_order_relaxed))
+						return 0;
+
+					unsigned p = enqueue_position.load(std::memory_order_relaxed);
+					while(true) {
+						Slot &s = slots[p & (QUEUE_SIZE-1)];
+						const int diff = (int)(s.sequence.load(std::memory_order_acquire)-p);
+
+						if(diff == 0) {
+							if(enqueue_position.compare_exchange_weak(p, p+1, std::memory_order_relaxed))
+								break;
+						} else if(diff < 0) {
+							dropped.fetch_add(1, std::memory_order_relaxed);
+							return 0; // full
+						} else {
+							p = enqueue_position.load(std::memory_order_relaxed);
+						}
+					}
+
+					position = p;
+					return &slots[p & (QUEUE_SIZE-1)];
+				}
+
+				void publish(Slot *s, unsigned position)
+				{
+					s->sequence.store(position+1, std::memory_order_release);
+					wakeup.notify_one();
+				}
+
+				bool ready()
+				{
+					const Slot &s = slots[dequeue_position & (QUEUE_SIZE-1)];
+					return s.sequence.load(std::memory_order_acquire) == dequeue_position+1;
+				}
+
+				static unsigned int __stdcall sink_tf(void *p)
+				{
+					((Sink*)p)->run();
+					return 0;
+				}
+
+				void run()
+				{
+					std::string message;
+
+					while(true) {
+						while(ready()) {
+							Slot &s = slots[dequeue_position & (QUEUE_SIZE-1)];
+
+							message.clear();
+							format_message(s, start_us, message);
+
+							s.sequence.store(dequeue_position+QUEUE_SIZE, std::memory_order_release);
+							++dequeue_position;
+
+							output(message);
+							written.store(dequeue_position, std::memory_order_release);
+							futex_wake_all(&written);
+						}
+
+						const unsigned num_dropped = dropped.exchange(0, std::memory_order_relaxed);
+						if(num_dropped) {
+							message.clear();
+							append_format(message, "[log] queue full, %u messages dropped\n", num_dropped);
+							output(message);
+						}
+
+						if(stop_requested.load(std::memory_order_acquire) && !ready())
+							break;
+
+						const unsigned key = wakeup.prepare_wait();
+						if(ready() || stop_requested.load(std::memory_order_acquire))
+							wakeup.cancel_wait();
+						else
+							wakeup.wait(key);
+					}
+
+					close_file();
+					finished.store(true, std::memory_order_release);
+				}
+
+				void output(const std::string &message)
+				{
+					CriticalSectionScope s(lock);
+
+					if(debugger) {
+#ifdef _WIN32
+						OutputDebugStringA(message.c_str());
+#else
+						fputs(message.c_str(), stderr);
+#endif
+					}
+
+					if(file) {
+						fwrite(message.c_str(), 1, message.length(), file);
+						fflush(file);
+					}
+				}
+
+				void open_file(const wchar_t *path)
+				{
+					CriticalSectionScope s(lock);
+
+					if(file)
+						fclose(file);
+					file = 0;
+
+					if(!path || !*path)
+						return;
+
+#ifdef _WIN32
+					file = _wfopen(path, L"ab");
+#else
+					std::string narrow;
+					append_utf8(narrow, path, (unsigned)wcslen(path));
+					file = fopen(narrow.c_str(), "ab");
+#endif
+				}
+
+				void close_file()
+				{
+					open_file(0);
+				}
+
+				void flush()
+				{
+					const unsigned target = enqueue_position.load(std::memory_order_acquire);
+					while(true) {
+						const unsigned w = written.load(std::memory_order_acquire);
+						if((int)(w-target) >= 0 || stopped_and_drained())
+							return;
+
+						futex_wait(&written, w, 10);
+					}
+				}
+
+				bool stopped_and_drained()
+				{
+					return stop_requested.load(std::memory_order_acquire) && finished.load(std::memory_order_acquire);
+				}
+
+				void shutdown()
+				{
+					stopped.store(true, std::memory_order_relaxed);
+					flush();
+
+					stop_requested.store(true, std::memory_order_release);
+					wakeup.notify_all();
+				}
+
+				Slot slots[QUEUE_SIZE];
+
+				std::atomic<unsigned> enqueue_position;
+				unsigned dequeue_position; // sink thread
+
+				std::atomic<unsigned> written; // messages written so far, see 'flush'
+				std::atomic<unsigned> dropped;
+
+				std::atomic<bool> stopped;			// no more messages taken
+				std::atomic<bool> stop_requested;	// the sink thread exits once drained
+				std::atomic<bool> finished;
+
+				EventCount wakeup;
+
+				CriticalSection lock; // sinks
+				bool debugger;
+				FILE *file;
+
+				const unsigned long long start_us;
+			};
+
+			Sink &sink()
+			{
+				// NOTE : never freed, see constructor
+				static Sink *s = new Sink();
+				return *s;
+			}
+
+			inline Slot &slot_of(detail::Writer &w)
+			{
+				return *(Slot*)w.slot;
+			}
+
+			// room for 'size' more payload bytes, marks the argument as truncated if not
+			inline char *reserve(detail::Writer &w, unsigned type, unsigned size)
+			{
+				if(w.num_args >= MAX_ARGS)
+					return 0;
+
+				Slot &s = slot_of(w);
+				if(w.payload_size+size > PAYLOAD_SIZE) {
+					s.types[w.num_args++] = ARG_TRUNCATED;
+					return 0;
+				}
+
+				s.types[w.num_args++] = (unsigned char)type;
+				char *p = s.payload+w.payload_size;
+				w.payload_size += size;
+				return p;
+			}
+
+			inline void capture_value(detail::Writer &w, unsigned type, const void *v, unsigned size)
+			{
+				if(char *p = reserve(w, type, size))
+					memcpy(p, v, size);
+			}
+
+			// as much of the string as fits
+			void capture_chars(detail::Writer &w, unsigned type, const void *s, size_t length, unsigned char_size)
+			{
+				const unsigned available = (PAYLOAD_SIZE > w.payload_size+sizeof(unsigned short) ? PAYLOAD_SIZE-w.payload_size-(unsigned)sizeof(unsigned short) : 0);
+
+				unsigned short l = (unsigned short)(length < available/char_size ? length : available/char_size);
+				if(char *p = reserve(w, type, sizeof(l)+l*char_size)) {
+					memcpy(p, &l, sizeof(l));
+					memcpy(p+sizeof(l), s, l*char_size);
+				}
+			}
+		}
+
+		void set_level(Category c, Level l)
+		{
+			category_levels[c].store((unsigned char)l, std::memory_order_relaxed);
+		}
+
+		void set_level(Level l)
+		{
+			for(unsigned i=0; i<NUM_CATEGORIES; ++i)
+				set_level((Category)i, l);
+		}
+
+		bool level_from_string(const char *s, Level &out)
+		{
+			for(unsigned i=0; s && i<=LEVEL_OFF; ++i) {
+				if(!strcmp(s, LEVEL_NAMES[i])) {
+					out = (Level)i;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool category_from_string(const char *s, Category &out)
+		{
+			for(unsigned i=0; s && i<NUM_CATEGORIES; ++i) {
+				if(!strcmp(s, CATEGORY_NAMES[i])) {
+					out = (Category)i;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void set_debugger_output(bool on)
+		{
+			Sink &s = sink();
+			CriticalSectionScope scope(s.lock);
+			s.debugger = on;
+		}
+
+		void set_file(const wchar_t *path)
+		{
+			sink().open_file(path);
+		}
+
+		void flush()
+		{
+			sink().flush();
+		}
+
+		void shutdown()
+		{
+			sink().shutdown();
+		}
+
+		namespace detail {
+			bool begin(Writer &w, Category c, Level l, const char *format)
+			{
+				Slot *s = sink().claim(w.position);
+				if(!s)
+					return false;
+
+				if(!thread_index)
+					thread_index = next_thread_index.fetch_add(1, std::memory_order_relaxed);
+
+				s->level = (unsigned char)l;
+				s->category = (unsigned char)c;
+				s->thread = thread_index;
+				s->format = format;
+				s->time_us = now_us();
+
+				w.slot = s;
+				w.num_args = 0;
+				w.payload_size = 0;
+				return true;
+			}
+
+			void commit(Writer &w)
+			{
+				Slot &s = slot_of(w);
+				s.num_args = (unsigned char)w.num_args;
+				sink().publish(&s, w.position);
+			}
+
+			void capture_signed(Writer &w, long long v)
+			{
+				capture_value(w, ARG_SIGNED, &v, sizeof(v));
+			}
+
+			void capture_unsigned(Writer &w, unsigned long long v)
+			{
+				capture_value(w, ARG_UNSIGNED, &v, sizeof(v));
+			}
+
+			void capture_double(Writer &w, double v)
+			{
+				capture_value(w, ARG_DOUBLE, &v, sizeof(v));
+			}
+
+			void capture_pointer(Writer &w, const void *v)
+			{
+				const unsigned long long p = (unsigned long long)(size_t)v;
+				capture_value(w, ARG_POINTER, &p, sizeof(p));
+			}
+
+			void capture_string(Writer &w, const char *s, size_t length)
+			{
+				if(!s)
+					s = "(null)", length = 6;
+				else if(length == (size_t)-1)
+					length = strlen(s);
+
+				capture_chars(w, ARG_STRING, s, length, sizeof(char));
+			}
+
+			void capture_wstring(Writer &w, const wchar_t *s, size_t length)
+			{
+				if(!s)
+					s = L"(null)", length = 6;
+				else if(length == (size_t)-1)
+					length = wcslen(s);
+
+				capture_chars(w, ARG_WSTRING, s, length, sizeof(wchar_t));
+			}
+		}
+	}
+}
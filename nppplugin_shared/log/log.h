@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+/*
+ *	Leveled, categorized logging, formatted and written on a background thread.
+ *
+ *		LOG_DEBUG(npp::log::CATEGORY_REPO, "merged %u records into %S", n, name);
+ *
+ *	The calling thread checks the level (one relaxed load) and copies the format
+ *	pointer and the arguments into a slot of a bounded lock-free queue, nothing
+ *	is formatted there. When the queue is full the message is dropped (and the
+ *	drops are reported by the sink).
+ *
+ *	Supported arguments : integers, floating point, pointers, narrow and wide
+ *	strings (copied, long strings are truncated). '%S' (and '%ls') prints a wide
+ *	string, '*' widths are not supported.
+ *
+ *	NOTE : the format must be a string literal (or otherwise outlive the message)
+ */
+#define LOG_AT(category, level, format, ...) \
+	do { \
+		if(npp::log::enabled((category), (level))) \
+			npp::log::write((category), (level), format, ##__VA_ARGS__); \
+	} while(0)
+
+#define LOG_TRACE(category, format, ...) LOG_AT((category), npp::log::LEVEL_TRACE, format, ##__VA_ARGS__)
+#define LOG_DEBUG(category, format, ...) LOG_AT((category), npp::log::LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(category, format, ...) LOG_AT((category), npp::log::LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_WARNING(category, format, ...) LOG_AT((category), npp::log::LEVEL_WARNING, format, ##__VA_ARGS__)
+#define LOG_ERROR(category, format, ...) LOG_AT((category), npp::log::LEVEL_ERROR, format, ##__VA_ARGS__)
+
+namespace npp {
+	namespace log {
+		enum Level {
+			LEVEL_TRACE = 0,
+			LEVEL_DEBUG,
+			LEVEL_INFO,
+			LEVEL_WARNING,
+			LEVEL_ERROR,
+			LEVEL_OFF
+		};
+
+		enum Category {
+			CATEGORY_GENERAL = 0,
+			CATEGORY_REPO,		// file repository, index maintenance
+			CATEGORY_PARSER,	// directory parsing
+			CATEGORY_SEARCH,
+			CATEGORY_MONITOR,	// folder monitor
+			CATEGORY_HUB,		// plugin messages, settings
+			CATEGORY_UI,
+
+			NUM_CATEGORIES
+		};
+
+		// per category, debug builds start at LEVEL_DEBUG, release builds at LEVEL_WARNING
+		extern std::atomic<unsigned char> category_levels[NUM_CATEGORIES];
+
+		inline bool enabled(Category c, Level l)
+		{
+			return (unsigned)l >= category_levels[c].load(std::memory_order_relaxed);
+		}
+
+		void set_level(Category c, Level l);
+		void set_level(Level l); // all categories
+
+		// by name ('trace', 'debug', 'info', 'warning', 'error', 'off'), false if unknown
+		bool level_from_string(const char *s, Level &out);
+		bool category_from_string(const char *s, Category &out);
+
+		/*
+		 *	Sinks. The debugger (OutputDebugString, stderr on other platforms) is on
+		 *	by default, a file is appended to when set (empty/null closes it).
+		 */
+		void set_debugger_output(bool on);
+		void set_file(const wchar_t *path);
+
+		// waits until everything logged so far is written
+		void flush();
+
+		// flushes and stops the sink thread (logging after this is dropped)
+		void shutdown();
+
+		namespace detail {
+			struct Writer;
+
+			// false when the queue is full or the logger is shut down
+			bool begin(Writer &w, Category c, Level l, const char *format);
+			void commit(Writer &w);
+
+			void capture_signed(Writer &w, long long v);
+			void capture_unsigned(Writer &w, unsigned long long v);
+			void capture_double(Writer &w, double v);
+			void capture_pointer(Writer &w, const void *v);
+			void capture_string(Writer &w, const char *s, size_t length);
+			void capture_wstring(Writer &w, const wchar_t *s, size_t length);
+
+			struct Writer {
+				void *slot;
+				unsigned position;
+				unsigned num_args;
+				unsigned payload_size;
+			};
+
+			inline void capture(Writer &w, bool v) { capture_signed(w, v ? 1 : 0); }
+			inline void capture(Writer &w, char v) { capture_signed(w, v); }
+			inline void capture(Writer &w, signed char v) { capture_signed(w, v); }
+			inline void capture(Writer &w, unsigned char v) { capture_unsigned(w, v); }
+			inline void capture(Writer &w, short v) { capture_signed(w, v); }
+			inline void capture(Writer &w, unsigned short v) { capture_unsigned(w, v); }
+			inline void capture(Writer &w, int v) { capture_signed(w, v); }
+			inline void capture(Writer &w, unsigned int v) { capture_unsigned(w, v); }
+			inline void capture(Writer &w, long v) { capture_signed(w, v); }
+			inline void capture(Writer &w, unsigned long v) { capture_unsigned(w, v); }
+			inline void capture(Writer &w, long long v) { capture_signed(w, v); }
+			inline void capture(Writer &w, unsigned long long v) { capture_unsigned(w, v); }
+			inline void capture(Writer &w, float v) { capture_double(w, v); }
+			inline void capture(Writer &w, double v) { capture_double(w, v); }
+			inline void capture(Writer &w, const void *v) { capture_pointer(w, v); }
+			inline void capture(Writer &w, const char *s) { capture_string(w, s, (size_t)-1); }
+			inline void capture(Writer &w, const wchar_t *s) { capture_wstring(w, s, (size_t)-1); }
+			inline void capture(Writer &w, const std::string &s) { capture_string(w, s.c_str(), s.length()); }
+			inline void capture(Writer &w, const std::wstring &s) { capture_wstring(w, s.c_str(), s.length()); }
+
+			inline void capture_all(Writer&) {}
+
+			template<typename T, typename... Rest>
+			inline void capture_all(Writer &w, const T &v, const Rest&... rest)
+			{
+				capture(w, v);
+				capture_all(w, rest...);
+			}
+		}
+
+		template<typename... Args>
+		void write(Category c, Level l, const char *format, const Args&... args)
+		{
+			detail::Writer w;
+			if(!detail::begin(w, c, l, format))
+				return;
+
+			detail::capture_all(w, args...);
+			detail::commit(w);
+		}
+	}
+}
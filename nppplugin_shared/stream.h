@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <stdio.h>
+#include <string.h> // memmove, strlen
 
 namespace npp {
 	namespace stream {
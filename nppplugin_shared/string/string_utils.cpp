@@ -1,13 +1,22 @@
 #include "string_utils.h"
 #include <stdio.h>
 #include <assert.h>
+#include <string.h> // strlen
+#include <ctype.h> // toupper
 
-#include <Windows.h> // MultiByteToWideChar
+#include "wcs_compat.h"
+
+#if defined(_WIN32)
+	#include <Windows.h> // MultiByteToWideChar
+#else
+	#include <stdlib.h> // mbstowcs
+#endif
 
 #define strlen32(s) (unsigned)strlen((s))
 #define wstrlen32(s) (unsigned)wcslen((s))
 
 namespace string_util {
+#if defined(_WIN32)
 	std::wstring to_wide(const char *s) {
 		unsigned L = MultiByteToWideChar(CP_ACP, 0, s, -1, 0, 0);
 
@@ -50,6 +59,100 @@ namespace string_util {
 		return res;
 	}
 
+	std::string wstr_to_utf8(const wchar_t *s) {
+		std::string res;
+		if(!s)
+			return res;
+
+		const int L = WideCharToMultiByte(CP_UTF8, 0, s, -1, NULL, 0, NULL, NULL);
+		if(L <= 1)
+			return res;
+
+		res.resize(L);
+		WideCharToMultiByte(CP_UTF8, 0, s, -1, &res[0], L, NULL, NULL);
+		res.resize(L-1); // terminator
+		return res;
+	}
+#else
+	// NOTE : the current locale stands in for the ansi code page
+	std::wstring to_wide(const char *s) {
+		const size_t L = mbstowcs(0, s, 0);
+		if(L == (size_t)-1)
+			return std::wstring();
+
+		std::vector<wchar_t> t(L+1);
+		mbstowcs(&t[0], s, L+1);
+
+		return std::wstring(&t[0], L);
+	}
+
+	std::string from_wide(const wchar_t *s) {
+		const size_t L = wcstombs(0, s, 0);
+		if(L == (size_t)-1)
+			return std::string();
+
+		std::vector<char> t(L+1);
+		wcstombs(&t[0], s, L+1);
+
+		return std::string(&t[0], L);
+	}
+
+	// wchar_t is UTF-32 here, like 'MultiByteToWideChar' the result includes the terminator (and is empty on invalid input)
+	std::wstring utf8_to_wstr(const char *utf8) {
+		std::wstring res;
+		if(!utf8)
+			return res;
+
+		const unsigned char *s = (const unsigned char*)utf8;
+		while(*s) {
+			unsigned c = *s++;
+			unsigned n = 0;
+
+			if(c >= 0xf0 && c < 0xf8) { c &= 0x07; n = 3; }
+			else if(c >= 0xe0) { c &= 0x0f; n = 2; }
+			else if(c >= 0xc0) { c &= 0x1f; n = 1; }
+			else if(c >= 0x80) return std::wstring();
+
+			while(n--) {
+				if((*s & 0xc0) != 0x80)
+					return std::wstring();
+
+				c = (c << 6) | (*s++ & 0x3f);
+			}
+			res += (wchar_t)c;
+		}
+
+		res += L'\0';
+		return res;
+	}
+
+	std::string wstr_to_utf8(const wchar_t *s) {
+		std::string res;
+		if(!s)
+			return res;
+
+		for(; *s; ++s) {
+			const unsigned c = (unsigned)*s;
+			if(c < 0x80) {
+				res += (char)c;
+			} else if(c < 0x800) {
+				res += (char)(0xc0 | (c >> 6));
+				res += (char)(0x80 | (c & 0x3f));
+			} else if(c < 0x10000) {
+				res += (char)(0xe0 | (c >> 12));
+				res += (char)(0x80 | ((c >> 6) & 0x3f));
+				res += (char)(0x80 | (c & 0x3f));
+			} else {
+				res += (char)(0xf0 | (c >> 18));
+				res += (char)(0x80 | ((c >> 12) & 0x3f));
+				res += (char)(0x80 | ((c >> 6) & 0x3f));
+				res += (char)(0x80 | (c & 0x3f));
+			}
+		}
+		return res;
+	}
+#endif
+
 	bool str_ends_with(const wchar_t *a, const wchar_t *end, bool case_sensitive)
 	{
 		unsigned sla = wstrlen32(a);
@@ -213,7 +316,11 @@ namespace string_util {
 }
 
 namespace file_util {
+#if defined(_WIN32)
 	const char folder_separator = '\\';
+#else
+	const char folder_separator = '/';
+#endif
 	const char folder_separator_forward = '/';
 
 	#define MAX(a, b)  (((a) > (b)) ? (a) : (b))
@@ -286,7 +393,7 @@ namespace file_util {
 
 	void append_slash(std::wstring &d) {
 		if(!ends_with_slash(d.c_str()))
-			d += L"\\";
+			d += (wchar_t)folder_separator;
 	}
 
 	const wchar_t *fileextension(const wchar_t *s, bool keep_dot) {
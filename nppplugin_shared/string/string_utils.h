@@ -5,6 +5,7 @@
 
 namespace string_util {
 	std::wstring utf8_to_wstr(const char *utf8);
+	std::string wstr_to_utf8(const wchar_t *s);
 
 	std::wstring to_wide(const char *s);
 	std::string from_wide(const wchar_t *s);
@@ -0,0 +1,12 @@
+#pragma once
+
+/*
+ *	The MSVC names of the wide string functions used by the shared code, on
+ *	other platforms (the benchmarks and tools build on Linux).
+ */
+#if !defined(_WIN32)
+	#include <wchar.h>
+
+	#define _wcsicmp wcscasecmp
+	#define _wcsnicmp wcsncasecmp
+#endif
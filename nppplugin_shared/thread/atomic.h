@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <thread> // yield
+
+#if defined(_MSC_VER)
+	#include <intrin.h> // _mm_pause
+#endif
+
+namespace npp {
+	enum { CACHE_LINE_SIZE = 64 };
+
+	// hint to the cpu that we are busy waiting
+	inline void cpu_relax()
+	{
+	#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+		_mm_pause();
+	#elif defined(__i386__) || defined(__x86_64__)
+		__builtin_ia32_pause();
+	#elif defined(__aarch64__) || defined(__arm__)
+		__asm__ __volatile__("yield");
+	#else
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+	#endif
+	}
+
+	/*
+	 *	Exponential backoff for spin loops, 'spin' returns false when it is time
+	 *	to stop spinning and park (or yield) instead.
+	 */
+	struct SpinWait {
+		SpinWait() : _count(0) {}
+
+		bool spin()
+		{
+			if(_count >= MAX_ROUNDS)
+				return false;
+
+			const unsigned n = 1u << _count++;
+			for(unsigned i=0; i<n; ++i)
+				cpu_relax();
+
+			return true;
+		}
+
+		void spin_or_yield()
+		{
+			if(!spin())
+				std::this_thread::yield();
+		}
+
+		void reset() { _count = 0; }
+
+	private:
+		enum { MAX_ROUNDS = 10 }; // ~2k pauses in total
+		unsigned _count;
+	};
+}
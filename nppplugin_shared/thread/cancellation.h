@@ -0,0 +1,23 @@
+#pragma once
+
+#include <atomic>
+
+namespace npp {
+	/*
+	 *	Cooperative cancellation, long running work polls 'cancelled' at points
+	 *	where it can stop cleanly (ex. per directory, per chunk of records).
+	 *	Once cancelled it stays cancelled.
+	 */
+	struct CancellationToken {
+		CancellationToken() : _cancelled(false) {}
+
+		void cancel() { _cancelled.store(true, std::memory_order_release); }
+		bool cancelled() const { return _cancelled.load(std::memory_order_acquire); }
+
+	private:
+		CancellationToken(const CancellationToken&);
+		CancellationToken &operator=(const CancellationToken&);
+
+		std::atomic<bool> _cancelled;
+	};
+}
@@ -1,16 +1,58 @@
 #pragma once
-#include <Windows.h>
+
+#include "atomic.h"
+#include "futex.h"
 
 namespace npp {
+	/*
+	 *	Mutex that spins for a short while before it parks the thread (futex).
+	 *	Uncontended enter/leave is a single atomic operation. NOT recursive.
+	 */
 	struct CriticalSection {
-		CriticalSection() { ::InitializeCriticalSection(&cs); }
-		~CriticalSection() { ::DeleteCriticalSection(&cs); }
+		CriticalSection() : _state(UNLOCKED) {}
+
+		void enter()
+		{
+			unsigned expected = UNLOCKED;
+			if(_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+				return;
+
+			enter_contended();
+		}
+
+		bool try_enter()
+		{
+			unsigned expected = UNLOCKED;
+			return _state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed);
+		}
 
-		void enter() { ::EnterCriticalSection(&cs); }
-		void leave() { ::LeaveCriticalSection(&cs); }
+		void leave()
+		{
+			if(_state.exchange(UNLOCKED, std::memory_order_release) == CONTENDED)
+				futex_wake_one(&_state);
+		}
 
 	private:
-		CRITICAL_SECTION cs;
+		CriticalSection(const CriticalSection&);
+		CriticalSection &operator=(const CriticalSection&);
+
+		enum { UNLOCKED = 0, LOCKED, CONTENDED };
+
+		void enter_contended()
+		{
+			SpinWait sw;
+			while(sw.spin()) {
+				unsigned expected = UNLOCKED;
+				if(_state.load(std::memory_order_relaxed) == UNLOCKED && _state.compare_exchange_weak(expected, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+					return;
+			}
+
+			// NOTE : once parked we can no longer tell if there are other waiters, take it as 'CONTENDED'
+			while(_state.exchange(CONTENDED, std::memory_order_acquire) != UNLOCKED)
+				futex_wait(&_state, CONTENDED);
+		}
+
+		std::atomic<unsigned> _state;
 	};
 
 	struct CriticalSectionScope {
@@ -18,6 +60,7 @@ namespace npp {
 		~CriticalSectionScope() { cs.leave(); }
 
 	private:
+		CriticalSectionScope &operator=(const CriticalSectionScope&);
 		CriticalSection &cs;
 	};
 }
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "futex.h"
+
+namespace npp {
+	/*
+	 *	Signal between threads, same semantics as a Win32 event.
+	 *
+	 *	- manual reset : stays signaled until 'reset', 'set' releases every waiter
+	 *	- auto reset : a successful 'wait' consumes the signal, 'set' releases one waiter
+	 */
+	struct Event {
+		Event(bool manual_reset = false, bool initial_state = false) : _state(initial_state ? 1 : 0), _manual_reset(manual_reset) {}
+
+		void set()
+		{
+			if(_state.exchange(1, std::memory_order_release))
+				return; // already signaled, nobody is sleeping on it
+
+			if(_manual_reset)
+				futex_wake_all(&_state);
+			else
+				futex_wake_one(&_state);
+		}
+
+		void reset()
+		{
+			_state.store(0, std::memory_order_relaxed);
+		}
+
+		// returns false on timeout
+		bool wait(unsigned ms = WAIT_INFINITE)
+		{
+			Deadline deadline(ms);
+			while(!try_consume()) {
+				const unsigned remaining = deadline.remaining_ms();
+				if(!remaining)
+					return false;
+
+				futex_wait(&_state, 0, remaining);
+			}
+			return true;
+		}
+
+	private:
+		Event(const Event&);
+		Event &operator=(const Event&);
+
+		bool try_consume()
+		{
+			if(_manual_reset)
+				return _state.load(std::memory_order_acquire) != 0;
+
+			unsigned expected = 1;
+			return _state.compare_exchange_strong(expected, 0, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+
+		std::atomic<unsigned> _state;
+		const bool _manual_reset;
+	};
+}
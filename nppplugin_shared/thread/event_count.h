@@ -0,0 +1,68 @@
+#pragma once
+
+#include "futex.h"
+
+namespace npp {
+	/*
+	 *	Lets a consumer sleep on a condition (ex. 'queue not empty') without
+	 *	producers taking a lock when nobody sleeps.
+	 *
+	 *	Consumer :
+	 *		unsigned key = ec.prepare_wait();
+	 *		if(condition) ec.cancel_wait(); else ec.wait(key);
+	 *
+	 *	Producer :
+	 *		make condition true; ec.notify_all(); (or notify_one)
+	 */
+	struct EventCount {
+		EventCount() : _epoch(0), _waiters(0) {}
+
+		unsigned prepare_wait()
+		{
+			_waiters.fetch_add(1);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			return _epoch.load(std::memory_order_acquire);
+		}
+
+		void cancel_wait()
+		{
+			_waiters.fetch_sub(1);
+		}
+
+		void wait(unsigned key)
+		{
+			while(_epoch.load(std::memory_order_acquire) == key)
+				futex_wait(&_epoch, key);
+
+			_waiters.fetch_sub(1);
+		}
+
+		void notify_all()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(!_waiters.load(std::memory_order_relaxed))
+				return;
+
+			_epoch.fetch_add(1, std::memory_order_release);
+			futex_wake_all(&_epoch);
+		}
+
+		// NOTE : the other waiters see the new epoch (and return) if they wake up spuriously
+		void notify_one()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(!_waiters.load(std::memory_order_relaxed))
+				return;
+
+			_epoch.fetch_add(1, std::memory_order_release);
+			futex_wake_one(&_epoch);
+		}
+
+	private:
+		EventCount(const EventCount&);
+		EventCount &operator=(const EventCount&);
+
+		std::atomic<unsigned> _epoch;
+		std::atomic<unsigned> _waiters;
+	};
+}
@@ -0,0 +1,96 @@
+#include "futex.h"
+
+#if defined(__linux__)
+	#include <linux/futex.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+	#include <time.h>
+#else
+	#include <mutex>
+	#include <condition_variable>
+	#include <stdint.h>
+#endif
+
+namespace npp {
+#if defined(__linux__)
+	namespace {
+		long futex(std::atomic<unsigned> *address, int op, unsigned value, const struct timespec *timeout)
+		{
+			static_assert(sizeof(std::atomic<unsigned>) == sizeof(unsigned), "futex word must be a plain 32 bit integer");
+			return ::syscall(SYS_futex, (unsigned*)address, op, value, timeout, 0, 0);
+		}
+	}
+
+	void futex_wait(std::atomic<unsigned> *address, unsigned expected, unsigned ms)
+	{
+		if(ms == WAIT_INFINITE) {
+			futex(address, FUTEX_WAIT_PRIVATE, expected, 0);
+			return;
+		}
+
+		struct timespec ts;
+		ts.tv_sec = ms / 1000;
+		ts.tv_nsec = (long)(ms % 1000) * 1000000;
+		futex(address, FUTEX_WAIT_PRIVATE, expected, &ts);
+	}
+
+	void futex_wake_one(std::atomic<unsigned> *address)
+	{
+		futex(address, FUTEX_WAKE_PRIVATE, 1, 0);
+	}
+
+	void futex_wake_all(std::atomic<unsigned> *address)
+	{
+		futex(address, FUTEX_WAKE_PRIVATE, 0x7fffffff, 0);
+	}
+#else
+	namespace {
+		struct ParkingBucket {
+			std::mutex mutex;
+			std::condition_variable cv;
+		};
+
+		enum { NUM_PARKING_BUCKETS = 64 };
+
+		ParkingBucket &bucket(std::atomic<unsigned> *address)
+		{
+			// NOTE : never freed, detached threads may still wake someone during static destruction
+			static ParkingBucket *parking_table = new ParkingBucket[NUM_PARKING_BUCKETS];
+
+			uintptr_t a = (uintptr_t)address;
+			a ^= (a >> 6) ^ (a >> 12);
+			return parking_table[(a >> 2) % NUM_PARKING_BUCKETS];
+		}
+	}
+
+	void futex_wait(std::atomic<unsigned> *address, unsigned expected, unsigned ms)
+	{
+		ParkingBucket &b = bucket(address);
+		std::unique_lock<std::mutex> lock(b.mutex);
+
+		// NOTE : checked under the bucket lock, wakers take it before notifying
+		if(address->load(std::memory_order_acquire) != expected)
+			return;
+
+		if(ms == WAIT_INFINITE)
+			b.cv.wait(lock);
+		else
+			b.cv.wait_for(lock, std::chrono::milliseconds(ms));
+	}
+
+	void futex_wake_one(std::atomic<unsigned> *address)
+	{
+		// buckets are shared between addresses, waking just one could pick the wrong waiter
+		futex_wake_all(address);
+	}
+
+	void futex_wake_all(std::atomic<unsigned> *address)
+	{
+		ParkingBucket &b = bucket(address);
+		{
+			std::lock_guard<std::mutex> lock(b.mutex);
+		}
+		b.cv.notify_all();
+	}
+#endif
+}
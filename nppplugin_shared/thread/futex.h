@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+namespace npp {
+	enum { WAIT_INFINITE = 0xFFFFFFFFu };
+
+	/*
+	 *	Address based wait/wake, a futex on Linux and a hashed parking table
+	 *	(mutex + condition variable per bucket) everywhere else.
+	 *
+	 *	- 'futex_wait' blocks while '*address == expected', until woken or 'ms' passed
+	 *	- wakeups may be spurious, always re-check the condition
+	 */
+	void futex_wait(std::atomic<unsigned> *address, unsigned expected, unsigned ms = WAIT_INFINITE);
+	void futex_wake_one(std::atomic<unsigned> *address);
+	void futex_wake_all(std::atomic<unsigned> *address);
+
+	// converts a timeout in milliseconds into what is left of it on every call
+	struct Deadline {
+		explicit Deadline(unsigned ms) : _infinite(ms == WAIT_INFINITE), _end(std::chrono::steady_clock::now() + std::chrono::milliseconds(_infinite ? 0 : ms)) {}
+
+		bool expired() const { return !_infinite && std::chrono::steady_clock::now() >= _end; }
+
+		unsigned remaining_ms() const
+		{
+			if(_infinite)
+				return WAIT_INFINITE;
+
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if(now >= _end)
+				return 0;
+
+			// round up so we never wake up just before the deadline
+			return (unsigned)std::chrono::duration_cast<std::chrono::milliseconds>(_end - now + std::chrono::microseconds(999)).count();
+		}
+
+	private:
+		bool _infinite;
+		std::chrono::steady_clock::time_point _end;
+	};
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+
+namespace npp {
+	struct MPSCNode {
+		std::atomic<MPSCNode*> next;
+	};
+
+	/*
+	 *	Intrusive, lock-free, multiple producer single consumer queue (FIFO).
+	 *
+	 *	- 'push' is wait-free and can be called from any thread
+	 *	- 'pop' may only be called by the (single) consumer, it can return 0 while
+	 *	  a producer is in the middle of a push, the producer notifies afterwards
+	 *	- the queue never owns the nodes
+	 */
+	struct MPSCQueue {
+		MPSCQueue() : _head(&_stub), _tail(&_stub) { _stub.next.store(0, std::memory_order_relaxed); }
+
+		void push(MPSCNode *n)
+		{
+			n->next.store(0, std::memory_order_relaxed);
+			MPSCNode *prev = _head.exchange(n, std::memory_order_acq_rel);
+			prev->next.store(n, std::memory_order_release);
+		}
+
+		MPSCNode *pop()
+		{
+			MPSCNode *tail = _tail;
+			MPSCNode *next = tail->next.load(std::memory_order_acquire);
+
+			if(tail == &_stub) {
+				if(!next)
+					return 0;
+
+				_tail = next;
+				tail = next;
+				next = next->next.load(std::memory_order_acquire);
+			}
+
+			if(next) {
+				_tail = next;
+				return tail;
+			}
+
+			if(tail != _head.load(std::memory_order_acquire))
+				return 0; // producer between exchange and link
+
+			push(&_stub);
+
+			next = tail->next.load(std::memory_order_acquire);
+			if(next) {
+				_tail = next;
+				return tail;
+			}
+
+			return 0;
+		}
+
+		// consumer only, like 'pop' it can miss a push in progress
+		bool empty() const
+		{
+			return _tail == &_stub && !_stub.next.load(std::memory_order_acquire);
+		}
+
+	private:
+		MPSCQueue(const MPSCQueue&);
+		MPSCQueue &operator=(const MPSCQueue&);
+
+		std::atomic<MPSCNode*> _head;	// producers
+		MPSCNode *_tail;				// consumer
+		MPSCNode _stub;
+	};
+}
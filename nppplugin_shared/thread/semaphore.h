@@ -0,0 +1,60 @@
+#pragma once
+
+#include "futex.h"
+
+namespace npp {
+	// counting semaphore, 'post' only enters the kernel when somebody sleeps
+	struct Semaphore {
+		explicit Semaphore(unsigned initial_count = 0) : _count(initial_count), _waiters(0) {}
+
+		void post(unsigned n = 1)
+		{
+			_count.fetch_add(n, std::memory_order_seq_cst);
+			if(!_waiters.load(std::memory_order_seq_cst))
+				return;
+
+			if(n == 1)
+				futex_wake_one(&_count);
+			else
+				futex_wake_all(&_count);
+		}
+
+		bool try_wait()
+		{
+			unsigned c = _count.load(std::memory_order_relaxed);
+			while(c) {
+				if(_count.compare_exchange_weak(c, c-1, std::memory_order_acquire, std::memory_order_relaxed))
+					return true;
+			}
+			return false;
+		}
+
+		// returns false on timeout
+		bool wait(unsigned ms = WAIT_INFINITE)
+		{
+			if(try_wait())
+				return true;
+
+			Deadline deadline(ms);
+			while(true) {
+				const unsigned remaining = deadline.remaining_ms();
+				if(!remaining)
+					return try_wait();
+
+				_waiters.fetch_add(1, std::memory_order_seq_cst);
+				futex_wait(&_count, 0, remaining);
+				_waiters.fetch_sub(1, std::memory_order_relaxed);
+
+				if(try_wait())
+					return true;
+			}
+		}
+
+	private:
+		Semaphore(const Semaphore&);
+		Semaphore &operator=(const Semaphore&);
+
+		std::atomic<unsigned> _count;
+		std::atomic<unsigned> _waiters;
+	};
+}
@@ -1,55 +1,90 @@
 #include "thread.h"
+#include "event.h"
+
 #include <assert.h>
-#include <Windows.h>
-#include <process.h> // _beginthreadex
+#include <memory>
+#include <thread>
+
+#if defined(_WIN32)
+	#include <Windows.h>
+#elif defined(__linux__)
+	#include <unistd.h>
+	#include <sys/syscall.h>
+#endif
 
 namespace npp {
 
-	struct Thread {
-		Thread() {}
-		operator HANDLE() const	{ return handle; }
+	// outlives 'Thread', a thread may destroy its own handle before it returns
+	struct ThreadState {
+		ThreadState() : finished(true, false) {}
 
-		DWORD thread_id;
+		Event finished;
+	};
+
+	struct Thread {
+		Thread() : entry_point(0), user_data(0), started(false), valid(true) {}
 
 		ThreadEntry entry_point;
 		void *user_data;
-		HANDLE handle;
+
+		std::thread handle;
+		std::shared_ptr<ThreadState> state;
+
+		bool started;
+		bool valid;
 	};
 
+	namespace {
+		void thread_main(ThreadEntry f, void *user_data, std::shared_ptr<ThreadState> state)
+		{
+			f(user_data);
+			state->finished.set();
+		}
+	}
 
 	Thread *thread_create(ThreadEntry f, void *user_data) {
 		Thread *t = new Thread();
 
 		t->entry_point = f;
 		t->user_data = user_data;
-		unsigned int tid;
-		HANDLE h = (HANDLE)_beginthreadex(0, 0, f, user_data, CREATE_SUSPENDED, &tid);
-		t->thread_id = tid;
-		t->handle = h;
-		if(!h) {
-			delete t;
-			t = 0;
-		}
+		t->state = std::make_shared<ThreadState>();
+
 		return t;
 	}
 
 	void thread_destroy(Thread *t)
 	{
+		// NOTE : joined once finished, none of its code runs after (a module can be unloaded)
+		if(t->handle.joinable()) {
+			if(t->state->finished.wait(0))
+				t->handle.join();
+			else
+				t->handle.detach();
+		}
+
 		delete t;
 	}
 
 	bool thread_wait(Thread *t, unsigned ms)
 	{
-		return ::WaitForSingleObject((*t), ms) == WAIT_OBJECT_0;
+		if(!t->started)
+			return false;
+
+		return t->state->finished.wait(ms);
 	}
 
 	bool thread_resume(Thread *t) {
-		if(t->handle) {
-			DWORD res = ::ResumeThread(*t);
-			return res != (DWORD) -1;
+		if(!t->valid) {
+			assert(false);
+			return false;
 		}
-		assert(false);
-		return false;
+
+		if(t->started)
+			return true;
+
+		t->handle = std::thread(thread_main, t->entry_point, t->user_data, t->state);
+		t->started = true;
+		return true;
 	}
 
 	bool thread_start(Thread *t) {
@@ -57,17 +92,39 @@ namespace npp {
 	}
 
 	bool thread_stop(Thread *t) {
-		BOOL res = ::CloseHandle(*t);
-
-		bool success (res != 0);
+		if(!t->valid)
+			return false;
 
-		if(success)
-			t->handle = 0;
+		if(t->handle.joinable())
+			t->handle.detach();
 
-		return success;
+		t->valid = false;
+		return true;
 	}
 
 	bool thread_valid(Thread *t) {
-		return (t->handle != 0);
+		return t->valid;
+	}
+
+	unsigned thread_hardware_concurrency()
+	{
+		unsigned n = std::thread::hardware_concurrency();
+		return n ? n : 1;
+	}
+
+	void thread_set_background(bool background)
+	{
+#if defined(_WIN32)
+		::SetThreadPriority(::GetCurrentThread(), background ? THREAD_MODE_BACKGROUND_BEGIN : THREAD_MODE_BACKGROUND_END);
+#elif defined(__linux__) && defined(SYS_ioprio_set)
+		// see ioprio_set(2), no glibc wrapper
+		const int IOPRIO_WHO_PROCESS = 1; // a thread id is fine
+		const int IOPRIO_CLASS_BE = 2, IOPRIO_CLASS_IDLE = 3, IOPRIO_CLASS_SHIFT = 13;
+		const int ioprio = (background ? (IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) : ((IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 4));
+
+		syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio);
+#else
+		(void)background;
+#endif
 	}
 }
@@ -1,10 +1,20 @@
 #pragma once
 
+#if !defined(_WIN32) && !defined(__stdcall)
+	#define __stdcall
+#endif
+
 namespace npp {
 	typedef unsigned int ( __stdcall* ThreadEntry)(void*);
 
 	struct Thread;
 
+	/*
+	 *	Threads are created suspended and run once started. 'thread_stop' releases
+	 *	the handle (the thread keeps running), 'thread_wait' still works after that.
+	 *	'thread_destroy' joins a thread that finished, a thread 'thread_wait' returned
+	 *	true for is gone after it.
+	 */
 	Thread *thread_create(ThreadEntry f, void *user_data);
 	void thread_destroy(Thread *t);
 
@@ -13,4 +23,13 @@ namespace npp {
 	bool thread_start(Thread *t);
 	bool thread_stop(Thread *t);
 	bool thread_valid(Thread *t);
+
+	unsigned thread_hardware_concurrency();
+
+	/*
+	 *	Lowers (or restores) the I/O and CPU priority of the calling thread, as far
+	 *	as the OS allows it (Windows : background mode, Linux : idle I/O class only,
+	 *	an unprivileged thread can not raise its CPU priority back).
+	 */
+	void thread_set_background(bool background);
 }
@@ -0,0 +1,493 @@
+#include "thread_pool.h"
+#include "thread.h"
+#include "critical_section.h"
+#include "event_count.h"
+#include "mpsc_queue.h"
+#include "trace/trace.h"
+
+#include <queue>
+#include <vector>
+#include <chrono>
+#include <thread> // yield
+
+namespace npp {
+	namespace {
+		enum {
+			MAX_WORKERS = 64,
+			INJECTION_CHECK_INTERVAL = 31,	// a busy worker still looks at the injection/low queue this often
+			STRAND_BATCH_SIZE = 32			// tasks run per strand pickup, before giving the worker back
+		};
+
+		struct Task {
+			TaskFunction function;
+			void *user_data;
+		};
+
+		// a ring buffer, doubles when full and never shrinks (no allocation once warm)
+		struct WorkQueue {
+			WorkQueue() : head(0), count(0) {}
+
+			void push_back(const Task &t)
+			{
+				CriticalSectionScope s(lock);
+				if(count == tasks.size())
+					grow();
+
+				tasks[(head+count) & (tasks.size()-1)] = t;
+				++count;
+			}
+
+			bool pop_back(Task &t)
+			{
+				CriticalSectionScope s(lock);
+				if(!count)
+					return false;
+
+				--count;
+				t = tasks[(head+count) & (tasks.size()-1)];
+				return true;
+			}
+
+			bool pop_front(Task &t)
+			{
+				CriticalSectionScope s(lock);
+				if(!count)
+					return false;
+
+				t = tasks[head];
+				head = (head+1) & (tasks.size()-1);
+				--count;
+				return true;
+			}
+
+			void grow()
+			{
+				std::vector<Task> bigger(tasks.empty() ? 64 : tasks.size()*2);
+				for(size_t i=0; i<count; ++i)
+					bigger[i] = tasks[(head+i) & (tasks.size()-1)];
+
+				tasks.swap(bigger);
+				head = 0;
+			}
+
+			CriticalSection lock;
+			std::vector<Task> tasks; // size is a power of two
+			size_t head;
+			size_t count;
+		};
+
+		struct ThreadPool {
+			explicit ThreadPool(unsigned n);
+
+			void submit(const Task &t, TaskPriority priority);
+			void work(unsigned index);
+			bool shutdown(unsigned ms);
+
+			bool find_task(unsigned index, unsigned tick, Task &t);
+
+			unsigned num_workers;
+			WorkQueue *queues;			// one per worker
+			Thread **workers;
+			WorkQueue injection_queue;	// submits from outside the pool
+			WorkQueue high_queue;		// PRIORITY_HIGH, from anywhere
+			WorkQueue low_queue;		// PRIORITY_LOW, from anywhere
+
+			std::atomic<unsigned> queued;	// submitted and not yet picked up
+			std::atomic<bool> stopping;		// workers return once nothing is queued
+			EventCount idle;
+		};
+
+		struct WorkerParams {
+			ThreadPool *pool;
+			unsigned index;
+		};
+
+		// index of the worker owning the calling thread, -1 outside the pool
+		thread_local int current_worker = -1;
+
+		unsigned int __stdcall worker_tf(void *p)
+		{
+			WorkerParams *wp = (WorkerParams*)p;
+			ThreadPool *pool = wp->pool;
+			unsigned index = wp->index;
+			delete wp;
+
+			current_worker = (int)index;
+			TRACE_THREAD_NAME("pool worker");
+
+			pool->work(index);
+			return 0;
+		}
+
+		ThreadPool::ThreadPool(unsigned n) : num_workers(n), queues(new WorkQueue[n]), workers(new Thread*[n]), queued(0), stopping(false)
+		{
+			for(unsigned i=0; i<n; ++i) {
+				WorkerParams *wp = new WorkerParams();
+				wp->pool = this;
+				wp->index = i;
+
+				// NOTE : the handles are kept for 'shutdown'
+				workers[i] = thread_create(worker_tf, wp);
+				thread_start(workers[i]);
+			}
+		}
+
+		void ThreadPool::submit(const Task &t, TaskPriority priority)
+		{
+			// NOTE : counted before it is visible, a worker seeing the task always sees the count
+			queued.fetch_add(1, std::memory_order_seq_cst);
+
+			if(priority == PRIORITY_HIGH)
+				high_queue.push_back(t);
+			else if(priority == PRIORITY_LOW)
+				low_queue.push_back(t);
+			else if(current_worker >= 0)
+				queues[current_worker].push_back(t);
+			else
+				injection_queue.push_back(t);
+
+			idle.notify_one();
+		}
+
+		bool ThreadPool::find_task(unsigned index, unsigned tick, Task &t)
+		{
+			if(high_queue.pop_front(t))
+				return true;
+
+			// NOTE : peek at the injection/low queue now and then so they are never starved
+			if((tick % INJECTION_CHECK_INTERVAL) == 0 && (injection_queue.pop_front(t) || low_queue.pop_front(t)))
+				return true;
+
+			if(queues[index].pop_back(t) || injection_queue.pop_front(t))
+				return true;
+
+			for(unsigned i=1; i<num_workers; ++i) {
+				if(queues[(index+i) % num_workers].pop_front(t))
+					return true;
+			}
+			return low_queue.pop_front(t);
+		}
+
+		void ThreadPool::work(unsigned index)
+		{
+			unsigned tick = 0;
+			SpinWait sw;
+
+			while(true) {
+				Task t;
+				if(find_task(index, ++tick, t)) {
+					queued.fetch_sub(1, std::memory_order_relaxed);
+					t.function(t.user_data);
+					sw.reset();
+					continue;
+				}
+
+				// a task may be in flight (counted, not yet visible in a queue), spin a little first
+				if(queued.load(std::memory_order_relaxed) && sw.spin())
+					continue;
+
+				unsigned key = idle.prepare_wait();
+				if(queued.load(std::memory_order_seq_cst)) {
+					idle.cancel_wait();
+					std::this_thread::yield();
+					continue;
+				}
+
+				if(stopping.load(std::memory_order_seq_cst)) {
+					idle.cancel_wait();
+					return;
+				}
+
+				idle.wait(key);
+				sw.reset();
+			}
+		}
+
+		// false if a worker is still busy after 'ms', its handle is released then
+		bool ThreadPool::shutdown(unsigned ms)
+		{
+			stopping.store(true, std::memory_order_seq_cst);
+			idle.notify_all();
+
+			Deadline deadline(ms);
+			bool joined = true;
+			for(unsigned i=0; i<num_workers; ++i) {
+				joined = thread_wait(workers[i], deadline.remaining_ms()) && joined;
+				thread_destroy(workers[i]);
+			}
+			return joined;
+		}
+
+		// set once created, 'threadpool_shutdown' does not start what never ran
+		std::atomic<ThreadPool*> created_pool(0);
+
+		ThreadPool &pool()
+		{
+			// NOTE : never freed, a task left behind by 'threadpool_shutdown' may still use it
+			static ThreadPool *p = new ThreadPool(thread_hardware_concurrency() < (unsigned)MAX_WORKERS ? thread_hardware_concurrency() : (unsigned)MAX_WORKERS);
+			created_pool.store(p, std::memory_order_release);
+			return *p;
+		}
+
+		struct DelayedTask {
+			std::chrono::steady_clock::time_point due;
+			Task task;
+			TaskPriority priority;
+
+			// 'std::priority_queue' keeps the largest on top, we want the earliest
+			bool operator<(const DelayedTask &o) const { return due > o.due; }
+		};
+
+		// hands delayed tasks to the pool once they are due, one thread for the process
+		struct Timer {
+			Timer() : wakeup(0), stopping(false)
+			{
+				thread = thread_create(timer_tf, this);
+				thread_start(thread);
+			}
+
+			// the tasks not yet due are dropped
+			bool shutdown(unsigned ms)
+			{
+				stopping.store(true, std::memory_order_release);
+				wakeup.fetch_add(1, std::memory_order_release);
+				futex_wake_one(&wakeup);
+
+				const bool joined = thread_wait(thread, ms);
+				thread_destroy(thread);
+				return joined;
+			}
+
+			void add(const DelayedTask &dt)
+			{
+				{
+					CriticalSectionScope s(lock);
+					tasks.push(dt);
+				}
+
+				wakeup.fetch_add(1, std::memory_order_release);
+				futex_wake_one(&wakeup);
+			}
+
+			static unsigned int __stdcall timer_tf(void *p)
+			{
+				((Timer*)p)->run();
+				return 0;
+			}
+
+			void run()
+			{
+				std::vector<DelayedTask> due;
+
+				while(true) {
+					// NOTE : read before looking at 'tasks', an 'add' after this makes the wait return
+					const unsigned key = wakeup.load(std::memory_order_acquire);
+					unsigned wait_ms = WAIT_INFINITE;
+
+					if(stopping.load(std::memory_order_acquire))
+						return;
+
+					{
+						CriticalSectionScope s(lock);
+						const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+						while(!tasks.empty() && tasks.top().due <= now) {
+							due.push_back(tasks.top());
+							tasks.pop();
+						}
+
+						if(!tasks.empty()) {
+							// round up, waking up early only means another round
+							wait_ms = (unsigned)std::chrono::duration_cast<std::chrono::milliseconds>(tasks.top().due - now + std::chrono::microseconds(999)).count();
+						}
+					}
+
+					for(unsigned i=0; i<due.size(); ++i)
+						pool().submit(due[i].task, due[i].priority);
+
+					if(!due.empty()) {
+						due.clear();
+						continue;
+					}
+
+					futex_wait(&wakeup, key, wait_ms);
+				}
+			}
+
+			CriticalSection lock;
+			std::priority_queue<DelayedTask> tasks;
+			std::atomic<unsigned> wakeup;
+			std::atomic<bool> stopping;
+			Thread *thread;
+		};
+
+		std::atomic<Timer*> created_timer(0);
+
+		Timer &timer()
+		{
+			// NOTE : never freed, like the pool
+			static Timer *t = new Timer();
+			created_timer.store(t, std::memory_order_release);
+			return *t;
+		}
+
+		struct StrandTask : MPSCNode {
+			TaskFunction function; // 0 : destroy the strand
+			void *user_data;
+			TaskPriority priority;
+
+			StrandTask *next_free;
+		};
+	}
+
+	struct Strand {
+		Strand() : pending(0), urgent(0), free_tasks(0) {}
+		~Strand()
+		{
+			while(StrandTask *st = free_tasks) {
+				free_tasks = st->next_free;
+				delete st;
+			}
+		}
+
+		MPSCQueue tasks;
+		std::atomic<unsigned> pending;	// posted and not yet run, the strand is scheduled while > 0
+		std::atomic<unsigned> urgent;	// PRIORITY_HIGH tasks among 'pending'
+
+		// tasks that ran, reused by the next posts (no allocation once warm)
+		CriticalSection free_lock;
+		StrandTask *free_tasks;
+	};
+
+	namespace {
+		void strand_run(void *ud)
+		{
+			Strand *s = (Strand*)ud;
+
+			unsigned executed = 0;
+			while(executed < STRAND_BATCH_SIZE) {
+				StrandTask *st = (StrandTask*)s->tasks.pop();
+				if(!st)
+					break; // empty, or a producer is in the middle of a push
+
+				TaskFunction f = st->function;
+				void *user_data = st->user_data;
+				if(st->priority == PRIORITY_HIGH)
+					s->urgent.fetch_sub(1, std::memory_order_relaxed);
+
+				if(!f) {
+					delete st;
+					delete s;
+					return;
+				}
+
+				{
+					CriticalSectionScope cs(s->free_lock);
+					st->next_free = s->free_tasks;
+					s->free_tasks = st;
+				}
+
+				f(user_data);
+				++executed;
+			}
+
+			// reschedule if anything was posted meanwhile, exactly one runner exists at any time
+			if(s->pending.fetch_sub(executed, std::memory_order_acq_rel) != executed) {
+				const TaskPriority priority = (s->urgent.load(std::memory_order_relaxed) ? PRIORITY_HIGH : PRIORITY_NORMAL);
+				threadpool_submit(strand_run, s, priority);
+			}
+		}
+
+		void strand_push(Strand *s, TaskFunction f, void *user_data, TaskPriority priority)
+		{
+			StrandTask *st = 0;
+			{
+				CriticalSectionScope cs(s->free_lock);
+				if((st = s->free_tasks) != 0)
+					s->free_tasks = st->next_free;
+			}
+			if(!st)
+				st = new StrandTask();
+
+			st->function = f;
+			st->user_data = user_data;
+			st->priority = priority;
+
+			if(priority == PRIORITY_HIGH)
+				s->urgent.fetch_add(1, std::memory_order_relaxed);
+
+			/*
+			 *	NOTE :	counted before the push, the strand is not touched after it. Once the task
+			 *			is in the queue the runner can run it and a destroy posted behind it, and
+			 *			free the strand while this thread is still here. The runner only looks
+			 *			at 'pending' after a batch, a task counted but not yet pushed makes it
+			 *			come back for it (the pop returns 0 meanwhile).
+			 */
+			const bool idle = (s->pending.fetch_add(1, std::memory_order_acq_rel) == 0);
+			s->tasks.push(st);
+
+			// NOTE : no runner exists before this submit, nothing can free the strand meanwhile
+			if(idle)
+				threadpool_submit(strand_run, s, priority);
+		}
+	}
+
+	void threadpool_submit(TaskFunction f, void *user_data, TaskPriority priority)
+	{
+		Task t = { f, user_data };
+		pool().submit(t, priority);
+	}
+
+	void threadpool_submit_after(unsigned ms, TaskFunction f, void *user_data, TaskPriority priority)
+	{
+		if(!ms)
+			return threadpool_submit(f, user_data, priority);
+
+		DelayedTask dt;
+		dt.due = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+		dt.task.function = f;
+		dt.task.user_data = user_data;
+		dt.priority = priority;
+
+		timer().add(dt);
+	}
+
+	unsigned threadpool_num_workers()
+	{
+		return pool().num_workers;
+	}
+
+	bool threadpool_is_worker()
+	{
+		return current_worker >= 0;
+	}
+
+	bool threadpool_shutdown(unsigned ms)
+	{
+		Deadline deadline(ms);
+		bool joined = true;
+
+		// NOTE : the timer first, it submits to the pool
+		if(Timer *t = created_timer.load(std::memory_order_acquire))
+			joined = t->shutdown(deadline.remaining_ms());
+
+		if(ThreadPool *p = created_pool.load(std::memory_order_acquire))
+			joined = p->shutdown(deadline.remaining_ms()) && joined;
+
+		return joined;
+	}
+
+	Strand *strand_create()
+	{
+		return new Strand();
+	}
+
+	void strand_post(Strand *s, TaskFunction f, void *user_data, TaskPriority priority)
+	{
+		strand_push(s, f, user_data, priority);
+	}
+
+	void strand_destroy(Strand *s)
+	{
+		strand_push(s, 0, 0, PRIORITY_NORMAL);
+	}
+}
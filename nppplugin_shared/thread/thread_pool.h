@@ -0,0 +1,51 @@
+#pragma once
+
+namespace npp {
+	typedef void (*TaskFunction)(void *user_data);
+
+	enum TaskPriority {
+		PRIORITY_NORMAL = 0,
+		PRIORITY_HIGH,		// interactive work, picked up before anything else
+		PRIORITY_LOW		// background work, picked up when there is nothing else (and now and then)
+	};
+
+	/*
+	 *	Process wide work-stealing pool, one worker per hardware thread, started
+	 *	on first use and stopped by 'threadpool_shutdown'.
+	 *
+	 *	- tasks submitted from a worker go to its own queue (LIFO, cache friendly)
+	 *	- tasks submitted from any other thread go to a shared injection queue
+	 *	- idle workers steal the oldest task from the other queues
+	 *	- high priority tasks go to their own queue, checked first by every worker
+	 *	- low priority tasks go to their own queue (FIFO), checked last
+	 *	- tasks should not block for long, split big jobs and resubmit them (at low
+	 *	  priority, resubmitted to the own queue they would run before everything else)
+	 */
+	void threadpool_submit(TaskFunction f, void *user_data, TaskPriority priority = PRIORITY_NORMAL);
+
+	// submitted (as above) once 'ms' passed, waiting does not hold a worker
+	void threadpool_submit_after(unsigned ms, TaskFunction f, void *user_data, TaskPriority priority = PRIORITY_NORMAL);
+	unsigned threadpool_num_workers();
+	bool threadpool_is_worker(); // is the calling thread a pool worker
+
+	/*
+	 *	Stops the timer (delayed tasks not yet due are dropped) and the workers, once they
+	 *	ran what is queued, and waits for their threads. Called once before the module is
+	 *	unloaded, from outside the pool, nothing may be submitted after. False if a thread
+	 *	is still running after 'ms'.
+	 */
+	bool threadpool_shutdown(unsigned ms);
+
+	/*
+	 *	Serial task queue on top of the pool. Tasks posted to the same strand run
+	 *	one at a time in posting order, on whichever worker picks the strand up.
+	 *	Priority does not reorder a strand, it decides how soon the strand gets a worker.
+	 */
+	struct Strand;
+
+	Strand *strand_create();
+	void strand_post(Strand *s, TaskFunction f, void *user_data, TaskPriority priority = PRIORITY_NORMAL);
+
+	// freed once every task posted before has run, nothing may be posted after
+	void strand_destroy(Strand *s);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "futex.h"
+
+namespace npp {
+	/*
+	 *	Counts outstanding work (ex. live objects of a subsystem), 'wait' blocks
+	 *	until the count drops to zero.
+	 */
+	struct WaitGroup {
+		WaitGroup() : _count(0) {}
+
+		void add()
+		{
+			_count.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void done()
+		{
+			if(_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				futex_wake_all(&_count);
+		}
+
+		unsigned count() const
+		{
+			return _count.load(std::memory_order_acquire);
+		}
+
+		// returns false if the count did not reach zero within 'ms'
+		bool wait(unsigned ms = WAIT_INFINITE)
+		{
+			Deadline deadline(ms);
+
+			unsigned c;
+			while((c = _count.load(std::memory_order_acquire)) != 0) {
+				const unsigned remaining = deadline.remaining_ms();
+				if(!remaining)
+					return false;
+
+				futex_wait(&_count, c, remaining);
+			}
+			return true;
+		}
+
+	private:
+		WaitGroup(const WaitGroup&);
+		WaitGroup &operator=(const WaitGroup&);
+
+		std::atomic<unsigned> _count;
+	};
+}
@@ -0,0 +1,177 @@
+#include "trace.h"
+
+#ifdef NPP_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+
+namespace npp {
+	namespace trace {
+		namespace {
+			/*
+			 *	Written by the owning thread only. 'sequence' is odd while the slot is
+			 *	written and 2*(index+1) when done, readers copy the slot and keep it
+			 *	only if 'sequence' was the same (and even) before and after.
+			 */
+			struct Event {
+				std::atomic<unsigned long long> sequence;
+				std::atomic<const char*> name;
+				std::atomic<const char*> arg_name;
+				std::atomic<unsigned long long> arg;
+				std::atomic<Ticks> start;
+				std::atomic<Ticks> end;
+			};
+
+			struct ThreadBuffer {
+				ThreadBuffer() : next(0), id(0), written(0), name(0)
+				{
+					for(unsigned i=0; i<EVENTS_PER_THREAD; ++i)
+						events[i].sequence.store(0, std::memory_order_relaxed);
+				}
+
+				ThreadBuffer *next;	// set before the buffer is published
+				unsigned id;
+
+				std::atomic<unsigned long long> written;
+				std::atomic<const char*> name;
+
+				Event events[EVENTS_PER_THREAD];
+			};
+
+			// every buffer ever created, newest first
+			std::atomic<ThreadBuffer*> buffers(0);
+			std::atomic<unsigned> next_thread_id(1);
+
+			thread_local ThreadBuffer *current_buffer = 0;
+
+			// NOTE : never freed, the threads (pool workers and the ui thread) live as long as the process
+			ThreadBuffer *thread_buffer()
+			{
+				ThreadBuffer *b = current_buffer;
+				if(b)
+					return b;
+
+				b = new ThreadBuffer();
+				b->id = next_thread_id.fetch_add(1, std::memory_order_relaxed);
+
+				ThreadBuffer *head = buffers.load(std::memory_order_relaxed);
+				do {
+					b->next = head;
+				} while(!buffers.compare_exchange_weak(head, b, std::memory_order_release, std::memory_order_relaxed));
+
+				current_buffer = b;
+				return b;
+			}
+
+			void append_escaped(std::string &out, const char *s)
+			{
+				for(; *s; ++s) {
+					if(*s == '"' || *s == '\\')
+						out += '\\';
+					out += *s;
+				}
+			}
+
+			void append_event(std::string &out, unsigned tid, const char *name, const char *arg_name, unsigned long long arg, Ticks start, Ticks end)
+			{
+				char buffer[128];
+
+				out += (out.empty() ? "" : ",\n");
+				out += "{\"name\":\"";
+				append_escaped(out, name);
+
+				// NOTE : microseconds, with nanoseconds as the fraction
+				snprintf(buffer, sizeof(buffer), "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u,\"dur\":%llu.%03u",
+						tid, start/1000, (unsigned)(start%1000), (end-start)/1000, (unsigned)((end-start)%1000));
+				out += buffer;
+
+				if(arg_name) {
+					out += ",\"args\":{\"";
+					append_escaped(out, arg_name);
+					snprintf(buffer, sizeof(buffer), "\":%llu}", arg);
+					out += buffer;
+				}
+				out += "}";
+			}
+
+			void append_thread_name(std::string &out, unsigned tid, const char *name)
+			{
+				char buffer[128];
+
+				out += (out.empty() ? "" : ",\n");
+				snprintf(buffer, sizeof(buffer), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", tid);
+				out += buffer;
+				append_escaped(out, name);
+				out += "\"}}";
+			}
+		}
+
+		Ticks now()
+		{
+			return (Ticks)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		void record(const char *name, const char *arg_name, unsigned long long arg, Ticks start, Ticks end)
+		{
+			ThreadBuffer *b = thread_buffer();
+
+			const unsigned long long i = b->written.load(std::memory_order_relaxed);
+			Event &e = b->events[i%EVENTS_PER_THREAD];
+
+			e.sequence.store(2*i+1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			e.name.store(name, std::memory_order_relaxed);
+			e.arg_name.store(arg_name, std::memory_order_relaxed);
+			e.arg.store(arg, std::memory_order_relaxed);
+			e.start.store(start, std::memory_order_relaxed);
+			e.end.store(end, std::memory_order_relaxed);
+
+			e.sequence.store(2*i+2, std::memory_order_release);
+			b->written.store(i+1, std::memory_order_release);
+		}
+
+		void thread_name(const char *name)
+		{
+			thread_buffer()->name.store(name, std::memory_order_release);
+		}
+
+		void export_chrome_json(std::string &out)
+		{
+			std::string events;
+
+			for(ThreadBuffer *b = buffers.load(std::memory_order_acquire); b; b = b->next) {
+				const char *name = b->name.load(std::memory_order_acquire);
+				if(name)
+					append_thread_name(events, b->id, name);
+
+				const unsigned long long written = b->written.load(std::memory_order_acquire);
+				const unsigned long long first = (written > EVENTS_PER_THREAD ? written-EVENTS_PER_THREAD : 0);
+
+				for(unsigned long long i=first; i<written; ++i) {
+					const Event &e = b->events[i%EVENTS_PER_THREAD];
+
+					const unsigned long long s = e.sequence.load(std::memory_order_acquire);
+					const char *event_name = e.name.load(std::memory_order_relaxed);
+					const char *arg_name = e.arg_name.load(std::memory_order_relaxed);
+					const unsigned long long arg = e.arg.load(std::memory_order_relaxed);
+					const Ticks start = e.start.load(std::memory_order_relaxed);
+					const Ticks end = e.end.load(std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_acquire);
+
+					if(s != 2*i+2 || e.sequence.load(std::memory_order_relaxed) != s)
+						continue; // overwritten meanwhile
+
+					append_event(events, b->id, event_name, arg_name, arg, start, end);
+				}
+			}
+
+			out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+			out += events;
+			out += "\n]}\n";
+		}
+	}
+}
+
+#endif // NPP_TRACE
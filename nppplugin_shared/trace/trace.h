@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+
+/*
+ *	Span tracing, exported as Chrome trace json (chrome://tracing, ui.perfetto.dev).
+ *
+ *	Compiled out unless NPP_TRACE is defined ('premake5 --trace ...'). When compiled
+ *	in, every thread records finished spans into its own ring buffer (the last
+ *	'EVENTS_PER_THREAD' spans are kept), recording is two clock reads and a few
+ *	relaxed stores. 'trace::export_chrome_json' can run at any time, from any thread.
+ *
+ *		void merge() {
+ *			TRACE_SCOPE("merge");
+ *			TRACE_SCOPE_ARG("merge", "records", n); // with a number shown in the viewer
+ *			...
+ *		}
+ *
+ *	NOTE : names (and arg names) must be string literals (or otherwise outlive the trace)
+ */
+
+#ifdef NPP_TRACE
+	#define TRACE_CONCAT_(a, b) a##b
+	#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+	#define TRACE_SCOPE(name) npp::trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)((name), 0, 0)
+	#define TRACE_SCOPE_ARG(name, arg_name, arg) npp::trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)((name), (arg_name), (unsigned long long)(arg))
+
+	#define TRACE_THREAD_NAME(name) npp::trace::thread_name(name)
+#else
+	#define TRACE_SCOPE(name)
+	#define TRACE_SCOPE_ARG(name, arg_name, arg)
+	#define TRACE_THREAD_NAME(name)
+#endif
+
+namespace npp {
+	namespace trace {
+		enum { EVENTS_PER_THREAD = 8*1024 };
+
+		typedef unsigned long long Ticks; // nanoseconds, monotonic
+
+		Ticks now();
+
+		void record(const char *name, const char *arg_name, unsigned long long arg, Ticks start, Ticks end);
+
+		// shown as the thread name in the viewer
+		void thread_name(const char *name);
+
+		// snapshot of all threads, spans being overwritten while copying are skipped
+		void export_chrome_json(std::string &out);
+
+		struct Scope {
+			Scope(const char *name, const char *arg_name, unsigned long long arg) : _name(name), _arg_name(arg_name), _arg(arg), _start(now()) {}
+			~Scope() { record(_name, _arg_name, _arg, _start, now()); }
+
+		private:
+			Scope(const Scope&);
+			Scope &operator=(const Scope&);
+
+			const char *_name;
+			const char *_arg_name;
+			unsigned long long _arg;
+			Ticks _start;
+		};
+	}
+}
@@ -0,0 +1,154 @@
+/*
+ *	Latency and throughput of the file repository input pipeline under many producers,
+ *	results as json on stdout.
+ *
+ *	bench_input [--messages=1000000] [--paced=20000] [--interval_us=50]
+ *
+ *	Every message goes onto an MPSC queue and posts a step, the step drains the queue
+ *	on a strand, the way 'FileRepo' is fed. Every producer count runs twice :
+ *	flooding the queue with '--messages' (throughput) and paced, every producer
+ *	pushing one of '--paced' messages every '--interval_us' (push to pop latency of
+ *	the hand over, strand scheduling and a parked worker waking up, rather than of a
+ *	backlog).
+ */
+#include "thread/event.h"
+#include "thread/mpsc_queue.h"
+#include "thread/thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	struct Message : npp::MPSCNode {
+		Clock::time_point pushed;
+	};
+
+	struct Input {
+		npp::MPSCQueue messages;
+		npp::Strand *strand;
+		npp::Event done;
+		npp::Event flushed;
+
+		// strand only
+		unsigned received;
+		std::vector<double> *latencies_us;
+
+		// like 'FileRepo::step' : drain the queue
+		static void step_task(void *user_data)
+		{
+			Input *in = (Input*)user_data;
+			while(Message *m = (Message*)in->messages.pop()) {
+				(*in->latencies_us)[in->received++] = std::chrono::duration<double, std::micro>(Clock::now()-m->pushed).count();
+				if(in->received == in->latencies_us->size())
+					in->done.set();
+			}
+		}
+
+		static void flush_task(void *user_data)
+		{
+			((Input*)user_data)->flushed.set();
+		}
+	};
+
+	void push(Input &in, Message *m)
+	{
+		m->pushed = Clock::now();
+		in.messages.push(m);
+		npp::strand_post(in.strand, Input::step_task, &in);
+	}
+
+	// seconds until the consumer has every message
+	double run(unsigned num_producers, unsigned num_messages, unsigned interval_us, std::vector<double> &latencies_us)
+	{
+		const unsigned per_producer = num_messages/num_producers;
+
+		Input in;
+		std::vector<Message> messages(num_producers*per_producer);
+		latencies_us.resize(messages.size());
+
+		in.strand = npp::strand_create();
+		in.received = 0;
+		in.latencies_us = &latencies_us;
+
+		const Clock::time_point start = Clock::now();
+
+		std::vector<std::thread> producers;
+		for(unsigned p=0; p<num_producers; ++p) {
+			Message *mine = &messages[p*per_producer];
+			producers.push_back(std::thread([&in, mine, per_producer, interval_us]() {
+				for(unsigned i=0; i<per_producer; ++i) {
+					const Clock::time_point next = Clock::now()+std::chrono::microseconds(interval_us);
+					push(in, &mine[i]);
+
+					while(interval_us && Clock::now() < next)
+						std::this_thread::yield();
+				}
+			}));
+		}
+
+		in.done.wait();
+		const double seconds = std::chrono::duration<double>(Clock::now()-start).count();
+
+		for(unsigned p=0; p<producers.size(); ++p)
+			producers[p].join();
+
+		// NOTE : steps posted after the last message was drained may still be queued, the strand runs them in order
+		npp::strand_post(in.strand, Input::flush_task, &in);
+		in.flushed.wait();
+		npp::strand_destroy(in.strand);
+
+		return seconds;
+	}
+
+	// nearest rank
+	double percentile(const std::vector<double> &sorted, double p)
+	{
+		size_t rank = (size_t)(p/100.0*sorted.size()+0.5);
+		rank = (rank ? rank-1 : 0);
+		return sorted[rank < sorted.size() ? rank : sorted.size()-1];
+	}
+
+	unsigned argument(int argc, char **argv, const char *name, unsigned value)
+	{
+		const size_t length = strlen(name);
+		for(int i=1; i<argc; ++i) {
+			if(!strncmp(argv[i], name, length) && argv[i][length] == '=')
+				return (unsigned)strtoul(argv[i]+length+1, 0, 10);
+		}
+		return value;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned num_messages = argument(argc, argv, "--messages", 1000000);
+	const unsigned num_paced = argument(argc, argv, "--paced", 20000);
+	const unsigned interval_us = argument(argc, argv, "--interval_us", 50);
+
+	const unsigned producers[] = { 1, 2, 4, 8 };
+	std::vector<double> latencies_us;
+
+	printf("[\n");
+	for(unsigned i=0; i<4; ++i) {
+		const unsigned n = producers[i];
+
+		const double seconds = run(n, num_messages, 0, latencies_us);
+		const double mmessages_per_second = (latencies_us.size()/1000000.0)/(seconds > 0 ? seconds : 1e-9);
+
+		run(n, num_paced, interval_us, latencies_us);
+		std::sort(latencies_us.begin(), latencies_us.end());
+
+		printf("\t{ \"producers\" : %u, \"mmessages_per_second\" : %.3f, \"p50_us\" : %.2f, \"p99_us\" : %.2f, \"max_us\" : %.2f }%s\n",
+			n, mmessages_per_second, percentile(latencies_us, 50), percentile(latencies_us, 99), latencies_us.back(), i != 3 ? "," : "");
+	}
+	printf("]\n");
+
+	return 0;
+}
@@ -0,0 +1,935 @@
+/*
+ *	Filesystem event storms against the folder monitor and file repository (Linux),
+ *	results as json (stdout or '--out').
+ *
+ *	bench_monitor [--dir=/tmp/bench_monitor] [--files=20000] [--scenarios=name[,name]]
+ *	              [--rate=1000] [--duration=5] [--probe-every=200] [--timeout=60]
+ *	              [--seed=1] [--out=file.json]
+ *
+ *	A scratch tree of '--files' files (see 'corpus.h') is written below '--dir' (removed
+ *	first), indexed as a monitored solution, then every scenario changes it while the
+ *	monitor runs :
+ *		create_burst	new files in existing and new directories, as fast as possible (a checkout)
+ *		modify			rewrites existing files
+ *		deep_rename		renames the largest top directory and a deep one, then back
+ *		mass_delete		removes the largest top directory (make clean)
+ *		churn			creates, rewrites and removes files at '--rate' changes per second for '--duration' seconds
+ *		storm			creates '--files' files in one directory and removes them again, as fast as possible
+ *
+ *	Every '--probe-every' changes a probe file is created, a thread searches for it until
+ *	it is found (event to index latency). Once a scenario is done the repo is given
+ *	'--timeout' seconds to settle (the index matches the tree and nothing is pending),
+ *	then the index is compared to a fresh walk of the tree (missing, stale and
+ *	duplicate files). Monitor overflows (dropped events) and rescans are reported
+ *	per scenario.
+ */
+#include "corpus.h"
+
+#include "file_repository.h"
+#include "filerecords.h"
+#include "stats.h"
+
+#include "json/json.h"
+#include "log/log.h"
+#include "string/string_utils.h"
+#include "thread/critical_section.h"
+#include "thread/event.h"
+#include "thread/thread.h"
+
+#if !defined(__linux__)
+
+#include <stdio.h>
+
+int main()
+{
+	fprintf(stderr, "bench_monitor runs on Linux only\n");
+	return 1;
+}
+
+#else
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+	typedef stats::u64 u64;
+
+	struct Options {
+		Options() : dir("/tmp/bench_monitor"), files(20000), rate(1000), duration(5), probe_every(200), timeout(60), seed(1) {}
+
+		std::string dir;
+		std::string out;
+		std::vector<std::string> scenarios;
+		unsigned files;
+		unsigned rate;
+		unsigned duration;
+		unsigned probe_every;
+		unsigned timeout;
+		unsigned seed;
+	};
+
+	Options options;
+
+	std::vector<std::string> split(const char *s)
+	{
+		std::vector<std::string> parts;
+		std::stringstream ss(s);
+		std::string part;
+		while(std::getline(ss, part, ','))
+			if(!part.empty())
+				parts.push_back(part);
+		return parts;
+	}
+
+	bool parse_arguments(int argc, char **argv)
+	{
+		for(int i=1; i<argc; ++i) {
+			const char *a = argv[i];
+			const char *v = strchr(a, '=');
+			const std::string name(a, v ? v-a : strlen(a));
+			v = (v ? v+1 : "");
+
+			if(name == "--dir") {
+				options.dir = v;
+			} else if(name == "--files") {
+				options.files = (unsigned)strtoul(v, 0, 10);
+			} else if(name == "--scenarios") {
+				options.scenarios = split(v);
+			} else if(name == "--rate") {
+				options.rate = (unsigned)strtoul(v, 0, 10);
+			} else if(name == "--duration") {
+				options.duration = (unsigned)strtoul(v, 0, 10);
+			} else if(name == "--probe-every") {
+				options.probe_every = (unsigned)strtoul(v, 0, 10);
+			} else if(name == "--timeout") {
+				options.timeout = (unsigned)strtoul(v, 0, 10);
+			} else if(name == "--seed") {
+				options.seed = (unsigned)strtoul(v, 0, 10);
+			} else if(name == "--out") {
+				options.out = v;
+			} else {
+				fprintf(stderr, "unknown argument '%s'\n", a);
+				return false;
+			}
+		}
+
+		// NOTE : the tree is removed first, refuse anything that looks like it is not scratch
+		if(options.dir.length() < 2 || options.dir == "/" || !options.files || !options.rate || !options.probe_every) {
+			fprintf(stderr, "invalid arguments\n");
+			return false;
+		}
+
+		if(options.dir[options.dir.length()-1] == '/')
+			options.dir.erase(options.dir.length()-1);
+
+		if(options.scenarios.empty())
+			options.scenarios = split("create_burst,modify,deep_rename,mass_delete,churn,storm");
+
+		return true;
+	}
+
+	double ms_since(u64 start_us)
+	{
+		return (stats::now_us()-start_us)/1000.0;
+	}
+
+	// latencies, nearest rank
+	struct Latencies {
+		void add(double ms) { _ms.push_back(ms); }
+
+		void to_json(Json::Value &out)
+		{
+			out["count"] = (unsigned)_ms.size();
+			if(_ms.empty())
+				return;
+
+			std::sort(_ms.begin(), _ms.end());
+
+			const double p[] = { 50, 95, 99 };
+			const char *names[] = { "p50_ms", "p95_ms", "p99_ms" };
+			for(unsigned i=0; i<3; ++i) {
+				size_t rank = (size_t)(p[i]/100.0*_ms.size()+0.5);
+				rank = (rank ? rank-1 : 0);
+				out[names[i]] = _ms[rank < _ms.size() ? rank : _ms.size()-1];
+			}
+			out["max_ms"] = _ms.back();
+		}
+
+	private:
+		std::vector<double> _ms;
+	};
+
+	//////////////////////////////////////////////////////////////////////////
+	// the scratch tree
+
+	bool make_directory(const std::string &d)
+	{
+		return mkdir(d.c_str(), 0755) == 0 || errno == EEXIST;
+	}
+
+	bool make_directories(const std::string &d)
+	{
+		for(size_t i=1; i<d.length(); ++i)
+			if(d[i] == '/' && !make_directory(d.substr(0, i)))
+				return false;
+
+		return make_directory(d);
+	}
+
+	bool write_file(const std::string &f, unsigned content)
+	{
+		const int fd = open(f.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0)
+			return false;
+
+		char text[32];
+		const int n = snprintf(text, sizeof(text), "%u\n", content);
+		const bool ok = (write(fd, text, n) == n);
+		close(fd);
+		return ok;
+	}
+
+	void remove_tree(const std::string &d)
+	{
+		DIR *dir = opendir(d.c_str());
+		if(dir) {
+			while(struct dirent *e = readdir(dir)) {
+				if(!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+					continue;
+
+				const std::string p = d+"/"+e->d_name;
+				struct stat st;
+				if(lstat(p.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+					remove_tree(p);
+				else
+					unlink(p.c_str());
+			}
+			closedir(dir);
+		}
+		rmdir(d.c_str());
+	}
+
+	// files below 'd' as the parser sees them (directories starting with '.' or '$' skipped)
+	void walk(const std::string &d, std::vector<std::string> &files, unsigned *num_directories)
+	{
+		DIR *dir = opendir(d.c_str());
+		if(!dir)
+			return;
+
+		++*num_directories;
+		while(struct dirent *e = readdir(dir)) {
+			const std::string p = d+"/"+e->d_name;
+			struct stat st;
+			if(lstat(p.c_str(), &st) != 0)
+				continue;
+
+			if(S_ISDIR(st.st_mode)) {
+				if(e->d_name[0] != '.' && e->d_name[0] != '$')
+					walk(p, files, num_directories);
+			} else {
+				files.push_back(p);
+			}
+		}
+		closedir(dir);
+	}
+
+	// what the scenarios pick from, kept up to date by them
+	struct Tree {
+		std::vector<std::string> files;
+		std::vector<std::string> directories; // without the trailing slash
+		unsigned next_name;
+
+		Tree() : next_name(0) {}
+
+		std::string new_file_name(const std::string &d)
+		{
+			char name[64];
+			snprintf(name, sizeof(name), "/added_%u.cpp", next_name++);
+			return d+name;
+		}
+
+		// every path below 'from' gets 'to' instead
+		void rename(const std::string &from, const std::string &to)
+		{
+			for(size_t i=0; i<files.size(); ++i)
+				if(files[i].compare(0, from.length()+1, from+"/") == 0)
+					files[i] = to+files[i].substr(from.length());
+
+			for(size_t i=0; i<directories.size(); ++i)
+				if(directories[i] == from || directories[i].compare(0, from.length()+1, from+"/") == 0)
+					directories[i] = to+directories[i].substr(from.length());
+		}
+
+		void remove(const std::string &d)
+		{
+			const std::string prefix = d+"/";
+			files.erase(std::remove_if(files.begin(), files.end(), [&](const std::string &f) { return f.compare(0, prefix.length(), prefix) == 0; }), files.end());
+			directories.erase(std::remove_if(directories.begin(), directories.end(), [&](const std::string &s) { return s == d || s.compare(0, prefix.length(), prefix) == 0; }), directories.end());
+		}
+	};
+
+	unsigned depth_of(const std::string &d)
+	{
+		return (unsigned)std::count(d.begin()+options.dir.length(), d.end(), '/');
+	}
+
+	// the top directory with the most files below it
+	std::string largest_top_directory(const Tree &tree)
+	{
+		std::map<std::string, unsigned> counts;
+		for(size_t i=0; i<tree.files.size(); ++i) {
+			const std::string &f = tree.files[i];
+			const size_t end = f.find('/', options.dir.length()+1);
+			if(end != std::string::npos)
+				counts[f.substr(0, end)] += 1;
+		}
+
+		std::string best;
+		unsigned best_count = 0;
+		for(std::map<std::string, unsigned>::const_iterator i=counts.begin(); i!=counts.end(); ++i) {
+			if(i->second > best_count && i->first != options.dir+"/probes") {
+				best = i->first;
+				best_count = i->second;
+			}
+		}
+		return best;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// the repo
+
+	struct PendingQuery {
+		PendingQuery() : num_results(0) {}
+
+		npp::Event done;
+		unsigned num_results;
+		std::vector<char> result;
+	};
+
+	void search_done(void *userdata, void *result, unsigned size, const filerepo::SearchStatus &)
+	{
+		PendingQuery *q = (PendingQuery*)userdata;
+		q->num_results = *(const unsigned*)result;
+		q->result.assign((const char*)result, (const char*)result+size);
+		q->done.set();
+	}
+
+	unsigned search(FileRepositoryHandle repo, const wchar_t *s, std::vector<char> *result = 0)
+	{
+		PendingQuery q;
+		filerepo::search(repo, s, &q, search_done);
+		q.done.wait();
+
+		if(result)
+			result->swap(q.result);
+		return q.num_results;
+	}
+
+	// full paths of every record (a search for everything)
+	void index_contents(FileRepositoryHandle repo, std::vector<std::string> &paths)
+	{
+		std::vector<char> result;
+		const unsigned n = search(repo, L"", &result);
+
+		const char *base = &result[0]+(n+1)*sizeof(unsigned);
+		for(unsigned i=0; i<n; ++i) {
+			const unsigned offset = *(const unsigned*)(&result[0]+(i+1)*sizeof(unsigned));
+			const char *record = base+offset;
+			const FileRecordHeader &h = *(const FileRecordHeader*)record;
+
+			// NOTE : the 6 byte headers leave every other record unaligned for a 4 byte wchar_t, copied out char by char
+			std::wstring full;
+			for(unsigned part=0; part<2; ++part) {
+				const char *c = record+sizeof(FileRecordHeader)+(part ? h.filename_offset : 0);
+				for(wchar_t w; memcpy(&w, c, sizeof(w)), w; c += sizeof(w))
+					full += w;
+			}
+			paths.push_back(string_util::from_wide(full.c_str()));
+		}
+	}
+
+	struct RepoState {
+		u64 records;
+		u64 pending;
+		u64 batches;
+		u64 overflows;
+		u64 rescans;
+		u64 watch_failures;
+		u64 watched_directories;
+	};
+
+	RepoState repo_state(FileRepositoryHandle repo)
+	{
+		Json::Value s;
+		filerepo::get_stats(repo, s);
+
+		RepoState r;
+		r.records = (u64)s["index"]["records"].asDouble();
+		r.pending = (u64)(s["index"]["pending_changes"].asDouble()+s["index"]["pending_updates"].asDouble());
+		r.batches = (u64)s["monitor"]["batches"].asDouble();
+		r.overflows = (u64)s["monitor"]["overflows"].asDouble();
+		r.rescans = (u64)s["monitor"]["rescans"].asDouble();
+		r.watch_failures = (u64)s["monitor"]["watch_failures"].asDouble();
+		r.watched_directories = (u64)s["monitor"]["watched_directories"].asDouble();
+		return r;
+	}
+
+	/*
+	 *	Settled once the index has as many records as the tree has files, nothing is pending
+	 *	and the monitor has been quiet for a while (a count can match on the way). Gives up
+	 *	early when the repo is idle with a different count (changes were lost), 'settle_ms'
+	 *	is when it went idle then.
+	 */
+	bool wait_until_settled(FileRepositoryHandle repo, u64 expected_records, double *settle_ms)
+	{
+		const unsigned QUIET_MS = 200;
+		const unsigned IDLE_MS = 2000;
+
+		const u64 start = stats::now_us();
+		const u64 deadline = start+options.timeout*1000000ull;
+
+		u64 last_batches = ~0ull;
+		u64 quiet_since = start;
+		u64 matched_at = 0;
+		u64 idle_at = 0;
+		while(stats::now_us() < deadline) {
+			const RepoState s = repo_state(repo);
+			const u64 now = stats::now_us();
+
+			if(s.batches != last_batches) {
+				last_batches = s.batches;
+				quiet_since = now;
+				idle_at = 0;
+			}
+
+			const bool matches = (s.records == expected_records && s.pending == 0);
+			if(!matches)
+				matched_at = 0;
+			else if(!matched_at)
+				matched_at = now;
+
+			if(s.pending != 0)
+				idle_at = 0;
+			else if(!idle_at)
+				idle_at = now;
+
+			if(matched_at && now-quiet_since >= QUIET_MS*1000ull) {
+				*settle_ms = (matched_at-start)/1000.0;
+				return true;
+			}
+
+			if(!matched_at && idle_at && now-idle_at >= IDLE_MS*1000ull) {
+				*settle_ms = (idle_at-start)/1000.0;
+				return false;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+
+		*settle_ms = ms_since(start);
+		return false;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// probes, event to index latency
+
+	struct Probes {
+		Probes() : repo(0), next(0), lost(0), stop(false) {}
+
+		FileRepositoryHandle repo;
+		std::string directory;
+		unsigned next;
+
+		npp::CriticalSection lock;
+		std::deque<std::pair<std::wstring, u64> > pending; // query, created
+		Latencies latencies;
+		unsigned lost;
+
+		std::atomic<bool> stop;
+
+		void create()
+		{
+			char name[64];
+			snprintf(name, sizeof(name), "/zzprobe%uq.txt", next);
+
+			wchar_t query[64];
+			swprintf(query, 64, L"zzprobe%uq", next);
+			++next;
+
+			const u64 created = stats::now_us();
+			if(!write_file(directory+name, next))
+				return;
+
+			npp::CriticalSectionScope s(lock);
+			pending.push_back(std::make_pair(std::wstring(query), created));
+		}
+
+		// searches for the oldest probe until it is found (or given up on)
+		void check_loop()
+		{
+			const u64 GIVE_UP_US = options.timeout*1000000ull;
+
+			while(true) {
+				std::pair<std::wstring, u64> p;
+				{
+					npp::CriticalSectionScope s(lock);
+					if(pending.empty()) {
+						if(stop.load())
+							return;
+					} else {
+						p = pending.front();
+					}
+				}
+
+				if(p.first.empty()) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					continue;
+				}
+
+				// NOTE : queries are answered before index work, polling slower than searches take leaves the repo time to index
+				while(true) {
+					const u64 searched = stats::now_us();
+					if(search(repo, p.first.c_str()) || searched-p.second > GIVE_UP_US)
+						break;
+
+					const u64 search_us = stats::now_us()-searched;
+					std::this_thread::sleep_for(std::chrono::microseconds(std::max<u64>(1000, 4*search_us)));
+				}
+
+				const u64 found = stats::now_us();
+
+				npp::CriticalSectionScope s(lock);
+				if(found-p.second > GIVE_UP_US)
+					++lost;
+				else
+					latencies.add((found-p.second)/1000.0);
+				pending.pop_front();
+			}
+		}
+
+		static unsigned int __stdcall check_tf(void *p)
+		{
+			((Probes*)p)->check_loop();
+			return 0;
+		}
+	};
+
+	//////////////////////////////////////////////////////////////////////////
+	// scenarios, return the number of changes made
+
+	struct Context {
+		Tree tree;
+		corpus::Random random;
+		Probes *probes;
+		unsigned changes;
+
+		Context() : random(1), probes(0), changes(0) {}
+
+		// a change was made, paced by 'rate' when given
+		void changed(u64 start_us = 0, unsigned rate = 0)
+		{
+			++changes;
+			if(changes % options.probe_every == 0)
+				probes->create();
+
+			if(rate) {
+				const u64 due = start_us+(u64)changes*1000000ull/rate;
+				const u64 now = stats::now_us();
+				if(due > now)
+					std::this_thread::sleep_for(std::chrono::microseconds(due-now));
+			}
+		}
+	};
+
+	void create_burst(Context &c)
+	{
+		const unsigned n = std::max(options.files/4, 1u);
+
+		for(unsigned i=0; i<n; ++i) {
+			std::string d = c.tree.directories[c.random.below((unsigned)c.tree.directories.size())];
+
+			// every 20th file in a new directory, a few levels deep
+			if(i % 20 == 0 && depth_of(d) < 8) {
+				char name[32];
+				snprintf(name, sizeof(name), "/new_%u", c.tree.next_name++);
+				d += name;
+				if(!make_directory(d))
+					continue;
+
+				c.tree.directories.push_back(d);
+				c.changed();
+			}
+
+			const std::string f = c.tree.new_file_name(d);
+			if(write_file(f, i)) {
+				c.tree.files.push_back(f);
+				c.changed();
+			}
+		}
+	}
+
+	void modify(Context &c)
+	{
+		const unsigned n = std::max(options.files/10, 1u);
+		for(unsigned i=0; i<n && !c.tree.files.empty(); ++i) {
+			if(write_file(c.tree.files[c.random.below((unsigned)c.tree.files.size())], i))
+				c.changed();
+		}
+	}
+
+	void deep_rename(Context &c)
+	{
+		std::string top = largest_top_directory(c.tree);
+
+		std::string deep;
+		for(size_t i=0; i<c.tree.directories.size(); ++i)
+			if(depth_of(c.tree.directories[i]) > depth_of(deep.empty() ? options.dir : deep) && c.tree.directories[i].compare(0, top.length()+1, top+"/") != 0)
+				deep = c.tree.directories[i];
+
+		const std::string renamed[] = { top, deep };
+		for(unsigned r=0; r<2; ++r) {
+			const std::string &from = renamed[r];
+			if(from.empty())
+				continue;
+
+			const std::string to = from+"_renamed";
+			if(::rename(from.c_str(), to.c_str()) == 0) {
+				c.tree.rename(from, to);
+				c.changed();
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+			if(::rename(to.c_str(), from.c_str()) == 0) {
+				c.tree.rename(to, from);
+				c.changed();
+			}
+		}
+	}
+
+	void mass_delete(Context &c)
+	{
+		const std::string top = largest_top_directory(c.tree);
+		if(top.empty())
+			return;
+
+		// NOTE : like 'rm -rf', every file is a change
+		std::vector<std::string> files;
+		unsigned num_directories = 0;
+		walk(top, files, &num_directories);
+
+		for(size_t i=0; i<files.size(); ++i)
+			if(unlink(files[i].c_str()) == 0)
+				c.changed();
+
+		remove_tree(top);
+		c.tree.remove(top);
+		c.changed();
+	}
+
+	void churn(Context &c)
+	{
+		const u64 start = stats::now_us();
+		const u64 end = start+options.duration*1000000ull;
+
+		std::vector<std::string> created;
+		while(stats::now_us() < end) {
+			const unsigned what = c.random.below(3);
+			if(what == 0 || created.empty()) {
+				const std::string f = c.tree.new_file_name(c.tree.directories[c.random.below((unsigned)c.tree.directories.size())]);
+				if(write_file(f, 0)) {
+					created.push_back(f);
+					c.tree.files.push_back(f);
+				}
+			} else if(what == 1) {
+				write_file(created[c.random.below((unsigned)created.size())], 1);
+			} else {
+				const unsigned i = c.random.below((unsigned)created.size());
+				unlink(created[i].c_str());
+				c.tree.files.erase(std::find(c.tree.files.begin(), c.tree.files.end(), created[i]));
+				created[i] = created.back();
+				created.pop_back();
+			}
+
+			c.changed(start, options.rate);
+		}
+	}
+
+	void storm(Context &c)
+	{
+		const std::string d = options.dir+"/storm";
+		if(!make_directory(d))
+			return;
+
+		c.tree.directories.push_back(d);
+		c.changed();
+
+		std::vector<std::string> files;
+		for(unsigned i=0; i<options.files; ++i) {
+			const std::string f = c.tree.new_file_name(d);
+			if(write_file(f, i)) {
+				files.push_back(f);
+				c.changed();
+			}
+		}
+
+		for(size_t i=0; i<files.size(); ++i)
+			if(unlink(files[i].c_str()) == 0)
+				c.changed();
+
+		remove_tree(d);
+		c.tree.remove(d);
+		c.changed();
+	}
+
+	struct Scenario {
+		const char *name;
+		void (*run)(Context&);
+	};
+
+	const Scenario SCENARIOS[] = {
+		{ "create_burst", create_burst },
+		{ "modify", modify },
+		{ "deep_rename", deep_rename },
+		{ "mass_delete", mass_delete },
+		{ "churn", churn },
+		{ "storm", storm },
+	};
+	const unsigned NUM_SCENARIOS = sizeof(SCENARIOS)/sizeof(SCENARIOS[0]);
+
+	//////////////////////////////////////////////////////////////////////////
+
+	void compare_index(FileRepositoryHandle repo, const std::vector<std::string> &walked, Json::Value &out)
+	{
+		std::vector<std::string> indexed;
+		index_contents(repo, indexed);
+
+		std::vector<std::string> files(walked);
+		std::sort(files.begin(), files.end());
+		std::sort(indexed.begin(), indexed.end());
+
+		const size_t unique = std::unique(indexed.begin(), indexed.end())-indexed.begin();
+		const unsigned duplicates = (unsigned)(indexed.size()-unique);
+		indexed.resize(unique);
+
+		std::vector<std::string> missing, stale;
+		std::set_difference(files.begin(), files.end(), indexed.begin(), indexed.end(), std::back_inserter(missing));
+		std::set_difference(indexed.begin(), indexed.end(), files.begin(), files.end(), std::back_inserter(stale));
+
+		out["files"] = (unsigned)files.size();
+		out["records"] = (unsigned)(unique+duplicates);
+		out["missing"] = (unsigned)missing.size();
+		out["stale"] = (unsigned)stale.size();
+		out["duplicates"] = duplicates;
+		out["correct"] = (missing.empty() && stale.empty() && !duplicates);
+
+		// a few examples, to look into
+		for(size_t i=0; i<missing.size() && i<5; ++i)
+			out["missing_examples"].append(missing[i]);
+		for(size_t i=0; i<stale.size() && i<5; ++i)
+			out["stale_examples"].append(stale[i]);
+	}
+
+	unsigned read_proc_value(const char *path)
+	{
+		FILE *f = fopen(path, "r");
+		if(!f)
+			return 0;
+
+		unsigned v = 0;
+		if(fscanf(f, "%u", &v) != 1)
+			v = 0;
+		fclose(f);
+		return v;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if(!parse_arguments(argc, argv))
+		return 1;
+
+	npp::log::set_level(npp::log::LEVEL_WARNING);
+
+	Json::Value root(Json::objectValue);
+	Json::Value &meta = root["meta"];
+	meta["dir"] = options.dir;
+	meta["files"] = options.files;
+	meta["seed"] = options.seed;
+	meta["rate"] = options.rate;
+	meta["duration_seconds"] = options.duration;
+	meta["probe_every"] = options.probe_every;
+	meta["hardware_threads"] = npp::thread_hardware_concurrency();
+	meta["max_queued_events"] = read_proc_value("/proc/sys/fs/inotify/max_queued_events");
+	meta["max_user_watches"] = read_proc_value("/proc/sys/fs/inotify/max_user_watches");
+
+	// the scratch tree
+	Context c;
+	c.random = corpus::Random(options.seed);
+	{
+		fprintf(stderr, "writing %u files below %s\n", options.files, options.dir.c_str());
+		remove_tree(options.dir);
+		if(!make_directories(options.dir)) {
+			fprintf(stderr, "can not create '%s'\n", options.dir.c_str());
+			return 1;
+		}
+
+		corpus::Shape shape;
+		shape.seed = options.seed;
+
+		corpus::Corpus corpus;
+		corpus.generate(shape, string_util::to_wide(options.dir.c_str()).c_str(), options.files);
+
+		for(unsigned d=0; d<corpus.directories.size(); ++d) {
+			std::string dir = string_util::from_wide(corpus.directories[d].c_str());
+			dir.erase(dir.length()-1);
+			if(d && !make_directory(dir))
+				continue;
+			c.tree.directories.push_back(dir);
+
+			for(unsigned i=0; i<corpus.files_in_directory[d]; ++i) {
+				const std::string f = string_util::from_wide(corpus.file_path(d, i).c_str());
+				if(write_file(f, i))
+					c.tree.files.push_back(f);
+			}
+		}
+
+		make_directory(options.dir+"/probes");
+	}
+
+	// indexed and monitored
+	FileRepositoryHandle repo = filerepo::allocate_handle();
+	{
+		Json::Value solution(Json::objectValue);
+		Json::Value &d = solution["directories"][0u];
+		d["path"] = options.dir;
+		d["recursive"] = true;
+		d["monitored"] = true;
+
+		std::vector<std::string> files;
+		unsigned num_directories = 0;
+		walk(options.dir, files, &num_directories);
+
+		const u64 start = stats::now_us();
+		filerepo::add_solution(repo, solution);
+
+		// the monitor starts once parsing is done
+		while(true) {
+			const RepoState s = repo_state(repo);
+			if(s.records == files.size() && s.watched_directories+s.watch_failures >= num_directories)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+
+		Json::Value &r = root["setup"];
+		r["files"] = (unsigned)files.size();
+		r["directories"] = num_directories;
+		r["index_and_watch_ms"] = ms_since(start);
+		r["watch_failures"] = (double)repo_state(repo).watch_failures;
+	}
+
+	Probes probes;
+	probes.repo = repo;
+	probes.directory = options.dir+"/probes";
+	c.probes = &probes;
+
+	Json::Value &results = root["scenarios"];
+	for(size_t s=0; s<options.scenarios.size(); ++s) {
+		const Scenario *scenario = 0;
+		for(unsigned i=0; i<NUM_SCENARIOS; ++i)
+			if(options.scenarios[s] == SCENARIOS[i].name)
+				scenario = &SCENARIOS[i];
+
+		if(!scenario) {
+			fprintf(stderr, "unknown scenario '%s'\n", options.scenarios[s].c_str());
+			continue;
+		}
+
+		fprintf(stderr, "%s\n", scenario->name);
+
+		probes.latencies = Latencies();
+		probes.lost = 0;
+		probes.stop = false;
+
+		npp::Thread *checker = npp::thread_create(Probes::check_tf, &probes);
+		npp::thread_start(checker);
+
+		const RepoState before = repo_state(repo);
+		c.changes = 0;
+
+		const u64 start = stats::now_us();
+		scenario->run(c);
+		const double changes_ms = ms_since(start);
+
+		std::vector<std::string> files;
+		unsigned num_directories = 0;
+		walk(options.dir, files, &num_directories);
+
+		double settle_ms = 0;
+		const bool settled = wait_until_settled(repo, files.size(), &settle_ms);
+
+		probes.stop = true;
+		npp::thread_wait(checker, (options.timeout+5)*1000);
+		npp::thread_destroy(checker);
+
+		const RepoState after = repo_state(repo);
+
+		Json::Value r(Json::objectValue);
+		r["scenario"] = scenario->name;
+		r["changes"] = c.changes;
+		r["changes_ms"] = changes_ms;
+		r["changes_per_second"] = (changes_ms > 0 ? c.changes/(changes_ms/1000.0) : 0.0);
+		r["settled"] = settled;
+		r["settle_ms"] = settle_ms;
+
+		Json::Value &monitor = r["monitor"];
+		monitor["batches"] = (double)(after.batches-before.batches);
+		monitor["overflows"] = (double)(after.overflows-before.overflows);
+		monitor["rescans"] = (double)(after.rescans-before.rescans);
+		monitor["watch_failures"] = (double)(after.watch_failures-before.watch_failures);
+		monitor["watched_directories"] = (double)after.watched_directories;
+		monitor["directories"] = num_directories;
+
+		probes.latencies.to_json(r["event_to_index"]);
+		r["event_to_index"]["lost"] = probes.lost;
+
+		compare_index(repo, files, r["index"]);
+		results.append(r);
+	}
+
+	Json::StyledWriter writer;
+	const std::string json = writer.write(root);
+
+	FILE *f = (options.out.empty() ? stdout : fopen(options.out.c_str(), "wb"));
+	if(!f) {
+		fprintf(stderr, "can not write '%s'\n", options.out.c_str());
+		return 1;
+	}
+
+	fwrite(json.c_str(), 1, json.length(), f);
+	if(f != stdout)
+		fclose(f);
+
+	filerepo::stop(repo);
+	filerepo::join(10000);
+	remove_tree(options.dir);
+
+	npp::log::shutdown();
+	return 0;
+}
+
+#endif // __linux__
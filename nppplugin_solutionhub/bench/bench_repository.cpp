@@ -0,0 +1,1265 @@
+/*
+ *	Benchmarks of the file repository core, results as json (stdout or '--out').
+ *
+ *	bench_repository [--sizes=10000,100000,1000000,5000000] [--seed=1] [--iterations=0]
+ *	                 [--only=name[,name]] [--out=file.json]
+ *
+ *	Every size gets a fresh corpus (see 'corpus.h'), the same seed always gives
+ *	the same records so runs of different commits can be compared. Iterations
+ *	(0 : depends on the size) report min/median/mean, the repo benchmarks
+ *	report latency percentiles over all queries.
+ */
+#include "corpus.h"
+
+#include "file_repository.h"
+#include "file_repository_common.h"
+#include "stats.h"
+#include "stream.h"
+#include "vfs.h"
+
+#include "json/json.h"
+#include "log/log.h"
+#include "string/string_utils.h"
+#include "thread/critical_section.h"
+#include "thread/event.h"
+#include "thread/mpsc_queue.h"
+#include "thread/thread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <thread>
+
+/*
+ *	Allocations of the whole process are counted while 'count_allocations' is set
+ *	(see 'repo_search_allocations').
+ */
+namespace {
+	std::atomic<bool> count_allocations(false);
+	std::atomic<unsigned long long> allocations(0);
+}
+
+// NOTE : kept out of line, gcc flags a 'free' inlined into a delete of memory from 'operator new'
+#if defined(_MSC_VER)
+	#define BENCH_NOINLINE __declspec(noinline)
+#else
+	#define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+void *operator new(size_t size)
+{
+	if(count_allocations.load(std::memory_order_relaxed))
+		allocations.fetch_add(1, std::memory_order_relaxed);
+
+	void *p = malloc(size ? size : 1);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+BENCH_NOINLINE void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+namespace {
+	typedef stats::u64 u64;
+
+	struct Options {
+		Options() : seed(1), iterations(0) {}
+
+		std::vector<unsigned> sizes;
+		std::vector<std::string> only;
+		std::string out;
+		unsigned seed;
+		unsigned iterations;
+	};
+
+	Options options;
+
+	bool enabled(const char *name)
+	{
+		if(options.only.empty())
+			return true;
+
+		return std::find(options.only.begin(), options.only.end(), name) != options.only.end();
+	}
+
+	std::vector<std::string> split(const char *s)
+	{
+		std::vector<std::string> parts;
+		std::stringstream ss(s);
+		std::string part;
+		while(std::getline(ss, part, ','))
+			if(!part.empty())
+				parts.push_back(part);
+		return parts;
+	}
+
+	bool parse_arguments(int argc, char **argv)
+	{
+		for(int i=1; i<argc; ++i) {
+			const char *a = argv[i];
+			const char *v = strchr(a, '=');
+			const std::string name(a, v ? v-a : strlen(a));
+			v = (v ? v+1 : "");
+
+			if(name == "--sizes") {
+				std::vector<std::string> sizes = split(v);
+				for(size_t j=0; j<sizes.size(); ++j)
+					options.sizes.push_back((unsigned)strtoul(sizes[j].c_str(), 0, 10));
+			} else if(name == "--only") {
+				options.only = split(v);
+			} else if(name == "--out") {
+				options.out = v;
+			} else if(name == "--seed") {
+				options.seed = (unsigned)strtoul(v, 0, 10);
+			} else if(name == "--iterations") {
+				options.iterations = (unsigned)strtoul(v, 0, 10);
+			} else {
+				fprintf(stderr, "unknown argument '%s'\n", a);
+				return false;
+			}
+		}
+
+		if(options.sizes.empty()) {
+			const unsigned defaults[] = { 10000, 100000, 1000000, 5000000 };
+			options.sizes.assign(defaults, defaults+4);
+		}
+
+		return true;
+	}
+
+	unsigned iterations_for(unsigned num_records)
+	{
+		if(options.iterations)
+			return options.iterations;
+
+		return (num_records <= 100000 ? 10 : (num_records <= 1000000 ? 5 : 3));
+	}
+
+	double ms_since(u64 start_us)
+	{
+		return (stats::now_us()-start_us)/1000.0;
+	}
+
+	// min/median/mean of repeated runs
+	struct Samples {
+		void add(double ms) { _ms.push_back(ms); }
+
+		void to_json(Json::Value &out)
+		{
+			std::sort(_ms.begin(), _ms.end());
+
+			double sum = 0;
+			for(size_t i=0; i<_ms.size(); ++i)
+				sum += _ms[i];
+
+			out["iterations"] = (unsigned)_ms.size();
+			out["min_ms"] = _ms.front();
+			out["median_ms"] = _ms[_ms.size()/2];
+			out["mean_ms"] = sum/_ms.size();
+		}
+
+		// latencies, nearest rank
+		void percentiles_to_json(Json::Value &out)
+		{
+			std::sort(_ms.begin(), _ms.end());
+
+			const double p[] = { 50, 95, 99 };
+			const char *names[] = { "p50_ms", "p95_ms", "p99_ms" };
+			for(unsigned i=0; i<3; ++i) {
+				size_t rank = (size_t)(p[i]/100.0*_ms.size()+0.5);
+				rank = (rank ? rank-1 : 0);
+				out[names[i]] = _ms[rank < _ms.size() ? rank : _ms.size()-1];
+			}
+
+			out["count"] = (unsigned)_ms.size();
+			out["max_ms"] = _ms.back();
+		}
+
+		bool empty() const { return _ms.empty(); }
+
+	private:
+		std::vector<double> _ms;
+	};
+
+	Json::Value results(Json::arrayValue);
+
+	Json::Value &add_result(const char *benchmark, unsigned num_records, const char *variant = 0)
+	{
+		Json::Value r(Json::objectValue);
+		r["benchmark"] = benchmark;
+		r["records"] = num_records;
+		if(variant)
+			r["variant"] = variant;
+
+		fprintf(stderr, "  %s%s%s\n", benchmark, variant ? " / " : "", variant ? variant : "");
+		return results.append(r);
+	}
+
+	unsigned num_records(const std::vector<char> &db)
+	{
+		return *(const unsigned*)&db[0];
+	}
+
+	const wchar_t *record_path(const char *record)
+	{
+		return (const wchar_t*)(record+sizeof(RecordHeader));
+	}
+
+	// every 'stride' record of the (sorted) db, a sorted db as well
+	void pick_records(std::vector<char> &out, const std::vector<char> &db, unsigned stride, unsigned offset)
+	{
+		out.clear();
+		npp::stream::pack(out, 0u);
+
+		unsigned n = 0;
+		const char *b = &db[sizeof(unsigned)];
+		for(unsigned i=0; i<num_records(db); ++i) {
+			const RecordHeader &rh = *(const RecordHeader*)b;
+			if(i % stride == offset) {
+				npp::stream::pack_bytes(out, b, rh.record_size);
+				++n;
+			}
+			b += rh.record_size;
+		}
+
+		memcpy(&out[0], &n, sizeof(n));
+	}
+
+	// the paths of every 'stride' record with a new date, appended (unsorted)
+	void redate_records(std::vector<char> &out, const std::vector<char> &db, unsigned stride, unsigned seed)
+	{
+		if(out.empty())
+			npp::stream::pack(out, 0u);
+
+		wchar_t date[17];
+
+		const char *b = &db[sizeof(unsigned)];
+		for(unsigned i=0; i<num_records(db); ++i) {
+			const RecordHeader &rh = *(const RecordHeader*)b;
+			if(i % stride == 0) {
+				corpus::make_datestring(date, seed+i);
+				filerepo::aux::append_filerecord(out, record_path(b), date);
+			}
+			b += rh.record_size;
+		}
+	}
+
+	// the filenames of 'n' records spread over db
+	void pick_filenames(std::vector<std::wstring> &out, const std::vector<char> &db, unsigned n)
+	{
+		const unsigned stride = (num_records(db) > n ? num_records(db)/n : 1);
+
+		const char *b = &db[sizeof(unsigned)];
+		for(unsigned i=0; i<num_records(db) && out.size()<n; ++i) {
+			const RecordHeader &rh = *(const RecordHeader*)b;
+			if(i % stride == 0)
+				out.push_back(record_path(b)+rh.filename_offset);
+			b += rh.record_size;
+		}
+	}
+
+	void append_change_packet(std::vector<char> &packets, unsigned change_type, const std::vector<char> &db)
+	{
+		npp::stream::pack(packets, change_type);
+		npp::stream::pack(packets, (unsigned)db.size());
+		npp::stream::pack_bytes(packets, &db[0], (unsigned)db.size());
+	}
+
+	/*
+	 *	A query as 'FileRepo::search' hands it to 'search_db' (see 'pack_query'),
+	 *	'-' excludes a token, '\' searches the full path.
+	 */
+	struct Query {
+		explicit Query(const wchar_t *s) : text(s), search_all(0), num_include(0), num_exclude(0)
+		{
+			std::wstringstream ss(s);
+			std::wstring token;
+			while(ss >> token) {
+				const bool exclude_token = token[0] == L'-';
+				const bool search_all_token = token[0] == L'\\';
+				search_all |= (search_all_token ? 1 : 0);
+
+				token.erase(std::remove(token.begin(), token.end(), L'-'), token.end());
+				if(search_all_token)
+					token.erase(0, 1);
+				if(token.empty())
+					continue;
+
+				std::vector<wchar_t> &to = (exclude_token ? exclude : include);
+				to.insert(to.end(), token.begin(), token.end());
+				to.push_back(0);
+				++(exclude_token ? num_exclude : num_include);
+			}
+
+			if(!num_include && !num_exclude)
+				search_all = 1;
+
+			include.push_back(0);
+			exclude.push_back(0);
+		}
+
+		std::string name() const
+		{
+			if(text.empty())
+				return "(everything)";
+			return std::string(text.begin(), text.end());
+		}
+
+		std::wstring text;
+		unsigned search_all;
+		unsigned char num_include, num_exclude;
+		std::vector<wchar_t> include, exclude;
+	};
+
+	const wchar_t *QUERIES[] = {
+		L"render",			// common word, in names and directories
+		L"mesh loader",		// two tokens
+		L"xyzzy",			// no match, a full scan
+		L"cpp -test",		// exclude
+		L"\\engine render",	// full path
+		L"a",				// short token, most records match
+		L""					// everything
+	};
+	const unsigned NUM_QUERIES = sizeof(QUERIES)/sizeof(QUERIES[0]);
+
+	// field qualified queries, repo only (the clauses are parsed by 'pack_query')
+	const wchar_t *FILTERS[] = {
+		L"ext:cpp",							// a fifth of the records
+		L"render ext:h,hpp",				// token and extensions
+		L"ui ext:lua",						// a few percent of the records
+		L"path:engine -ext:cpp,h",			// negated extensions
+		L"modified:>2024-06-01",			// recent
+		L"modified:>2024-09-01 ext:cpp",	// a range of the date index
+		L"mesh modified:<2011-01-01"		// old, a token
+	};
+	const unsigned NUM_FILTERS = sizeof(FILTERS)/sizeof(FILTERS[0]);
+
+	/*
+	 *	Runs of every filter, each with a clause that drops nothing (and misses the query
+	 *	cache). The first one scans, a stale index is not built by a query, the last one
+	 *	runs once the repo built the indexes it wants (the path index is built after five
+	 *	scans, the run behind them waits for it).
+	 */
+	const unsigned FILTER_RUNS = 7;
+
+	// filenames looked up per variant, see 'bench_repo_lookups'
+	const unsigned NUM_LOOKUPS = 100;
+
+	//////////////////////////////////////////////////////////////////////////
+	// aux
+
+	void bench_insert_filerecord(const corpus::Corpus &c, const std::vector<char> &db)
+	{
+		const unsigned N = num_records(db);
+		const unsigned K = (N < 1000000 ? 1000 : 10); // every insert scans and moves the db
+
+		std::vector<char> inserts;
+		c.append_new_records(inserts, K, 1);
+
+		Samples samples;
+		std::vector<char> target;
+		for(unsigned it=0; it<iterations_for(N); ++it) {
+			target = db;
+
+			const u64 start = stats::now_us();
+			const char *b = &inserts[sizeof(unsigned)];
+			for(unsigned i=0; i<K; ++i) {
+				const RecordHeader &rh = *(const RecordHeader*)b;
+				const wchar_t *path = record_path(b);
+				filerepo::aux::insert_filerecord(target, path, path+rh.filename_offset+rh.filename_length);
+				b += rh.record_size;
+			}
+			samples.add(ms_since(start));
+		}
+
+		Json::Value &r = add_result("insert_filerecord", N);
+		r["inserts"] = K;
+		samples.to_json(r);
+		r["per_insert_us"] = r["median_ms"].asDouble()*1000.0/K;
+	}
+
+	/*
+	 *	'merge_dbs' and 'exclude_db' move the tail of the db for every record (1% of the
+	 *	records up to 1000, 100 from 1M on, or a run takes minutes), 'rewrite' is the
+	 *	out of place path the repo uses.
+	 */
+	unsigned in_place_delta(unsigned num_records)
+	{
+		if(num_records >= 1000000)
+			return 100;
+
+		const unsigned n = num_records/100;
+		return (n < 1 ? 1 : (n > 1000 ? 1000 : n));
+	}
+
+	void bench_merge_dbs(const corpus::Corpus &c, const std::vector<char> &db)
+	{
+		const unsigned N = num_records(db);
+
+		std::vector<char> delta;
+		c.append_new_records(delta, in_place_delta(N), 2);
+		filerepo::aux::sort_db(delta);
+
+		Samples samples;
+		std::vector<char> target;
+		for(unsigned it=0; it<iterations_for(N); ++it) {
+			target = db;
+
+			const u64 start = stats::now_us();
+			filerepo::aux::merge_dbs(target, &delta[0], (unsigned)delta.size());
+			samples.add(ms_since(start));
+		}
+
+		Json::Value &r = add_result("merge_dbs", N);
+		r["delta_records"] = num_records(delta);
+		samples.to_json(r);
+	}
+
+	void bench_exclude_db(const std::vector<char> &db)
+	{
+		const unsigned N = num_records(db);
+
+		const unsigned stride = N/in_place_delta(N);
+
+		std::vector<char> delta;
+		pick_records(delta, db, stride, stride/2);
+
+		Samples samples;
+		std::vector<char> target;
+		for(unsigned it=0; it<iterations_for(N); ++it) {
+			target = db;
+
+			const u64 start = stats::now_us();
+			filerepo::aux::exclude_db(target, &delta[0], (unsigned)delta.size());
+			samples.add(ms_since(start));
+		}
+
+		Json::Value &r = add_result("exclude_db", N);
+		r["delta_records"] = num_records(delta);
+		samples.to_json(r);
+	}
+
+	void bench_add_replace_db(const corpus::Corpus &c, const std::vector<char> &db)
+	{
+		const unsigned N = num_records(db);
+
+		// half replaced (new dates), half new
+		std::vector<char> delta;
+		redate_records(delta, db, 200, options.seed);
+		const unsigned replaced = num_records(delta);
+		c.append_new_records(delta, replaced, 3);
+		filerepo::aux::sort_db(delta);
+
+		Samples samples;
+		std::vector<char> target;
+		for(unsigned it=0; it<iterations_for(N); ++it) {
+			target = db;
+
+			const u64 start = stats::now_us();
+			filerepo::aux::add_replace_db(target, &delta[0], (unsigned)delta.size());
+			samples.add(ms_since(start));
+		}
+
+		Json::Value &r = add_result("add_replace_db", N);
+		r["delta_records"] = num_records(delta);
+		r["replaced_records"] = replaced;
+		samples.to_json(r);
+	}
+
+	void bench_rewrite(const corpus::Corpus &c, const std::vector<char> &db)
+	{
+		const unsigned N = num_records(db);
+		const unsigned delta_records = (N/100 ? N/100 : 1);
+
+		std::vector<char> merge_delta, exclude_delta;
+		c.append_new_records(merge_delta, delta_records, 5);
+		filerepo::aux::sort_db(merge_delta);
+		pick_records(exclude_delta, db, N/delta_records, 3);
+
+		const char *variants[] = { "merge", "exclude" };
+		for(unsigned v=0; v<2; ++v) {
+			Samples samples;
+			std::vector<char> target, delta;
+			filerepo::PendingUpdates unmatched;
+			for(unsigned it=0; it<iterations_for(N); ++it) {
+				target = db;
+				delta = (v == 0 ? merge_delta : exclude_delta);
+
+				const u64 start = stats::now_us();
+				filerepo::RewriteJob job;
+				if(v == 0)
+					filerepo::aux::rewrite_begin_merge(job, target, delta, unmatched);
+				else
+					filerepo::aux::rewrite_begin_exclude(job, target, delta);
+
+				while(!filerepo::aux::rewrite_step(job, 0xffffffffu))
+					;
+				filerepo::aux::rewrite_finish(job, target, unmatched);
+				samples.add(ms_since(start));
+			}
+
+			Json::Value &r = add_result("rewrite", N, variants[v]);
+			r["delta_records"] = num_records(v == 0 ? merge_delta : exclude_delta);
+			samples.to_json(r);
+		}
+	}
+
+	void bench_search_db(const std::vector<char> &db)
+	{
+		const unsigned N = num_records(db);
+
+		std::vector<char> result;
+		for(unsigned q=0; q<NUM_QUERIES; ++q) {
+			const Query query(QUERIES[q]);
+
+			Samples samples;
+			unsigned result_bytes = 0;
+			for(unsigned it=0; it<iterations_for(N); ++it) {
+				const u64 start = stats::now_us();
+				result_bytes = filerepo::aux::search_db(result, db, query.search_all,
+														query.num_include, query.num_exclude,
+														&query.include[0], &query.exclude[0]);
+				samples.add(ms_since(start));
+			}
+
+			Json::Value &r = add_result("search_db", N, query.name().c_str());
+			r["matches"] = *(const unsigned*)&result[0];
+			r["result_bytes"] = result_bytes;
+			samples.to_json(r);
+		}
+	}
+
+	void bench_rename_directory(const corpus::Corpus &c, const std::vector<char> &db)
+	{
+		const unsigned N = num_records(db);
+
+		// a top level directory holds a big part of the tree, a deep one a handful of files
+		unsigned top = 1, deep = 1;
+		for(unsigned d=1; d<c.directories.size(); ++d) {
+			if(c.directory_depth[d] == 1 && c.directories[d].length() > c.directories[top].length())
+				top = d;
+			if(c.directory_depth[d] >= c.directory_depth[deep] && c.files_in_directory[d])
+				deep = d;
+		}
+
+		struct Rename {
+			const char *variant;
+			std::wstring from, to;
+		};
+
+		// the RENAME rewrite (what the repo runs), every record is copied once whatever the lengths
+		Rename renames[3];
+		renames[0].variant = "top_same_length";
+		renames[0].from = c.directories[top];
+		renames[0].to = renames[0].from;
+		renames[0].to[renames[0].to.length()-2] = L'X';
+
+		renames[1].variant = "deep_longer";
+		renames[1].from = c.directories[deep];
+		renames[1].to = renames[1].from.substr(0, renames[1].from.length()-1)+L"_renamed"+corpus::separator();
+
+		renames[2].variant = "deep_shorter";
+		renames[2].from = c.directories[deep];
+		renames[2].to = renames[2].from.substr(0, renames[2].from.length()-3)+corpus::separator();
+
+		std::vector<char> target;
+		filerepo::PendingUpdates unmatched;
+		for(unsigned i=0; i<3; ++i) {
+			Samples samples;
+			for(unsigned it=0; it<iterations_for(N); ++it) {
+				target = db;
+
+				const u64 start = stats::now_us();
+				filerepo::RewriteJob job;
+				filerepo::aux::rewrite_begin_rename(job, target, renames[i].from.c_str(), renames[i].to.c_str());
+				while(!filerepo::aux::rewrite_step(job, 0xffffffffu))
+					;
+				filerepo::aux::rewrite_finish(job, target, unmatched);
+				samples.add(ms_since(start));
+			}
+
+			Json::Value &r = add_result("rename_directory", N, renames[i].variant);
+			r["depth"] = c.directory_depth[i == 0 ? top : deep];
+			samples.to_json(r);
+		}
+	}
+
+	void bench_sort_db(const corpus::Corpus &c)
+	{
+		Samples samples;
+		std::vector<char> db;
+		for(unsigned it=0; it<iterations_for(c.num_files); ++it) {
+			db.clear();
+			c.append_records(db);
+
+			const u64 start = stats::now_us();
+			filerepo::aux::sort_db(db);
+			samples.add(ms_since(start));
+		}
+
+		Json::Value &r = add_result("sort_db", c.num_files);
+		samples.to_json(r);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// end to end, 'FileRepo' on the thread pool
+
+	struct PendingQuery {
+		PendingQuery() : num_results(0), latency_us(0), posted_us(0) {}
+
+		npp::Event done;
+		unsigned num_results;
+		u64 latency_us;
+		u64 posted_us;
+	};
+
+	void search_done(void *userdata, void *result, unsigned, const filerepo::SearchStatus &)
+	{
+		PendingQuery *q = (PendingQuery*)userdata;
+		q->num_results = *(const unsigned*)result;
+		q->latency_us = stats::now_us()-q->posted_us;
+		q->done.set();
+	}
+
+	// 'filter' with a clause no name matches, '~' is not in the corpus
+	std::wstring filter_run(const wchar_t *filter, unsigned run)
+	{
+		if(!run)
+			return filter;
+
+		std::wstringstream ss;
+		ss << filter << L" -name:~" << run;
+		return ss.str();
+	}
+
+	unsigned search(FileRepositoryHandle repo, const wchar_t *s, double *latency_ms, bool exact = false)
+	{
+		PendingQuery q;
+		q.posted_us = stats::now_us();
+		if(exact)
+			filerepo::search_exact(repo, s, &q, search_done);
+		else
+			filerepo::search(repo, s, &q, search_done);
+		q.done.wait();
+
+		*latency_ms = q.latency_us/1000.0;
+		return q.num_results;
+	}
+
+	u64 indexed_records(FileRepositoryHandle repo, bool *idle)
+	{
+		Json::Value s;
+		filerepo::get_stats(repo, s);
+
+		*idle = s["index"]["pending_changes"].asDouble() == 0;
+		return (u64)s["index"]["records"].asDouble();
+	}
+
+	// see 'queries' of 'filerepo::get_stats'
+	u64 query_counter(FileRepositoryHandle repo, const char *name)
+	{
+		Json::Value s;
+		filerepo::get_stats(repo, s);
+		return (u64)s["queries"][name].asDouble();
+	}
+
+	void search_batch_done(void *userdata, void *result, unsigned, const filerepo::SearchStatus &)
+	{
+		PendingQuery *q = (PendingQuery*)userdata;
+		q->num_results = *(const unsigned*)result; // searches answered
+		q->latency_us = stats::now_us()-q->posted_us;
+		q->done.set();
+	}
+
+	/*
+	 *	Lookups of single filenames (resolving a build log), one after the other, as one
+	 *	batch and all posted at once (the repo searches what queued up in one pass). Then
+	 *	the first set again as exact lookups, the first one builds the exact index.
+	 */
+	void bench_repo_lookups(FileRepositoryHandle repo, unsigned N, const std::vector<std::wstring> &names)
+	{
+		// NOTE : a set of names per variant, none is answered from the query cache
+		const unsigned n = (unsigned)names.size()/3;
+		const char *variants[] = { "sequential", "batch", "posted" };
+
+		for(unsigned v=0; v<3; ++v) {
+			std::vector<const wchar_t*> lookups;
+			for(unsigned i=0; i<n; ++i)
+				lookups.push_back(names[v*n+i].c_str());
+
+			const u64 scans = query_counter(repo, "scans");
+			const u64 start = stats::now_us();
+
+			if(v == 0) {
+				for(unsigned i=0; i<n; ++i) {
+					double ms = 0;
+					search(repo, lookups[i], &ms);
+				}
+			} else if(v == 1) {
+				PendingQuery q;
+				q.posted_us = start;
+				filerepo::search_batch(repo, &lookups[0], n, &q, search_batch_done);
+				q.done.wait();
+			} else {
+				std::vector<PendingQuery> queries(n);
+				for(unsigned i=0; i<n; ++i) {
+					queries[i].posted_us = stats::now_us();
+					filerepo::search(repo, lookups[i], &queries[i], search_done);
+				}
+				for(unsigned i=0; i<n; ++i)
+					queries[i].done.wait();
+			}
+
+			Json::Value &r = add_result("repo_lookups", N, variants[v]);
+			r["lookups"] = n;
+			r["ms"] = ms_since(start);
+			r["scans"] = (double)(query_counter(repo, "scans")-scans);
+		}
+
+		{
+			const u64 scans = query_counter(repo, "scans");
+			const u64 start = stats::now_us();
+
+			double first_ms = 0;
+			unsigned matches = 0;
+			for(unsigned i=0; i<n; ++i) {
+				double ms = 0;
+				matches += search(repo, names[i].c_str(), &ms, true);
+				if(!i)
+					first_ms = ms;
+			}
+
+			Json::Value &r = add_result("repo_lookups", N, "exact");
+			r["lookups"] = n;
+			r["ms"] = ms_since(start);
+			r["first_ms"] = first_ms;
+			r["matches"] = matches;
+			r["scans"] = (double)(query_counter(repo, "scans")-scans);
+		}
+	}
+
+	void wait_for_records(FileRepositoryHandle repo, u64 n)
+	{
+		bool idle = false;
+		while(indexed_records(repo, &idle) != n || !idle)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	/*
+	 *	Queries from another thread while the repo works, one 'QUERY_STREAM_PAUSE_MS' after
+	 *	the previous answer (typing). Every query misses the query cache (see 'filter_run').
+	 */
+	const unsigned QUERY_STREAM_PAUSE_MS = 10;
+
+	// queries per variant of 'repo_search_during_merge', the merges are repeated until then
+	const unsigned QUERY_STREAM_SAMPLES = 100;
+	const unsigned QUERY_STREAM_MAX_MERGES = 20;
+
+	struct QueryStream {
+		void start(FileRepositoryHandle r)
+		{
+			repo = r;
+			stopped.store(false);
+			thread = std::thread([this]() {
+				for(unsigned i=1; !stopped.load(std::memory_order_relaxed); ++i) {
+					double ms = 0;
+					search(repo, filter_run(L"render", i).c_str(), &ms);
+					samples.add(ms);
+
+					std::this_thread::sleep_for(std::chrono::milliseconds(QUERY_STREAM_PAUSE_MS));
+				}
+			});
+		}
+
+		void stop(Json::Value &out)
+		{
+			stopped.store(true);
+			thread.join();
+
+			if(!samples.empty())
+				samples.percentiles_to_json(out);
+		}
+
+		FileRepositoryHandle repo;
+		std::atomic<bool> stopped;
+		std::thread thread;
+		Samples samples; // stream thread only until 'stop'
+	};
+
+	void bench_repo_search(const corpus::Corpus &c, std::vector<char> &db)
+	{
+		const unsigned N = num_records(db);
+
+		FileRepositoryHandle repo = filerepo::allocate_handle();
+
+		std::vector<std::wstring> lookups;
+		pick_filenames(lookups, db, 3*NUM_LOOKUPS);
+
+		// ingest, one change packet (the shape of a parser chunk)
+		{
+			std::vector<char> packets;
+			append_change_packet(packets, filerepo_headers::CHANGE_ADD, db);
+			std::vector<char>().swap(db); // the repo holds its own copies, keeps the peak down
+
+			const u64 start = stats::now_us();
+			filerepo::post_changes(repo, &packets[0], (unsigned)packets.size());
+			std::vector<char>().swap(packets);
+			wait_for_records(repo, N);
+
+			Json::Value &r = add_result("repo_ingest", N);
+			r["ms"] = ms_since(start);
+		}
+
+		/*
+		 *	The first run of a query searches the index, the repeats are answered from
+		 *	the query cache (unless the result is too big to keep, see 'cache_hits').
+		 */
+		const unsigned rounds = (N <= 100000 ? 50 : (N <= 1000000 ? 10 : 3));
+		for(unsigned q=0; q<NUM_QUERIES; ++q) {
+			double miss_ms = 0;
+			unsigned matches = search(repo, QUERIES[q], &miss_ms);
+
+			const u64 hits = query_counter(repo, "cache_hits");
+
+			Samples samples;
+			for(unsigned i=0; i<rounds; ++i) {
+				double ms = 0;
+				matches = search(repo, QUERIES[q], &ms);
+				samples.add(ms);
+			}
+
+			Json::Value &r = add_result("repo_search", N, Query(QUERIES[q]).name().c_str());
+			r["matches"] = matches;
+			r["miss_ms"] = miss_ms;
+			r["cache_hits"] = (double)(query_counter(repo, "cache_hits")-hits);
+			samples.percentiles_to_json(r);
+		}
+
+		// steady state, every query above has run (the buffers are warm) and the repo is idle
+		{
+			const unsigned num_counted = 10*NUM_QUERIES;
+
+			allocations.store(0);
+			count_allocations.store(true);
+			for(unsigned i=0; i<num_counted; ++i) {
+				double ms = 0;
+				search(repo, QUERIES[i % NUM_QUERIES], &ms);
+			}
+			count_allocations.store(false);
+
+			Json::Value &r = add_result("repo_search_allocations", N);
+			r["queries"] = num_counted;
+			r["allocations_per_query"] = allocations.load()/(double)num_counted;
+		}
+
+		bench_repo_lookups(repo, N, lookups);
+
+		// the first and the last run of every filter
+		for(unsigned f=0; f<NUM_FILTERS; ++f) {
+			double first_ms = 0, ms = 0;
+			unsigned matches = 0;
+			for(unsigned run=0; run<FILTER_RUNS; ++run)
+				matches = search(repo, filter_run(FILTERS[f], run).c_str(), run ? &ms : &first_ms);
+
+			const std::wstring name(FILTERS[f]);
+			Json::Value &r = add_result("repo_filters", N, std::string(name.begin(), name.end()).c_str());
+			r["matches"] = matches;
+			r["first_ms"] = first_ms;
+			r["ms"] = ms;
+		}
+
+		// scoped to one component (the first directory three below the root)
+		for(unsigned d=0; d<c.directories.size(); ++d) {
+			if(c.directory_depth[d] != 3)
+				continue;
+
+			const std::wstring scope(L"in:"+c.directories[d]);
+			const std::wstring scoped[] = { scope, L"ui "+scope };
+			const char *variants[] = { "in:component", "ui in:component" };
+
+			for(unsigned s=0; s<2; ++s) {
+				double first_ms = 0, ms = 0;
+				unsigned matches = 0;
+				for(unsigned run=0; run<FILTER_RUNS; ++run)
+					matches = search(repo, filter_run(scoped[s].c_str(), run).c_str(), run ? &ms : &first_ms);
+
+				Json::Value &r = add_result("repo_filters", N, variants[s]);
+				r["directory"] = std::string(c.directories[d].begin(), c.directories[d].end());
+				r["matches"] = matches;
+				r["first_ms"] = first_ms;
+				r["ms"] = ms;
+			}
+			break;
+		}
+
+		/*
+		 *	A stream of queries (see 'QueryStream') on the idle repo, then while it merges
+		 *	deltas of a tenth of its records one after the other. Queries are served between
+		 *	the (bounded) steps of a merge, p99 is the wait for a step.
+		 */
+		{
+			QueryStream idle_stream;
+			const u64 served = query_counter(repo, "served");
+			idle_stream.start(repo);
+			while(query_counter(repo, "served")-served < QUERY_STREAM_SAMPLES)
+				std::this_thread::sleep_for(std::chrono::milliseconds(QUERY_STREAM_PAUSE_MS));
+
+			Json::Value &idle_result = add_result("repo_search_during_merge", N, "idle");
+			idle_stream.stop(idle_result);
+
+			const unsigned delta_records = (N/10 ? N/10 : 1);
+			u64 expected = N;
+			unsigned num_merges = 0;
+			double merge_ms = 0;
+
+			const u64 served_before_merges = query_counter(repo, "served");
+			QueryStream stream;
+			stream.start(repo);
+			while(num_merges < QUERY_STREAM_MAX_MERGES) {
+				std::vector<char> delta;
+				c.append_new_records(delta, delta_records, 100+num_merges);
+				filerepo::aux::sort_db(delta);
+
+				std::vector<char> packets;
+				append_change_packet(packets, filerepo_headers::CHANGE_ADD, delta);
+
+				const u64 start = stats::now_us();
+				filerepo::post_changes(repo, &packets[0], (unsigned)packets.size());
+
+				expected += num_records(delta);
+				wait_for_records(repo, expected);
+				merge_ms += ms_since(start);
+				++num_merges;
+
+				if(query_counter(repo, "served")-served_before_merges >= QUERY_STREAM_SAMPLES)
+					break;
+			}
+
+			Json::Value &r = add_result("repo_search_during_merge", N, "merge");
+			stream.stop(r);
+			r["delta_records"] = delta_records;
+			r["merges"] = num_merges;
+			r["merge_ms"] = merge_ms/num_merges;
+		}
+
+		filerepo::stop(repo);
+		filerepo::join(10000);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// parsing and monitoring a synthetic tree in memory (see 'vfs.h'), no disk involved
+
+	u64 watched_directories(FileRepositoryHandle repo)
+	{
+		Json::Value s;
+		filerepo::get_stats(repo, s);
+		return (u64)s["monitor"]["watched_directories"].asDouble();
+	}
+
+	void bench_repo_parse(const wchar_t *root_directory, unsigned n)
+	{
+		vfs::MemoryShape shape;
+		shape.seed = options.seed;
+		shape.num_files = n;
+
+		vfs::Provider *fs = vfs::memory_create(root_directory, shape);
+		FileRepositoryHandle repo = filerepo::allocate_handle(fs);
+
+		Json::Value solution(Json::objectValue);
+		Json::Value &d = solution["directories"][0u];
+		d["path"] = string_util::from_wide(root_directory);
+		d["recursive"] = true;
+		d["monitored"] = true;
+
+		{
+			const u64 start = stats::now_us();
+			filerepo::add_solution(repo, solution);
+			wait_for_records(repo, n);
+			const double ms = ms_since(start);
+
+			// the monitor starts once parsing is done
+			while(!watched_directories(repo))
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+			Json::Value &r = add_result("repo_parse", n);
+			r["ms"] = ms;
+			r["files_per_second"] = (ms > 0 ? n*1000.0/ms : 0.0);
+		}
+
+		// a batch of changes through the monitor path, until the index has them all
+		{
+			std::vector<std::wstring> files;
+			vfs::memory_pick_files(fs, options.seed, 200, files);
+
+			const u64 start = stats::now_us();
+			unsigned num_changes = 0;
+			for(size_t i=0; i<files.size(); ++i) {
+				const std::wstring &f = files[i];
+				switch(i % 4) {
+				case 0: num_changes += vfs::memory_modify_file(fs, f.c_str()); break;
+				case 1: num_changes += vfs::memory_remove_file(fs, f.c_str()); break;
+				default: num_changes += vfs::memory_add_file(fs, (f+L".new").c_str()); break;
+				}
+			}
+
+			// NOTE : the directories of the first files picked, they may be gone by the time they are renamed/removed
+			if(files.size() >= 2) {
+				std::wstring from = files[0].substr(0, file_util::pathlength(files[0].c_str())-1);
+				num_changes += vfs::memory_rename_directory(fs, from.c_str(), (from+L"_renamed").c_str());
+
+				std::wstring removed = files[1].substr(0, file_util::pathlength(files[1].c_str())-1);
+				num_changes += vfs::memory_remove_directory(fs, removed.c_str());
+			}
+
+			vfs::memory_flush(fs);
+			const u64 expected = vfs::memory_count_files(fs);
+			wait_for_records(repo, expected);
+
+			Json::Value &r = add_result("repo_parse_changes", n);
+			r["changes"] = num_changes;
+			r["ms"] = ms_since(start);
+			r["files"] = (double)expected;
+		}
+
+		// the same tree indexed again by a second repo, under a stream of queries (see 'QueryStream')
+		FileRepositoryHandle queried = filerepo::allocate_handle(fs);
+		{
+			d["monitored"] = false;
+
+			QueryStream stream;
+			stream.start(queried);
+
+			const u64 start = stats::now_us();
+			filerepo::add_solution(queried, solution);
+			wait_for_records(queried, vfs::memory_count_files(fs));
+			const double ms = ms_since(start);
+
+			Json::Value &r = add_result("repo_search_during_parse", n, "render");
+			stream.stop(r);
+			r["parse_ms"] = ms;
+		}
+
+		filerepo::stop(queried);
+		filerepo::stop(repo);
+		filerepo::join(10000);
+		vfs::memory_destroy(fs);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// the queues of 'FileRepo' (MPSC) against a locked deque, many producers one consumer
+
+	struct Item : npp::MPSCNode {
+		unsigned value;
+	};
+
+	struct LockedQueue {
+		void push(Item *i)
+		{
+			npp::CriticalSectionScope s(lock);
+			items.push_back(i);
+		}
+
+		Item *pop()
+		{
+			npp::CriticalSectionScope s(lock);
+			if(items.empty())
+				return 0;
+
+			Item *i = items.front();
+			items.pop_front();
+			return i;
+		}
+
+		npp::CriticalSection lock;
+		std::deque<Item*> items;
+	};
+
+	struct MPSCAdapter {
+		void push(Item *i) { queue.push(i); }
+		Item *pop() { return (Item*)queue.pop(); }
+
+		npp::MPSCQueue queue;
+	};
+
+	template <class Queue>
+	struct Producer {
+		Queue *queue;
+		Item *items;
+		unsigned num_items;
+		std::atomic<unsigned> *go;
+
+		static unsigned __stdcall run(void *user_data)
+		{
+			Producer *p = (Producer*)user_data;
+			while(!p->go->load(std::memory_order_acquire))
+				;
+
+			for(unsigned i=0; i<p->num_items; ++i)
+				p->queue->push(&p->items[i]);
+
+			return 0;
+		}
+	};
+
+	// million items per second
+	template <class Queue>
+	double queue_throughput(unsigned num_producers, unsigned items_per_producer)
+	{
+		Queue queue;
+		std::atomic<unsigned> go(0);
+
+		std::vector<Item> items(num_producers*items_per_producer);
+		std::vector<Producer<Queue> > producers(num_producers);
+		std::vector<npp::Thread*> threads(num_producers);
+
+		for(unsigned p=0; p<num_producers; ++p) {
+			Producer<Queue> &producer = producers[p];
+			producer.queue = &queue;
+			producer.items = &items[p*items_per_producer];
+			producer.num_items = items_per_producer;
+			producer.go = &go;
+
+			threads[p] = npp::thread_create(Producer<Queue>::run, &producer);
+			npp::thread_start(threads[p]);
+		}
+
+		const u64 start = stats::now_us();
+		go.store(1, std::memory_order_release);
+
+		const unsigned total = (unsigned)items.size();
+		unsigned received = 0;
+		while(received != total) {
+			if(queue.pop())
+				++received;
+		}
+		const double seconds = (stats::now_us()-start)/1000000.0;
+
+		for(unsigned p=0; p<num_producers; ++p) {
+			npp::thread_wait(threads[p], npp::WAIT_INFINITE);
+			npp::thread_destroy(threads[p]);
+		}
+
+		return (total/1000000.0)/(seconds > 0 ? seconds : 1e-9);
+	}
+
+	void bench_queues()
+	{
+		const unsigned total_items = 2000000;
+		const unsigned producers[] = { 1, 2, 4, 8 };
+
+		for(unsigned i=0; i<4; ++i) {
+			const unsigned n = producers[i];
+			const unsigned per_producer = total_items/n;
+
+			Json::Value &r = add_result("input_queue", n*per_producer);
+			r["producers"] = n;
+			r["mpsc_mitems_per_second"] = queue_throughput<MPSCAdapter>(n, per_producer);
+			r["locked_deque_mitems_per_second"] = queue_throughput<LockedQueue>(n, per_producer);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if(!parse_arguments(argc, argv))
+		return 1;
+
+	npp::log::set_level(npp::log::LEVEL_WARNING);
+
+	corpus::Shape shape;
+	shape.seed = options.seed;
+
+	Json::Value root(Json::objectValue);
+	Json::Value &meta = root["meta"];
+	meta["seed"] = options.seed;
+	meta["wchar_size"] = (unsigned)sizeof(wchar_t);
+	meta["hardware_threads"] = npp::thread_hardware_concurrency();
+	meta["shape"]["max_depth"] = shape.max_depth;
+	meta["shape"]["mean_subdirectories"] = shape.mean_subdirectories;
+	meta["shape"]["mean_files"] = shape.mean_files;
+	meta["shape"]["name_length"].append(shape.min_name_length);
+	meta["shape"]["name_length"].append(shape.max_name_length);
+	for(size_t i=0; i<options.sizes.size(); ++i)
+		meta["sizes"].append(options.sizes[i]);
+
+#if defined(_WIN32)
+	const wchar_t *root_directory = L"c:\\src";
+#else
+	const wchar_t *root_directory = L"/src";
+#endif
+
+	for(size_t s=0; s<options.sizes.size(); ++s) {
+		const unsigned n = options.sizes[s];
+		fprintf(stderr, "%u records\n", n);
+
+		corpus::Corpus c;
+		c.generate(shape, root_directory, n);
+
+		std::vector<char> db;
+		c.append_records(db);
+		filerepo::aux::sort_db(db);
+
+		Json::Value &r = add_result("corpus", n);
+		r["directories"] = (unsigned)c.directories.size();
+		r["db_bytes"] = (double)db.size();
+
+		if(enabled("sort_db"))
+			bench_sort_db(c);
+		if(enabled("insert_filerecord"))
+			bench_insert_filerecord(c, db);
+		if(enabled("merge_dbs"))
+			bench_merge_dbs(c, db);
+		if(enabled("exclude_db"))
+			bench_exclude_db(db);
+		if(enabled("rewrite"))
+			bench_rewrite(c, db);
+		if(enabled("add_replace_db"))
+			bench_add_replace_db(c, db);
+		if(enabled("search_db"))
+			bench_search_db(db);
+		if(enabled("rename_directory"))
+			bench_rename_directory(c, db);
+
+		// NOTE : last, hands the db over
+		if(enabled("repo_search"))
+			bench_repo_search(c, db);
+
+		if(enabled("repo_parse"))
+			bench_repo_parse(root_directory, n);
+	}
+
+	if(enabled("input_queue"))
+		bench_queues();
+
+	root["results"] = results;
+
+	Json::StyledWriter writer;
+	const std::string json = writer.write(root);
+
+	FILE *f = (options.out.empty() ? stdout : fopen(options.out.c_str(), "wb"));
+	if(!f) {
+		fprintf(stderr, "can not write '%s'\n", options.out.c_str());
+		return 1;
+	}
+
+	fwrite(json.c_str(), 1, json.length(), f);
+	if(f != stdout)
+		fclose(f);
+
+	npp::log::shutdown();
+	return 0;
+}
@@ -0,0 +1,312 @@
+#include "corpus.h"
+
+#include "file_repository_common.h"
+
+#include <wchar.h>
+#include <wctype.h>
+
+namespace corpus {
+	namespace {
+		// words of source trees, joined into file and directory names
+		const wchar_t *WORDS[] = {
+			L"render", L"mesh", L"texture", L"shader", L"material", L"light", L"camera", L"scene",
+			L"physics", L"body", L"collision", L"audio", L"sound", L"stream", L"net", L"socket",
+			L"player", L"entity", L"component", L"system", L"manager", L"factory", L"pool", L"cache",
+			L"loader", L"parser", L"writer", L"reader", L"buffer", L"string", L"path", L"file",
+			L"thread", L"task", L"job", L"queue", L"event", L"input", L"window", L"view",
+			L"ui", L"button", L"font", L"anim", L"skeleton", L"bone", L"curve", L"math",
+			L"vector", L"matrix", L"quat", L"util", L"debug", L"log", L"profile", L"test",
+			L"config", L"settings", L"plugin", L"script", L"lua", L"vm", L"gc", L"alloc",
+			L"memory", L"core", L"base", L"common", L"platform", L"win32", L"linux", L"io"
+		};
+		const unsigned NUM_WORDS = sizeof(WORDS)/sizeof(WORDS[0]);
+
+		// typical top of a tree, used (more often) for the first levels
+		const wchar_t *TOP_DIRECTORIES[] = {
+			L"src", L"include", L"engine", L"tools", L"tests", L"third_party", L"data", L"docs",
+			L"build", L"scripts", L"game", L"editor", L"runtime", L"external", L"content", L"shaders"
+		};
+		const unsigned NUM_TOP_DIRECTORIES = sizeof(TOP_DIRECTORIES)/sizeof(TOP_DIRECTORIES[0]);
+
+		struct Extension {
+			const wchar_t *name; // 0 : none
+			unsigned weight;
+		};
+
+		const Extension EXTENSIONS[] = {
+			{ L"cpp", 22 }, { L"h", 20 }, { L"c", 4 }, { L"hpp", 3 }, { L"inl", 2 },
+			{ L"cs", 4 }, { L"lua", 6 }, { L"py", 4 }, { L"js", 3 }, { L"ts", 2 },
+			{ L"json", 4 }, { L"xml", 4 }, { L"txt", 3 }, { L"md", 2 }, { L"ini", 1 },
+			{ L"png", 6 }, { L"dds", 3 }, { L"fbx", 1 }, { L"wav", 1 }, { L"bat", 1 },
+			{ L"cmake", 1 }, { 0, 1 }
+		};
+		const unsigned NUM_EXTENSIONS = sizeof(EXTENSIONS)/sizeof(EXTENSIONS[0]);
+
+		const unsigned MAX_DIRECTORY_NAME = 14;
+		const unsigned MAX_FILE_SUFFIX = 8+1+5; // '_<index>.<extension>'
+		const unsigned MAX_PATH_LENGTH = 250; // record headers hold the path length in a byte
+
+		unsigned extension_weights()
+		{
+			unsigned sum = 0;
+			for(unsigned i=0; i<NUM_EXTENSIONS; ++i)
+				sum += EXTENSIONS[i].weight;
+			return sum;
+		}
+
+		const wchar_t *pick_extension(Random &r)
+		{
+			static const unsigned total = extension_weights();
+
+			unsigned w = r.below(total);
+			for(unsigned i=0; i<NUM_EXTENSIONS; ++i) {
+				if(w < EXTENSIONS[i].weight)
+					return EXTENSIONS[i].name;
+				w -= EXTENSIONS[i].weight;
+			}
+			return 0;
+		}
+
+		void append_capitalized(String &s, const wchar_t *w)
+		{
+			s += (wchar_t)towupper(*w);
+			s += (w+1);
+		}
+
+		// 'snake_case', 'CamelCase', 'lowercase', sometimes with a number
+		String make_name(Random &r, unsigned min_length, unsigned max_length)
+		{
+			const unsigned style = r.below(3);
+			const unsigned num_words = 1+r.below(3);
+
+			String name;
+			for(unsigned i=0; i<num_words || name.length() < min_length; ++i) {
+				const wchar_t *w = WORDS[r.below(NUM_WORDS)];
+				if(style == 0 && i)
+					name += L'_';
+
+				if(style == 1)
+					append_capitalized(name, w);
+				else
+					name += w;
+			}
+
+			if(r.below(8) == 0) {
+				wchar_t number[16];
+				swprintf(number, 16, L"%u", r.below(100));
+				name += number;
+			}
+
+			if(name.length() > max_length)
+				name.resize(max_length);
+
+			return name;
+		}
+
+		String make_directory_name(Random &r, unsigned depth)
+		{
+			const unsigned top_chance = (depth < 2 ? 2 : 6);
+			if(r.below(top_chance) == 0)
+				return TOP_DIRECTORIES[r.below(NUM_TOP_DIRECTORIES)];
+
+			String name = make_name(r, 2, MAX_DIRECTORY_NAME);
+			for(unsigned i=0; i<name.length(); ++i)
+				name[i] = (wchar_t)towlower(name[i]);
+			return name;
+		}
+
+		inline unsigned long long mix(unsigned long long a, unsigned long long b)
+		{
+			Random r(a*0x9e3779b97f4a7c15ull+b);
+			return r.next();
+		}
+	}
+
+	Shape::Shape() :
+		seed(1),
+		max_depth(10),
+		mean_subdirectories(3),
+		mean_files(12),
+		min_name_length(3),
+		max_name_length(24)
+	{
+	}
+
+	unsigned long long Random::next()
+	{
+		unsigned long long z = (state += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	unsigned Random::around(unsigned mean)
+	{
+		if(!mean)
+			return 0;
+
+		// geometric with p = 1/(mean+1), capped
+		unsigned n = 0;
+		while(n < 4*mean && below(mean+1) != 0)
+			++n;
+		return n;
+	}
+
+	wchar_t separator()
+	{
+#if defined(_WIN32)
+		return L'\\';
+#else
+		return L'/';
+#endif
+	}
+
+	void make_datestring(wchar_t *res, unsigned long long seed)
+	{
+		Random r(seed);
+
+		const unsigned day = 1+r.below(28);
+		const unsigned month = 1+r.below(12);
+		const unsigned year = 2010+r.below(15);
+
+		swprintf(res, 16+1, L"%02u/%02u/%04u %02u:%02u", day, month, year, r.below(24), r.below(60));
+	}
+
+	void Corpus::generate(const Shape &s, const wchar_t *root, unsigned n)
+	{
+		shape = s;
+		num_files = 0;
+
+		directories.clear();
+		directory_depth.clear();
+		files_in_directory.clear();
+
+		String r(root);
+		if(r.empty() || r[r.length()-1] != separator())
+			r += separator();
+
+		directories.push_back(r);
+		directory_depth.push_back(0);
+		files_in_directory.push_back(0);
+
+		Random random(shape.seed);
+
+		// breadth first, the last level is cut off once there are enough files
+		for(unsigned d=0; num_files < n; ++d) {
+			// NOTE : the tree died out (depth, path lengths) before it had enough files, widen it
+			while(d == directories.size())
+				add_directory(random, pick_parent(random));
+
+			const unsigned depth = directory_depth[d];
+
+			unsigned files = random.around(shape.mean_files);
+			files = (num_files+files > n ? n-num_files : files);
+			files_in_directory[d] = files;
+			num_files += files;
+
+			const unsigned subdirectories = (depth < shape.max_depth ? random.around(shape.mean_subdirectories) : 0);
+			for(unsigned i=0; i<subdirectories; ++i)
+				add_directory(random, d);
+		}
+	}
+
+	bool Corpus::add_directory(Random &random, unsigned parent)
+	{
+		const unsigned depth = directory_depth[parent];
+
+		// siblings can get the same name, the index makes it unique
+		String path = directories[parent]+make_directory_name(random, depth);
+
+		wchar_t suffix[16];
+		swprintf(suffix, 16, L"%u", (unsigned)directories.size());
+		path += suffix;
+
+		if(path.length()+1+shape.max_name_length+MAX_FILE_SUFFIX >= MAX_PATH_LENGTH)
+			return false;
+
+		path += separator();
+
+		directories.push_back(path);
+		directory_depth.push_back(depth+1);
+		files_in_directory.push_back(0);
+		return true;
+	}
+
+	unsigned Corpus::pick_parent(Random &random) const
+	{
+		for(unsigned attempt=0; attempt<16; ++attempt) {
+			const unsigned d = random.below((unsigned)directories.size());
+			if(directory_depth[d] < shape.max_depth && directories[d].length() < MAX_PATH_LENGTH/2)
+				return d;
+		}
+		return 0; // the root
+	}
+
+	String Corpus::file_path(unsigned d, unsigned i) const
+	{
+		Random r(mix(shape.seed, ((unsigned long long)d << 24) ^ i));
+
+		String path = directories[d];
+		path += make_name(r, shape.min_name_length, shape.max_name_length);
+
+		// NOTE : unique within the directory
+		wchar_t suffix[16];
+		swprintf(suffix, 16, L"_%u", i);
+		path += suffix;
+
+		const wchar_t *e = pick_extension(r);
+		if(e) {
+			path += L'.';
+			path += e;
+		}
+		return path;
+	}
+
+	void Corpus::append_records(std::vector<char> &db) const
+	{
+		if(db.empty()) {
+			const unsigned zero = 0;
+			db.insert(db.end(), (const char*)&zero, (const char*)&zero+sizeof(zero));
+		}
+
+		wchar_t date[17];
+		for(unsigned d=0; d<directories.size(); ++d) {
+			for(unsigned i=0; i<files_in_directory[d]; ++i) {
+				make_datestring(date, mix(shape.seed+1, ((unsigned long long)d << 24) ^ i));
+				filerepo::aux::append_filerecord(db, file_path(d, i).c_str(), date);
+			}
+		}
+	}
+
+	void Corpus::append_new_records(std::vector<char> &db, unsigned n, unsigned seed) const
+	{
+		if(db.empty()) {
+			const unsigned zero = 0;
+			db.insert(db.end(), (const char*)&zero, (const char*)&zero+sizeof(zero));
+		}
+
+		Random r(mix(shape.seed, seed));
+
+		wchar_t date[17];
+		wchar_t suffix[32];
+		for(unsigned i=0; i<n; ++i) {
+			const unsigned d = r.below((unsigned)directories.size());
+
+			String path = directories[d];
+			path += make_name(r, shape.min_name_length, shape.max_name_length);
+
+			// NOTE : corpus files end in '_<index>.', these never collide with them
+			swprintf(suffix, 32, L"_new%u_%u", seed, i);
+			path += suffix;
+
+			const wchar_t *e = pick_extension(r);
+			if(e) {
+				path += L'.';
+				path += e;
+			}
+
+			make_datestring(date, r.next());
+			filerepo::aux::append_filerecord(db, path.c_str(), date);
+		}
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+/*
+ *	Deterministic synthetic path corpora for the benchmarks and tools.
+ *
+ *	The tree is grown breadth first from the root, every directory gets a random
+ *	number of files and subdirectories (geometric, around the means of 'Shape')
+ *	until there are enough files. Names are built from a small vocabulary of
+ *	source tree words in a few naming styles, extensions follow a weighted mix
+ *	of a typical C/C++ code base with content and scripts. The same seed and
+ *	shape always give the same corpus, on every platform.
+ */
+namespace corpus {
+	typedef std::wstring String;
+
+	struct Shape {
+		Shape();
+
+		unsigned seed;
+
+		unsigned max_depth;				// below the root
+		unsigned mean_subdirectories;	// fan-out
+		unsigned mean_files;			// per directory
+
+		// of the words in a file name (excluding extension), long names are rare
+		unsigned min_name_length;
+		unsigned max_name_length;
+	};
+
+	// splitmix64
+	struct Random {
+		explicit Random(unsigned long long seed) : state(seed) {}
+
+		unsigned long long next();
+
+		// [0, n)
+		unsigned below(unsigned n) { return (unsigned)(next() % n); }
+
+		// geometric-ish around 'mean' (at most 4*mean)
+		unsigned around(unsigned mean);
+
+		unsigned long long state;
+	};
+
+	struct Corpus {
+		// grows the tree for 'num_files' files below 'root'
+		void generate(const Shape &shape, const wchar_t *root, unsigned num_files);
+
+		// the records of all files (unsorted, see 'filerepo::aux::sort_db')
+		void append_records(std::vector<char> &db) const;
+
+		// 'n' files that are not in the corpus, spread over its directories (unsorted)
+		void append_new_records(std::vector<char> &db, unsigned n, unsigned seed) const;
+
+		// file 'i' of directory 'd'
+		String file_path(unsigned d, unsigned i) const;
+
+		unsigned num_files;
+
+		Shape shape;
+		std::vector<String> directories;		// full paths, with a trailing separator
+		std::vector<unsigned> directory_depth;
+		std::vector<unsigned> files_in_directory;
+
+	private:
+		// false if the path would get too long
+		bool add_directory(Random &random, unsigned parent);
+		unsigned pick_parent(Random &random) const;
+	};
+
+	// "DD/MM/YYYY HH:MM", deterministic per 'seed'
+	void make_datestring(wchar_t *res, unsigned long long seed);
+
+	// the separator of the platform, paths are native (the parser and search treat them so)
+	wchar_t separator();
+}
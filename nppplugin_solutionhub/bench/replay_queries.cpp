@@ -0,0 +1,502 @@
+/*
+ *	Replays a query trace (see 'query_trace.h') against file repositories, results as json
+ *	(stdout or '--out').
+ *
+ *	replay_queries --trace=queries.jsonl [--records=100000] [--seed=1]
+ *	               [--speed=1.0 | --fast] [--out=file.json]
+ *
+ *	Every solution of the trace gets a repo with a synthetic corpus of '--records' files
+ *	(see 'corpus.h'), changes are replayed as changes of the same kind and size to it.
+ *	At the recorded pacing ('--speed' scales it) queries are posted on time whether or
+ *	not the previous ones were answered (open loop), '--fast' posts the next event once
+ *	the previous query is answered (closed loop, throughput).
+ *
+ *	NOTE : the corpus is not the recorded tree, the number of results differs (anonymized
+ *	queries hardly match anything), the cost of a query is mostly the scan of the index.
+ */
+#include "corpus.h"
+
+#include "file_repository.h"
+#include "file_repository_common.h"
+#include "stats.h"
+#include "stream.h"
+
+#include "json/json.h"
+#include "log/log.h"
+#include "string/string_utils.h"
+#include "thread/event.h"
+#include "thread/thread.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+namespace {
+	typedef stats::u64 u64;
+
+	struct Options {
+		Options() : records(100000), seed(1), speed(1.0), fast(false) {}
+
+		std::string trace;
+		std::string out;
+		unsigned records;
+		unsigned seed;
+		double speed;
+		bool fast;
+	};
+
+	Options options;
+
+	bool parse_arguments(int argc, char **argv)
+	{
+		for(int i=1; i<argc; ++i) {
+			const char *a = argv[i];
+			const char *v = strchr(a, '=');
+			const std::string name(a, v ? v-a : strlen(a));
+			v = (v ? v+1 : "");
+
+			if(name == "--trace") {
+				options.trace = v;
+			} else if(name == "--out") {
+				options.out = v;
+			} else if(name == "--records") {
+				options.records = (unsigned)strtoul(v, 0, 10);
+			} else if(name == "--seed") {
+				options.seed = (unsigned)strtoul(v, 0, 10);
+			} else if(name == "--speed") {
+				options.speed = atof(v);
+			} else if(name == "--fast") {
+				options.fast = true;
+			} else {
+				fprintf(stderr, "unknown argument '%s'\n", a);
+				return false;
+			}
+		}
+
+		if(options.trace.empty() || options.speed <= 0) {
+			fprintf(stderr, "usage : replay_queries --trace=queries.jsonl [--records=100000] [--seed=1] [--speed=1.0 | --fast] [--out=file.json]\n");
+			return false;
+		}
+
+		return true;
+	}
+
+	// latencies, nearest rank
+	struct Latencies {
+		void add(double ms) { _ms.push_back(ms); }
+
+		void to_json(Json::Value &out)
+		{
+			out["count"] = (unsigned)_ms.size();
+			if(_ms.empty())
+				return;
+
+			std::sort(_ms.begin(), _ms.end());
+
+			const double p[] = { 50, 95, 99 };
+			const char *names[] = { "p50_ms", "p95_ms", "p99_ms" };
+			for(unsigned i=0; i<3; ++i) {
+				size_t rank = (size_t)(p[i]/100.0*_ms.size()+0.5);
+				rank = (rank ? rank-1 : 0);
+				out[names[i]] = _ms[rank < _ms.size() ? rank : _ms.size()-1];
+			}
+			out["max_ms"] = _ms.back();
+		}
+
+	private:
+		std::vector<double> _ms;
+	};
+
+	//////////////////////////////////////////////////////////////////////////
+	// the trace
+
+	struct Event {
+		enum Type { QUERY, CHANGE };
+
+		Type type;
+		u64 t_us;
+		std::string solution;
+		std::string plugin;		// query
+		std::wstring query;		// query
+		std::string change;		// change
+		unsigned records;		// change
+	};
+
+	struct Trace {
+		Trace() : anonymized(false) {}
+
+		std::vector<Event> events;
+		std::vector<std::string> solutions;
+		bool anonymized;
+
+		Latencies recorded; // as the hub measured them
+	};
+
+	bool load_trace(const char *path, Trace &trace)
+	{
+		std::ifstream in(path, std::ios::binary);
+		if(!in) {
+			fprintf(stderr, "can not read '%s'\n", path);
+			return false;
+		}
+
+		Json::Reader reader;
+		std::string line;
+		unsigned line_number = 0;
+		while(std::getline(in, line)) {
+			++line_number;
+			if(line.empty() || line == "\r")
+				continue;
+
+			Json::Value e;
+			if(!reader.parse(line, e, false) || !e.isObject()) {
+				fprintf(stderr, "%s(%u) : not an event, skipped\n", path, line_number);
+				continue;
+			}
+
+			const std::string type = e["type"].asString();
+			if(type == "header") {
+				trace.anonymized = e["anonymized"].asBool();
+				continue;
+			}
+
+			if(type == "result") {
+				trace.recorded.add(e["latency_us"].asDouble()/1000.0);
+				continue;
+			}
+
+			if(type != "query" && type != "change")
+				continue;
+
+			Event ev;
+			ev.type = (type == "query" ? Event::QUERY : Event::CHANGE);
+			ev.t_us = (u64)e["t_us"].asDouble();
+			ev.solution = e["solution"].asString();
+			ev.plugin = e["plugin"].asString();
+			ev.query = string_util::utf8_to_wstr(e["query"].asString().c_str());
+			ev.change = e["change"].asString();
+			ev.records = e["records"].asUInt();
+			trace.events.push_back(ev);
+
+			if(std::find(trace.solutions.begin(), trace.solutions.end(), ev.solution) == trace.solutions.end())
+				trace.solutions.push_back(ev.solution);
+		}
+
+		// NOTE : lines are written as they happen, the order of threads racing for the file can be off by a bit
+		std::stable_sort(trace.events.begin(), trace.events.end(), [](const Event &a, const Event &b) { return a.t_us < b.t_us; });
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// a repo per solution, changes of the trace turned into changes of its corpus
+
+	struct Solution {
+		Solution() : repo(0), next_removed(0), next_updated(0), changes(0), renamed(false) {}
+
+		FileRepositoryHandle repo;
+		corpus::Corpus corpus;
+		std::vector<char> db; // as ingested, sorted
+
+		unsigned next_removed;	// records of 'db' are removed in order
+		unsigned next_updated;
+		unsigned changes;
+
+		corpus::String renamed_from, renamed_to; // a rename is undone by the next
+		bool renamed;
+	};
+
+	unsigned num_records(const std::vector<char> &db)
+	{
+		return *(const unsigned*)&db[0];
+	}
+
+	void append_change_packet(std::vector<char> &packets, unsigned change_type, const std::vector<char> &db)
+	{
+		npp::stream::pack(packets, change_type);
+		npp::stream::pack(packets, (unsigned)db.size());
+		npp::stream::pack_bytes(packets, &db[0], (unsigned)db.size());
+	}
+
+	void pack_directory(std::vector<char> &packets, const corpus::String &d)
+	{
+		const wchar_t null(0);
+		npp::stream::pack(packets, (unsigned)((d.length()+1)*sizeof(wchar_t)));
+		npp::stream::pack_bytes(packets, (const char*)d.c_str(), (unsigned)(d.length()*sizeof(wchar_t)));
+		npp::stream::pack(packets, null);
+	}
+
+	// 'n' records of 'db' from 'first' on (wrapping), 'date' replaced when given
+	void take_records(std::vector<char> &out, const std::vector<char> &db, unsigned first, unsigned n, unsigned date_seed)
+	{
+		npp::stream::pack(out, 0u);
+
+		const unsigned total = num_records(db);
+		n = std::min(n, total);
+
+		const char *b = &db[sizeof(unsigned)];
+		for(unsigned i=0; i<first % total; ++i)
+			b += ((const RecordHeader*)b)->record_size;
+
+		wchar_t date[17];
+		for(unsigned i=0; i<n; ++i) {
+			if(b == &db[0]+db.size())
+				b = &db[sizeof(unsigned)];
+
+			const RecordHeader &rh = *(const RecordHeader*)b;
+			const wchar_t *path = (const wchar_t*)(b+sizeof(RecordHeader));
+			if(date_seed) {
+				corpus::make_datestring(date, date_seed+i);
+				filerepo::aux::append_filerecord(out, path, date);
+			} else {
+				filerepo::aux::append_filerecord(out, path, path+wcslen(path)+1);
+			}
+			b += rh.record_size;
+		}
+
+		filerepo::aux::sort_db(out);
+	}
+
+	void make_change(Solution &s, const Event &e, std::vector<char> &packets)
+	{
+		++s.changes;
+		const unsigned n = std::max(e.records, 1u);
+
+		std::vector<char> delta;
+		if(e.change == "add" || e.change == "index") {
+			s.corpus.append_new_records(delta, n, s.changes);
+			filerepo::aux::sort_db(delta);
+			append_change_packet(packets, filerepo_headers::CHANGE_ADD, delta);
+		} else if(e.change == "remove") {
+			// NOTE : removing records that are gone already is as much work (a scan), keeps the size of the index
+			take_records(delta, s.db, s.next_removed, n, 0);
+			s.next_removed += n;
+			append_change_packet(packets, filerepo_headers::CHANGE_REMOVE, delta);
+		} else if(e.change == "update") {
+			take_records(delta, s.db, s.next_updated, n, s.changes);
+			s.next_updated += n;
+			append_change_packet(packets, filerepo_headers::CHANGE_UPDATE, delta);
+		} else if(e.change == "rename") {
+			if(!s.renamed) {
+				corpus::Random r(s.changes);
+				const unsigned d = 1+r.below((unsigned)s.corpus.directories.size()-1);
+				s.renamed_from = s.corpus.directories[d];
+				s.renamed_to = s.renamed_from.substr(0, s.renamed_from.length()-1)+L"_renamed"+corpus::separator();
+			}
+
+			const corpus::String &from = (s.renamed ? s.renamed_to : s.renamed_from);
+			const corpus::String &to = (s.renamed ? s.renamed_from : s.renamed_to);
+			s.renamed = !s.renamed;
+
+			npp::stream::pack(packets, (unsigned)filerepo_headers::CHANGE_DIRECTORY_RENAME);
+			const unsigned insert_point = (unsigned)packets.size();
+			npp::stream::pack(packets, 0u);
+			pack_directory(packets, from);
+			pack_directory(packets, to);
+
+			const unsigned data_size = (unsigned)packets.size()-insert_point;
+			memcpy(&packets[insert_point], &data_size, sizeof(data_size));
+		}
+	}
+
+	u64 indexed_records(FileRepositoryHandle repo, bool *idle)
+	{
+		Json::Value s;
+		filerepo::get_stats(repo, s);
+
+		*idle = s["index"]["pending_changes"].asDouble() == 0;
+		return (u64)s["index"]["records"].asDouble();
+	}
+
+	void wait_for_records(FileRepositoryHandle repo, u64 n)
+	{
+		bool idle = false;
+		while(indexed_records(repo, &idle) != n || !idle)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	void setup_solution(Solution &s, unsigned index)
+	{
+		corpus::Shape shape;
+		shape.seed = options.seed+index;
+
+#if defined(_WIN32)
+		const wchar_t *root_directory = L"c:\\src";
+#else
+		const wchar_t *root_directory = L"/src";
+#endif
+		s.corpus.generate(shape, root_directory, options.records);
+		s.corpus.append_records(s.db);
+		filerepo::aux::sort_db(s.db);
+
+		s.repo = filerepo::allocate_handle();
+
+		std::vector<char> packets;
+		append_change_packet(packets, filerepo_headers::CHANGE_ADD, s.db);
+		filerepo::post_changes(s.repo, &packets[0], (unsigned)packets.size());
+		wait_for_records(s.repo, num_records(s.db));
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// replay
+
+	struct PendingQuery {
+		PendingQuery() : event(0), done(true), num_results(0), latency_us(0), posted_us(0), late_us(0), indexing(false) {}
+
+		const Event *event;
+		npp::Event done; // manual reset, waited for again at the end
+		unsigned num_results;
+		u64 latency_us;
+		u64 posted_us;
+		u64 late_us;	// posted after its (scaled) time, the replay could not keep up
+		bool indexing;
+	};
+
+	void search_done(void *userdata, void *result, unsigned, const filerepo::SearchStatus &status)
+	{
+		PendingQuery *q = (PendingQuery*)userdata;
+		q->num_results = *(const unsigned*)result;
+		q->latency_us = stats::now_us()-q->posted_us;
+		q->indexing = status.indexing;
+		q->done.set();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if(!parse_arguments(argc, argv))
+		return 1;
+
+	npp::log::set_level(npp::log::LEVEL_WARNING);
+
+	Trace trace;
+	if(!load_trace(options.trace.c_str(), trace))
+		return 1;
+
+	unsigned num_queries = 0;
+	for(size_t i=0; i<trace.events.size(); ++i)
+		num_queries += (trace.events[i].type == Event::QUERY ? 1 : 0);
+
+	fprintf(stderr, "%u events, %u queries, %u solutions\n", (unsigned)trace.events.size(), num_queries, (unsigned)trace.solutions.size());
+
+	std::map<std::string, Solution*> solutions;
+	for(size_t i=0; i<trace.solutions.size(); ++i) {
+		Solution *s = new Solution;
+		setup_solution(*s, (unsigned)i);
+		solutions[trace.solutions[i]] = s;
+	}
+
+	PendingQuery *queries = new PendingQuery[num_queries ? num_queries : 1];
+	unsigned posted = 0;
+	unsigned changes = 0;
+
+	const u64 start = stats::now_us();
+	const u64 first_us = (trace.events.empty() ? 0 : trace.events.front().t_us);
+
+	for(size_t i=0; i<trace.events.size(); ++i) {
+		const Event &e = trace.events[i];
+		Solution &s = *solutions[e.solution];
+
+		u64 due_us = 0;
+		if(!options.fast) {
+			due_us = start+(u64)((e.t_us-first_us)/options.speed);
+
+			const u64 now = stats::now_us();
+			if(due_us > now)
+				std::this_thread::sleep_for(std::chrono::microseconds(due_us-now));
+		}
+
+		if(e.type == Event::CHANGE) {
+			std::vector<char> packets;
+			make_change(s, e, packets);
+			if(!packets.empty())
+				filerepo::post_changes(s.repo, &packets[0], (unsigned)packets.size());
+			++changes;
+			continue;
+		}
+
+		PendingQuery &q = queries[posted++];
+		q.event = &e;
+		q.posted_us = stats::now_us();
+		q.late_us = (due_us && q.posted_us > due_us ? q.posted_us-due_us : 0);
+		filerepo::search(s.repo, e.query.c_str(), &q, search_done);
+
+		if(options.fast)
+			q.done.wait();
+	}
+
+	for(unsigned i=0; i<posted; ++i)
+		queries[i].done.wait();
+
+	const double wall_ms = (stats::now_us()-start)/1000.0;
+
+	Latencies all, while_indexing;
+	std::map<std::string, Latencies> per_plugin;
+	u64 max_late_us = 0;
+	for(unsigned i=0; i<posted; ++i) {
+		const PendingQuery &q = queries[i];
+		const double ms = q.latency_us/1000.0;
+
+		all.add(ms);
+		per_plugin[q.event->plugin].add(ms);
+		if(q.indexing)
+			while_indexing.add(ms);
+
+		max_late_us = std::max(max_late_us, q.late_us);
+	}
+
+	Json::Value root(Json::objectValue);
+	Json::Value &meta = root["meta"];
+	meta["trace"] = options.trace;
+	meta["anonymized"] = trace.anonymized;
+	meta["records_per_solution"] = options.records;
+	meta["seed"] = options.seed;
+	meta["mode"] = (options.fast ? "fast" : "paced");
+	if(!options.fast)
+		meta["speed"] = options.speed;
+	meta["hardware_threads"] = npp::thread_hardware_concurrency();
+	for(size_t i=0; i<trace.solutions.size(); ++i)
+		meta["solutions"].append(trace.solutions[i]);
+
+	Json::Value &r = root["replay"];
+	r["queries"] = posted;
+	r["changes"] = changes;
+	r["wall_ms"] = wall_ms;
+	r["queries_per_second"] = (wall_ms > 0 ? posted/(wall_ms/1000.0) : 0.0);
+	if(!options.fast)
+		r["max_late_ms"] = max_late_us/1000.0;
+
+	all.to_json(r["latency"]);
+	while_indexing.to_json(r["latency_while_indexing"]);
+	for(std::map<std::string, Latencies>::iterator i=per_plugin.begin(); i!=per_plugin.end(); ++i)
+		i->second.to_json(r["per_plugin"][i->first]);
+
+	trace.recorded.to_json(root["recorded"]["latency"]);
+
+	Json::StyledWriter writer;
+	const std::string json = writer.write(root);
+
+	FILE *f = (options.out.empty() ? stdout : fopen(options.out.c_str(), "wb"));
+	if(!f) {
+		fprintf(stderr, "can not write '%s'\n", options.out.c_str());
+		return 1;
+	}
+
+	fwrite(json.c_str(), 1, json.length(), f);
+	if(f != stdout)
+		fclose(f);
+
+	for(std::map<std::string, Solution*>::iterator i=solutions.begin(); i!=solutions.end(); ++i) {
+		filerepo::stop(i->second->repo);
+		delete i->second;
+	}
+	filerepo::join(10000);
+	delete [] queries;
+
+	npp::log::shutdown();
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ *	Stress test of strand teardown, exits with 1 on a failure.
+ *
+ *	stress_strand [--rounds=20000] [--pushers=4] [--tasks=8]
+ *
+ *	Every round a strand is owned like a repo owns its strand : the owner, every
+ *	pusher thread and every posted task hold a reference, the last one to let go
+ *	destroys the strand. That happens on whichever thread it happens, a worker
+ *	running a task or a pusher, while the other pushers may still be returning
+ *	from 'strand_post'. Run it under a memory checker (ASan, Application
+ *	Verifier) to catch a strand touched after it is freed.
+ */
+#include "thread/thread_pool.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace {
+	std::atomic<unsigned> tasks_run(0);
+	std::atomic<unsigned> strands_destroyed(0);
+	std::atomic<bool> dropped_task_ran(false);
+
+	struct Owner {
+		npp::Strand *strand;
+		std::atomic<unsigned> references;
+		std::atomic<unsigned> running;	// tasks of the strand running right now, at most one
+		bool overlapped;
+	};
+
+	void release(Owner *o)
+	{
+		if(o->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			npp::strand_destroy(o->strand);
+			strands_destroyed.fetch_add(1, std::memory_order_release);
+		}
+	}
+
+	void task(void *ud)
+	{
+		Owner *o = (Owner*)ud;
+		if(o->running.fetch_add(1, std::memory_order_relaxed))
+			o->overlapped = true;
+
+		tasks_run.fetch_add(1, std::memory_order_relaxed);
+
+		o->running.fetch_sub(1, std::memory_order_relaxed);
+		release(o);
+	}
+
+	void dropped_task(void *)
+	{
+		dropped_task_ran.store(true);
+	}
+
+	unsigned argument(int argc, char **argv, const char *name, unsigned value)
+	{
+		const size_t length = strlen(name);
+		for(int i=1; i<argc; ++i) {
+			if(!strncmp(argv[i], name, length) && argv[i][length] == '=')
+				return (unsigned)strtoul(argv[i]+length+1, 0, 10);
+		}
+		return value;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned rounds = argument(argc, argv, "--rounds", 20000);
+	const unsigned num_pushers = argument(argc, argv, "--pushers", 4);
+	const unsigned num_tasks = argument(argc, argv, "--tasks", 8);
+
+	// NOTE : freed at the end, a strand may be destroyed after its round is over
+	std::vector<Owner*> owners;
+	owners.reserve(rounds);
+
+	for(unsigned r=0; r<rounds; ++r) {
+		Owner *o = new Owner();
+		o->strand = npp::strand_create();
+		o->references.store(1+num_pushers);
+		o->running.store(0);
+		o->overlapped = false;
+		owners.push_back(o);
+
+		std::vector<std::thread> pushers;
+		for(unsigned p=0; p<num_pushers; ++p) {
+			pushers.push_back(std::thread([o, num_tasks, p]() {
+				for(unsigned t=0; t<num_tasks; ++t) {
+					o->references.fetch_add(1, std::memory_order_relaxed);
+					npp::strand_post(o->strand, task, o, (t+p) % 3 ? npp::PRIORITY_NORMAL : npp::PRIORITY_HIGH);
+				}
+				release(o);
+			}));
+		}
+
+		release(o);
+		for(unsigned p=0; p<pushers.size(); ++p)
+			pushers[p].join();
+	}
+
+	// NOTE : nothing touches an owner after its last release, every task has counted by then
+	while(strands_destroyed.load(std::memory_order_acquire) != rounds)
+		std::this_thread::yield();
+
+	bool failed = (tasks_run.load() != rounds*num_pushers*num_tasks);
+	for(unsigned r=0; r<owners.size(); ++r) {
+		failed |= owners[r]->overlapped;
+		delete owners[r];
+	}
+
+	// like the plugin on unload, a delayed task left behind is dropped
+	npp::threadpool_submit_after(60000, dropped_task, 0);
+	const bool joined = npp::threadpool_shutdown(1000);
+	failed |= !joined || dropped_task_ran.load();
+
+	printf("{ \"rounds\" : %u, \"tasks_run\" : %u, \"pool_joined\" : %s, \"failed\" : %s }\n", rounds, tasks_run.load(), joined ? "true" : "false", failed ? "true" : "false");
+	return failed ? 1 : 0;
+}
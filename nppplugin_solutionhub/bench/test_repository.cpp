@@ -0,0 +1,347 @@
+/*
+ *	Checks of the file repository core, exits with 1 on a failure.
+ *
+ *	test_repository
+ *
+ *	Every failed check prints what it expected and what it got, the last line is a
+ *	json summary. Allocations are counted by a replaced global operator new.
+ */
+#include "file_repository.h"
+#include "file_repository_common.h"
+#include "stream.h"
+
+#include "thread/event.h"
+#include "thread/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <wchar.h>
+
+/*
+ *	Allocations of the whole process are counted while 'count_allocations' is set
+ *	(see 'check_steady_state_allocations').
+ */
+namespace {
+	std::atomic<bool> count_allocations(false);
+	std::atomic<unsigned> allocations(0);
+}
+
+// NOTE : kept out of line, gcc flags a 'free' inlined into a delete of memory from 'operator new'
+#if defined(_MSC_VER)
+	#define TEST_NOINLINE __declspec(noinline)
+#else
+	#define TEST_NOINLINE __attribute__((noinline))
+#endif
+
+void *operator new(size_t size)
+{
+	if(count_allocations.load(std::memory_order_relaxed))
+		allocations.fetch_add(1, std::memory_order_relaxed);
+
+	void *p = malloc(size ? size : 1);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+TEST_NOINLINE void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+namespace {
+	unsigned num_checks = 0;
+	unsigned num_failed = 0;
+
+	// the paths below are written with '/', records use the separator of the platform
+	std::wstring native(const wchar_t *path)
+	{
+		std::wstring p(path);
+#if defined(_WIN32)
+		std::replace(p.begin(), p.end(), L'/', L'\\');
+#endif
+		return p;
+	}
+
+	std::vector<char> make_db(const wchar_t **paths, unsigned n)
+	{
+		const unsigned zero = 0;
+		std::vector<char> db((const char*)&zero, (const char*)&zero+sizeof(zero));
+
+		for(unsigned i=0; i<n; ++i)
+			filerepo::aux::append_filerecord(db, native(paths[i]).c_str(), L"01/02/2024 10:00");
+
+		filerepo::aux::sort_db(db);
+		return db;
+	}
+
+	// full names of the records, sorted, empty for a record its header does not describe
+	std::vector<std::wstring> fullnames(const std::vector<char> &db)
+	{
+		std::vector<std::wstring> names;
+
+		const unsigned n = *(const unsigned*)&db[0];
+		const char *r = &db[sizeof(unsigned)];
+		for(unsigned i=0; i<n; ++i) {
+			const RecordHeader &rh = *(const RecordHeader*)r;
+			const wchar_t *full = (const wchar_t*)(r+sizeof(RecordHeader));
+			const std::wstring name(full);
+
+			const bool valid = name.length() == rh.filename_offset+rh.filename_length-1u
+				&& rh.filename_offset && (full[rh.filename_offset-1] == L'/' || full[rh.filename_offset-1] == L'\\')
+				&& rh.record_size == sizeof(RecordHeader)+(name.length()+1+wcslen(full+name.length()+1)+1)*sizeof(wchar_t);
+
+			names.push_back(valid ? name : std::wstring());
+			r += rh.record_size;
+		}
+
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+
+	void check(const char *name, const std::vector<char> &db, const wchar_t **expected, unsigned n)
+	{
+		std::vector<std::wstring> want;
+		for(unsigned i=0; i<n; ++i)
+			want.push_back(native(expected[i]));
+		std::sort(want.begin(), want.end());
+
+		const std::vector<std::wstring> got = fullnames(db);
+
+		++num_checks;
+		if(got == want)
+			return;
+
+		++num_failed;
+		printf("%s failed\n", name);
+		for(unsigned i=0; i<want.size(); ++i)
+			printf("\texpected %ls\n", want[i].c_str());
+		for(unsigned i=0; i<got.size(); ++i)
+			printf("\tgot      %ls\n", got[i].c_str());
+	}
+
+	// in small steps, like the repo between queries
+	void run(filerepo::RewriteJob &job, std::vector<char> &db)
+	{
+		while(!filerepo::aux::rewrite_step(job, 2))
+			;
+
+		filerepo::PendingUpdates unmatched;
+		filerepo::aux::rewrite_finish(job, db, unmatched);
+	}
+
+	// a directory name in the middle of other paths, and written in another case
+	const wchar_t *TREE[] = {
+		L"/src/engine/a.cpp",
+		L"/src/engine/render/b.cpp",
+		L"/other/src/engine/c.cpp",
+		L"/src/engine2/d.cpp",
+		L"/SRC/Engine/e.cpp",
+	};
+	const unsigned TREE_SIZE = sizeof(TREE)/sizeof(TREE[0]);
+
+	void check_rename()
+	{
+		const wchar_t *renamed[] = {
+			L"/src/core/a.cpp",
+			L"/src/core/render/b.cpp",
+			L"/other/src/engine/c.cpp",
+			L"/src/engine2/d.cpp",
+			L"/src/core/e.cpp",
+		};
+
+		const wchar_t *longer[] = {
+			L"/src/engine/renamed/a.cpp",
+			L"/src/engine/renamed/render/b.cpp",
+			L"/other/src/engine/c.cpp",
+			L"/src/engine2/d.cpp",
+			L"/src/engine/renamed/e.cpp",
+		};
+
+		{
+			std::vector<char> db = make_db(TREE, TREE_SIZE);
+			filerepo::RewriteJob job;
+			filerepo::aux::rewrite_begin_rename(job, db, native(L"/src/engine/").c_str(), native(L"/src/core/").c_str());
+			run(job, db);
+			check("rename", db, renamed, TREE_SIZE);
+		}
+		{
+			std::vector<char> db = make_db(TREE, TREE_SIZE);
+			filerepo::RewriteJob job;
+			filerepo::aux::rewrite_begin_rename(job, db, native(L"/src/engine").c_str(), native(L"/src/core").c_str());
+			run(job, db);
+			check("rename, no separator at the end", db, renamed, TREE_SIZE);
+		}
+		{
+			std::vector<char> db = make_db(TREE, TREE_SIZE);
+			filerepo::RewriteJob job;
+			filerepo::aux::rewrite_begin_rename(job, db, native(L"/src/engine/").c_str(), native(L"/src/engine/renamed/").c_str());
+			run(job, db);
+			check("rename to a longer name", db, longer, TREE_SIZE);
+		}
+	}
+
+	void check_remove_directory()
+	{
+		const wchar_t *kept[] = {
+			L"/other/src/engine/c.cpp",
+			L"/src/engine2/d.cpp",
+		};
+
+		std::vector<char> db = make_db(TREE, TREE_SIZE);
+		filerepo::RewriteJob job;
+		filerepo::aux::rewrite_begin_remove_directory(job, db, native(L"/src/engine/").c_str());
+		run(job, db);
+		check("remove directory", db, kept, 2);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// 'FileRepo' on the thread pool
+
+	const unsigned REPO_RECORDS = 20000;
+	const unsigned MERGE_RECORDS = 200;
+	const unsigned ROUNDS = 50;
+
+	// a merge allocates the copy of its change packet and, when the db grows, the buffer it is rewritten into, nothing per record
+	const unsigned MAX_ALLOCATIONS_PER_MERGE = 8;
+
+	struct PendingQuery {
+		npp::Event done;
+		unsigned num_results;
+	};
+
+	void search_done(void *userdata, void *result, unsigned, const filerepo::SearchStatus &)
+	{
+		PendingQuery *q = (PendingQuery*)userdata;
+		q->num_results = *(const unsigned*)result;
+		q->done.set();
+	}
+
+	unsigned search(FileRepositoryHandle repo, const wchar_t *s)
+	{
+		PendingQuery q;
+		q.num_results = 0;
+		filerepo::search(repo, s, &q, search_done);
+		q.done.wait();
+		return q.num_results;
+	}
+
+	// 'n' records named '<name><i>.cpp', sorted
+	std::vector<char> make_records(const wchar_t *directory, const wchar_t *name, unsigned n)
+	{
+		const unsigned zero = 0;
+		std::vector<char> db((const char*)&zero, (const char*)&zero+sizeof(zero));
+
+		wchar_t path[128];
+		for(unsigned i=0; i<n; ++i) {
+			swprintf(path, sizeof(path)/sizeof(path[0]), L"%ls/dir%u/%ls%u.cpp", directory, i % 97, name, i);
+			filerepo::aux::append_filerecord(db, native(path).c_str(), L"01/02/2024 10:00");
+		}
+
+		filerepo::aux::sort_db(db);
+		return db;
+	}
+
+	void post(FileRepositoryHandle repo, unsigned change_type, const std::vector<char> &db, std::vector<char> &packets)
+	{
+		packets.clear();
+		npp::stream::pack(packets, change_type);
+		npp::stream::pack(packets, (unsigned)db.size());
+		npp::stream::pack_bytes(packets, &db[0], (unsigned)db.size());
+
+		filerepo::post_changes(repo, &packets[0], (unsigned)packets.size());
+	}
+
+	// NOTE : polls with a query, a merge is visible once it is over (and the poll does not allocate)
+	void wait_for_matches(FileRepositoryHandle repo, const wchar_t *s, unsigned n)
+	{
+		while(search(repo, s) != n)
+			;
+	}
+
+	// a query or a merge through the repo once warm (buffers grown, free lists filled)
+	void check_steady_state_allocations()
+	{
+		const wchar_t *QUERIES[] = { L"file1", L"dir3 file", L"file -dir5", L"\\dir7", L"delta" };
+		const unsigned NUM_QUERIES = sizeof(QUERIES)/sizeof(QUERIES[0]);
+
+		FileRepositoryHandle repo = filerepo::allocate_handle();
+
+		std::vector<char> packets;
+		post(repo, filerepo_headers::CHANGE_ADD, make_records(L"/src", L"file", REPO_RECORDS), packets);
+		wait_for_matches(repo, L"file", REPO_RECORDS);
+
+		const std::vector<char> delta = make_records(L"/new", L"delta", MERGE_RECORDS);
+		std::vector<char> merge_packets;
+		merge_packets.reserve(delta.size()+64);
+
+		// the same queries and merges as below, until nothing is left to grow
+		for(unsigned round=0; round<2; ++round) {
+			for(unsigned i=0; i<ROUNDS*NUM_QUERIES; ++i)
+				search(repo, QUERIES[i % NUM_QUERIES]);
+
+			for(unsigned i=0; i<ROUNDS/10; ++i) {
+				post(repo, filerepo_headers::CHANGE_ADD, delta, merge_packets);
+				wait_for_matches(repo, L"delta", MERGE_RECORDS);
+				post(repo, filerepo_headers::CHANGE_REMOVE, delta, merge_packets);
+				wait_for_matches(repo, L"delta", 0);
+			}
+		}
+
+		{
+			allocations.store(0);
+			count_allocations.store(true);
+			for(unsigned i=0; i<ROUNDS*NUM_QUERIES; ++i)
+				search(repo, QUERIES[i % NUM_QUERIES]);
+			count_allocations.store(false);
+
+			++num_checks;
+			if(allocations.load()) {
+				++num_failed;
+				printf("queries once warm failed\n\texpected no allocation\n\tgot      %u in %u queries\n", allocations.load(), ROUNDS*NUM_QUERIES);
+			}
+		}
+
+		{
+			allocations.store(0);
+			count_allocations.store(true);
+			for(unsigned i=0; i<ROUNDS; ++i) {
+				post(repo, filerepo_headers::CHANGE_ADD, delta, merge_packets);
+				wait_for_matches(repo, L"delta", MERGE_RECORDS);
+				post(repo, filerepo_headers::CHANGE_REMOVE, delta, merge_packets);
+				wait_for_matches(repo, L"delta", 0);
+			}
+			count_allocations.store(false);
+
+			++num_checks;
+			if(allocations.load() > 2*ROUNDS*MAX_ALLOCATIONS_PER_MERGE) {
+				++num_failed;
+				printf("merges once warm failed\n\texpected at most %u allocations per merge\n\tgot      %u in %u merges\n", MAX_ALLOCATIONS_PER_MERGE, allocations.load(), 2*ROUNDS);
+			}
+		}
+
+		filerepo::stop(repo);
+		filerepo::join(10000);
+	}
+}
+
+int main()
+{
+	check_rename();
+	check_remove_directory();
+	check_steady_state_allocations();
+	npp::threadpool_shutdown(10000);
+
+	printf("{ \"checks\" : %u, \"failed\" : %u }\n", num_checks, num_failed);
+	return num_failed ? 1 : 0;
+}
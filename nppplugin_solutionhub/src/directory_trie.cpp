@@ -0,0 +1,450 @@
+#include "directory_trie.h"
+#include "thread/atomic.h"
+
+#include <string>
+#include <vector>
+#include <thread> // yield
+#include <wctype.h> // towlower
+
+typedef std::wstring String;
+
+struct DirectoryTrie::Node {
+	Node(const wchar_t *n, unsigned l) : name(n, l), first_child(0), next_sibling(0), seen(false), lock(0), retired_next(0), retired_epoch(0) {}
+
+	const String name;
+
+	std::atomic<Node*> first_child;
+	std::atomic<Node*> next_sibling;
+	std::atomic<bool> seen;
+
+	std::atomic<int> lock;	// guards modifications of the 'first_child' list
+	Node *retired_next;
+	unsigned retired_epoch;
+};
+
+// NOTE : a cache line each, operations of different threads do not share a written line
+struct DirectoryTrie::Reader {
+	std::atomic<unsigned> epoch;
+	char pad[npp::CACHE_LINE_SIZE-sizeof(std::atomic<unsigned>)];
+};
+
+namespace {
+	typedef DirectoryTrie::Node Node;
+
+	enum { MAX_THREADS = 128 }; // threads with a reader slot at the same time, others fall back to '_overflow'
+
+	std::atomic<bool> thread_slot_used[MAX_THREADS];
+	std::atomic<unsigned> num_thread_slots(0); // slots from here on were never handed out
+
+	// slot of the calling thread in every trie, held until the thread exits
+	struct ThreadSlot {
+		ThreadSlot() : index(MAX_THREADS)
+		{
+			for(unsigned i=0; i<MAX_THREADS; ++i) {
+				if(thread_slot_used[i].exchange(true, std::memory_order_acquire))
+					continue;
+
+				index = i;
+				unsigned n = num_thread_slots.load(std::memory_order_relaxed);
+				while(n <= i && !num_thread_slots.compare_exchange_weak(n, i+1))
+					;
+				break;
+			}
+		}
+
+		~ThreadSlot()
+		{
+			if(index < MAX_THREADS)
+				thread_slot_used[index].store(false, std::memory_order_release);
+		}
+
+		unsigned index;
+	};
+
+	thread_local ThreadSlot thread_slot;
+
+	// is epoch 'a' before 'b' (wraps around)
+	inline bool epoch_before(unsigned a, unsigned b)
+	{
+		return (int)(a-b) < 0;
+	}
+}
+
+/*
+ *	NOTE :	The epoch is published before the operation loads a single node, the fence
+ *			pairs with the one in 'reclaim' : either the reclaimer sees the epoch, or
+ *			the operation sees every unlink that came before the nodes were retired.
+ */
+struct DirectoryTrie::Operation {
+	Operation(DirectoryTrie &t) : trie(t), slot(thread_slot.index)
+	{
+		if(slot < MAX_THREADS) {
+			trie._readers[slot].epoch.store(trie._epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		} else {
+			trie._overflow.fetch_add(1);
+		}
+	}
+
+	~Operation()
+	{
+		if(slot < MAX_THREADS)
+			trie._readers[slot].epoch.store(0, std::memory_order_release);
+		else
+			trie._overflow.fetch_sub(1);
+
+		trie.reclaim();
+	}
+
+	DirectoryTrie &trie;
+	const unsigned slot;
+
+private:
+	Operation &operator=(const Operation&);
+};
+
+namespace {
+
+	inline bool is_separator(wchar_t c) { return c == L'\\' || c == L'/'; }
+
+	// splits on separators, skips empty components
+	bool next_component(const wchar_t *&p, const wchar_t *&component, unsigned &length)
+	{
+		while(*p && is_separator(*p))
+			++p;
+
+		if(!*p)
+			return false;
+
+		component = p;
+		while(*p && !is_separator(*p))
+			++p;
+
+		length = (unsigned)(p-component);
+		return true;
+	}
+
+	bool component_equal(const String &name, const wchar_t *component, unsigned length)
+	{
+		if(name.length() != length)
+			return false;
+
+		for(unsigned i=0; i<length; ++i) {
+			if(towlower(name[i]) != towlower(component[i]))
+				return false;
+		}
+		return true;
+	}
+
+	void lock(Node *n)
+	{
+		while(n->lock.exchange(1, std::memory_order_acquire))
+			std::this_thread::yield();
+	}
+
+	void unlock(Node *n)
+	{
+		n->lock.store(0, std::memory_order_release);
+	}
+
+	Node *find_child(Node *n, const wchar_t *component, unsigned length)
+	{
+		Node *c = n->first_child.load(std::memory_order_acquire);
+		while(c) {
+			if(component_equal(c->name, component, length))
+				return c;
+
+			c = c->next_sibling.load(std::memory_order_acquire);
+		}
+		return 0;
+	}
+
+	// is 'a' equal to, or an ancestor of, 'b'
+	bool is_prefix_path(const wchar_t *a, const wchar_t *b)
+	{
+		const wchar_t *ca, *cb;
+		unsigned la, lb;
+		while(next_component(a, ca, la)) {
+			if(!next_component(b, cb, lb))
+				return false;
+
+			String t(ca, la);
+			if(!component_equal(t, cb, lb))
+				return false;
+		}
+		return true;
+	}
+
+	void free_subtree(Node *n)
+	{
+		// NOTE : 'next_sibling' of 'n' itself is NOT part of the subtree
+		std::vector<Node*> pending(1, n);
+		while(!pending.empty()) {
+			Node *p = pending.back();
+			pending.pop_back();
+
+			Node *c = p->first_child.load(std::memory_order_relaxed);
+			while(c) {
+				pending.push_back(c);
+				c = c->next_sibling.load(std::memory_order_relaxed);
+			}
+			delete p;
+		}
+	}
+}
+
+DirectoryTrie::DirectoryTrie() : _root(new Node(L"", 0)), _epoch(1), _readers(new Reader[MAX_THREADS]), _overflow(0), _retired(0)
+{
+	for(unsigned i=0; i<MAX_THREADS; ++i)
+		_readers[i].epoch.store(0, std::memory_order_relaxed);
+}
+
+DirectoryTrie::~DirectoryTrie()
+{
+	free_subtree(_root);
+	delete [] _readers;
+
+	Node *r = _retired.exchange(0);
+	while(r) {
+		Node *next = r->retired_next;
+		free_subtree(r);
+		r = next;
+	}
+}
+
+bool DirectoryTrie::contains(const wchar_t *directory)
+{
+	Operation op(*this);
+
+	Node *parent = 0;
+	Node *n = find(directory, &parent);
+
+	return (n && n->seen.load(std::memory_order_acquire));
+}
+
+void DirectoryTrie::insert(const wchar_t *directory)
+{
+	Operation op(*this);
+
+	Node *n = find_or_create(directory);
+	if(n != _root)
+		n->seen.store(true, std::memory_order_release);
+}
+
+void DirectoryTrie::remove(const wchar_t *directory)
+{
+	Operation op(*this);
+
+	Node *parent = 0;
+	Node *n = find(directory, &parent);
+	if(n && unlink(parent, n))
+		retire(n);
+}
+
+void DirectoryTrie::rename(const wchar_t *from, const wchar_t *to)
+{
+	if(is_prefix_path(from, to))
+		return; // can not move a directory into itself
+
+	Operation op(*this);
+
+	Node *parent = 0;
+	Node *f = find(from, &parent);
+	if(!f)
+		return;
+
+	Node *t = find_or_create(to);
+	if(t == _root)
+		return;
+
+	if(f->seen.load(std::memory_order_acquire))
+		t->seen.store(true, std::memory_order_release);
+
+	lock(f);
+	Node *children = f->first_child.exchange(0);
+	unlock(f);
+
+	if(children)
+		merge_children(t, children);
+
+	if(unlink(parent, f))
+		retire(f);
+}
+
+DirectoryTrie::Node *DirectoryTrie::find(const wchar_t *directory, Node **parent)
+{
+	const wchar_t *component;
+	unsigned length;
+
+	Node *p = 0;
+	Node *n = _root;
+	while(n && next_component(directory, component, length)) {
+		p = n;
+		n = find_child(n, component, length);
+	}
+
+	*parent = p;
+	return (n == _root ? 0 : n);
+}
+
+DirectoryTrie::Node *DirectoryTrie::find_or_create(const wchar_t *directory)
+{
+	const wchar_t *component;
+	unsigned length;
+
+	Node *n = _root;
+	while(next_component(directory, component, length)) {
+		Node *child = find_child(n, component, length);
+		if(!child) {
+			lock(n);
+			child = find_child(n, component, length); // re-check under lock
+			if(!child) {
+				child = new Node(component, length);
+				child->next_sibling.store(n->first_child.load(std::memory_order_relaxed), std::memory_order_relaxed);
+				n->first_child.store(child, std::memory_order_release); // publish
+			}
+			unlock(n);
+		}
+		n = child;
+	}
+
+	return n;
+}
+
+bool DirectoryTrie::unlink(Node *parent, Node *n)
+{
+	bool found = false;
+
+	lock(parent);
+	Node *prev = 0;
+	Node *c = parent->first_child.load(std::memory_order_relaxed);
+	while(c) {
+		if(c == n) {
+			// NOTE : 'next_sibling' of 'n' is left intact for readers currently standing on it
+			Node *next = n->next_sibling.load(std::memory_order_relaxed);
+			if(prev)
+				prev->next_sibling.store(next, std::memory_order_release);
+			else
+				parent->first_child.store(next, std::memory_order_release);
+
+			found = true;
+			break;
+		}
+		prev = c;
+		c = c->next_sibling.load(std::memory_order_relaxed);
+	}
+	unlock(parent);
+
+	return found;
+}
+
+void DirectoryTrie::merge_children(Node *destination, Node *children)
+{
+	lock(destination);
+
+	if(!destination->first_child.load(std::memory_order_relaxed)) {
+		// common case, adopt the whole list
+		destination->first_child.store(children, std::memory_order_release);
+		unlock(destination);
+		return;
+	}
+
+	/*
+	 *	NOTE :	Readers that reached 'children' before it was detached may still walk it, its
+	 *			links are left alone. Children new to 'destination' are copied, in front of
+	 *			its current list, and the copies published with one store.
+	 */
+	Node *head = destination->first_child.load(std::memory_order_relaxed);
+
+	Node *c = children;
+	while(c) {
+		Node *next = c->next_sibling.load(std::memory_order_relaxed);
+		const String &name = c->name;
+
+		lock(c);
+		Node *grand_children = c->first_child.exchange(0);
+		unlock(c);
+
+		// NOTE : 'children' holds every name once, the copies need not be searched
+		Node *existing = find_child(destination, name.c_str(), (unsigned)name.length());
+		if(!existing) {
+			Node *copy = new Node(name.c_str(), (unsigned)name.length());
+			copy->seen.store(c->seen.load(std::memory_order_acquire), std::memory_order_relaxed);
+			copy->first_child.store(grand_children, std::memory_order_relaxed);
+			copy->next_sibling.store(head, std::memory_order_relaxed);
+			head = copy;
+		} else {
+			if(c->seen.load(std::memory_order_acquire))
+				existing->seen.store(true, std::memory_order_release);
+
+			// NOTE : lock order is always ancestor before descendant
+			if(grand_children)
+				merge_children(existing, grand_children);
+		}
+
+		retire(c);
+		c = next;
+	}
+
+	destination->first_child.store(head, std::memory_order_release); // publish
+	unlock(destination);
+}
+
+void DirectoryTrie::retire(Node *n)
+{
+	// NOTE : unlinked before, an operation starting in a later epoch can not reach it
+	n->retired_epoch = _epoch.fetch_add(2);
+
+	Node *head = _retired.load();
+	do {
+		n->retired_next = head;
+	} while(!_retired.compare_exchange_weak(head, n));
+}
+
+void DirectoryTrie::reclaim()
+{
+	if(!_retired.load())
+		return;
+
+	Node *list = _retired.exchange(0);
+	if(!list)
+		return;
+
+	// NOTE : pairs with the fence in 'Operation', see there
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	// the epoch of the oldest operation in flight, 0 : none
+	unsigned oldest = 0;
+	for(unsigned i=0, n=num_thread_slots.load(std::memory_order_relaxed); i<n; ++i) {
+		const unsigned e = _readers[i].epoch.load(std::memory_order_relaxed);
+		if(e && (!oldest || epoch_before(e, oldest)))
+			oldest = e;
+	}
+
+	// NOTE : operations without a slot do not tell their epoch, nothing is freed while one runs
+	const bool overflow = (_overflow.load() != 0);
+
+	Node *keep = 0;
+	Node *keep_tail = 0;
+	while(list) {
+		Node *next = list->retired_next;
+		if(!overflow && (!oldest || epoch_before(list->retired_epoch, oldest))) {
+			free_subtree(list);
+		} else {
+			list->retired_next = keep;
+			keep = list;
+			if(!keep_tail)
+				keep_tail = list;
+		}
+		list = next;
+	}
+
+	if(!keep)
+		return;
+
+	// still (possibly) in use, put back
+	Node *head = _retired.load();
+	do {
+		keep_tail->retired_next = head;
+	} while(!_retired.compare_exchange_weak(head, keep));
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+
+/*
+ *	Trie of directory paths, one node per path component (compared case-insensitive).
+ *
+ *	- lookups are lock-free
+ *	- writers only lock the node whose child list they modify
+ *	- 'remove' unlinks the whole subtree, nodes are reclaimed once every operation
+ *	  that could have reached them is done (epochs, one slot per thread)
+ *	- 'rename' moves the children of 'from' below 'to', O(depth) when 'to' is empty,
+ *	  a published sibling list is never relinked
+ */
+struct DirectoryTrie {
+	DirectoryTrie();
+	~DirectoryTrie();
+
+	bool contains(const wchar_t *directory);
+
+	void insert(const wchar_t *directory);
+	void remove(const wchar_t *directory);
+	void rename(const wchar_t *from, const wchar_t *to);
+
+	struct Node;
+
+private:
+	struct Operation;
+	struct Reader;
+
+	Node *find(const wchar_t *directory, Node **parent);
+	Node *find_or_create(const wchar_t *directory);
+	bool unlink(Node *parent, Node *n);
+	void merge_children(Node *destination, Node *children);
+
+	void retire(Node *n);
+	void reclaim();
+
+	DirectoryTrie(const DirectoryTrie&);
+	DirectoryTrie &operator=(const DirectoryTrie&);
+
+	Node *_root;
+
+	std::atomic<unsigned> _epoch;		// odd, bumped by every 'retire'
+	Reader *_readers;					// per thread slot, the epoch its operation started in (0 : none)
+	std::atomic<unsigned> _overflow;	// operations of threads without a slot
+	std::atomic<Node*> _retired;		// unlinked, waiting for the operations of their epoch
+};
@@ -3,19 +3,42 @@
 
 #include "json/json.h"
 #include "thread/thread.h"
+#include "thread/thread_pool.h"
+#include "thread/mpsc_queue.h"
+#include "thread/cancellation.h"
+#include "thread/wait_group.h"
 #include "thread/critical_section.h"
-#include "debug.h"
+#include "trace/trace.h"
+#include "log/log.h"
 
 #include "stream.h"
 
 #include "string/string_utils.h"
-
-#include "win32/win_aux.h"
+#include "file/file_system.h"
 
 #include "folder_monitor.h"
+#include "io_budget.h"
+#include "stats.h"
+#include "memory.h"
+#include "query_trace.h"
+#include "query_cache.h"
+#include "vfs.h"
+
+#if defined(_WIN32)
+	#include <Windows.h> // GetCurrentProcessId
+#else
+	#include <unistd.h> // getpid
+#endif
 
 #include <vector>
+#include <stack>
 #include <sstream>
+#include <wctype.h> // iswspace, towlower
+#include <wchar.h> // swprintf
+#include <time.h> // time
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 
 using namespace npp;
 
@@ -37,173 +60,714 @@ struct SearchHeader {
 	unsigned char num_include;
 	unsigned char num_exclude;
 
+	unsigned exclude_length;	// in bytes, the clauses follow
+	unsigned char num_clauses;
+
 	SearchResponseData response;
 };
 
-struct TSBuffer {
-	npp::CriticalSection cs;
-	std::vector<char> data;
+// followed by 'num_queries' QUERY_FILES packets (their responses are not used)
+struct BatchHeader {
+	unsigned num_queries;
+	SearchResponseData response;
 };
 
-struct InputRequest {
-	InputRequest(HANDLE wu, TSBuffer &b) : wakeup_event(wu), buffer(b) {}
+// source records rewritten per step, queries wait at most this long (~1ms)
+const unsigned REWRITE_RECORDS_PER_STEP = (16*1024);
+
+// directories/files enumerated per parse task, before the job goes back to the pool
+const unsigned PARSE_DIRECTORIES_PER_TASK = 64;
+const unsigned PARSE_FILES_PER_TASK = 4096;
+
+/*
+ *	Parsers publish a chunk when they have this many records (doubled after every
+ *	chunk, each merge rewrites the whole db), or when this long has passed.
+ */
+const unsigned PARSE_PUBLISH_RECORDS = (8*1024);
+const unsigned PARSE_PUBLISH_MS = 250;
+
+/*
+ *	Memory budget (see 'filerepo::set_memory_budget'). While the repos are over
+ *	it, the least recently searched idle repo is written to a snapshot file and
+ *	its index freed, the next search loads it back.
+ */
+const unsigned EVICTION_CHECK_MS = (10*1000);	// recheck while over budget
+const unsigned EVICTION_NEXT_MS = 100;			// recheck after an eviction was posted
+const unsigned EVICT_IDLE_SECONDS = 300;		// default, not searched for this long
+
+// changes queued for an evicted repo wait for the next search, above this they are applied (and the index loaded) right away
+const unsigned EVICTED_INPUT_LIMIT = (1024*1024);
+
+// results of recent queries kept per repo (see 'QueryCache')
+const unsigned QUERY_CACHE_BYTES = (4*1024*1024);
+
+// rough size of one pending date update (key, record and map node), not worth walking the map for
+const unsigned PENDING_UPDATE_BYTES = 256;
+
+// date updates kept for a record that is not in the index yet (see '_unmatched_updates')
+const unsigned MAX_UNMATCHED_UPDATES = (64*1024);
+
+/*
+ *	Query indexes are not built by the query that could use one, a stale index costs
+ *	the queries a scan each. Once they scanned as often as the index takes to build
+ *	(in scans of the db, measured at 1M records), an idle maintenance step builds it.
+ */
+const unsigned DATE_INDEX_BUILD_SCANS = 2;
+const unsigned EXTENSION_INDEX_BUILD_SCANS = 2;
+const unsigned PATH_INDEX_BUILD_SCANS = 5;
+
+struct FileRepo;
+
+/*
+ *	Input to the repo strand, handed over without copying the payload.
+ *
+ *	PACKETS		: 'data' is one or more header-prefixed packets (see filerepo_headers)
+ *	DATABASE	: 'data' is a complete sorted db to merge (a chunk of parser results)
+ *	QUERY		: 'data' is one 'QUERY_FILES' (or 'QUERY_FILES_BATCH', 'QUERY_FILES_EXACT') packet
+ */
+struct InputMessage : npp::MPSCNode {
+	enum {
+		PACKETS = 0,
+		DATABASE,
+		QUERY
+	};
+
+	InputMessage(unsigned t) : type(t), posted_us(stats::now_us()), accounted(0), next_free(0) {}
+
+	unsigned type;
+	std::vector<char> data;
 
-	HANDLE wakeup_event;
-	TSBuffer &buffer;
-};
+	stats::u64 posted_us;
+	memory::u64 accounted; // 'memory::INPUT'
 
-void append_data(TSBuffer &dest, const void *start, unsigned size)
-{
-	npp::CriticalSectionScope h(dest.cs);
-	stream::pack_bytes(dest.data, start, size);
-}
+	InputMessage *next_free; // queries are reused, see 'FileRepo::take_query'
+};
 
-void append_input(InputRequest *irs, const void *start, unsigned size) {
-	const InputRequest &ir = *irs;
-	TSBuffer &buffer = ir.buffer;
+/*
+ *	A query message being answered (see 'FileRepo::serve_queries'), its queries are
+ *	'count' of '_served' from 'first'.
+ */
+struct ServedMessage {
+	InputMessage *m;
+	SearchResponseData response;
+	bool batch;
+	unsigned first;
+	unsigned count;
+};
 
-	append_data(buffer, start, size);
+struct ServedQuery {
+	filerepo::aux::SearchQuery query;
+	const std::vector<unsigned> *cached;	// 0 : searched, see 'scan'
+	unsigned scan;							// index of the search in the shared scan
+	bool exact;								// QUERY_FILES_EXACT, 'cached' is the lookup
+};
 
-	::SetEvent(ir.wakeup_event);
-}
+/*
+ *	See 'filerepo::get_stats', read from any thread. The index part is written
+ *	by the strand, the rest by the parsers and the folder monitor.
+ */
+struct RepoStats {
+	RepoStats() : started_us(stats::now_us()) {}
+
+	const stats::u64 started_us;
+
+	// index
+	stats::Counter records;
+	stats::Counter index_bytes;		// the db, plus the result of the rewrite in progress
+	stats::Counter segments;		// the db, plus the one being rewritten
+	stats::Counter pending_updates;	// dates, applied by the next rewrite
+
+	stats::Counter changes_posted;
+	stats::Counter changes_applied;
+
+	stats::Counter queries_served;
+	stats::Counter query_cache_hits;
+	stats::Counter query_cache_misses;
+	stats::Counter query_scans;		// passes over the db, for any number of queries
+	stats::Counter query_batches;
+	stats::Counter query_exact;		// lookups, no scan and not cached
+	stats::Histogram search;		// posted to answered
+	stats::Histogram merge;			// rewrite started to finished
+	stats::Histogram change;		// posted to applied
+
+	// parsers
+	stats::Counter files_parsed;
+	stats::Counter directories_failed;
+	stats::Counter parse_busy_us;	// walking, summed over tasks
+	stats::Histogram parse;			// one solution directory, started to done
+	stats::Histogram directory_read;
+
+	// folder monitor
+	stats::Counter monitor_batches;
+	stats::Counter monitor_bytes;
+
+	// memory budget
+	stats::Counter evictions;
+	stats::Counter reloads;
+};
 
+/*
+ *	All work on the db runs as steps on the repo strand (serial) on the shared
+ *	thread pool, directory parsing runs as pool tasks.
+ *
+ *	Every step first answers all queued queries, then does one bounded unit
+ *	of index maintenance. Changes are applied in arrival order as out of place
+ *	rewrites ('filerepo::RewriteJob'), a few thousand records per step, and
+ *	queries in between are answered from the db as it was before the rewrite.
+ *	Queries not in the cache are answered together by one pass over the db
+ *	('filerepo::aux::search_db_shared'), however many are queued.
+ *
+ *	Parsers publish what they found in chunks while walking, searches are
+ *	answered from whatever has been merged so far and report the progress.
+ *
+ *	The repo is reference counted : the owner, the folder monitor, every scheduled
+ *	step and every running parser holds a reference, the last one to let go
+ *	deletes it. Stopping cancels '_cancel', which parsers look at per directory
+ *	(and file), steps before every rewrite step and searches every few thousand
+ *	records, so everything lets go within milliseconds.
+ *
+ *	Started repos are registered for the memory budget, an evicted repo has
+ *	its index in '_snapshot_file' until a search (or a pile of changes) needs
+ *	it, folder monitoring goes on meanwhile.
+ */
 struct FileRepo {
-	FileRepo();
+	FileRepo(const vfs::Provider *fs);
 	~FileRepo();
 
 	void start();
 	void stop();
-	void wait_for_pending_jobs();
 
 	void search(const wchar_t *s, void *userdata, filerepo::search_callback scb);
+	void search_batch(const wchar_t *const *s, unsigned n, void *userdata, filerepo::search_callback scb);
+	void search_exact(const wchar_t *path, void *userdata, filerepo::search_callback scb);
 	void add_directories(Json::Value const &solution);
 
-	void append_inputdata(const void *start, unsigned size); // thread safe/locking
+	void append_inputdata(const void *start, unsigned size); // thread safe/lock-free
 
-private:
-	void run();
+	// NOTE : takes over the content of 'data'
+	void post_input(unsigned type, std::vector<char> &data);
+	void post_message(InputMessage *m);
+
+	// a query message from the free list (or a new one), see 'drop_message'
+	InputMessage *take_query();
 
-	static unsigned int  __stdcall run_tf(void*);
+	void acquire();
+	void release();
+
+	// posts an eviction to the strand, done only if the repo is still idle by then
+	void post_evict();
+
+	// any thread, a candidate for eviction (the strand has the final say)
+	bool evictable(stats::u64 now_us, stats::u64 idle_us) const;
+
+	void monitor_counters(folder_monitor::Counters &c) const { _fs->watch_counters(_monitor, c); }
+
+	const vfs::Provider *_fs; // where the files are, the OS unless given (benchmarks)
+
+	npp::CancellationToken _cancel;
+
+	// indexing progress, updated by the parsers
+	std::atomic<unsigned> _directories_found;
+	std::atomic<unsigned> _directories_parsed;
+
+	// paces the parsers (per solution)
+	IOBudget _io_budget;
+
+	RepoStats _stats;
+	memory::Account _memory;
+
+	std::atomic<stats::u64> _last_used_us;	// last search
+	std::atomic<bool> _evicted;
+
+private:
+	static void step_task(void*);
+	static void continuation_task(void*);
+	static void evict_task(void*);
+
+	void post_step(npp::TaskPriority priority);
+
+	void step();
+	void serve_queries();
+	void answer(const ServedMessage &sm);
+	unsigned pack_answer(const ServedQuery &sq);
+	void find_exact(const wchar_t *path);
+	filerepo::QueryIndexes query_indexes(unsigned fields);
+	filerepo::SearchStatus search_status();
+	bool maintain();
+	bool begin_rewrite();
+	bool build_query_index();
+	bool process_packets();
+	void update_index_stats();
+	void update_results_memory();
+	void drop_results();
+	void drop_message(InputMessage *m);
+	void drop_input();
+	void drop_index();
+	void index_changed();
+
+	void start_parsers(Json::Value const &directories);
+	void evict();
+	void reload();
 
 	std::vector<char> _filedata;
 	void *_monitor;
-	bool _exit_requested;
 
-	HANDLE _wakeup_event;
-	npp::Thread *_thread;
-	npp::CriticalSection _cs;
+	npp::Strand *_strand;
+	std::atomic<unsigned> _references;
+
+	npp::MPSCQueue _queries;	// answered first
+	npp::MPSCQueue _changes;	// applied in order
+	std::atomic<bool> _query_step_posted; // a step is posted that has not looked at '_queries' yet
+
+	// answered queries, reused by the next searches
+	npp::CriticalSection _free_queries_lock;
+	InputMessage *_free_queries;
+
+	// being worked on by the strand
+	InputMessage *_current;
+	unsigned _current_offset;
+	filerepo::RewriteJob _job;
+	stats::u64 _job_started_us;
+	bool _continuation_scheduled;
+
+	filerepo::PendingUpdates _pending_updates;
+	filerepo::PendingUpdates _unmatched_updates;	// no record when they were applied, waiting for a merge that adds it
+	std::vector<char> _temp_buffer;
+
+	// bumped by every change to '_filedata', cached results are of one generation
+	unsigned long long _generation;
+	QueryCache _query_cache;
+
+	// queries being answered, kept for the next step
+	std::vector<ServedMessage> _serving;
+	std::vector<ServedQuery> _served;
+	std::vector<filerepo::aux::SearchQuery> _scan_queries;
+	std::vector<std::vector<unsigned> > _scan_results;
+	std::vector<char> _batch_buffer;
+
+	// built from '_filedata' by the first exact lookup after a change
+	filerepo::ExactIndex _exact_index;
+	bool _exact_index_current;
+	std::vector<unsigned> _exact_matched;
+
+	// built once queries with a "modified:" clause scanned long enough after a change
+	filerepo::DateIndex _date_index;
+	bool _date_index_current;
+	unsigned _date_index_scans;
+
+	// built once queries with an "ext:" clause scanned long enough after a change
+	filerepo::ExtensionIndex _extension_index;
+	bool _extension_index_current;
+	unsigned _extension_index_scans;
+
+	// built once queries with an "in:" clause scanned long enough after a change
+	filerepo::PathIndex _path_index;
+	bool _path_index_current;
+	unsigned _path_index_scans;
+
+	std::atomic<unsigned> _outstanding_parsers;
+	bool _monitored_directories;
 
-	TSBuffer _input_buffer;
-	InputRequest *_input_requests;
-	std::vector<npp::Thread *> _worker_threads;
+	// progress reported so far (strand), counted from the bases when indexing started
+	unsigned _progress;
+	unsigned _directories_found_base;
+	unsigned _directories_parsed_base;
 
-	unsigned _outstanding_parsers;
-	bool _monitored_directories;
+	// NOTE : set by 'add_solution', before the first search
+	Json::Value _solutions;	// re-indexed if the snapshot is lost
+
+	String _snapshot_file;
+	std::atomic<stats::u64> _evict_retry_us; // not a candidate before, the strand refused
 };
 
+// every repo alive, see 'filerepo::join'
+npp::WaitGroup live_repos;
+
+// started and not yet stopped, for the memory budget
+npp::CriticalSection repos_lock;
+std::vector<FileRepo*> repos;
+String snapshot_directory;
+std::atomic<unsigned> evict_idle_seconds(EVICT_IDLE_SECONDS);
+std::atomic<bool> eviction_check_scheduled(false);
+std::atomic<unsigned> next_snapshot_id(0);
+
+void schedule_eviction_check(unsigned ms);
+
+// one trace event per packet, the number of records (or directories) it changes
+void trace_changes(const void *repo, const char *packets, unsigned size)
+{
+	const char *b = packets;
+	const char *end = packets+size;
+	while(b < end) {
+		const unsigned header = stream::unpack<unsigned>(b);
+		if(header == filerepo_headers::PARSER_DONE)
+			continue;
+
+		const unsigned buffer_size = stream::unpack<unsigned>(b);
+		if(header == filerepo_headers::CHANGE_ADD || header == filerepo_headers::CHANGE_REMOVE || header == filerepo_headers::CHANGE_UPDATE) {
+			static const char *names[] = { "add", "remove", "update" };
+			query_trace::change(repo, names[header], *(const unsigned*)b);
+			b += buffer_size;
+		} else {
+			// NOTE : the size of these includes the size itself
+			if(header == filerepo_headers::CHANGE_DIRECTORY_RENAME)
+				query_trace::change(repo, "rename", 1);
+			else if(header == filerepo_headers::CHANGE_DIRECTORY_REMOVE)
+				query_trace::change(repo, "remove_directory", 1);
+			b += buffer_size-sizeof(unsigned);
+		}
+	}
+}
+
 void foldermonitor_callback(void *user_data, void *s, unsigned n) {
-	DEBUG_PRINT("[foldermonitor_callback data size : %d]", n);
+	LOG_TRACE(npp::log::CATEGORY_MONITOR, "changes, %u bytes", n);
 	FileRepo *db = (FileRepo*)user_data;
+	db->_stats.monitor_batches.add();
+	db->_stats.monitor_bytes.add(n);
 	db->append_inputdata(s, n);
 }
 
+void foldermonitor_release(void *user_data) {
+	FileRepo *db = (FileRepo*)user_data;
+	db->release(); // the monitor
+}
 
-unsigned int __stdcall directory_parse_tf(void*);
 
-struct ThreadParams {
-	ThreadParams(InputRequest &ir, bool *s) : input_requests(ir), shutdown(s) {}
-	InputRequest &input_requests;
-	bool *shutdown;
-};
+void directory_parse_task(void*);
+
+// parses a directory tree a slice at a time, resubmitting itself in between
+struct ParseJob {
+	ParseJob(FileRepo &r, String d, String incf, String exlf, bool rec) :
+	repo(r), directory(d), inc_filter(incf), exl_filter(exlf), recursive(rec), num_records(0), publish_records(0), last_publish(std::chrono::steady_clock::now()), started_us(stats::now_us()), accounted(0) {}
 
-struct DPThreadParams : ThreadParams {
-	DPThreadParams(InputRequest &ir, bool *s, String d, String incf, String exlf, bool r) :
-	ThreadParams(ir, s), directory(d), inc_filter(incf), exl_filter(exlf), recursive(r) {}
+	FileRepo &repo;
 
 	String directory, inc_filter, exl_filter;
 	bool recursive;
-};
 
-struct SearchInfo {
-	unsigned search_full; // '+'
+	unsigned num_records;
+	std::vector<char> files; // not yet published
 
-	unsigned char num_exclude;
-	unsigned char num_include;
+	unsigned publish_records; // publish when 'files' holds this many records
+	std::chrono::steady_clock::time_point last_publish;
+
+	stats::u64 started_us;
+	memory::u64 accounted; // 'memory::PARSER', capacity of 'files'
 
-	std::vector<char> exclude_tokens;
-	std::vector<char> include_tokens;
+	std::vector<String> directories;
+	std::stack<String> enum_directories;
 };
 
+// whitespace separated, like reading a stream with 'operator>>'
+bool next_token(const wchar_t *&s, const wchar_t *&begin, const wchar_t *&end)
+{
+	while(*s && iswspace(*s))
+		++s;
+	if(!*s)
+		return false;
+
+	begin = s;
+	while(*s && !iswspace(*s))
+		++s;
+	end = s;
+	return true;
+}
+
+struct ClauseName {
+	const wchar_t *name;
+	unsigned field;
+};
+
+const ClauseName CLAUSE_NAMES[] = {
+	{ L"ext:", filerepo_clauses::EXT },
+	{ L"in:", filerepo_clauses::IN },
+	{ L"name:", filerepo_clauses::NAME },
+	{ L"path:", filerepo_clauses::PATH },
+	{ L"modified:", filerepo_clauses::MODIFIED_AFTER }
+};
 
-void cleanup(String& s)
+// the field of a "field:value" token ('-' first negates), 0 for a plain token
+unsigned clause_field(const wchar_t *begin, const wchar_t *end, const wchar_t *&value)
 {
-	static const String removeme(L"-");
+	if(begin != end && *begin == L'-')
+		++begin;
+
+	for(unsigned i=0; i<sizeof(CLAUSE_NAMES)/sizeof(CLAUSE_NAMES[0]); ++i) {
+		const wchar_t *n = CLAUSE_NAMES[i].name;
+		const wchar_t *c = begin;
+		for(; *n && c != end && (wchar_t)towlower(*c) == *n; ++n, ++c) {}
 
-	String::iterator c(s.begin());
-	while(c!=s.end()) {
-		if(removeme.find(*c) != std::string::npos) {
-			c = s.erase(c);
+		if(!*n) {
+			value = c;
+			return CLAUSE_NAMES[i].field;
+		}
+	}
+	return 0;
+}
+
+/*
+ *	The date key (see 'filerepo::aux::date_key') of a "modified:" value, an age ("<7d" newer,
+ *	">7d" older, units m, h, d and w) or a date (">2024-01-31" after, "<2024-01-31" before).
+ *	Newer/after without either. Returns the field, 0 if the value is not one.
+ */
+unsigned modified_clause(const wchar_t *value, const wchar_t *end, unsigned &key)
+{
+	const wchar_t op = (value != end && (*value == L'<' || *value == L'>') ? *value : 0);
+	if(op)
+		++value;
+
+	unsigned n[3] = { 0, 0, 0 };
+	unsigned parts = 0, digits = 0;
+	for(; value != end && parts < 3; ++value) {
+		if(*value >= L'0' && *value <= L'9') {
+			n[parts] = n[parts]*10+(*value-L'0');
+			++digits;
+		} else if(*value == L'-' && digits) {
+			++parts;
+			digits = 0;
 		} else {
-			++c;
+			break;
+		}
+	}
+	if(!digits)
+		return 0;
+
+	wchar_t datestring[17];
+	if(parts == 2 && value == end) {
+		// a date, from its midnight
+		swprintf(datestring, 16+1, L"%02u/%02u/%04u 00:00", n[2], n[1], n[0]);
+		key = filerepo::aux::date_key(datestring);
+		if(!key)
+			return 0;
+		return (op == L'<' ? filerepo_clauses::MODIFIED_BEFORE : filerepo_clauses::MODIFIED_AFTER);
+	}
+
+	if(parts || end-value != 1)
+		return 0;
+
+	unsigned minutes = 0;
+	switch(towlower(*value)) {
+	case L'm': minutes = 1; break;
+	case L'h': minutes = 60; break;
+	case L'd': minutes = 24*60; break;
+	case L'w': minutes = 7*24*60; break;
+	default: return 0;
+	}
+
+	filerepo::make_internal_datestring_time(datestring, (long long)time(0));
+	const unsigned now = filerepo::aux::date_key(datestring);
+	const unsigned long long age = (unsigned long long)n[0]*minutes;
+	key = (age < now ? (unsigned)(now-age) : 0);
+
+	return (op == L'>' ? filerepo_clauses::MODIFIED_BEFORE : filerepo_clauses::MODIFIED_AFTER);
+}
+
+/*
+ *	Appends the clause of token 'begin'..'end' (see 'filerepo_clauses') to 'out', returns
+ *	false if it has no (valid) value. Values are separated by ',', extensions lose a
+ *	leading '.', directories their leading and trailing separators.
+ */
+bool pack_clause(unsigned field, const wchar_t *begin, const wchar_t *value, const wchar_t *end, std::vector<char> &out)
+{
+	const wchar_t null(0);
+	const unsigned clause_offset = (unsigned)out.size();
+
+	const wchar_t negated = (*begin == L'-' ? 1 : 0);
+	stream::pack(out, (wchar_t)field);
+	stream::pack(out, negated);
+	stream::pack(out, (wchar_t)0);
+
+	unsigned num_values = 0;
+	if(field == filerepo_clauses::MODIFIED_AFTER) {
+		unsigned key = 0;
+		field = modified_clause(value, end, key);
+		if(field) {
+			wchar_t decimal[16];
+			swprintf(decimal, 16, L"%u", key);
+			for(const wchar_t *c=decimal; *c; ++c)
+				stream::pack(out, *c);
+			stream::pack(out, null);
+			num_values = 1;
+
+			*(wchar_t*)&out[clause_offset] = (wchar_t)field;
 		}
+	} else {
+		while(value != end) {
+			const wchar_t *v = value;
+			while(value != end && *value != L',')
+				++value;
+			const wchar_t *v_end = value;
+			if(value != end)
+				++value;
+
+			if(field == filerepo_clauses::EXT && v != v_end && *v == L'.')
+				++v;
+			if(field == filerepo_clauses::IN) {
+				while(v != v_end && (*v == L'\\' || *v == L'/'))
+					++v;
+				while(v_end != v && (v_end[-1] == L'\\' || v_end[-1] == L'/'))
+					--v_end;
+			}
+			if(v == v_end)
+				continue;
+
+			for(; v != v_end; ++v)
+				stream::pack(out, *v);
+			stream::pack(out, null);
+			++num_values;
+		}
+	}
+
+	if(!num_values) {
+		LOG_TRACE(npp::log::CATEGORY_SEARCH, "skipping a clause without values");
+		out.resize(clause_offset);
+		return false;
 	}
+
+	*(wchar_t*)&out[clause_offset+2*sizeof(wchar_t)] = (wchar_t)num_values;
+	return true;
 }
 
-bool build_searchinformation(const wchar_t *s, SearchInfo &out) {
+/*
+ *	Appends the QUERY_FILES packet of search string 's' to 'out' (nothing is allocated once
+ *	it is big enough). Include tokens come first, then exclude tokens ('-' first), dashes
+ *	within tokens are dropped and '\' searches the full path. Then the "field:value"
+ *	clauses (see 'filerepo_clauses'), '-' first negates them.
+ */
+void pack_query(const wchar_t *s, void *userdata, filerepo::search_callback cb, std::vector<char> &out)
+{
 	const wchar_t null(0);
 
-	unsigned char &num_exclude = out.num_exclude, &num_include = out.num_include;
-	num_exclude = 0, num_include = 0;
-	unsigned &include_all = out.search_full;
-	std::vector<char> &exclude_tokens = out.exclude_tokens;
-	std::vector<char> &include_tokens = out.include_tokens;
+	stream::pack(out, (unsigned)filerepo_headers::QUERY_FILES);
 
-	include_all = 0;
+	const unsigned header_offset = (unsigned)out.size();
+	SearchHeader h; memset(&h, 0, sizeof(h));
+	stream::pack(out, h);
 
-	String buf;
-	std::wstringstream ss(s);
+	unsigned char num_tokens[3] = { 0, 0, 0 }; // include, exclude, clauses
 
-	while (ss >> buf) {
-		wchar_t first_char = buf.at(0);
-		bool exclude_token = first_char == L'-';
-		bool include_all_token = first_char == L'\\';
-		include_all = (include_all == 0 ? (include_all_token ? 1 : 0) : 1);
+	// NOTE : three passes over the string, no token is copied anywhere else
+	for(unsigned pass=0; pass<3; ++pass) {
+		const wchar_t *c = s, *begin = 0, *end = 0;
+		while(next_token(c, begin, end)) {
+			const wchar_t *value = 0;
+			const unsigned field = clause_field(begin, end, value);
+			if(field) {
+				if(pass == 2 && num_tokens[2] < 255 && pack_clause(field, begin, value, end, out))
+					++num_tokens[2];
+				continue;
+			}
+			if(pass == 2)
+				continue;
 
-		cleanup(buf);
-		unsigned str_len = (unsigned)buf.length();
-		if(str_len) {
-			if (include_all_token && str_len <= 1)
+			const bool exclude_token = (*begin == L'-');
+			const bool include_all_token = (*begin == L'\\');
+			if(include_all_token)
+				h.include_all = 1;
+
+			if(exclude_token != (pass == 1))
 				continue;
 
-			const wchar_t *b = buf.c_str();
-			if (include_all_token) { --str_len; ++b; }
+			unsigned str_len = 0;
+			for(const wchar_t *t=begin; t!=end; ++t)
+				str_len += (*t != L'-');
 
-			std::vector<char> &insert_to = (exclude_token ? exclude_tokens : include_tokens);
-			unsigned char &add_to = (exclude_token ? num_exclude : num_include);
-			npp::stream::pack_bytes(insert_to, b, str_len*sizeof(wchar_t));
-			npp::stream::pack(insert_to, null);
+			if(!str_len) {
+				LOG_TRACE(npp::log::CATEGORY_SEARCH, "skipping empty search token");
+				continue;
+			}
+			if(include_all_token && str_len <= 1)
+				continue;
 
-			add_to = add_to+1;
+			if(include_all_token)
+				++begin;
 
-		} else {
-			DEBUG_PRINT("Skipping empty!");
+			for(const wchar_t *t=begin; t!=end; ++t)
+				if(*t != L'-')
+					stream::pack(out, *t);
+			stream::pack(out, null);
+
+			++num_tokens[pass];
 		}
+
+		if(pass == 0)
+			h.include_length = (unsigned)out.size()-header_offset-sizeof(SearchHeader);
+		else if(pass == 1)
+			h.exclude_length = (unsigned)out.size()-header_offset-sizeof(SearchHeader)-h.include_length;
 	}
 
-	bool any = (include_all+num_exclude+num_include) > 0;
-	if(!any)
-		include_all = 1;
+	h.num_include = num_tokens[0];
+	h.num_exclude = num_tokens[1];
+	h.num_clauses = num_tokens[2];
+	if(!(h.include_all+h.num_include+h.num_exclude))
+		h.include_all = 1;
 
-	return true;
+	h.size = (unsigned)out.size()-header_offset;
+	h.response.data = userdata;
+	h.response.cb = cb;
+	memcpy(&out[header_offset], &h, sizeof(h));
+}
+
+// appends the QUERY_FILES_EXACT packet of 'path', its one token is 'path' without surrounding whitespace
+void pack_exact_query(const wchar_t *path, void *userdata, filerepo::search_callback cb, std::vector<char> &out)
+{
+	const wchar_t null(0);
+
+	stream::pack(out, (unsigned)filerepo_headers::QUERY_FILES_EXACT);
+
+	const unsigned header_offset = (unsigned)out.size();
+	SearchHeader h; memset(&h, 0, sizeof(h));
+	stream::pack(out, h);
+
+	while(*path && iswspace(*path))
+		++path;
+	const wchar_t *end = path+wcslen(path);
+	while(end != path && iswspace(end[-1]))
+		--end;
+
+	// NOTE : 'include_all' only tells it is a path, 'filerepo::aux::find_exact' sees that itself
+	for(const wchar_t *c=path; c!=end; ++c) {
+		stream::pack(out, *c);
+		if(*c == L'\\' || *c == L'/')
+			h.include_all = 1;
+	}
+	stream::pack(out, null);
+
+	h.num_include = (path != end ? 1 : 0);
+	h.include_length = (unsigned)out.size()-header_offset-sizeof(SearchHeader);
+	h.size = (unsigned)out.size()-header_offset;
+	h.response.data = userdata;
+	h.response.cb = cb;
+	memcpy(&out[header_offset], &h, sizeof(h));
+}
+
+// the query of the QUERY_FILES (or QUERY_FILES_EXACT) packet at 'b', moves 'b' past the packet
+const SearchHeader &unpack_query(const char *&b, filerepo::aux::SearchQuery &q)
+{
+	stream::unpack<unsigned>(b); // QUERY_FILES(_EXACT)
+	const char *start = b;
+	const SearchHeader &sh = stream::unpack<SearchHeader>(b);
+
+	q.search_all = sh.include_all;
+	q.num_include = sh.num_include;
+	q.num_exclude = sh.num_exclude;
+	q.include = (const wchar_t *)b;
+	q.exclude = (const wchar_t *)(b+sh.include_length);
+	q.num_clauses = sh.num_clauses;
+	q.clauses = (const wchar_t *)(b+sh.include_length+sh.exclude_length);
+	q.clauses_length = (unsigned)((sh.size-sizeof(SearchHeader)-sh.include_length-sh.exclude_length)/sizeof(wchar_t));
+
+	b = start+sh.size;
+	return sh;
 }
 
 } // anonymous
 
 namespace filerepo
 {
-	FileRepositoryHandle allocate_handle()
+	FileRepositoryHandle allocate_handle(const vfs::Provider *fs)
 	{
-		FileRepo *repo = new FileRepo();
+		FileRepo *repo = new FileRepo(fs ? fs : vfs::os());
 		repo->start();
 		return repo;
 	}
@@ -211,7 +775,7 @@ namespace filerepo
 	void stop(FileRepositoryHandle &rh)
 	{
 		if(!rh) {
-			DEBUG_PRINT("[filerepo] ERROR : Invalid handle to stop!");
+			LOG_ERROR(npp::log::CATEGORY_REPO, "invalid handle to stop");
 			return;
 		}
 
@@ -233,276 +797,1047 @@ namespace filerepo
 		repo->search(s, ud, scb);
 	}
 
+	void search_batch(FileRepositoryHandle rh, const wchar_t *const *search_strings, unsigned n, void *ud, search_callback scb)
+	{
+		FileRepo *repo = (FileRepo *)rh;
+		repo->search_batch(search_strings, n, ud, scb);
+	}
+
+	void search_exact(FileRepositoryHandle rh, const wchar_t *path, void *ud, search_callback scb)
+	{
+		FileRepo *repo = (FileRepo *)rh;
+		repo->search_exact(path, ud, scb);
+	}
+
+	void post_changes(FileRepositoryHandle rh, const void *packets, unsigned size)
+	{
+		FileRepo *repo = (FileRepo *)rh;
+		repo->append_inputdata(packets, size);
+	}
+
+	void get_stats(FileRepositoryHandle rh, Json::Value &out)
+	{
+		FileRepo *repo = (FileRepo *)rh;
+		const RepoStats &s = repo->_stats;
+
+		const stats::u64 now = stats::now_us();
+		const double uptime = (now-s.started_us)/1000000.0;
+
+		out = Json::Value(Json::objectValue);
+		out["uptime_seconds"] = uptime;
+
+		Json::Value &index = out["index"];
+		index["records"] = (double)s.records.get();
+		index["bytes"] = (double)s.index_bytes.get();
+		index["segments"] = (double)s.segments.get();
+		index["pending_updates"] = (double)s.pending_updates.get();
+
+		// NOTE : applied is read first, pending can not go below zero
+		const stats::u64 applied = s.changes_applied.get();
+		const stats::u64 posted = s.changes_posted.get();
+		index["pending_changes"] = (double)(posted > applied ? posted-applied : 0);
+		index["changes_applied"] = (double)applied;
+
+		Json::Value &queries = out["queries"];
+		queries["served"] = (double)s.queries_served.get();
+		queries["cache_hits"] = (double)s.query_cache_hits.get();
+		queries["cache_misses"] = (double)s.query_cache_misses.get();
+		queries["scans"] = (double)s.query_scans.get();
+		queries["batches"] = (double)s.query_batches.get();
+		queries["exact"] = (double)s.query_exact.get();
+
+		Json::Value &latency = out["latency"];
+		s.search.to_json(latency["search"]);
+		s.merge.to_json(latency["merge"]);
+		s.change.to_json(latency["change"]);
+		s.parse.to_json(latency["parse"]);
+		s.directory_read.to_json(latency["directory_read"]);
+
+		Json::Value &parser = out["parser"];
+		const stats::u64 files = s.files_parsed.get();
+		const stats::u64 busy_us = s.parse_busy_us.get();
+		parser["files"] = (double)files;
+		parser["directories"] = (double)repo->_directories_parsed.load(std::memory_order_relaxed);
+		parser["directories_failed"] = (double)s.directories_failed.get();
+		parser["busy_seconds"] = busy_us/1000000.0;
+		parser["files_per_second"] = (busy_us ? (files*1000000.0)/busy_us : 0.0);
+
+		Json::Value &monitor = out["monitor"];
+		const stats::u64 batches = s.monitor_batches.get();
+		monitor["batches"] = (double)batches;
+		monitor["bytes"] = (double)s.monitor_bytes.get();
+		monitor["batches_per_second"] = (uptime > 0 ? batches/uptime : 0.0);
+
+		folder_monitor::Counters mc;
+		repo->monitor_counters(mc);
+		monitor["overflows"] = (double)mc.overflows;
+		monitor["rescans"] = (double)mc.rescans;
+		monitor["watch_failures"] = (double)mc.watch_failures;
+		monitor["watched_directories"] = (double)mc.watched_directories;
+
+		Json::Value &mem = out["memory"];
+		for(unsigned k=0; k<memory::NUM_KINDS; ++k)
+			mem[memory::kind_name((memory::Kind)k)] = (double)repo->_memory.get((memory::Kind)k);
+
+		mem["total"] = (double)repo->_memory.total();
+		mem["process_total"] = (double)memory::total();
+		mem["budget"] = (double)memory::budget();
+		mem["evicted"] = repo->_evicted.load(std::memory_order_relaxed);
+		mem["evictions"] = (double)s.evictions.get();
+		mem["reloads"] = (double)s.reloads.get();
+	}
+
+	void set_memory_budget(unsigned long long budget_bytes, unsigned idle_seconds, const wchar_t *directory)
+	{
+		{
+			npp::CriticalSectionScope s(repos_lock);
+			snapshot_directory = (directory ? directory : L"");
+		}
+
+		evict_idle_seconds.store(idle_seconds, std::memory_order_relaxed);
+		memory::set_budget(budget_bytes);
+
+		if(memory::over_budget())
+			schedule_eviction_check(0);
+	}
+
+	bool join(unsigned timeout_ms)
+	{
+		npp::Deadline deadline(timeout_ms);
+		if(!live_repos.wait(deadline.remaining_ms()))
+			return false;
+
+		return folder_monitor::join(deadline.remaining_ms());
+	}
+
 } // namespace file_repo
 
 namespace
 {
 
-FileRepo::FileRepo() :
+FileRepo::FileRepo(const vfs::Provider *fs) :
+_fs(fs),
+_directories_found(0),
+_directories_parsed(0),
 _monitor(0),
-_exit_requested(false),
-_wakeup_event(0),
-_thread(0),
-_input_requests(0),
+_strand(0),
+_references(2), // owner, monitor
+_free_queries(0),
+_current(0),
+_current_offset(0),
+_job_started_us(0),
+_continuation_scheduled(false),
+_generation(0),
+_query_cache(QUERY_CACHE_BYTES),
+_exact_index_current(false),
+_date_index_current(false),
+_date_index_scans(0),
+_extension_index_current(false),
+_extension_index_scans(0),
+_path_index_current(false),
+_path_index_scans(0),
 _outstanding_parsers(0),
-_monitored_directories(false)
+_monitored_directories(false),
+_progress(0),
+_directories_found_base(0),
+_directories_parsed_base(0),
+_solutions(Json::arrayValue),
+_evict_retry_us(0)
 {
-	folder_monitor::RegisterContext ctx = { this, foldermonitor_callback };
+	_last_used_us.store(stats::now_us(), std::memory_order_relaxed);
+	_evicted.store(false, std::memory_order_relaxed);
+	_query_step_posted.store(false, std::memory_order_relaxed);
+
+	live_repos.add();
 
-	_monitor = folder_monitor::allocate(&ctx);
+	folder_monitor::RegisterContext ctx = { this, foldermonitor_callback, foldermonitor_release };
+
+	_monitor = _fs->watch_allocate(_fs->user_data, &ctx);
 }
 
 void FileRepo::append_inputdata(const void *start, unsigned size) {
-	append_input(_input_requests, start, size);
+	if(query_trace::recording())
+		trace_changes(this, (const char*)start, size);
+
+	std::vector<char> data;
+	stream::pack_bytes(data, start, size);
+
+	post_input(InputMessage::PACKETS, data);
+}
+
+void FileRepo::post_input(unsigned type, std::vector<char> &data) {
+	InputMessage *m = new InputMessage(type);
+	m->data.swap(data);
+
+	post_message(m);
+}
+
+void FileRepo::post_message(InputMessage *m) {
+	m->accounted = m->data.capacity();
+	_memory.add(memory::INPUT, m->accounted);
+
+	const bool query = (m->type == InputMessage::QUERY);
+	if(!query)
+		_stats.changes_posted.add();
+
+	(query ? _queries : _changes).push(m);
+
+	// NOTE : one step serves every query queued by then, a query queued meanwhile needs no step of its own
+	if(query && _query_step_posted.exchange(true))
+		return;
+
+	post_step(query ? npp::PRIORITY_HIGH : npp::PRIORITY_NORMAL);
+}
+
+InputMessage *FileRepo::take_query() {
+	InputMessage *m = 0;
+	{
+		npp::CriticalSectionScope s(_free_queries_lock);
+		if((m = _free_queries) != 0)
+			_free_queries = m->next_free;
+	}
+
+	if(!m)
+		return new InputMessage(InputMessage::QUERY);
+
+	m->posted_us = stats::now_us();
+	return m;
+}
+
+void FileRepo::post_step(npp::TaskPriority priority)
+{
+	acquire(); // released when the step is done
+	npp::strand_post(_strand, FileRepo::step_task, this, priority);
+}
+
+void FileRepo::acquire()
+{
+	_references.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FileRepo::release()
+{
+	if(_references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		LOG_DEBUG(npp::log::CATEGORY_REPO, "deleting repo");
+		delete this;
+	}
 }
 
 FileRepo::~FileRepo() {
-	npp::thread_stop(_thread);
-	npp::thread_destroy(_thread);
+	drop_input();
+
+	while(InputMessage *m = _free_queries) {
+		_free_queries = m->next_free;
+		delete m;
+	}
+
+	// NOTE : nothing is scheduled (would hold a reference), the strand is freed after the running task
+	npp::strand_destroy(_strand);
 
-	::CloseHandle(_wakeup_event);
-	delete _input_requests;
+	live_repos.done();
 }
 
 void FileRepo::start()
 {
 	unsigned h = 0;
 	stream::pack(_filedata, h);
+	update_index_stats();
 
-	const char *eventname = 0;
-	BOOL manual_reset = TRUE, initial_state = FALSE;
-	_wakeup_event = ::CreateEventA(0, manual_reset, initial_state, eventname);
-	_input_requests = new InputRequest(_wakeup_event, _input_buffer);
+	_strand = npp::strand_create();
 
-	_thread = npp::thread_create(FileRepo::run_tf, this);
-	npp::thread_start(_thread);
+	npp::CriticalSectionScope s(repos_lock);
+	repos.push_back(this);
 }
 
 void FileRepo::stop()
 {
-	if(!_thread)
+	if(!_strand)
 		return; // not started
 
-	folder_monitor::stop(_monitor);
+	{
+		// NOTE : the owner reference is still held, the eviction check can not see a deleted repo
+		npp::CriticalSectionScope s(repos_lock);
+		repos.erase(std::find(repos.begin(), repos.end(), this));
+	}
 
-	_exit_requested = true;
-	::SetEvent(_wakeup_event);
+	_cancel.cancel();
+	_fs->watch_stop(_monitor);
+
+	// frees the index right away, even if a parser is stuck in a slow directory
+	post_step(npp::PRIORITY_HIGH);
+
+	release(); // owner
+}
+
+void FileRepo::step_task(void *ud) {
+	FileRepo *repo = (FileRepo*)ud;
+	repo->step();
+	repo->release();
+}
+
+void FileRepo::continuation_task(void *ud) {
+	FileRepo *repo = (FileRepo*)ud;
+	repo->_continuation_scheduled = false;
+	repo->step();
+	repo->release();
+}
+
+void FileRepo::evict_task(void *ud) {
+	FileRepo *repo = (FileRepo*)ud;
+	repo->evict();
+	repo->release();
 }
 
-void FileRepo::wait_for_pending_jobs()
+void FileRepo::post_evict()
 {
-	std::vector<npp::Thread*>::iterator i(_worker_threads.begin()), end(_worker_threads.end());
-	while(i!=end) {
-		npp::Thread *t = (*i);
+	acquire(); // released when the eviction is done
+	npp::strand_post(_strand, FileRepo::evict_task, this, npp::PRIORITY_LOW);
+}
 
-		if(!npp::thread_wait(t, 5000)) {
-			std::string err_msg = win_aux::get_last_error();
-			DEBUG_PRINT("thread_wait failure. GetLastError(0X%.8X), msg(%s)\n", ::GetLastError(), err_msg.c_str());
-		}
+bool FileRepo::evictable(stats::u64 now_us, stats::u64 idle_us) const
+{
+	if(_evicted.load(std::memory_order_relaxed) || _outstanding_parsers.load(std::memory_order_relaxed))
+		return false;
 
-		npp::thread_stop(t);
-		npp::thread_destroy(t);
+	return now_us >= _evict_retry_us.load(std::memory_order_relaxed) &&
+		now_us-_last_used_us.load(std::memory_order_relaxed) >= idle_us;
+}
 
-		++i;
+void FileRepo::step() {
+	TRACE_SCOPE("repo step");
+
+	_query_step_posted.store(false);
+
+	if(_cancel.cancelled()) {
+		drop_input();
+		drop_index();
+		return;
 	}
+
+	if(_evicted.load(std::memory_order_relaxed)) {
+		if(_queries.empty() && _memory.get(memory::INPUT) < EVICTED_INPUT_LIMIT)
+			return; // changes only, they wait in the queue
+
+		reload();
+	}
+
+	serve_queries();
+
+	if(maintain() && !_continuation_scheduled) {
+		// NOTE : back of the strand, queries posted meanwhile get their turn first
+		_continuation_scheduled = true;
+		acquire();
+		npp::strand_post(_strand, FileRepo::continuation_task, this);
+	}
+
+	if(memory::over_budget())
+		schedule_eviction_check(0);
+}
+
+void FileRepo::drop_message(InputMessage *m) {
+	if(!m)
+		return;
+
+	_memory.sub(memory::INPUT, m->accounted);
+
+	// NOTE : queries are small and frequent, they keep their buffer for the next one
+	if(m->type == InputMessage::QUERY) {
+		npp::CriticalSectionScope s(_free_queries_lock);
+		m->next_free = _free_queries;
+		_free_queries = m;
+		return;
+	}
+
+	delete m;
 }
 
-unsigned int  __stdcall FileRepo::run_tf(void* fdb) {
-	FileRepo *f = (FileRepo*)fdb;
-	f->run();
-	DEBUG_PRINT("[FileRepo] Deleting filerepo!");
-	f->wait_for_pending_jobs();
+void FileRepo::drop_input() {
+	while(npp::MPSCNode *n = _queries.pop())
+		drop_message((InputMessage*)n);
 
-	delete f;
+	while(npp::MPSCNode *n = _changes.pop())
+		drop_message((InputMessage*)n);
 
-	return 0;
+	drop_message(_current);
+	_current = 0;
 }
 
-void FileRepo::run() {
-	unsigned num_delayed = 0;
+void FileRepo::drop_index() {
+	_job = filerepo::RewriteJob();
 
-	std::vector<char> delayed_events;
-	stream::pack(delayed_events, num_delayed);
+	std::vector<char>().swap(_filedata);
+	filerepo::PendingUpdates().swap(_pending_updates);
+	filerepo::PendingUpdates().swap(_unmatched_updates);
+	index_changed();
+	drop_results();
 
-	std::vector<char> temp_buffer;
-	while(!_exit_requested) {
-		::WaitForSingleObject(_wakeup_event, INFINITE);
-		if(_exit_requested)
+	if(_evicted.load(std::memory_order_relaxed)) {
+		npp::file_system::remove(_snapshot_file.c_str());
+		_evicted.store(false, std::memory_order_relaxed);
+	}
+
+	update_index_stats();
+}
+
+// strand, every change to '_filedata'
+void FileRepo::index_changed() {
+	++_generation;
+	_exact_index_current = false;
+	_date_index_current = false;
+	_date_index_scans = 0;
+	_extension_index_current = false;
+	_extension_index_scans = 0;
+	_path_index_current = false;
+	_path_index_scans = 0;
+}
+
+// strand
+void FileRepo::update_index_stats() {
+	// NOTE : an evicted repo keeps reporting the records in its snapshot
+	if(!_evicted.load(std::memory_order_relaxed))
+		_stats.records.set(_filedata.empty() ? 0 : *((const unsigned*)&_filedata[0]));
+
+	_stats.index_bytes.set(_filedata.size()+_job.result.size());
+	_stats.segments.set((_filedata.empty() ? 0 : 1)+(_job.active() ? 1 : 0));
+	_stats.pending_updates.set(_pending_updates.size());
+
+	_memory.set(memory::INDEX, _filedata.capacity());
+	_memory.set(memory::REWRITE, _job.result.capacity());
+	_memory.set(memory::DELTAS, _job.delta.capacity()+(_job.updates.size()+_pending_updates.size()+_unmatched_updates.size())*PENDING_UPDATE_BYTES);
+	update_results_memory();
+}
+
+void FileRepo::update_results_memory() {
+	memory::u64 results = _temp_buffer.capacity()+_batch_buffer.capacity()+_exact_matched.capacity()*sizeof(unsigned);
+	for(unsigned i=0; i<_scan_results.size(); ++i)
+		results += _scan_results[i].capacity()*sizeof(unsigned);
+
+	_memory.set(memory::RESULTS, results);
+	_memory.set(memory::QUERY_CACHE, _query_cache.bytes());
+	_memory.set(memory::EXACT_INDEX, _exact_index.bytes());
+	_memory.set(memory::DATE_INDEX, _date_index.bytes());
+	_memory.set(memory::EXTENSION_INDEX, _extension_index.bytes());
+	_memory.set(memory::PATH_INDEX, _path_index.bytes());
+}
+
+// the buffers of the last queries, the cached results and the indexes built for queries
+void FileRepo::drop_results() {
+	std::vector<char>().swap(_temp_buffer);
+	std::vector<char>().swap(_batch_buffer);
+	std::vector<std::vector<unsigned> >().swap(_scan_results);
+	std::vector<unsigned>().swap(_exact_matched);
+	_query_cache.clear();
+	_exact_index = filerepo::ExactIndex();
+	_exact_index_current = false;
+	_date_index = filerepo::DateIndex();
+	_date_index_current = false;
+	_date_index_scans = 0;
+	_extension_index = filerepo::ExtensionIndex();
+	_extension_index_current = false;
+	_extension_index_scans = 0;
+	_path_index = filerepo::PathIndex();
+	_path_index_current = false;
+	_path_index_scans = 0;
+}
+
+unsigned process_id() {
+#if defined(_WIN32)
+	return (unsigned)GetCurrentProcessId();
+#else
+	return (unsigned)getpid();
+#endif
+}
+
+// true if 'db' is a complete db (record sizes add up)
+bool valid_db(const std::vector<char> &db) {
+	if(db.size() < sizeof(unsigned))
+		return false;
+
+	const char *b = &db[0];
+	const char *end = b+db.size();
+
+	unsigned num_records = stream::unpack<unsigned>(b);
+	while(num_records--) {
+		if((size_t)(end-b) < sizeof(RecordHeader))
+			return false;
+
+		const unsigned record_size = ((const RecordHeader*)b)->record_size;
+		if(record_size < sizeof(RecordHeader) || record_size > (size_t)(end-b))
+			return false;
+
+		b += record_size;
+	}
+	return b == end;
+}
+
+// strand, writes the index to the snapshot file and frees it, if nothing is (about to be) done with it
+void FileRepo::evict() {
+	TRACE_SCOPE("evict");
+
+	const stats::u64 now = stats::now_us();
+	const stats::u64 idle_us = evict_idle_seconds.load(std::memory_order_relaxed)*1000000ull;
+
+	const bool busy = (_job.active() || _current || !_pending_updates.empty() || _memory.get(memory::INPUT));
+	if(_cancel.cancelled() || busy || !evictable(now, idle_us)) {
+		_evict_retry_us.store(now+EVICTION_CHECK_MS*1000ull, std::memory_order_relaxed);
+		return;
+	}
+
+	if(_snapshot_file.empty()) {
+		npp::CriticalSectionScope s(repos_lock);
+		if(snapshot_directory.empty()) {
+			_evict_retry_us.store(now+EVICTION_CHECK_MS*1000ull, std::memory_order_relaxed);
 			return;
+		}
+
+		// NOTE : unique per process and repo, the file only lives as long as the repo
+		std::wstringstream ss;
+		ss << snapshot_directory << L"nppplugin_solutionhub_" << process_id() << L"_" << next_snapshot_id.fetch_add(1, std::memory_order_relaxed) << L".snapshot";
+		_snapshot_file = ss.str();
+	}
 
-		DEBUG_PRINT("[Thread] Woken up!");
-		TSBuffer &input_buffer = _input_requests->buffer;
-		std::vector<char>& indata = input_buffer.data;
+	const unsigned size = (unsigned)_filedata.size();
+	if(npp::file_system::write(_snapshot_file.c_str(), &_filedata[0], size) != size) {
+		LOG_WARNING(npp::log::CATEGORY_REPO, "could not write snapshot %S, keeping the index in memory", _snapshot_file);
+		npp::file_system::remove(_snapshot_file.c_str());
+		_evict_retry_us.store(now+EVICTION_CHECK_MS*1000ull, std::memory_order_relaxed);
+		return;
+	}
 
-		std::vector<char> workbuffer;
-		{
-			npp::CriticalSectionScope csh(input_buffer.cs);
-			if(!indata.empty()) {
-				const char *start = &indata[0];
-				unsigned size = (unsigned)indata.size();
-				stream::pack_bytes(workbuffer, start, size);
+	const memory::u64 freed = _memory.total();
+
+	_evicted.store(true, std::memory_order_relaxed);
+	std::vector<char>().swap(_filedata);
+	index_changed();
+	drop_results();
+
+	_stats.evictions.add();
+	update_index_stats();
+
+	LOG_INFO(npp::log::CATEGORY_REPO, "evicted to %S, %u bytes on disk, %llu bytes freed", _snapshot_file, size, freed-_memory.total());
+}
+
+// strand, loads the index from the snapshot file (re-indexes if that fails)
+void FileRepo::reload() {
+	TRACE_SCOPE("reload");
+
+	const unsigned size = npp::file_system::filesize(_snapshot_file.c_str());
+
+	std::vector<char> db(size);
+	const bool loaded = (size && npp::file_system::read(_snapshot_file.c_str(), &db[0], size) == size && valid_db(db));
+
+	npp::file_system::remove(_snapshot_file.c_str());
+	_evicted.store(false, std::memory_order_relaxed);
+	_stats.reloads.add();
+
+	if(loaded) {
+		_filedata.swap(db);
+		LOG_INFO(npp::log::CATEGORY_REPO, "reloaded %u bytes from %S", size, _snapshot_file);
+	} else {
+		LOG_ERROR(npp::log::CATEGORY_REPO, "snapshot %S is missing or damaged, indexing again", _snapshot_file);
+
+		_filedata.clear();
+		unsigned h = 0;
+		stream::pack(_filedata, h);
+
+		for(unsigned i=0; i<_solutions.size(); ++i)
+			start_parsers(_solutions[i]["directories"]);
+	}
+
+	index_changed();
+	update_index_stats();
+}
+
+/*
+ *	Answers every queued query, single or batched. The ones not in the query cache are
+ *	searched together, one pass over the db for all of them (queries of several plugins
+ *	queue up while a step runs).
+ */
+void FileRepo::serve_queries() {
+	_serving.clear();
+	_served.clear();
+	_scan_queries.clear();
+
+	// (1) look every query up, a message with nothing to search is answered right away
+	while(InputMessage *m = (InputMessage*)_queries.pop()) {
+		const char *b = &m->data[0];
+		const unsigned header = *(const unsigned*)b;
+
+		ServedMessage sm;
+		sm.m = m;
+		sm.batch = (header == filerepo_headers::QUERY_FILES_BATCH);
+		sm.first = (unsigned)_served.size();
+		sm.count = 1;
+
+		if(sm.batch) {
+			stream::unpack<unsigned>(b); // QUERY_FILES_BATCH
+			const BatchHeader &bh = stream::unpack<BatchHeader>(b);
+			sm.response = bh.response;
+			sm.count = bh.num_queries;
+		}
+
+		bool scan = false;
+		for(unsigned i=0; i<sm.count; ++i) {
+			ServedQuery sq;
+			const SearchHeader &sh = unpack_query(b, sq.query);
+			if(!sm.batch)
+				sm.response = sh.response;
+
+			// NOTE : answered right below, before the next lookup reuses '_exact_matched'
+			sq.exact = (header == filerepo_headers::QUERY_FILES_EXACT);
+			if(sq.exact) {
+				find_exact(sq.query.num_include ? sq.query.include : L"");
+				sq.cached = &_exact_matched;
+				_served.push_back(sq);
+				continue;
+			}
+
+			// NOTE : pending updates (dates) are applied by the next rewrite, they do not change the generation
+			const filerepo::aux::SearchQuery &q = sq.query;
+			_query_cache.set_query(q);
+
+			sq.cached = _query_cache.find(_generation);
+			sq.scan = (unsigned)_scan_queries.size();
+			if(!sq.cached) {
+				_scan_queries.push_back(q);
+				scan = true;
 			}
-			indata.clear();
+			_served.push_back(sq);
 		}
 
-		unsigned n = 0;
-		unsigned size = (unsigned)workbuffer.size();
-		DEBUG_PRINT("[filerepo] start working, workbuffersize :  %d bytes", size);
-		while(size != n) {
-			unsigned debug_size = (unsigned)workbuffer.size();
-			(void)debug_size;
-			const char *b = &workbuffer[n];
-			unsigned consume_n = 0;
-
-			const unsigned &header = stream::unpack<unsigned>(b);
-			if(header == filerepo_headers::CHANGE_ADD) {
-				DEBUG_PRINT("[Thread] Got change data, adding!");
-				const unsigned buffer_size = stream::unpack<unsigned>(b);
-
-				filerepo::aux::merge_dbs(_filedata, b, buffer_size);
-				consume_n = sizeof(unsigned)+buffer_size;
-			} else if(header == filerepo_headers::CHANGE_REMOVE) {
-				DEBUG_PRINT("[Thread] Got change data, SHOULD remove!");
-				const unsigned buffer_size = stream::unpack<unsigned>(b);
-
-				filerepo::aux::exclude_db(_filedata, b, buffer_size);
-				filerepo::aux::exclude_db(delayed_events, b, buffer_size);
-
-				consume_n = sizeof(unsigned)+buffer_size;
-			} else if(header == filerepo_headers::CHANGE_UPDATE) {
-				DEBUG_PRINT("[Thread] Got change data, SHOULD update!");
-
-				const unsigned buffer_size = stream::unpack<unsigned>(b);
-				filerepo::aux::add_replace_db(delayed_events, b, buffer_size);
-				consume_n = sizeof(unsigned)+buffer_size;
-			} else if(header == filerepo_headers::QUERY_FILES) {
-				DEBUG_PRINT("[Thread] Got search request!");
-				const SearchHeader &sh = stream::unpack<SearchHeader>(b);
-
-				const wchar_t *include = (const wchar_t *)b;
-				const wchar_t *exlude =  (const wchar_t *)(b+sh.include_length);
-
-				unsigned num_res = filerepo::aux::search_db(temp_buffer,
-														_filedata,
-														sh.include_all,
-														sh.num_include,
-														sh.num_exclude,
-														include,
-														exlude,
-														delayed_events);
-
-
-				//
-				// callback
-				const SearchResponseData &srd = sh.response;
-				srd.cb(srd.data, (void*)&temp_buffer[0], num_res);
-				//
-				consume_n = sh.size;
-			} else if(header == filerepo_headers::PARSER_DONE) {
-
-				_outstanding_parsers -= 1;
-				if(!_outstanding_parsers && _monitored_directories) {
-					DEBUG_PRINT("[thread] *all* parsers done, starting folder monitoring!");
-					folder_monitor::start(_monitor);
-				}
-			} else if(header == filerepo_headers::DIRECTORIES) {
-				const unsigned buffer_size = stream::unpack<unsigned>(b);
-				unsigned n_dirs = stream::unpack<unsigned>(b);
-				while(n_dirs) {
-					const unsigned byte_len = stream::unpack<unsigned>(b);
-					const wchar_t *dir = (const wchar_t *)b;
+		if(scan) {
+			_serving.push_back(sm);
+		} else {
+			// NOTE : a requester waiting for each answer keeps this loop going, only what is searched is kept
+			answer(sm);
+			drop_message(m);
+			_served.resize(sm.first);
+		}
+	}
 
-					folder_monitor::add_directory(dir);
+	// (2) the rest in one pass
+	if(!_scan_queries.empty()) {
+		const unsigned n = (unsigned)_scan_queries.size();
+		TRACE_SCOPE_ARG("shared scan", "queries", n);
 
-					stream::advance(b, byte_len);
-					--n_dirs;
-				}
-				consume_n = buffer_size;
-			} else if(header == filerepo_headers::CHANGE_DIRECTORY_RENAME) {
-				const unsigned buffer_size = stream::unpack<unsigned>(b);
+		if(_scan_results.size() < n)
+			_scan_results.resize(n);
 
-				const unsigned byte_len_from = stream::unpack<unsigned>(b);
-				const wchar_t *from_name = (const wchar_t *)b;
+		unsigned fields = 0;
+		for(unsigned i=0; i<n; ++i)
+			fields |= filerepo::aux::clause_fields(_scan_queries[i]);
 
-				stream::advance(b, byte_len_from);
-				const unsigned byte_len_to = stream::unpack<unsigned>(b);
-				const wchar_t *to_name = (const wchar_t *)b;
+		const filerepo::QueryIndexes indexes = query_indexes(fields);
+		filerepo::aux::search_db_shared(_filedata, &_scan_queries[0], n, &_scan_results[0], &indexes, &_cancel);
+		_stats.query_scans.add();
 
-				filerepo::aux::rename_directory(_filedata, from_name, to_name, temp_buffer);
+		if(_cancel.cancelled()) {
+			// partial, the rest is dropped by the next step
+			for(unsigned i=0; i<_serving.size(); ++i)
+				drop_message(_serving[i].m);
+			return;
+		}
+	}
 
-				consume_n = buffer_size;
-			} else {
-				unsigned fail_bit = 0;
-				fail_bit = 1;
-			}
+	for(unsigned i=0; i<_serving.size(); ++i)
+		answer(_serving[i]);
+
+	// (3) keep what was searched, only now (the cached results above stay where they are until answered)
+	for(unsigned i=0; i<_scan_queries.size(); ++i) {
+		_query_cache.set_query(_scan_queries[i]);
+		_query_cache.insert(_generation, _scan_results[i]);
+	}
+
+	// NOTE : the tokens of '_scan_queries' are in the messages, they go last
+	for(unsigned i=0; i<_serving.size(); ++i)
+		drop_message(_serving[i].m);
+
+	update_results_memory();
+}
+
+// the records '_exact_matched' for 'path', the index is (re)built after every change to the db
+void FileRepo::find_exact(const wchar_t *path) {
+	if(!_exact_index_current) {
+		TRACE_SCOPE("build exact index");
+		filerepo::aux::build_exact_index(_exact_index, _filedata);
+		_exact_index_current = true;
+		_memory.set(memory::EXACT_INDEX, _exact_index.bytes());
+	}
+
+	filerepo::aux::find_exact(_exact_index, _filedata, path, _exact_matched);
+}
+
+// the indexes the planner may use for queries with clauses of 'fields' (see 'filerepo::aux::clause_fields'), current ones only
+filerepo::QueryIndexes FileRepo::query_indexes(unsigned fields) {
+	const unsigned dated = (1u << filerepo_clauses::MODIFIED_AFTER) | (1u << filerepo_clauses::MODIFIED_BEFORE);
+	if((fields & dated) && !_date_index_current)
+		++_date_index_scans;
+
+	if((fields & (1u << filerepo_clauses::EXT)) && !_extension_index_current)
+		++_extension_index_scans;
+
+	if((fields & (1u << filerepo_clauses::IN)) && !_path_index_current)
+		++_path_index_scans;
 
-			consume_n += sizeof(unsigned); // header!
+	filerepo::QueryIndexes indexes = {
+		_date_index_current ? &_date_index : 0,
+		_extension_index_current ? &_extension_index : 0,
+		_path_index_current ? &_path_index : 0
+	};
+	return indexes;
+}
+
+// the result of 'sq' in '_temp_buffer', returns its size
+unsigned FileRepo::pack_answer(const ServedQuery &sq) {
+	const std::vector<unsigned> &matched = (sq.cached ? *sq.cached : _scan_results[sq.scan]);
+	if(sq.exact)
+		_stats.query_exact.add();
+	else if(sq.cached)
+		_stats.query_cache_hits.add();
+	else
+		_stats.query_cache_misses.add();
+
+	return filerepo::aux::pack_results(_temp_buffer, _filedata, matched.empty() ? 0 : &matched[0], (unsigned)matched.size());
+}
+
+void FileRepo::answer(const ServedMessage &sm) {
+	TRACE_SCOPE_ARG("query", "queued_us", stats::now_us()-sm.m->posted_us);
 
-			DEBUG_PRINT("[filerepo] consumed %d bytes", consume_n);
-			n += consume_n;
+	const SearchResponseData &srd = sm.response;
+
+	if(!sm.batch) {
+		const unsigned size = pack_answer(_served[sm.first]);
+		srd.cb(srd.data, (void*)&_temp_buffer[0], size, search_status());
+	} else {
+		// count, the size of every result, the results one after the other
+		_batch_buffer.resize((sm.count+1)*sizeof(unsigned));
+		*(unsigned*)&_batch_buffer[0] = sm.count;
+
+		for(unsigned i=0; i<sm.count; ++i) {
+			const unsigned size = pack_answer(_served[sm.first+i]);
+			*(unsigned*)&_batch_buffer[(i+1)*sizeof(unsigned)] = size;
+			_batch_buffer.insert(_batch_buffer.end(), _temp_buffer.begin(), _temp_buffer.begin()+size);
 		}
 
-		{
-			npp::CriticalSectionScope csh(input_buffer.cs);
-			if (indata.empty()) {
-				DEBUG_PRINT("[Thread] Back to waiting!");
-				::ResetEvent(_wakeup_event);
-			}
+		srd.cb(srd.data, (void*)&_batch_buffer[0], (unsigned)_batch_buffer.size(), search_status());
+		_stats.query_batches.add();
+	}
+
+	_stats.queries_served.add(sm.count);
+	_stats.search.record(stats::now_us()-sm.m->posted_us);
+}
+
+filerepo::SearchStatus FileRepo::search_status() {
+	filerepo::SearchStatus status = { false, 100 };
+	if(!_outstanding_parsers.load(std::memory_order_acquire))
+		return status;
+
+	// NOTE :	found grows while walking, the ratio can drop, never report less than before.
+	//			Capped at 99, the last chunk may still be merging.
+	const unsigned found = _directories_found.load(std::memory_order_relaxed)-_directories_found_base;
+	const unsigned parsed = _directories_parsed.load(std::memory_order_relaxed)-_directories_parsed_base;
+
+	unsigned progress = (found ? (unsigned)((parsed*100ull)/found) : 0);
+	progress = (progress > 99 ? 99 : progress);
+	_progress = (progress > _progress ? progress : _progress);
+
+	status.indexing = true;
+	status.progress = _progress;
+	return status;
+}
+
+// one bounded unit of work, returns true if there (possibly) is more to do
+bool FileRepo::maintain() {
+	if(_job.active()) {
+		TRACE_SCOPE_ARG("rewrite step", "type", _job.type);
+
+		if(!filerepo::aux::rewrite_step(_job, REWRITE_RECORDS_PER_STEP)) {
+			_stats.index_bytes.set(_filedata.size()+_job.result.size());
+			_memory.set(memory::REWRITE, _job.result.capacity());
+			return true;
+		}
+
+		filerepo::aux::rewrite_finish(_job, _filedata, _unmatched_updates);
+		index_changed();
+
+		// NOTE : the monitor only reports files that pass the filters, this is a safety net
+		if(_unmatched_updates.size() > MAX_UNMATCHED_UPDATES) {
+			LOG_WARNING(npp::log::CATEGORY_REPO, "%u updates without a record, dropping them", (unsigned)_unmatched_updates.size());
+			filerepo::PendingUpdates().swap(_unmatched_updates);
 		}
 
+		_stats.merge.record(stats::now_us()-_job_started_us);
+		update_index_stats();
+		return true;
 	}
+
+	const bool more = begin_rewrite();
+
+	if(_job.active())
+		_job_started_us = stats::now_us();
+
+	update_index_stats();
+
+	// NOTE : idle, the db stays as it is for a while
+	return more || build_query_index();
 }
 
-void FileRepo::search(const wchar_t *s, void *userdata, filerepo::search_callback scb) {
+// strand, builds (one of) the indexes queries scanned for long enough (see 'DATE_INDEX_BUILD_SCANS'), returns true if it did
+bool FileRepo::build_query_index() {
+	if(_filedata.empty())
+		return false;
+
+	if(!_date_index_current && _date_index_scans >= DATE_INDEX_BUILD_SCANS) {
+		TRACE_SCOPE("build date index");
+		filerepo::aux::build_date_index(_date_index, _filedata);
+		_date_index_current = true;
+		_memory.set(memory::DATE_INDEX, _date_index.bytes());
+		return true;
+	}
 
-	std::vector<char> searchdata;
+	if(!_extension_index_current && _extension_index_scans >= EXTENSION_INDEX_BUILD_SCANS) {
+		TRACE_SCOPE("build extension index");
+		filerepo::aux::build_extension_index(_extension_index, _filedata);
+		_extension_index_current = true;
+		_memory.set(memory::EXTENSION_INDEX, _extension_index.bytes());
+		return true;
+	}
 
-	SearchInfo si;
-	if(build_searchinformation(s, si)) {
-		stream::pack(searchdata, filerepo_headers::QUERY_FILES);
+	if(!_path_index_current && _path_index_scans >= PATH_INDEX_BUILD_SCANS) {
+		TRACE_SCOPE("build path index");
+		filerepo::aux::build_path_index(_path_index, _filedata);
+		_path_index_current = true;
+		_memory.set(memory::PATH_INDEX, _path_index.bytes());
+		return true;
+	}
 
-		const wchar_t null(0);
+	return false;
+}
 
-		const std::vector<char> &it = si.include_tokens;
-		const std::vector<char> &et = si.exclude_tokens;
-		unsigned include_len = (unsigned)(it.empty() ? 0 : it.size());
-		unsigned exclude_len = (unsigned)(et.empty() ? 0 : et.size());
+// takes the next change(s), possibly starting a rewrite
+bool FileRepo::begin_rewrite() {
+	if(!_current) {
+		_current = (InputMessage*)_changes.pop();
+		_current_offset = 0;
 
-		unsigned char num_include_tokens = si.num_include;
-		unsigned char num_exclude_tokens = si.num_exclude;
+		if(!_current) {
+			// batch drained
+			if(_pending_updates.empty())
+				return false;
 
-		unsigned show_all = si.search_full;
+			filerepo::aux::rewrite_begin_update(_job, _filedata, _pending_updates, _unmatched_updates);
+			return true;
+		}
+	}
 
-		unsigned size = (include_len+exclude_len)+sizeof(SearchHeader);
+	bool done = true;
+	if(_current->type == InputMessage::DATABASE) {
+		LOG_TRACE(npp::log::CATEGORY_REPO, "merging parser chunk");
+		filerepo::aux::rewrite_begin_merge(_job, _filedata, _current->data, _unmatched_updates);
+	} else if(!_current->data.empty()) {
+		done = process_packets();
+	}
 
-		SearchHeader h = {	size,
-							show_all,
-							include_len,
-							num_include_tokens,
-							num_exclude_tokens,
-							{ userdata, scb }
-						};
-		stream::pack(searchdata, h);
-		if(include_len)
-			stream::pack_bytes(searchdata, &it[0], (unsigned)it.size());
+	if(done) {
+		_stats.changes_applied.add();
+		_stats.change.record(stats::now_us()-_current->posted_us);
 
-		if(exclude_len)
-			stream::pack_bytes(searchdata, &et[0], (unsigned)et.size());
+		drop_message(_current);
+		_current = 0;
 	}
+	return true;
+}
 
-	if(searchdata.empty())
-		return;
+// merges directly following packets of the same type into 'delta' (one rewrite instead of many), returns consumed bytes
+unsigned coalesce_changes(unsigned type, std::vector<char> &delta, const char *b, const char *end) {
+	TRACE_SCOPE("coalesce changes");
+
+	// NOTE : appended and sorted once (stable, equal names stay in order like 'merge_dbs'), merging packet by packet is quadratic
+	unsigned consumed = 0;
+	unsigned num_records = *(const unsigned*)&delta[0];
+	while(b != end) {
+		const char *p = b;
+		if(stream::unpack<unsigned>(p) != type)
+			break;
+
+		const unsigned buffer_size = stream::unpack<unsigned>(p);
+		num_records += *(const unsigned*)p;
+		stream::pack_bytes(delta, p+sizeof(unsigned), buffer_size-sizeof(unsigned));
+
+		const unsigned n = 2*sizeof(unsigned)+buffer_size;
+		consumed += n;
+		b += n;
+	}
 
-	append_input(_input_requests, &searchdata[0], (unsigned)searchdata.size());
+	if(consumed) {
+		memcpy(&delta[0], &num_records, sizeof(num_records));
+		filerepo::aux::sort_db(delta);
+	}
+	return consumed;
+}
+
+// continues at '_current_offset', returns false if a rewrite was started before the end
+bool FileRepo::process_packets() {
+	filerepo::PendingUpdates &pending_updates = _pending_updates;
+
+	const char *workbuffer = &_current->data[0];
+	const unsigned size = (unsigned)_current->data.size();
+
+	unsigned &n = _current_offset;
+	while(size != n) {
+		if(_job.active())
+			return false;
+
+		const char *b = &workbuffer[n];
+		unsigned consume_n = 0;
+
+		const unsigned &header = stream::unpack<unsigned>(b);
+		if(header == filerepo_headers::CHANGE_ADD) {
+			LOG_TRACE(npp::log::CATEGORY_REPO, "change, adding records");
+			const unsigned buffer_size = stream::unpack<unsigned>(b);
+
+			std::vector<char> delta(b, b+buffer_size);
+			consume_n = sizeof(unsigned)+buffer_size;
+			consume_n += coalesce_changes(header, delta, b+buffer_size, workbuffer+size);
+
+			filerepo::aux::rewrite_begin_merge(_job, _filedata, delta, _unmatched_updates);
+		} else if(header == filerepo_headers::CHANGE_REMOVE) {
+			LOG_TRACE(npp::log::CATEGORY_REPO, "change, removing records");
+			const unsigned buffer_size = stream::unpack<unsigned>(b);
+
+			std::vector<char> delta(b, b+buffer_size);
+			consume_n = sizeof(unsigned)+buffer_size;
+			consume_n += coalesce_changes(header, delta, b+buffer_size, workbuffer+size);
+
+			filerepo::aux::discard_updates(pending_updates, &delta[0], (unsigned)delta.size());
+			filerepo::aux::discard_updates(_unmatched_updates, &delta[0], (unsigned)delta.size());
+			filerepo::aux::rewrite_begin_exclude(_job, _filedata, delta);
+		} else if(header == filerepo_headers::CHANGE_UPDATE) {
+			LOG_TRACE(npp::log::CATEGORY_REPO, "change, updating dates");
+
+			const unsigned buffer_size = stream::unpack<unsigned>(b);
+			filerepo::aux::queue_updates(pending_updates, b, buffer_size);
+			consume_n = sizeof(unsigned)+buffer_size;
+		} else if(header == filerepo_headers::PARSER_DONE) {
+
+			if(_outstanding_parsers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				// progress of the next indexing (new solution directories) starts from here
+				_progress = 0;
+				_directories_found_base = _directories_found.load(std::memory_order_relaxed);
+				_directories_parsed_base = _directories_parsed.load(std::memory_order_relaxed);
+
+				if(_monitored_directories) {
+					LOG_INFO(npp::log::CATEGORY_REPO, "all parsers done, starting folder monitoring");
+					_fs->watch_start(_monitor);
+				}
+			}
+		} else if(header == filerepo_headers::DIRECTORIES) {
+			const unsigned buffer_size = stream::unpack<unsigned>(b);
+			unsigned n_dirs = stream::unpack<unsigned>(b);
+			while(n_dirs) {
+				const unsigned byte_len = stream::unpack<unsigned>(b);
+				const wchar_t *dir = (const wchar_t *)b;
+
+				folder_monitor::add_directory(dir);
+
+				stream::advance(b, byte_len);
+				--n_dirs;
+			}
+			consume_n = buffer_size;
+		} else if(header == filerepo_headers::CHANGE_DIRECTORY_RENAME) {
+			// pending updates are keyed by the names before the rename, apply them first (packet is revisited)
+			if(!pending_updates.empty()) {
+				filerepo::aux::rewrite_begin_update(_job, _filedata, pending_updates, _unmatched_updates);
+				return false;
+			}
+
+			const unsigned buffer_size = stream::unpack<unsigned>(b);
+
+			const unsigned byte_len_from = stream::unpack<unsigned>(b);
+			const wchar_t *from_name = (const wchar_t *)b;
+
+			stream::advance(b, byte_len_from);
+			stream::unpack<unsigned>(b); // byte_len_to
+			const wchar_t *to_name = (const wchar_t *)b;
+
+			// NOTE : keyed by a name no record has anymore
+			filerepo::aux::discard_directory_updates(_unmatched_updates, from_name);
+			filerepo::aux::rewrite_begin_rename(_job, _filedata, from_name, to_name);
+
+			consume_n = buffer_size;
+		} else if(header == filerepo_headers::CHANGE_DIRECTORY_REMOVE) {
+			const unsigned buffer_size = stream::unpack<unsigned>(b);
+
+			stream::unpack<unsigned>(b); // byte_len
+			const wchar_t *directory = (const wchar_t *)b;
+
+			filerepo::aux::discard_directory_updates(pending_updates, directory);
+			filerepo::aux::discard_directory_updates(_unmatched_updates, directory);
+			filerepo::aux::rewrite_begin_remove_directory(_job, _filedata, directory);
+
+			consume_n = buffer_size;
+		} else {
+			unsigned fail_bit = 0;
+			fail_bit = 1;
+		}
+
+		consume_n += sizeof(unsigned); // header!
+
+		LOG_TRACE(npp::log::CATEGORY_REPO, "consumed %u bytes", consume_n);
+		n += consume_n;
+	}
+
+	return true;
+}
+
+void FileRepo::search(const wchar_t *s, void *userdata, filerepo::search_callback scb) {
+	InputMessage *m = take_query();
+	m->data.clear();
+	pack_query(s, userdata, scb, m->data);
+
+	_last_used_us.store(stats::now_us(), std::memory_order_relaxed);
+	post_message(m);
+}
+
+void FileRepo::search_batch(const wchar_t *const *s, unsigned n, void *userdata, filerepo::search_callback scb) {
+	InputMessage *m = take_query();
+	m->data.clear();
+	stream::pack(m->data, (unsigned)filerepo_headers::QUERY_FILES_BATCH);
+
+	BatchHeader h = { n, { userdata, scb } };
+	stream::pack(m->data, h);
+
+	for(unsigned i=0; i<n; ++i)
+		pack_query(s[i], 0, 0, m->data);
+
+	_last_used_us.store(stats::now_us(), std::memory_order_relaxed);
+	post_message(m);
+}
+
+void FileRepo::search_exact(const wchar_t *path, void *userdata, filerepo::search_callback scb) {
+	InputMessage *m = take_query();
+	m->data.clear();
+	pack_exact_query(path, userdata, scb, m->data);
+
+	_last_used_us.store(stats::now_us(), std::memory_order_relaxed);
+	post_message(m);
 }
 
 void FileRepo::add_directories(Json::Value const &solution) {
 	Json::Value const &directories = solution["directories"];
-	folder_monitor::add_solutions(_monitor, directories);
+	_fs->watch_add_solutions(_monitor, directories);
+
+	_io_budget.configure(solution["io_budget"]);
+	_solutions.append(solution);
 
+	start_parsers(directories);
+}
+
+void FileRepo::start_parsers(Json::Value const &directories) {
 	unsigned size = directories.size();
 	while(size) {
-		_outstanding_parsers += 1;
+		_outstanding_parsers.fetch_add(1, std::memory_order_acq_rel);
+		_directories_found.fetch_add(1, std::memory_order_relaxed); // the root
 
 		const Json::Value &dir = directories[--size];
 		const char *d = dir["path"].asCString();
@@ -516,36 +1851,220 @@ void FileRepo::add_directories(Json::Value const &solution) {
 		String wif = (include_filter ? string_util::to_wide(include_filter) : L"");
 		String wef = (exclude_filter ? string_util::to_wide(exclude_filter) : L"");
 
-		DPThreadParams *tp = new DPThreadParams(*_input_requests, &_exit_requested, wd, wif, wef, recursive);
-		npp::Thread *t = npp::thread_create(directory_parse_tf, tp);
-		_worker_threads.push_back(t);
-		npp::thread_start(t);
+		ParseJob *job = new ParseJob(*this, wd, wif, wef, recursive);
+		job->enum_directories.push(wd);
+		stream::pack(job->files, job->num_records);
+		job->publish_records = PARSE_PUBLISH_RECORDS;
+
+		acquire(); // released when the job is done
+		npp::threadpool_submit(directory_parse_task, job, npp::PRIORITY_LOW);
 	}
 }
 
+void eviction_check_task(void*) {
+	eviction_check_scheduled.store(false, std::memory_order_release);
+
+	if(!memory::over_budget())
+		return;
+
+	const stats::u64 now = stats::now_us();
+	const stats::u64 idle_us = evict_idle_seconds.load(std::memory_order_relaxed)*1000000ull;
+
+	// least recently searched first, one at a time (the next check sees what it freed)
+	FileRepo *victim = 0;
+	{
+		npp::CriticalSectionScope s(repos_lock);
+
+		// NOTE : nowhere to write a snapshot, 'set_memory_budget' checks again once there is
+		const unsigned num_candidates = (snapshot_directory.empty() ? 0 : (unsigned)repos.size());
+		for(unsigned i=0; i<num_candidates; ++i) {
+			FileRepo *r = repos[i];
+			if(r->evictable(now, idle_us) && (!victim || r->_last_used_us.load(std::memory_order_relaxed) < victim->_last_used_us.load(std::memory_order_relaxed)))
+				victim = r;
+		}
+
+		if(victim)
+			victim->acquire();
+	}
+
+	if(victim) {
+		LOG_DEBUG(npp::log::CATEGORY_REPO, "over the memory budget (%llu of %llu bytes), evicting a repo", memory::total(), memory::budget());
+		victim->post_evict();
+		victim->release();
+	}
+
+	schedule_eviction_check(victim ? EVICTION_NEXT_MS : EVICTION_CHECK_MS);
+}
+
+void schedule_eviction_check(unsigned ms) {
+	if(eviction_check_scheduled.exchange(true, std::memory_order_acq_rel))
+		return;
+
+	npp::threadpool_submit_after(ms, eviction_check_task, 0, npp::PRIORITY_LOW);
+}
+
 } // anonymous
 
 namespace {
 
-	#include <stack>
+	// hands the records found since the last chunk over to the repo, searchable once merged
+	void publish_parse_chunk(ParseJob *job)
+	{
+		std::vector<char> &files = job->files;
+		if(*((const unsigned*)&files[0]) == 0)
+			return;
+
+		TRACE_SCOPE_ARG("publish parse chunk", "records", *((const unsigned*)&files[0]));
 
-	unsigned int  __stdcall directory_parse_tf(void* params) {
-		DEBUG_PRINT("[filerepo] Directoryparser thread starting.");
-		DPThreadParams *tp = (DPThreadParams*)params;
-		bool *shutdown = tp->shutdown;
+		// records are appended while parsing, sorted once here
+		filerepo::aux::sort_db(files);
 
-		unsigned num_records = 0;
+		// NOTE : the db is handed over as is, no copy (accounted as input from here)
+		job->repo._memory.sub(memory::PARSER, job->accounted);
+		job->accounted = 0;
+
+		if(query_trace::recording())
+			query_trace::change(&job->repo, "index", *((const unsigned*)&files[0]));
+
+		job->repo.post_input(InputMessage::DATABASE, files);
 
-		std::vector<char> files;
+		files.clear();
+		unsigned num_records = 0;
 		stream::pack(files, num_records);
 
-		const String &include_filter = tp->inc_filter;
-		const String &exlude_filter = tp->exl_filter;
-		const String &start_directory = tp->directory;
-		bool recursive = tp->recursive;
+		job->publish_records *= 2;
+		job->last_publish = std::chrono::steady_clock::now();
+	}
+
+	bool parse_chunk_due(const ParseJob *job)
+	{
+		const unsigned num_records = *((const unsigned*)&job->files[0]);
+		if(!num_records)
+			return false;
+
+		if(num_records >= job->publish_records)
+			return true;
+
+		const std::chrono::steady_clock::duration since = std::chrono::steady_clock::now()-job->last_publish;
+		return (since >= std::chrono::milliseconds(PARSE_PUBLISH_MS));
+	}
+
+	void account_parse_job(ParseJob *job)
+	{
+		const memory::u64 n = job->files.capacity();
+		if(n > job->accounted)
+			job->repo._memory.add(memory::PARSER, n-job->accounted);
+		else
+			job->repo._memory.sub(memory::PARSER, job->accounted-n);
+
+		job->accounted = n;
+	}
+
+	void finish_parse_job(ParseJob *job)
+	{
+		publish_parse_chunk(job);
+
+		// temp buffer with change info
+		std::vector<char> data_buffer;
+
+		// PACK 'SEEN_DIRECTORIES' HERE
+
+		{
+			const std::vector<String> &directories = job->directories;
+			const unsigned sow = sizeof(wchar_t);
+			const wchar_t null(0);
+
+			unsigned data_size = 42;
+			unsigned header = filerepo_headers::DIRECTORIES;
+			stream::pack(data_buffer, header);
+			unsigned insert_point = (unsigned)data_buffer.size();
+			stream::pack(data_buffer, data_size);
+
+			unsigned num_dirs = (unsigned)directories.size();
+
+			stream::pack(data_buffer, num_dirs);
 
-		HANDLE hFind = INVALID_HANDLE_VALUE;
-		WIN32_FIND_DATA ffd;
+			for (unsigned i=0;i<num_dirs;++i) {
+				const String &d = directories[i];
+				unsigned l = (unsigned)d.length();
+				stream::pack(data_buffer, (unsigned)((l+1)*sow));
+
+				stream::pack_bytes(data_buffer, (const char *)d.c_str(), l*sow);
+				stream::pack(data_buffer, null);
+			}
+
+			data_size = (unsigned)data_buffer.size() - insert_point;
+
+			unsigned *patch = (unsigned*)((&data_buffer[0])+insert_point);
+
+			*patch = data_size;
+
+		}
+		// end
+		unsigned parser_done = filerepo_headers::PARSER_DONE;
+		stream::pack(data_buffer, parser_done);
+
+		job->repo.post_input(InputMessage::PACKETS, data_buffer);
+	}
+
+	// background I/O (and CPU) priority while walking, the worker goes on with interactive work after
+	struct BackgroundScope {
+		BackgroundScope() { npp::thread_set_background(true); }
+		~BackgroundScope() { npp::thread_set_background(false); }
+	};
+
+	/*
+	 *	The entries of one directory, through the file system of the repo (see 'vfs.h').
+	 *	Reads are timed for the io budget.
+	 */
+	struct DirectoryReader {
+		DirectoryReader(const vfs::Provider *fs) : _fs(fs), _handle(0), read_time(0) {}
+		~DirectoryReader() { if(_handle) _fs->close_directory(_handle); }
+
+		// 'directory' ends with a slash
+		bool open(const String &directory)
+		{
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			_handle = _fs->open_directory(_fs->user_data, directory.c_str());
+			read_time += std::chrono::steady_clock::now()-start;
+
+			return _handle != 0;
+		}
+
+		// false when done, or on failure (see 'failed')
+		bool next(vfs::Entry &e)
+		{
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			const bool found = _fs->next_entry(_handle, e);
+			read_time += std::chrono::steady_clock::now()-start;
+
+			return found;
+		}
+
+		bool failed() const { return _fs->directory_failed(_handle); }
+
+	private:
+		const vfs::Provider *_fs;
+		vfs::DirectoryHandle _handle;
+
+	public:
+		std::chrono::steady_clock::duration read_time;
+	};
+
+	void directory_parse_task(void* params) {
+		ParseJob *job = (ParseJob*)params;
+		const npp::CancellationToken &cancel = job->repo._cancel;
+		IOBudget &io_budget = job->repo._io_budget;
+
+		BackgroundScope background;
+		TRACE_SCOPE("parse directories");
+
+		std::vector<char> &files = job->files;
+		unsigned &num_records = job->num_records;
+
+		const String &include_filter = job->inc_filter;
+		const String &exlude_filter = job->exl_filter;
+		bool recursive = job->recursive;
 
 		const wchar_t *filter_include = (include_filter.empty() ? 0 : include_filter.c_str());
 		const wchar_t *filter_exclude = (exlude_filter.empty() ? 0 : exlude_filter.c_str());
@@ -553,12 +2072,22 @@ namespace {
 		const bool include_all_files = ((!filter_include && !filter_exclude) ? true : 0);
 
 		String spec;
-		std::vector<String> directories;
-		std::stack<String> enum_directories;
+		vfs::Entry entry;
+		std::vector<String> &directories = job->directories;
+		std::stack<String> &enum_directories = job->enum_directories;
 
-		enum_directories.push(start_directory);
+		bool failed = false;
+		unsigned budget = PARSE_DIRECTORIES_PER_TASK;
+		unsigned throttle_ms = 0;
+
+		const unsigned num_records_start = num_records;
+		const stats::u64 task_start_us = stats::now_us();
+
+		while (!enum_directories.empty() && budget-- && (num_records-num_records_start) < PARSE_FILES_PER_TASK && !cancel.cancelled()) { //
+			throttle_ms = io_budget.acquire_directory();
+			if(throttle_ms)
+				break;
 
-		while (!enum_directories.empty()) { //
 			String path = enum_directories.top();
 
 			spec = path;
@@ -566,18 +2095,23 @@ namespace {
 
 			directories.push_back(spec);
 
-			spec += L"*.*";
-
 			enum_directories.pop();
+			job->repo._directories_parsed.fetch_add(1, std::memory_order_relaxed);
 
-			hFind = FindFirstFile(spec.c_str(), &ffd);
+			DirectoryReader reader(job->repo._fs);
+			unsigned num_entries = 0;
 
-			if (hFind == INVALID_HANDLE_VALUE)
+			if (!reader.open(spec)) {
+				LOG_WARNING(npp::log::CATEGORY_PARSER, "could not read directory %S, stopping", path);
+				job->repo._stats.directories_failed.add();
+				failed = true;
 				break;
+			}
 
-			do {
-				bool is_directory = (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-				const wchar_t *fn = ffd.cFileName;
+			while (!cancel.cancelled() && reader.next(entry)) {
+				++num_entries;
+				bool is_directory = entry.is_directory;
+				const wchar_t *fn = entry.name.c_str();
 
 				if(is_directory) {
 					wchar_t first_char = *fn;
@@ -593,6 +2127,7 @@ namespace {
 						pushed.append(fn);
 
 						enum_directories.push(pushed);
+						job->repo._directories_found.fetch_add(1, std::memory_order_relaxed);
 					}
 				} else {
 					// is file
@@ -607,88 +2142,55 @@ namespace {
 					}
 
 					if (include) {
-						wchar_t datestring[17] = {};
-						//const unsigned datestring_len = 16;
-						filerepo::make_internal_datestring_ft(datestring, &ffd.ftLastWriteTime);
+						const wchar_t *datestring = entry.date;
 
 						String full_filename(path); file_util::append_slash(full_filename);
 						full_filename.append(fn);
 						const wchar_t *full = full_filename.c_str();
 
-						filerepo::aux::insert_filerecord(files, full, datestring);
+						filerepo::aux::append_filerecord(files, full, datestring);
 
 						num_records += 1; // increase, store at exit
 					}
 				} // else
-			} while (::FindNextFile(hFind, &ffd) != 0 && !*shutdown);
+			}
 
-			if (GetLastError() != ERROR_NO_MORE_FILES) {
-				FindClose(hFind);
-				//return;
+			if (reader.failed()) {
+				failed = true;
 				break;
 			}
 
-			FindClose(hFind);
-			hFind = INVALID_HANDLE_VALUE;
+			const std::chrono::steady_clock::duration read_time = reader.read_time;
+			io_budget.directory_read(num_entries*job->repo._fs->entry_bytes, std::chrono::duration<double, std::milli>(read_time).count());
+			job->repo._stats.directory_read.record((stats::u64)std::chrono::duration_cast<std::chrono::microseconds>(read_time).count());
 		} // directories
 
-		*((unsigned*)&files[0]) = num_records; // patch files
-
-		// temp buffer with change info
-		std::vector<char> data_buffer;
-
-		unsigned data_header = filerepo_headers::CHANGE_ADD;
-		stream::pack(data_buffer, data_header);
+		RepoStats &repo_stats = job->repo._stats;
+		repo_stats.files_parsed.add(num_records-num_records_start);
+		repo_stats.parse_busy_us.add(stats::now_us()-task_start_us);
 
-		// NOTE :	This works only as we have a "real db" after here (with a unsigned records field)
-		//			WAS a change header
-		unsigned file_size = (unsigned)files.size();
-		stream::pack(data_buffer, file_size);
+		if(!failed && !cancel.cancelled() && !enum_directories.empty()) {
+			if(parse_chunk_due(job))
+				publish_parse_chunk(job);
 
-		data_buffer.insert(data_buffer.end(), files.begin(), files.end());
-
-		// PACK 'SEEN_DIRECTORIES' HERE
-
-		{
-			const unsigned sow = sizeof(wchar_t);
-			const wchar_t null(0);
-
-			unsigned data_size = 42;
-			unsigned header = filerepo_headers::DIRECTORIES;
-			stream::pack(data_buffer, header);
-			unsigned insert_point = (unsigned)data_buffer.size();
-			stream::pack(data_buffer, data_size);
-
-			unsigned num_dirs = (unsigned)directories.size();
-
-			stream::pack(data_buffer, num_dirs);
-
-			for (unsigned i=0;i<num_dirs;++i) {
-				const String &d = directories[i];
-				unsigned l = (unsigned)d.length();
-				stream::pack(data_buffer, (unsigned)((l+1)*sow));
-
-				stream::pack_bytes(data_buffer, (const char *)d.c_str(), l*sow);
-				stream::pack(data_buffer, null);
-			}
-
-			data_size = (unsigned)data_buffer.size() - insert_point;
-
-			unsigned *patch = (unsigned*)((&data_buffer[0])+insert_point);
-
-			*patch = data_size;
+			account_parse_job(job);
 
+			// give the worker back, continue later (once the io budget allows it)
+			npp::threadpool_submit_after(throttle_ms, directory_parse_task, job, npp::PRIORITY_LOW);
+			return;
 		}
-		// end
-		unsigned parser_done = filerepo_headers::PARSER_DONE;
-		stream::pack(data_buffer, parser_done);
 
-		append_input(&tp->input_requests, &data_buffer[0], (unsigned)data_buffer.size());
+		if(!cancel.cancelled()) {
+			repo_stats.parse.record(stats::now_us()-job->started_us);
+			finish_parse_job(job);
+		}
 
-		delete tp;
+		FileRepo &repo = job->repo;
+		repo._memory.sub(memory::PARSER, job->accounted);
+		delete job;
+		repo.release();
 
-		DEBUG_PRINT("[FileRepo] Parser thread exiting!");
-		return 0;
+		LOG_DEBUG(npp::log::CATEGORY_PARSER, "parse job done");
 	}
 
 } // namespace anonymous
@@ -6,12 +6,60 @@ namespace Json {
 	class Value;
 }
 
+namespace vfs {
+	struct Provider;
+}
+
 namespace filerepo {
-	FileRepositoryHandle allocate_handle();
+	// 'fs' is where the files are (and how they are watched), the OS if 0 (see 'vfs.h')
+	FileRepositoryHandle allocate_handle(const vfs::Provider *fs = 0);
+
+	// cancels parsing/merging, the repo is freed in the background (see 'join')
 	void stop(FileRepositoryHandle&);
 	void add_solution(FileRepositoryHandle, Json::Value const&);
 
-	// userdata, buffer, buffersize
-	typedef void (*search_callback)(void*, void*, unsigned);
+	// state of the index a search was answered from
+	struct SearchStatus {
+		bool indexing;		// directories are still being parsed, results are partial
+		unsigned progress;	// percent, 100 when not indexing
+	};
+
+	// userdata, buffer, buffersize, status
+	typedef void (*search_callback)(void*, void*, unsigned, const SearchStatus&);
 	void search(FileRepositoryHandle, const wchar_t *search_string, void *search_callback_userdata, search_callback);
+
+	/*
+	 *	'n' searches answered together (one pass over the index for the ones not cached),
+	 *	one callback with : unsigned n, n*unsigned size, then every result (laid out like
+	 *	the result of 'search') one after the other.
+	 */
+	void search_batch(FileRepositoryHandle, const wchar_t *const *search_strings, unsigned n, void *search_callback_userdata, search_callback);
+
+	/*
+	 *	The records named 'path' ("file.ext"), or with a full path ending in it from a
+	 *	directory on ("dir\file.ext" or "dir/file.ext"), case-insensitive. A lookup, no
+	 *	scan of the index, the result is laid out like the result of 'search'.
+	 */
+	void search_exact(FileRepositoryHandle, const wchar_t *path, void *search_callback_userdata, search_callback);
+
+	/*
+	 *	Header-prefixed change packets (CHANGE_ADD, CHANGE_REMOVE, CHANGE_UPDATE and
+	 *	CHANGE_DIRECTORY_RENAME, see 'filerepo_headers'), applied in order like the
+	 *	changes from the folder monitor. Feeds a repo without directories to parse
+	 *	(benchmarks, tools).
+	 */
+	void post_changes(FileRepositoryHandle, const void *packets, unsigned size);
+
+	// counters, histograms and rates of the repo (see 'NPPM_SOLUTIONHUB_GET_STATS'), callable from any thread
+	void get_stats(FileRepositoryHandle, Json::Value &out);
+
+	/*
+	 *	While the repos together hold more than 'budget_bytes' (0 : no budget), the least
+	 *	recently searched repo not searched for 'idle_seconds' is written to a snapshot
+	 *	file in 'snapshot_directory' and its index freed. The next search loads it back.
+	 */
+	void set_memory_budget(unsigned long long budget_bytes, unsigned idle_seconds, const wchar_t *snapshot_directory);
+
+	// waits until every stopped repo (and its folder monitor) is gone, returns false if 'timeout_ms' passed first
+	bool join(unsigned timeout_ms);
 }
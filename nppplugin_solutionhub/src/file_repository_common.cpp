@@ -1,35 +1,24 @@
 #include "file_repository_common.h"
 #include "filerecords.h"
-#include <Windows.h>
+
+#if defined(_WIN32)
+	#include <Windows.h> // FileTimeToSystemTime
+#endif
 
 #include "string/string_utils.h"
+#include "string/wcs_compat.h"
 #include "stream.h"
-#include "debug.h"
-
-// dummy
-struct dummy_timer {
-	double interval() { return 0;  }
-	void start() {}
-	void stop() {}
-};
+#include "log/log.h"
+#include "thread/cancellation.h"
 
 #include <assert.h>
-namespace {
-	void debug_print_db(std::vector<char> const &db) {
-		using namespace npp;
-
-		const char *b = &db[0];
-		unsigned num_records = stream::unpack<unsigned>(b);
-
-		for(unsigned i=0; i<num_records; ++i) {
-			const RecordHeader &rh =  *(const RecordHeader*)b;
-			const wchar_t *start = (const wchar_t *)(b+sizeof(RecordHeader));
-
-			DEBUG_PRINT("[DB %d] fn(%S)", i, start);
-			stream::advance(b, rh.record_size);
-		}
-	}
+#include <algorithm> // stable_sort, lower_bound
+#include <wchar.h> // wcstoul
+#include <wctype.h> // towlower
+#include <ctype.h> // toupper
+#include <time.h>
 
+namespace {
 	inline unsigned date_length_bytes(const RecordHeader &rh)
 	{
 		const unsigned sow = sizeof(wchar_t);
@@ -43,10 +32,666 @@ namespace {
 		const unsigned sow = sizeof(wchar_t);
 		return (date_length_bytes(rh) / sow);
 	}
+
+	inline const wchar_t *record_filename(const char *r)
+	{
+		const RecordHeader &rh = *(const RecordHeader*)r;
+		return (const wchar_t *)(r+sizeof(RecordHeader))+rh.filename_offset;
+	}
+
+	inline const wchar_t *record_fullname(const char *r)
+	{
+		return (const wchar_t *)(r+sizeof(RecordHeader));
+	}
+
+	inline unsigned record_size(const char *r)
+	{
+		return ((const RecordHeader*)r)->record_size;
+	}
+
+	struct RecordFilenameLess {
+		bool operator()(const char *a, const char *b) const { return _wcsicmp(record_filename(a), record_filename(b)) < 0; }
+	};
+
+	// key of a record in 'PendingUpdates'
+	inline void make_update_key(const wchar_t *fullname, std::wstring &key)
+	{
+		key.assign(fullname);
+		for(unsigned i=0, n=(unsigned)key.length(); i<n; ++i)
+			key[i] = (wchar_t)towlower(key[i]);
+	}
+
+	// the records of 'pending' in db order (by filename), walked along a db instead of looking up every record
+	void sort_updates(const filerepo::PendingUpdates &pending, std::vector<const char*> &updates)
+	{
+		updates.clear();
+		updates.reserve(pending.size());
+		for(filerepo::PendingUpdates::const_iterator u=pending.begin(); u!=pending.end(); ++u)
+			updates.push_back(&u->second[0]);
+
+		std::sort(updates.begin(), updates.end(), RecordFilenameLess());
+	}
+
+	// the update of record 'r' among those from 'updates[k]' on with the same filename, ~0 if none
+	unsigned find_update(const std::vector<const char*> &updates, unsigned k, const char *r)
+	{
+		const wchar_t *filename = record_filename(r);
+		const wchar_t *fullname = record_fullname(r);
+
+		for(unsigned n=(unsigned)updates.size(); k<n && 0 == _wcsicmp(record_filename(updates[k]), filename); ++k) {
+			if(0 == _wcsicmp(record_fullname(updates[k]), fullname))
+				return k;
+		}
+		return ~0u;
+	}
+
+	inline const wchar_t *record_date(const char *r)
+	{
+		const RecordHeader &rh = *(const RecordHeader*)r;
+		return record_fullname(r)+rh.filename_offset+rh.filename_length;
+	}
+
+	inline bool is_separator(wchar_t c)
+	{
+		return c == L'\\' || c == L'/';
+	}
+
+	// like '_wcsicmp' folds, ASCII without the call
+	inline unsigned fold(wchar_t c)
+	{
+		if(c < 128)
+			return (c >= L'A' && c <= L'Z' ? c+(L'a'-L'A') : c);
+		return (unsigned)towlower(c);
+	}
+
+	// 'length' characters of 'a' and 'b' are equal, folded, any separator equals any other
+	bool same_path(const wchar_t *a, const wchar_t *b, unsigned length)
+	{
+		for(unsigned i=0; i<length; ++i) {
+			if(a[i] != b[i] && (is_separator(a[i]) ? !is_separator(b[i]) : fold(a[i]) != fold(b[i])))
+				return false;
+		}
+		return true;
+	}
+
+	/*
+	 *	The directory of a record ('length' characters of its path). Hashed and compared
+	 *	as is, the same directory written differently is a different key, ordered next
+	 *	to it (folded like 'same_path').
+	 */
+	struct DirectoryKey {
+		const wchar_t *path;
+		unsigned length;
+	};
+
+	inline unsigned path_char(wchar_t c)
+	{
+		return (is_separator(c) ? L'\\' : fold(c));
+	}
+
+	// NOTE : directories mostly differ in their last names, the characters before those are not hashed
+	struct DirectoryKeyHash {
+		enum { HASHED_CHARACTERS = 32 };
+
+		size_t operator()(const DirectoryKey &k) const
+		{
+			unsigned h = (2166136261u^k.length)*16777619u;
+			for(unsigned i=(k.length > HASHED_CHARACTERS ? k.length-HASHED_CHARACTERS : 0); i<k.length; ++i)
+				h = (h^(unsigned)k.path[i])*16777619u;
+			return h;
+		}
+	};
+
+	struct DirectoryKeyEqual {
+		bool operator()(const DirectoryKey &a, const DirectoryKey &b) const { return a.length == b.length && !memcmp(a.path, b.path, a.length*sizeof(wchar_t)); }
+	};
+
+	// NOTE : a directory goes before the ones below it, those are next to each other
+	struct DirectoryKeyLess {
+		bool operator()(const DirectoryKey &a, const DirectoryKey &b) const
+		{
+			const unsigned length = (a.length < b.length ? a.length : b.length);
+			for(unsigned i=0; i<length; ++i) {
+				if(a.path[i] == b.path[i])
+					continue;
+
+				const unsigned ca = path_char(a.path[i]), cb = path_char(b.path[i]);
+				if(ca != cb)
+					return ca < cb;
+			}
+			return a.length < b.length;
+		}
+	};
+
+	// records scanned between looking at the cancellation token (searches)
+	const unsigned CANCEL_CHECK_INTERVAL = 4096;
+
+	// clauses of a query evaluated per record, more are ignored
+	const unsigned MAX_QUERY_TERMS = 16;
+
+	// records of an index range are read out of db order, a range this much smaller than the db is worth it
+	const unsigned INDEX_ACCESS_FACTOR = 4;
+
+	// a clause of a query, see 'filerepo_clauses'
+	struct QueryTerm {
+		unsigned field;
+		bool negated;
+		unsigned num_values;
+		const wchar_t *values;
+		unsigned key;	// MODIFIED_AFTER/MODIFIED_BEFORE
+	};
+
+	// relative cost of evaluating a term on a record
+	unsigned term_cost(unsigned field)
+	{
+		switch(field) {
+		case filerepo_clauses::EXT:				return 1;
+		case filerepo_clauses::MODIFIED_AFTER:
+		case filerepo_clauses::MODIFIED_BEFORE:	return 2;
+		case filerepo_clauses::IN:				return 3;
+		case filerepo_clauses::NAME:			return 4;
+		default:								return 5;
+		}
+	}
+
+	/*
+	 *	How a query is answered (see 'plan_query') : the records it looks at, all of them
+	 *	or a range of an index, and its terms, cheapest first.
+	 */
+	struct QueryPlan {
+		enum {
+			SCAN = 0,
+			DATES,		// 'first' to 'end' of 'filerepo::DateIndex'
+			EXTENSIONS,	// the records of the values of 'terms[term]' in 'filerepo::ExtensionIndex'
+			DIRECTORIES	// the records below the directories of 'terms[term]' in 'filerepo::PathIndex'
+		};
+
+		unsigned access;
+		unsigned first;
+		unsigned end;
+		unsigned term;
+
+		unsigned num_terms;
+		QueryTerm terms[MAX_QUERY_TERMS];
+	};
+
+	// the filename of db record 'r' ends with '.' and 'extension'
+	bool has_extension(const char *r, const wchar_t *extension)
+	{
+		const unsigned length = ((const RecordHeader*)r)->filename_length-1;
+		const unsigned extension_length = (unsigned)wcslen(extension);
+		if(length <= extension_length)
+			return false;
+
+		const wchar_t *dot = record_filename(r)+length-extension_length-1;
+		return *dot == L'.' && same_path(dot+1, extension, extension_length);
+	}
+
+	// the directories of 'path' ('path_length' characters, ending with a separator) include 'directories' ("engine\render"), whole names
+	bool path_in_directories(const wchar_t *path, unsigned path_length, const wchar_t *directories)
+	{
+		const unsigned length = (unsigned)wcslen(directories);
+
+		for(unsigned p=0; p+length < path_length; ++p) {
+			if(p && !is_separator(path[p-1]))
+				continue;
+			if(is_separator(path[p+length]) && same_path(path+p, directories, length))
+				return true;
+		}
+		return false;
+	}
+
+	bool in_directories(const char *r, const wchar_t *directories)
+	{
+		return path_in_directories(record_fullname(r), ((const RecordHeader*)r)->filename_offset, directories);
+	}
+
+	// 'name' (folded) compared to 'extension' folded
+	int compare_extension(const std::wstring &name, const wchar_t *extension)
+	{
+		const wchar_t *n = name.c_str();
+		for(; *n && *extension; ++n, ++extension) {
+			const unsigned e = fold(*extension);
+			if((unsigned)*n != e)
+				return ((unsigned)*n < e ? -1 : 1);
+		}
+		return (*n ? 1 : (*extension ? -1 : 0));
+	}
+
+	// the id of 'extension' in 'index', -1 if no record has it
+	int find_extension(const filerepo::ExtensionIndex &index, const wchar_t *extension)
+	{
+		unsigned first = 0, end = (unsigned)index.names.size();
+		while(first < end) {
+			const unsigned middle = first+(end-first)/2;
+			const int c = compare_extension(index.names[middle], extension);
+			if(!c)
+				return (int)middle;
+			if(c < 0)
+				first = middle+1;
+			else
+				end = middle;
+		}
+		return -1;
+	}
+
+	// the records of 'index' an "ext:" term can only hold for, false if a value is not an extension ("tar.gz")
+	bool extension_records(const filerepo::ExtensionIndex &index, const QueryTerm &t, unsigned long long &num_records)
+	{
+		num_records = 0;
+
+		const wchar_t *v = t.values;
+		for(unsigned i=0; i<t.num_values; ++i) {
+			if(wcschr(v, L'.'))
+				return false;
+
+			const int id = find_extension(index, v);
+			num_records += (id < 0 ? 0 : index.counts[id]);
+			v += wcslen(v)+1;
+		}
+		return true;
+	}
+
+	/*
+	 *	The first directory of 'index' from 'd' on (or the end) that 'directories' ("in:"
+	 *	value, 'length' characters) is in, every record below it has it. Directories
+	 *	below one that does not are looked at next, the ones below one that does are
+	 *	skipped by the caller : a directory is only looked at when the ones it is below
+	 *	do not have it, only its own name can make it so.
+	 */
+	unsigned next_directory(const filerepo::PathIndex &index, const char *db, const wchar_t *directories, unsigned length, unsigned d)
+	{
+		for(; d<index.directories.size(); ++d) {
+			const filerepo::PathIndex::Directory &dir = index.directories[d];
+			if(dir.length <= length)
+				continue;
+
+			const wchar_t *path = record_fullname(db+index.records[dir.first]);
+			const wchar_t *name = path+dir.length-1-length;
+			if((name == path || is_separator(name[-1])) && same_path(name, directories, length))
+				break;
+		}
+		return d;
+	}
+
+	// the records of 'index' an "in:" term holds for
+	unsigned long long directory_records(const filerepo::PathIndex &index, const char *db, const QueryTerm &t)
+	{
+		unsigned long long num_records = 0;
+
+		const wchar_t *v = t.values;
+		for(unsigned i=0; i<t.num_values; ++i) {
+			const unsigned num_directories = (unsigned)index.directories.size();
+			const unsigned length = (unsigned)wcslen(v);
+			for(unsigned d=next_directory(index, db, v, length, 0); d<num_directories; d=next_directory(index, db, v, length, index.directories[d].next))
+				num_records += index.directories[d].end-index.directories[d].first;
+			v += wcslen(v)+1;
+		}
+		return num_records;
+	}
+
+	void plan_query(QueryPlan &plan, const filerepo::aux::SearchQuery &q, const char *db, unsigned num_records, const filerepo::QueryIndexes *indexes)
+	{
+		plan.access = QueryPlan::SCAN;
+		plan.first = 0;
+		plan.end = num_records;
+		plan.term = 0;
+		plan.num_terms = 0;
+
+		const wchar_t *c = q.clauses;
+		for(unsigned char i=0; i<q.num_clauses; ++i) {
+			QueryTerm t;
+			t.field = c[0];
+			t.negated = (c[1] != 0);
+			t.num_values = c[2];
+			t.values = c+3;
+			t.key = 0;
+
+			c += 3;
+			for(unsigned v=0; v<t.num_values; ++v)
+				c += wcslen(c)+1;
+
+			if(t.field == filerepo_clauses::MODIFIED_AFTER || t.field == filerepo_clauses::MODIFIED_BEFORE)
+				t.key = (unsigned)wcstoul(t.values, 0, 10);
+
+			if(plan.num_terms == MAX_QUERY_TERMS)
+				continue;
+
+			unsigned j = plan.num_terms++;
+			for(; j && term_cost(plan.terms[j-1].field) > term_cost(t.field); --j)
+				plan.terms[j] = plan.terms[j-1];
+			plan.terms[j] = t;
+		}
+
+		// the records of the dates the query asks for, when they are few enough
+		if(indexes && indexes->dates) {
+			const std::vector<unsigned> &keys = indexes->dates->keys;
+			unsigned first = 0, end = (unsigned)keys.size();
+			bool ranged = false;
+
+			for(unsigned i=0; i<plan.num_terms; ++i) {
+				const QueryTerm &t = plan.terms[i];
+				if(t.negated)
+					continue;
+
+				if(t.field == filerepo_clauses::MODIFIED_AFTER) {
+					const unsigned f = (unsigned)(std::upper_bound(keys.begin(), keys.end(), t.key)-keys.begin());
+					first = (f > first ? f : first);
+					ranged = true;
+				} else if(t.field == filerepo_clauses::MODIFIED_BEFORE) {
+					const unsigned e = (unsigned)(std::lower_bound(keys.begin(), keys.end(), t.key)-keys.begin());
+					end = (e < end ? e : end);
+					ranged = true;
+				}
+			}
+
+			end = (end < first ? first : end);
+			if(ranged && (unsigned long long)(end-first)*INDEX_ACCESS_FACTOR < num_records) {
+				plan.access = QueryPlan::DATES;
+				plan.first = first;
+				plan.end = end;
+			}
+		}
+
+		// the records of the extensions or below the directories the query asks for, when they are fewer still
+		unsigned long long fewest = (plan.access == QueryPlan::SCAN ? num_records : plan.end-plan.first);
+		for(unsigned i=0; indexes && i<plan.num_terms; ++i) {
+			const QueryTerm &t = plan.terms[i];
+			if(t.negated)
+				continue;
+
+			unsigned access = QueryPlan::SCAN;
+			unsigned long long n = 0;
+			if(t.field == filerepo_clauses::EXT && indexes->extensions) {
+				if(extension_records(*indexes->extensions, t, n))
+					access = QueryPlan::EXTENSIONS;
+			} else if(t.field == filerepo_clauses::IN && indexes->paths) {
+				n = directory_records(*indexes->paths, db, t);
+				access = QueryPlan::DIRECTORIES;
+			}
+
+			if(access != QueryPlan::SCAN && n < fewest && n*INDEX_ACCESS_FACTOR < num_records) {
+				plan.access = access;
+				plan.term = i;
+				fewest = n;
+			}
+		}
+	}
+
+	bool term_holds(const char *r, const QueryTerm &t)
+	{
+		bool holds = false;
+
+		if(t.field == filerepo_clauses::MODIFIED_AFTER || t.field == filerepo_clauses::MODIFIED_BEFORE) {
+			const unsigned key = filerepo::aux::date_key(record_date(r));
+			holds = (t.field == filerepo_clauses::MODIFIED_AFTER ? key > t.key : key < t.key);
+		} else {
+			const wchar_t *v = t.values;
+			for(unsigned i=0; i<t.num_values && !holds; ++i) {
+				switch(t.field) {
+				case filerepo_clauses::EXT:		holds = has_extension(r, v); break;
+				case filerepo_clauses::IN:		holds = in_directories(r, v); break;
+				case filerepo_clauses::NAME:	holds = (string_util::wstristr(record_filename(r), v) != 0); break;
+				case filerepo_clauses::PATH:	holds = (string_util::wstristr(record_fullname(r), v) != 0); break;
+				}
+				v += wcslen(v)+1;
+			}
+		}
+
+		return holds != t.negated;
+	}
+
+	// true if db record 'r' matches 'q' : every term holds, include tokens in order, no exclude token
+	bool record_matches(const char *r, const filerepo::aux::SearchQuery &q, const QueryPlan &plan)
+	{
+		for(unsigned i=0; i<plan.num_terms; ++i) {
+			if(!term_holds(r, plan.terms[i]))
+				return false;
+		}
+
+		if(!(q.num_include+q.num_exclude))
+			return true;
+
+		const RecordHeader &rh = *(const RecordHeader*)r;
+		const wchar_t *start = record_fullname(r);
+		const wchar_t *searchstring = (q.search_all ? start : start+rh.filename_offset);
+
+		const wchar_t *token = q.exclude;
+		for(unsigned char counter=q.num_exclude; counter; --counter) {
+			if(string_util::wstristr(searchstring, token))
+				return false;
+			token += wcslen(token)+1;
+		}
+
+		token = q.include;
+		const wchar_t *s = searchstring;
+		for(unsigned char counter=q.num_include; counter; --counter) {
+			const unsigned token_len = (unsigned)wcslen(token);
+			if((s = string_util::wstristr(s, token)) == 0)
+				return false;
+
+			s += token_len;
+			token += token_len+1;
+		}
+		return true;
+	}
+
+	// the offsets of the records of extension 'id' matching 'q' into 'matched', db order
+	void match_extension(const filerepo::ExtensionIndex &index, unsigned id, const std::vector<char> &db,
+							const filerepo::aux::SearchQuery &q, const QueryPlan &plan, std::vector<unsigned> &matched)
+	{
+		typedef filerepo::ExtensionIndex Index;
+
+		for(unsigned c=index.containers[id]; c<index.containers[id+1]; ++c) {
+			const Index::Container &set = index.sets[c];
+			const unsigned base = set.key << 16;
+			const unsigned short *values = &index.values[set.values];
+
+			if(set.count <= Index::ARRAY_MAX) {
+				for(unsigned i=0; i<set.count; ++i) {
+					const unsigned offset = index.records[base+values[i]];
+					if(record_matches(&db[0]+offset, q, plan))
+						matched.push_back(offset);
+				}
+				continue;
+			}
+
+			for(unsigned w=0; w<Index::BITMAP_WORDS; ++w) {
+				unsigned bits = values[w];
+				for(unsigned bit=0; bits; ++bit, bits >>= 1) {
+					if(!(bits & 1))
+						continue;
+
+					const unsigned offset = index.records[base+w*16+bit];
+					if(record_matches(&db[0]+offset, q, plan))
+						matched.push_back(offset);
+				}
+			}
+		}
+	}
+
+	// scans with fewer queries evaluate every query on every record
+	const unsigned SHARED_FILTER_MIN_QUERIES = 4;
+
+	/*
+	 *	Picks the queries worth evaluating on a record, for scans with many queries. A query
+	 *	is filed under one pair of characters of its include tokens (folded like 'wstristr'
+	 *	compares), it can only match records that contain the pair. The pair picked is
+	 *	the rarest in a sample of the db. Queries without one are evaluated on every record.
+	 */
+	struct QueryFilter {
+		enum {
+			BUCKETS = 4096,
+			SAMPLE_RECORDS = 2048,
+			FILENAME = 0,
+			FULLPATH
+		};
+
+		static unsigned bucket(unsigned a, unsigned b) { return (a*131+b) & (BUCKETS-1); }
+
+		// NOTE : queries not planned as a scan are left out
+		QueryFilter(const std::vector<char> &db, const filerepo::aux::SearchQuery *queries, const QueryPlan *plans, unsigned n) : next(n, -1), stamp(n, 0)
+		{
+			for(unsigned where=FILENAME; where<=FULLPATH; ++where) {
+				heads[where].assign(BUCKETS, -1);
+				used[where] = false;
+
+				for(unsigned q=0; q<n; ++q)
+					used[where] |= ((queries[q].search_all ? FULLPATH : FILENAME) == where);
+			}
+
+			std::vector<unsigned> seen[2];
+			sample(db, seen);
+
+			for(unsigned q=0; q<n; ++q) {
+				if(plans[q].access != QueryPlan::SCAN)
+					continue;
+
+				const unsigned where = (queries[q].search_all ? FULLPATH : FILENAME);
+				const std::vector<unsigned> &counts = seen[where];
+
+				int picked = -1;
+				const wchar_t *token = queries[q].include;
+				for(unsigned char counter=queries[q].num_include; counter; --counter) {
+					for(; token[0] && token[1]; ++token) {
+						const int b = (int)bucket(toupper(token[0]), toupper(token[1]));
+						if(picked < 0 || counts[b] < counts[picked])
+							picked = b;
+					}
+					token += (*token ? 2 : 1);
+				}
+
+				if(picked < 0) {
+					always.push_back(q);
+					continue;
+				}
+
+				next[q] = heads[where][picked];
+				heads[where][picked] = (int)q;
+			}
+		}
+
+		// records (of about 'SAMPLE_RECORDS' spread over db) with the pair, per bucket
+		void sample(const std::vector<char> &db, std::vector<unsigned> *seen)
+		{
+			const char *b = &db[0];
+			const unsigned num_records = npp::stream::unpack<unsigned>(b);
+			const unsigned stride = (num_records > SAMPLE_RECORDS ? num_records/SAMPLE_RECORDS : 1);
+
+			for(unsigned where=FILENAME; where<=FULLPATH; ++where)
+				seen[where].assign(BUCKETS, 0);
+
+			for(unsigned i=0; i<num_records; ++i) {
+				if(i % stride == 0) {
+					for(unsigned where=FILENAME; where<=FULLPATH; ++where) {
+						if(!used[where])
+							continue;
+
+						const wchar_t *s = (where == FULLPATH ? record_fullname(b) : record_filename(b));
+						for(; s[0] && s[1]; ++s)
+							++seen[where][bucket(toupper(s[0]), toupper(s[1]))];
+					}
+				}
+				npp::stream::advance(b, record_size(b));
+			}
+		}
+
+		std::vector<int> heads[2];
+		bool used[2];
+		std::vector<int> next;				// of the query, in its bucket
+		std::vector<unsigned> stamp;		// record (+1) the query was last evaluated on
+		std::vector<unsigned> always;
+	};
+
+	// FNV-1a of 's' folded (see 'filerepo::ExactIndex')
+	unsigned folded_hash(const wchar_t *s)
+	{
+		unsigned h = 2166136261u;
+		for(; *s; ++s)
+			h = (h^fold(*s))*16777619u;
+		return h;
+	}
+
+	// true if the full path of db record 'r' is 'path' ('length' characters), or ends with it after a separator
+	bool fullname_ends_with(const char *r, const wchar_t *path, unsigned length)
+	{
+		const RecordHeader &rh = *(const RecordHeader*)r;
+		const unsigned full_length = rh.filename_offset+rh.filename_length-1;
+		if(full_length < length)
+			return false;
+
+		const wchar_t *full = record_fullname(r);
+		const wchar_t *f = full+full_length-length;
+		return same_path(f, path, length) && (f == full || is_separator(f[-1]));
+	}
+
+	// true if db record 'r' is below 'directory' (folded like 'same_path'), which ends on a separator in the path
+	bool fullname_in_directory(const char *r, const std::wstring &directory)
+	{
+		const RecordHeader &rh = *(const RecordHeader*)r;
+		const unsigned full_length = rh.filename_offset+rh.filename_length-1;
+		const unsigned length = (unsigned)directory.length();
+		if(!length || full_length <= length)
+			return false;
+
+		const wchar_t *full = record_fullname(r);
+		return same_path(full, directory.c_str(), length) && (is_separator(directory[length-1]) || is_separator(full[length]));
+	}
+
+	/*
+	 *	Appends db record 'r' as result record 'index' (see 'search_db'), its data at
+	 *	'datasize' past 'base'. Returns the size of the data.
+	 */
+	unsigned pack_result_record(std::vector<char> &result, unsigned base, unsigned datasize, unsigned index, const char *r)
+	{
+		const unsigned sow = sizeof(wchar_t);
+		const unsigned so_unsigned = sizeof(unsigned);
+		const unsigned so_filerecord = sizeof(FileRecordHeader);
+
+		const RecordHeader &rh = *(const RecordHeader*)r;
+		const wchar_t *start = record_fullname(r);
+
+		unsigned filename_len = rh.filename_length;	// null included
+		unsigned path_len = rh.filename_offset+1; // add null
+		unsigned date_len = date_length(rh);
+
+		unsigned filerecord_size =	sow*(filename_len+path_len+date_len)+so_filerecord;
+
+		const unsigned required = base+datasize+filerecord_size;
+		if(result.size() < required)
+			result.resize(required);
+
+		const char *result_start = &result[0];
+		const char *data_start = result_start+base;
+
+		result_start += (so_unsigned * (index+1));
+		*(unsigned*)(result_start) = datasize;
+
+		FileRecordHeader fr;
+		fr.recordsize = (unsigned short)filerecord_size;
+		fr.filename_offset = (unsigned short)(path_len*sow);
+		fr.date_offset = (unsigned short)(filerecord_size - (date_len*sow) - so_filerecord);
+
+		wchar_t null(0);
+
+		const char *data_destination = data_start+datasize;
+		memcpy((void*)data_destination, &fr, sizeof(fr));
+		data_destination+=sizeof(fr);
+		//! Path
+		memcpy((void*)data_destination, start, (path_len-1)*sow);
+		data_destination += (path_len-1)*sow;
+		memcpy((void*)data_destination, &null, sow);
+		data_destination += sow;
+		//! Filename and Date
+		memcpy((void*)data_destination, (start+rh.filename_offset), (filename_len+date_len)*sow);
+
+		return filerecord_size;
+	}
 }
 
 namespace filerepo {
 
+#if defined(_WIN32)
 	void make_internal_datestring_st(wchar_t *res, const void *stin)
 	{
 		SYSTEMTIME &sys_local = *((SYSTEMTIME*)stin);
@@ -68,6 +713,30 @@ namespace filerepo {
 
 		make_internal_datestring_st(res, &sys_local);
 	}
+#endif
+
+	void make_internal_datestring_time(wchar_t *res, long long seconds)
+	{
+		const time_t t = (time_t)seconds;
+		struct tm local;
+
+#if defined(_WIN32)
+		localtime_s(&local, &t);
+#else
+		localtime_r(&t, &local);
+#endif
+
+		swprintf(res, 16+1, L"%02d/%02d/%04d %02d:%02d", local.tm_mday, local.tm_mon+1, local.tm_year+1900, local.tm_hour, local.tm_min);
+	}
+
+	unsigned long long ExtensionIndex::bytes() const
+	{
+		unsigned long long n = (records.capacity()+counts.capacity()+containers.capacity())*sizeof(unsigned);
+		n += sets.capacity()*sizeof(Container)+values.capacity()*sizeof(unsigned short);
+		for(unsigned i=0; i<names.size(); ++i)
+			n += sizeof(std::wstring)+(names[i].capacity()+1)*sizeof(wchar_t);
+		return n;
+	}
 
 	namespace aux {
 		RecordHeader make_recordheader(const wchar_t *fullname, unsigned datestring_len)
@@ -121,6 +790,40 @@ namespace filerepo {
 			}
 		}
 
+		void pack_directory_rename(std::vector<char> &s, const std::wstring &from, const std::wstring &to)
+		{
+			const wchar_t null(0);
+			const unsigned sow = sizeof(wchar_t);
+
+			npp::stream::pack(s, (unsigned)filerepo_headers::CHANGE_DIRECTORY_RENAME);
+			const unsigned insert_point = (unsigned)s.size();
+			npp::stream::pack(s, 0u); // size, patched
+
+			npp::stream::pack(s, (unsigned)((from.length()+1)*sow));
+			npp::stream::pack_bytes(s, (const char *)from.c_str(), (unsigned)from.length()*sow);
+			npp::stream::pack(s, null);
+
+			npp::stream::pack(s, (unsigned)((to.length()+1)*sow));
+			npp::stream::pack_bytes(s, (const char *)to.c_str(), (unsigned)to.length()*sow);
+			npp::stream::pack(s, null);
+
+			const unsigned data_size = (unsigned)s.size()-insert_point;
+			memcpy(&s[insert_point], &data_size, sizeof(data_size));
+		}
+
+		void pack_directory_remove(std::vector<char> &s, const std::wstring &directory)
+		{
+			const wchar_t null(0);
+			const unsigned sow = sizeof(wchar_t);
+
+			npp::stream::pack(s, (unsigned)filerepo_headers::CHANGE_DIRECTORY_REMOVE);
+			npp::stream::pack(s, (unsigned)(2*sizeof(unsigned)+(directory.length()+1)*sow)); // size, including itself
+
+			npp::stream::pack(s, (unsigned)((directory.length()+1)*sow));
+			npp::stream::pack_bytes(s, (const char *)directory.c_str(), (unsigned)directory.length()*sow);
+			npp::stream::pack(s, null);
+		}
+
 		void insert_filerecord(std::vector<char> &db, const wchar_t *filename, const wchar_t *date)
 		{
 			using namespace npp;
@@ -199,6 +902,61 @@ namespace filerepo {
 			assert((unsigned)(dest-b) == recordheader.record_size);
 		}
 
+		void append_filerecord(std::vector<char> &db, const wchar_t *filename, const wchar_t *date)
+		{
+			const unsigned sow = sizeof(wchar_t);
+
+			RecordHeader recordheader = make_recordheader(filename, 16);
+
+			const unsigned path_len = recordheader.filename_offset;
+			const unsigned fn_length = recordheader.filename_length;
+			const wchar_t null(0);
+
+			unsigned at = (unsigned)db.size();
+			db.resize(at+recordheader.record_size);
+			(*((unsigned*)&db[0]))++; // INC
+
+			char *dest = &db[at];
+			memcpy(dest, &recordheader, sizeof(recordheader)); dest+=sizeof(recordheader);
+
+			unsigned nb = (path_len+fn_length-1)*sow; // path and filename are stored back to back
+			memcpy(dest, filename, nb); dest+=nb;
+			memcpy(dest, &null, sow); dest+=sow;
+
+			nb = 16*sow;
+			memcpy(dest, date, nb); dest+=nb;
+			memcpy(dest, &null, sow); dest+=sow;
+
+			assert((unsigned)(dest-&db[at]) == recordheader.record_size);
+		}
+
+		void sort_db(std::vector<char> &db)
+		{
+			using namespace npp;
+
+			const char *b = &db[0];
+			const unsigned num_records = stream::unpack<unsigned>(b);
+			if(num_records < 2)
+				return;
+
+			std::vector<const char *> records(num_records);
+			for(unsigned i=0; i<num_records; ++i) {
+				records[i] = b;
+				stream::advance(b, record_size(b));
+			}
+
+			// NOTE : stable, equal filenames keep the order they were appended in (as 'insert_filerecord')
+			std::stable_sort(records.begin(), records.end(), RecordFilenameLess());
+
+			std::vector<char> sorted;
+			sorted.reserve(db.size());
+			stream::pack(sorted, num_records);
+			for(unsigned i=0; i<num_records; ++i)
+				stream::pack_bytes(sorted, records[i], record_size(records[i]));
+
+			db.swap(sorted);
+		}
+
 		void merge_dbs(std::vector<char> &db, const char *db2, unsigned db2_size)
 		{
 			// NO CHANGE NEEDED
@@ -393,26 +1151,162 @@ namespace filerepo {
 			}
 		}
 
-		unsigned search_db(std::vector<char> &result,
-							const std::vector<char> &db,
-							unsigned search_all,
-							unsigned char num_include,
-							unsigned char num_exclude,
-							const wchar_t *include,
-							const wchar_t *exclude,
-							std::vector<char> &delayed_events)
+		void queue_updates(PendingUpdates &pending, const char *db2, unsigned /*db2_size*/)
 		{
 			using namespace npp;
 
-			dummy_timer profiler;
+			std::wstring key;
 
-			unsigned sow = sizeof(wchar_t);
-			unsigned filerecord_header_size = sizeof(RecordHeader);
+			const char *c = db2;
+			const unsigned num_records = stream::unpack<unsigned>(c);
+			for(unsigned i=0; i<num_records; ++i) {
+				const RecordHeader &rh = *(const RecordHeader*)c;
+				make_update_key((const wchar_t *)(c+sizeof(RecordHeader)), key);
 
-			unsigned full_size = (unsigned)db.size();
-			unsigned num_records_in_db = *((unsigned*)&db[0]);
+				std::vector<char> &record = pending[key];
+				record.assign(c, c+rh.record_size);
 
-			unsigned datapart_size = full_size-(num_records_in_db*filerecord_header_size)-sizeof(unsigned);
+				stream::advance(c, rh.record_size);
+			}
+		}
+
+		void discard_updates(PendingUpdates &pending, const char *db2, unsigned /*db2_size*/)
+		{
+			using namespace npp;
+
+			if(pending.empty())
+				return;
+
+			std::wstring key;
+
+			const char *c = db2;
+			const unsigned num_records = stream::unpack<unsigned>(c);
+			for(unsigned i=0; i<num_records; ++i) {
+				const RecordHeader &rh = *(const RecordHeader*)c;
+				make_update_key((const wchar_t *)(c+sizeof(RecordHeader)), key);
+
+				pending.erase(key);
+
+				stream::advance(c, rh.record_size);
+			}
+		}
+
+		void discard_directory_updates(PendingUpdates &pending, const wchar_t *directory)
+		{
+			if(pending.empty())
+				return;
+
+			std::wstring prefix;
+			make_update_key(directory, prefix);
+
+			PendingUpdates::iterator u = pending.begin();
+			while(u != pending.end()) {
+				if(u->first.compare(0, prefix.length(), prefix) == 0)
+					u = pending.erase(u);
+				else
+					++u;
+			}
+		}
+
+		unsigned apply_updates(std::vector<char> &db, PendingUpdates &pending)
+		{
+			using namespace npp;
+
+			if(pending.empty())
+				return 0;
+
+			enum { UNMATCHED = 0, APPLIED, RESIZED };
+
+			std::vector<const char*> updates;
+			sort_updates(pending, updates);
+			std::vector<unsigned char> state(updates.size(), UNMATCHED);
+
+			unsigned num_applied = 0, num_resized = 0;
+
+			const unsigned num_updates = (unsigned)updates.size();
+			const unsigned num_records = *((unsigned*)&db[0]);
+
+			// (1) in place, the common case as datestrings are fixed length
+			char *b = &db[0]+sizeof(unsigned);
+			unsigned k = 0;
+			for(unsigned i=0; i<num_records; ++i) {
+				while(k < num_updates && _wcsicmp(record_filename(updates[k]), record_filename(b)) < 0)
+					++k;
+
+				if(k == num_updates)
+					break; // no update for the rest
+
+				const unsigned size = record_size(b);
+				const unsigned u = find_update(updates, k, b);
+				if(u != ~0u) {
+					if(record_size(updates[u]) == size) {
+						memcpy(b, updates[u], size);
+						state[u] = APPLIED;
+						++num_applied;
+					} else {
+						state[u] = RESIZED;
+						++num_resized;
+					}
+				}
+
+				b += size;
+			}
+
+			// (2) rebuild if any record changed size
+			if(num_resized) {
+				std::vector<char> rebuilt;
+				rebuilt.reserve(db.size());
+				stream::pack(rebuilt, num_records);
+
+				k = 0;
+				const char *r = &db[0]+sizeof(unsigned);
+				for(unsigned i=0; i<num_records; ++i) {
+					while(k < num_updates && _wcsicmp(record_filename(updates[k]), record_filename(r)) < 0)
+						++k;
+
+					const unsigned u = (k < num_updates ? find_update(updates, k, r) : ~0u);
+					if(u != ~0u && state[u] == RESIZED) {
+						stream::pack_bytes(rebuilt, updates[u], record_size(updates[u]));
+						++num_applied;
+					} else {
+						stream::pack_bytes(rebuilt, r, record_size(r));
+					}
+
+					stream::advance(r, record_size(r));
+				}
+
+				db.swap(rebuilt);
+			}
+
+			// NOTE : whatever is left has no record (yet), applied by a later call once it has
+			std::wstring key;
+			for(unsigned u=0; u<num_updates; ++u) {
+				if(state[u] != UNMATCHED) {
+					make_update_key(record_fullname(updates[u]), key);
+					pending.erase(key);
+				}
+			}
+
+			return num_applied;
+		}
+
+		unsigned search_db(std::vector<char> &result,
+							const std::vector<char> &db,
+							unsigned search_all,
+							unsigned char num_include,
+							unsigned char num_exclude,
+							const wchar_t *include,
+							const wchar_t *exclude,
+							const npp::CancellationToken *cancel)
+		{
+			using namespace npp;
+
+			const SearchQuery query = { search_all, num_include, num_exclude, include, exclude, 0, 0, 0 };
+
+			QueryPlan plan;
+			plan_query(plan, query, &db[0], 0, 0);
+
+			unsigned num_records_in_db = *((unsigned*)&db[0]);
 
 			// Resulting vector :
 			//	(1) num records
@@ -421,276 +1315,833 @@ namespace filerepo {
 			//
 			// Notes :
 			//	* One more null term in FileRecord (as path is also null termed)
+			//	* Room for every offset up front, the data grows as records match. 'result' is
+			//	  never shrunk (the size returned is what counts), a query allocates and clears
+			//	  nothing once it is warm
 			//
 
-			unsigned max_size_off_return =	datapart_size
-											+(num_records_in_db*sow) // null term of path
-											+(((num_records_in_db+1)*sizeof(unsigned))) // offsets + first header
-											+(num_records_in_db*sizeof(FileRecordHeader))
-											;
-
-			result.resize(max_size_off_return);
-
 			unsigned result_num_records = 0;
 			unsigned result_datasize = 0;
 			unsigned result_base_data_offset = (((num_records_in_db+1)*sizeof(unsigned)));
 
-			// setup delayed information
-			const unsigned delayed_buffersize = (unsigned)delayed_events.size()-sizeof(unsigned);
-
-			const char *d = &delayed_events[0];
-			unsigned num_delayed = stream::unpack<unsigned>(d);
-			const char *delayed_start = d; // 'cache'/save
-			unsigned delayed_consumed_bytes = 0;
-			// end
-			bool include_all_records = (0 == (num_include+num_exclude));
+			if(result.size() < result_base_data_offset)
+				result.resize(result_base_data_offset);
 
 			const char *b = &db[0];
 			const unsigned num_records = stream::unpack<unsigned>(b);
 
-			DEBUG_PRINT("[Search2] Searching, num db records : %d\n", num_records);
+			for(unsigned i=0; i<num_records; ++i) {
+				if(cancel && (i % CANCEL_CHECK_INTERVAL) == 0 && cancel->cancelled())
+					break;
 
-			profiler.start();
+				if(record_matches(b, query, plan)) {
+					result_datasize += pack_result_record(result, result_base_data_offset, result_datasize, result_num_records, b);
+					result_num_records = result_num_records + 1;
+				}
 
-			for(unsigned i=0; i<num_records; ++i) {
-				const RecordHeader &rh =  *(const RecordHeader*)b;
+				stream::advance(b, record_size(b));
+			}
+
+			LOG_TRACE(npp::log::CATEGORY_SEARCH, "searched %u records, %u found", num_records, result_num_records);
+
+			*((unsigned*)&result[0]) = result_num_records;
+
+			unsigned diff = num_records_in_db - result_num_records;
+			if(diff) {
+				unsigned new_base = (result_num_records+1)*sizeof(unsigned);
+				//unsigned shift = result_base_data_offset - new_base;
+
+				const char *start = &result[0];
+
+				void *destination = (void*)(start+new_base);
+				const void *source = (const void*)(start+result_base_data_offset);
+				unsigned num_bytes = result_datasize;
+				// can result in zero bytes
+				memmove(destination, source, num_bytes);
+			}
 
-				const wchar_t *start = (const wchar_t *)(b+sizeof(RecordHeader));
-				bool bail = false;
+			const unsigned result_size = ((result_num_records+1)*sizeof(unsigned))+result_datasize;
+			return result_size;
+		}
 
-				if(!include_all_records) {
-					const wchar_t *searchstring = (search_all ? start : start+rh.filename_offset);
-					unsigned char counter = num_exclude;
-					const wchar_t *token = exclude;
+		unsigned clause_fields(const SearchQuery &q)
+		{
+			unsigned fields = 0;
 
-					while(counter && !bail) {
+			const wchar_t *c = q.clauses;
+			for(unsigned char i=0; i<q.num_clauses; ++i) {
+				fields |= (1u << c[0]);
 
-						if(string_util::wstristr(searchstring, token)) {
-							bail = true;
+				const unsigned num_values = c[2];
+				c += 3;
+				for(unsigned v=0; v<num_values; ++v)
+					c += wcslen(c)+1;
+			}
+			return fields;
+		}
+
+		void search_db_shared(const std::vector<char> &db,
+								const SearchQuery *queries,
+								unsigned num_queries,
+								std::vector<unsigned> *matched,
+								const QueryIndexes *indexes,
+								const npp::CancellationToken *cancel)
+		{
+			using namespace npp;
+
+			for(unsigned q=0; q<num_queries; ++q)
+				matched[q].clear();
+
+			const char *b = &db[0];
+			const unsigned num_records = stream::unpack<unsigned>(b);
+
+			// NOTE : the plans of a few queries live on the stack, a scan for them allocates nothing
+			QueryPlan few[SHARED_FILTER_MIN_QUERIES];
+			std::vector<QueryPlan> many;
+			if(num_queries > SHARED_FILTER_MIN_QUERIES)
+				many.resize(num_queries);
+			QueryPlan *plans = (many.empty() ? few : &many[0]);
+
+			unsigned num_scanned = 0;
+			for(unsigned q=0; q<num_queries; ++q) {
+				QueryPlan &plan = plans[q];
+				plan_query(plan, queries[q], &db[0], num_records, indexes);
+
+				if(plan.access == QueryPlan::SCAN) {
+					++num_scanned;
+					continue;
+				}
+
+				if(plan.access == QueryPlan::DATES) {
+					for(unsigned i=plan.first; i<plan.end; ++i) {
+						const unsigned offset = indexes->dates->records[i];
+						if(record_matches(&db[0]+offset, queries[q], plan))
+							matched[q].push_back(offset);
+					}
+				} else if(plan.access == QueryPlan::EXTENSIONS) {
+					const QueryTerm &t = plan.terms[plan.term];
+					const wchar_t *v = t.values;
+					for(unsigned i=0; i<t.num_values; ++i) {
+						const int id = find_extension(*indexes->extensions, v);
+						if(id >= 0)
+							match_extension(*indexes->extensions, (unsigned)id, db, queries[q], plan, matched[q]);
+						v += wcslen(v)+1;
+					}
+
+					// NOTE : one extension is in db order already, a value given twice is found twice
+					if(t.num_values < 2)
+						continue;
+				} else {
+					// NOTE : the directories of different values can overlap
+					const filerepo::PathIndex &index = *indexes->paths;
+					const unsigned num_directories = (unsigned)index.directories.size();
+
+					const QueryTerm &t = plan.terms[plan.term];
+					const wchar_t *v = t.values;
+					for(unsigned i=0; i<t.num_values; ++i) {
+						const unsigned length = (unsigned)wcslen(v);
+						for(unsigned d=next_directory(index, &db[0], v, length, 0); d<num_directories; d=next_directory(index, &db[0], v, length, index.directories[d].next)) {
+							for(unsigned r=index.directories[d].first; r<index.directories[d].end; ++r) {
+								const unsigned offset = index.records[r];
+								if(record_matches(&db[0]+offset, queries[q], plan))
+									matched[q].push_back(offset);
+							}
 						}
-						token += wcslen(token)+1;
-						--counter;
+						v += wcslen(v)+1;
 					}
+				}
 
-					if(!bail) {
-						counter = num_include;
-						token = include;
-						const wchar_t *s = searchstring;
-						while(counter && !bail) {
+				// in db order like a scan finds them
+				std::sort(matched[q].begin(), matched[q].end());
+				matched[q].erase(std::unique(matched[q].begin(), matched[q].end()), matched[q].end());
+			}
 
-							const unsigned token_len = (unsigned)wcslen(token);
+			if(!num_scanned)
+				return;
 
-							if((s = string_util::wstristr(s, token)) == 0) {
-								bail = true;
-							} else {
-								s = s+token_len;
-							}
+			if(num_scanned < SHARED_FILTER_MIN_QUERIES) {
+				for(unsigned i=0; i<num_records; ++i) {
+					if(cancel && (i % CANCEL_CHECK_INTERVAL) == 0 && cancel->cancelled())
+						break;
 
-							token += token_len+1;
-							--counter;
-						}
+					// NOTE : the record is read from memory once, every query looks at it while it is in the cache
+					const unsigned offset = (unsigned)(b-&db[0]);
+					for(unsigned q=0; q<num_queries; ++q) {
+						if(plans[q].access == QueryPlan::SCAN && record_matches(b, queries[q], plans[q]))
+							matched[q].push_back(offset);
 					}
+
+					stream::advance(b, record_size(b));
 				}
 
-				if(!bail) {
-					//std::wstring full_extracted(start, rh.date_offset);
-					if(num_delayed) {
-						unsigned current_record_size = rh.record_size;
-
-						const RecordHeader &rhd = *(const RecordHeader*)d;
-						unsigned update_record_size = rhd.record_size;
-
-						if(update_record_size == current_record_size) {
-							const wchar_t *update_filename = (const wchar_t *)(d+sizeof(RecordHeader));
-							bool update = (0 == ::_wcsicmp(start, update_filename));
-							if(update) {
-								memcpy((void*)b, d, current_record_size);
-
-								// remove delayed
-								void *destination = (void*)d;
-								const void *source = (const void*)(d+current_record_size);
-								unsigned num_bytes = delayed_buffersize- (unsigned)(d-delayed_start)-current_record_size;
-								// can result in zero bytes
-								memmove(destination, source, num_bytes);
-								//
-								--num_delayed;
-								delayed_consumed_bytes += current_record_size;
-							}
+				LOG_TRACE(npp::log::CATEGORY_SEARCH, "searched %u records for %u queries", num_records, num_scanned);
+				return;
+			}
+
+			QueryFilter filter(db, queries, plans, num_queries);
+
+			for(unsigned i=0; i<num_records; ++i) {
+				if(cancel && (i % CANCEL_CHECK_INTERVAL) == 0 && cancel->cancelled())
+					break;
+
+				const unsigned offset = (unsigned)(b-&db[0]);
+
+				// every pair of characters of the filename (or the full path) picks the queries filed under it
+				for(unsigned where=QueryFilter::FILENAME; where<=QueryFilter::FULLPATH; ++where) {
+					if(!filter.used[where])
+						continue;
+
+					const wchar_t *s = (where == QueryFilter::FULLPATH ? record_fullname(b) : record_filename(b));
+					if(!*s)
+						continue;
+
+					unsigned previous = toupper(*s);
+					for(++s; *s; ++s) {
+						const unsigned c = toupper(*s);
+						int q = filter.heads[where][QueryFilter::bucket(previous, c)];
+						previous = c;
+
+						for(; q >= 0; q = filter.next[q]) {
+							if(filter.stamp[q] == i+1)
+								continue;
+
+							filter.stamp[q] = i+1;
+							if(record_matches(b, queries[q], plans[q]))
+								matched[q].push_back(offset);
 						}
 					}
+				}
 
-					const unsigned so_unsigned = sizeof(unsigned);
-					const unsigned so_filerecord = sizeof(FileRecordHeader);
+				for(unsigned a=0; a<filter.always.size(); ++a) {
+					const unsigned q = filter.always[a];
+					if(record_matches(b, queries[q], plans[q]))
+						matched[q].push_back(offset);
+				}
 
-					unsigned filename_len = rh.filename_length;	// null included
-					unsigned path_len = rh.filename_offset+1; // add null
-					unsigned date_len = (rh.record_size-(rh.filename_length+rh.filename_offset)*sow-sizeof(rh)) / sow;
+				stream::advance(b, record_size(b));
+			}
 
-					const char *result_start = &result[0];
-					const char *data_start = result_start+result_base_data_offset;
+			LOG_TRACE(npp::log::CATEGORY_SEARCH, "searched %u records for %u queries", num_records, num_scanned);
+		}
 
-					unsigned filerecord_size =	sow*(filename_len+path_len+date_len)+so_filerecord;
+		unsigned date_key(const wchar_t *datestring)
+		{
+			// "DD/MM/YYYY HH:MM"
+			const wchar_t *d = datestring;
+			for(unsigned i=0; i<16; ++i) {
+				const bool digit = (d[i] >= L'0' && d[i] <= L'9');
+				if(!d[i] || digit == (i == 2 || i == 5 || i == 10 || i == 13))
+					return 0;
+			}
 
-					result_start += (so_unsigned * (result_num_records+1));
-					*(unsigned*)(result_start) = result_datasize;
+			const unsigned day = (d[0]-L'0')*10+(d[1]-L'0');
+			const unsigned month = (d[3]-L'0')*10+(d[4]-L'0');
+			const unsigned hour = (d[11]-L'0')*10+(d[12]-L'0');
+			const unsigned minute = (d[14]-L'0')*10+(d[15]-L'0');
+			int year = (d[6]-L'0')*1000+(d[7]-L'0')*100+(d[8]-L'0')*10+(d[9]-L'0');
+			if(year < 1970 || month < 1 || month > 12)
+				return 0;
+
+			// days since 1970-01-01 of a (proleptic gregorian) date, the year starting in march
+			year -= (month <= 2 ? 1 : 0);
+			const int era = year/400;
+			const unsigned year_of_era = (unsigned)(year-era*400);
+			const unsigned day_of_year = (153*(month > 2 ? month-3 : month+9)+2)/5+day-1;
+			const unsigned day_of_era = year_of_era*365+year_of_era/4-year_of_era/100+day_of_year;
+			const unsigned days = (unsigned)(era*146097+(int)day_of_era-719468);
+
+			return days*24*60+hour*60+minute;
+		}
 
-					FileRecordHeader fr;
-					fr.recordsize = (unsigned short)filerecord_size;
-					fr.filename_offset = (unsigned short)(path_len*sow);
-					fr.date_offset = (unsigned short)(filerecord_size - (date_len*sow) - so_filerecord);
+		void build_date_index(DateIndex &index, const std::vector<char> &db)
+		{
+			using namespace npp;
 
-					wchar_t null(0);
+			index.keys.clear();
+			index.records.clear();
 
-					const char *data_destination = data_start+result_datasize;
-					memcpy((void*)data_destination, &fr, sizeof(fr));
-					data_destination+=sizeof(fr);
-					//! Path
-					memcpy((void*)data_destination, start, (path_len-1)*sow);
-					data_destination += (path_len-1)*sow;
-					memcpy((void*)data_destination, &null, sow);
-					data_destination += sow;
-					//! Filename and Date
-					memcpy((void*)data_destination, (start+rh.filename_offset), (filename_len+date_len)*sow);
+			if(db.size() < sizeof(unsigned))
+				return;
 
-					// bookkeeping
-					result_datasize = result_datasize + filerecord_size;
-					result_num_records = result_num_records + 1;
+			const char *start = &db[0];
+			const char *b = start;
+			const unsigned num_records = stream::unpack<unsigned>(b);
+
+			// key and offset in one, sorted by key then offset
+			std::vector<unsigned long long> sorted(num_records);
+			for(unsigned i=0; i<num_records; ++i) {
+				sorted[i] = ((unsigned long long)date_key(record_date(b)) << 32) | (unsigned)(b-start);
+				stream::advance(b, record_size(b));
+			}
+			std::sort(sorted.begin(), sorted.end());
+
+			index.keys.resize(num_records);
+			index.records.resize(num_records);
+			for(unsigned i=0; i<num_records; ++i) {
+				index.keys[i] = (unsigned)(sorted[i] >> 32);
+				index.records[i] = (unsigned)sorted[i];
+			}
+
+			LOG_TRACE(npp::log::CATEGORY_SEARCH, "date index, %u records", num_records);
+		}
+
+		void build_extension_index(ExtensionIndex &index, const std::vector<char> &db)
+		{
+			using namespace npp;
+			typedef ExtensionIndex::Container Container;
+
+			const unsigned NONE = ~0u;
+
+			index.records.clear();
+			index.names.clear();
+			index.counts.clear();
+			index.containers.clear();
+			index.sets.clear();
+			index.values.clear();
+
+			if(db.size() < sizeof(unsigned))
+				return;
+
+			const char *start = &db[0];
+			const char *b = start;
+			const unsigned num_records = stream::unpack<unsigned>(b);
+			index.records.resize(num_records);
+
+			// (1) the extension of every record, ids in the order they are seen
+			std::unordered_map<std::wstring, unsigned> ids;
+			std::vector<unsigned> record_ids(num_records);
+			std::wstring name;
+			for(unsigned i=0; i<num_records; ++i) {
+				index.records[i] = (unsigned)(b-start);
+				record_ids[i] = NONE;
+
+				const wchar_t *filename = record_filename(b);
+				const wchar_t *dot = wcsrchr(filename, L'.');
+				if(dot && dot[1]) {
+					name.clear();
+					for(++dot; *dot; ++dot)
+						name.push_back((wchar_t)fold(*dot));
+
+					std::pair<std::unordered_map<std::wstring, unsigned>::iterator, bool> inserted = ids.insert(std::make_pair(name, (unsigned)ids.size()));
+					record_ids[i] = inserted.first->second;
 				}
 
-				stream::advance(b, rh.record_size);
+				stream::advance(b, record_size(b));
 			}
 
-			profiler.stop();
+			// (2) ids by name
+			const unsigned num_extensions = (unsigned)ids.size();
+			std::vector<unsigned> sorted_ids(num_extensions);
+			index.names.resize(num_extensions);
+			{
+				std::vector<std::pair<std::wstring, unsigned> > names(ids.begin(), ids.end());
+				std::sort(names.begin(), names.end());
+				for(unsigned i=0; i<num_extensions; ++i) {
+					index.names[i].swap(names[i].first);
+					sorted_ids[names[i].second] = i;
+				}
+			}
 
-			double search_time = profiler.interval();
+			index.counts.assign(num_extensions, 0);
+			for(unsigned i=0; i<num_records; ++i) {
+				if(record_ids[i] != NONE) {
+					record_ids[i] = sorted_ids[record_ids[i]];
+					++index.counts[record_ids[i]];
+				}
+			}
 
-			if(delayed_consumed_bytes) {
-				*((unsigned*)&delayed_events[0]) = num_delayed;
+			// (3) the records of every extension, in db order
+			std::vector<unsigned> first(num_extensions+1, 0);
+			for(unsigned e=0; e<num_extensions; ++e)
+				first[e+1] = first[e]+index.counts[e];
 
-				unsigned new_size = (unsigned)delayed_events.size()-delayed_consumed_bytes;
-				delayed_events.resize(new_size);
+			std::vector<unsigned> numbers(first[num_extensions]);
+			for(unsigned i=0; i<num_records; ++i) {
+				if(record_ids[i] != NONE)
+					numbers[first[record_ids[i]]++] = i;
 			}
 
-			DEBUG_PRINT("[Search2] Search time : %f milliseconds, num found records %d\n", search_time, result_num_records);
+			// (4) their containers, 'first' is where every extension ends now
+			index.containers.resize(num_extensions+1);
+			for(unsigned e=0, n=0; e<num_extensions; ++e) {
+				index.containers[e] = (unsigned)index.sets.size();
+
+				while(n < first[e]) {
+					const unsigned key = numbers[n] >> 16;
+					unsigned end = n;
+					while(end < first[e] && (numbers[end] >> 16) == key)
+						++end;
+
+					Container set = { key, end-n, (unsigned)index.values.size() };
+					if(set.count <= ExtensionIndex::ARRAY_MAX) {
+						for(; n<end; ++n)
+							index.values.push_back((unsigned short)(numbers[n] & 0xffff));
+					} else {
+						index.values.resize(index.values.size()+ExtensionIndex::BITMAP_WORDS, 0);
+						unsigned short *words = &index.values[set.values];
+						for(; n<end; ++n)
+							words[(numbers[n] & 0xffff) >> 4] |= (unsigned short)(1u << (numbers[n] & 15));
+					}
+					index.sets.push_back(set);
+				}
+			}
+			index.containers[num_extensions] = (unsigned)index.sets.size();
 
-			*((unsigned*)&result[0]) = result_num_records;
+			LOG_TRACE(npp::log::CATEGORY_SEARCH, "extension index, %u records, %u extensions, %u containers", num_records, num_extensions, (unsigned)index.sets.size());
+		}
 
-			unsigned diff = num_records_in_db - result_num_records;
-			if(diff) {
-				unsigned new_base = (result_num_records+1)*sizeof(unsigned);
-				//unsigned shift = result_base_data_offset - new_base;
+		unsigned extension_count(const ExtensionIndex &index, const wchar_t *extension)
+		{
+			const int id = find_extension(index, extension);
+			return (id < 0 ? 0 : index.counts[id]);
+		}
 
-				const char *start = &result[0];
+		void build_path_index(PathIndex &index, const std::vector<char> &db)
+		{
+			using namespace npp;
 
-				void *destination = (void*)(start+new_base);
-				const void *source = (const void*)(start+result_base_data_offset);
-				unsigned num_bytes = result_datasize;
-				// can result in zero bytes
-				memmove(destination, source, num_bytes);
+			index.records.clear();
+			index.directories.clear();
+
+			if(db.size() < sizeof(unsigned))
+				return;
+
+			const char *start = &db[0];
+			const char *b = start;
+			const unsigned num_records = stream::unpack<unsigned>(b);
+
+			// (1) the directory of every record, ids in the order they are seen
+			std::unordered_map<DirectoryKey, unsigned, DirectoryKeyHash, DirectoryKeyEqual> ids;
+			std::vector<DirectoryKey> keys;
+			std::vector<unsigned> record_ids(num_records);
+			for(unsigned i=0; i<num_records; ++i) {
+				const DirectoryKey key = { record_fullname(b), ((const RecordHeader*)b)->filename_offset };
+				std::pair<std::unordered_map<DirectoryKey, unsigned, DirectoryKeyHash, DirectoryKeyEqual>::iterator, bool> inserted = ids.insert(std::make_pair(key, (unsigned)keys.size()));
+				if(inserted.second)
+					keys.push_back(key);
+				record_ids[i] = inserted.first->second;
+
+				stream::advance(b, record_size(b));
 			}
 
-			const unsigned result_size = ((result_num_records+1)*sizeof(unsigned))+result_datasize;
-			return result_size;
+			// (2) directories by path, the records of every one in db order after each other
+			const unsigned num_keys = (unsigned)keys.size();
+			std::vector<DirectoryKey> sorted;
+			sorted.swap(keys);
+			std::sort(sorted.begin(), sorted.end(), DirectoryKeyLess());
+
+			std::vector<unsigned> rank(num_keys), first(num_keys+1, 0);
+			for(unsigned k=0; k<num_keys; ++k)
+				rank[ids[sorted[k]]] = k;
+
+			for(unsigned i=0; i<num_records; ++i)
+				++first[rank[record_ids[i]]+1];
+			for(unsigned k=0; k<num_keys; ++k)
+				first[k+1] += first[k];
+
+			index.records.resize(num_records);
+			std::vector<unsigned> at(first.begin(), first.end()-1);
+			b = start+sizeof(unsigned);
+			for(unsigned i=0; i<num_records; ++i) {
+				index.records[at[rank[record_ids[i]]]++] = (unsigned)(b-start);
+				stream::advance(b, record_size(b));
+			}
+
+			// (3) every directory of every path, the ones a path is not below end before its records
+			std::vector<unsigned> open;
+			for(unsigned k=0; k<num_keys; ++k) {
+				const wchar_t *path = sorted[k].path;
+				const unsigned path_length = sorted[k].length;
+
+				while(!open.empty()) {
+					PathIndex::Directory &top = index.directories[open.back()];
+					if(top.length <= path_length && same_path(path, record_fullname(start+index.records[top.first]), top.length))
+						break;
+
+					top.end = first[k];
+					top.next = (unsigned)index.directories.size();
+					open.pop_back();
+				}
+
+				for(unsigned c=(open.empty() ? 0 : index.directories[open.back()].length); c<path_length; ++c) {
+					if(!is_separator(path[c]))
+						continue;
+
+					const PathIndex::Directory dir = { first[k], num_records, 0, c+1 };
+					open.push_back((unsigned)index.directories.size());
+					index.directories.push_back(dir);
+				}
+			}
+
+			for(unsigned i=0; i<open.size(); ++i)
+				index.directories[open[i]].next = (unsigned)index.directories.size();
+
+			LOG_TRACE(npp::log::CATEGORY_SEARCH, "path index, %u records, %u directories", num_records, (unsigned)index.directories.size());
 		}
 
-		void rename_directory(std::vector<char> &db, const wchar_t *from, const wchar_t *to, std::vector<char> &/*temp_buffer*/)
+		unsigned pack_results(std::vector<char> &result, const std::vector<char> &db, const unsigned *matched, unsigned num_matched)
+		{
+			// NOTE : same layout as 'search_db', the number of records is known up front
+			const unsigned base = (num_matched+1)*sizeof(unsigned);
+			if(result.size() < base)
+				result.resize(base);
+
+			unsigned datasize = 0;
+			for(unsigned i=0; i<num_matched; ++i)
+				datasize += pack_result_record(result, base, datasize, i, &db[0]+matched[i]);
+
+			*((unsigned*)&result[0]) = num_matched;
+			return base+datasize;
+		}
+
+		void build_exact_index(ExactIndex &index, const std::vector<char> &db)
 		{
 			using namespace npp;
 
-			const unsigned so_unsigned = sizeof(unsigned);
-			const unsigned sow = sizeof(wchar_t);
+			index.records.clear();
+			index.groups.clear();
+			index.hashes.clear();
+			index.slots.clear();
 
-			unsigned current_dbsize = (unsigned)db.size()-sizeof(unsigned); // DB part(i.e. no header)
-			unsigned num_records_in_db = *((unsigned*)&db[0]);
+			if(db.size() < sizeof(unsigned))
+				return;
+
+			const char *start = &db[0];
+			const char *b = start;
+			const unsigned num_records = stream::unpack<unsigned>(b);
+			index.records.reserve(num_records);
+
+			// NOTE : equal filenames are next to each other, the hash only differs between groups
+			const wchar_t *previous = 0;
+			unsigned previous_hash = 0;
+			for(unsigned i=0; i<num_records; ++i) {
+				const wchar_t *filename = record_filename(b);
+				const unsigned hash = folded_hash(filename);
+
+				if(!previous || hash != previous_hash || _wcsicmp(previous, filename) != 0) {
+					index.groups.push_back(i);
+					index.hashes.push_back(hash);
+				}
+				previous = filename;
+				previous_hash = hash;
+
+				index.records.push_back((unsigned)(b-start));
+				stream::advance(b, record_size(b));
+			}
 
-			const unsigned strlen_from = (unsigned)wcslen(from);
-			const unsigned strlen_to = (unsigned)wcslen(to);
+			const unsigned num_groups = (unsigned)index.hashes.size();
+			index.groups.push_back(num_records);
 
-			const bool inplace = strlen_from == strlen_to;
-			const bool allocate = strlen_to > strlen_from;
-			const bool deallocate = strlen_from > strlen_to;
+			// at most half full
+			unsigned num_slots = 16;
+			while(num_slots < num_groups*2)
+				num_slots *= 2;
 
-			unsigned diff_len_bytes = 0;
-			unsigned diff_len = 0;
-			if(allocate) {
-				// need to inc storage
-				diff_len = strlen_to-strlen_from;
-				diff_len_bytes = diff_len*sow;
-			} else if(deallocate) {
-				diff_len = strlen_from-strlen_to;
-				diff_len_bytes = diff_len*sow;
+			index.slots.assign(num_slots, 0);
+			for(unsigned g=0; g<num_groups; ++g) {
+				unsigned s = index.hashes[g] & (num_slots-1);
+				while(index.slots[s])
+					s = (s+1) & (num_slots-1);
+				index.slots[s] = g+1;
 			}
 
-			const char *b = &db[0];
-			b += so_unsigned; // skip header
+			LOG_TRACE(npp::log::CATEGORY_SEARCH, "exact index, %u records in %u groups", num_records, num_groups);
+		}
+
+		unsigned find_exact(const ExactIndex &index, const std::vector<char> &db, const wchar_t *path, std::vector<unsigned> &matched)
+		{
+			matched.clear();
 
-			unsigned current_offset = 0;
-			unsigned deallocated_bytes = 0;
+			while(is_separator(*path))
+				++path;
 
-			DEBUG_PRINT("Rename start: current_size(%d)", current_dbsize);
+			const unsigned length = (unsigned)wcslen(path);
+			const wchar_t *filename = path+length;
+			while(filename != path && !is_separator(filename[-1]))
+				--filename;
 
-			for(unsigned i=0; i<num_records_in_db; ++i) {
-				RecordHeader &rh =  *(RecordHeader*)b;
-				unsigned record_size = rh.record_size; // can change if we allocate
+			if(!*filename || index.slots.empty())
+				return 0;
 
-				const wchar_t *start = (const wchar_t *)(b+sizeof(RecordHeader));
+			const unsigned hash = folded_hash(filename);
+			const unsigned mask = (unsigned)index.slots.size()-1;
 
-				if(wcsstr(start, from)) {
-					if(inplace) {
-						memcpy((void*)start, (const char*)to, strlen_to*sizeof(wchar_t));
-					} else if(deallocate) {
-						memcpy((void*)start, (const char*)to, strlen_to*sizeof(wchar_t));
+			for(unsigned s = hash & mask; index.slots[s]; s = (s+1) & mask) {
+				const unsigned g = index.slots[s]-1;
+				if(index.hashes[g] != hash)
+					continue;
 
-						char *destination = (char*)(b+sizeof(RecordHeader))+strlen_to*sizeof(wchar_t);
-						const char *source = destination+diff_len_bytes;
-						const unsigned shift_bytes = current_dbsize - (unsigned)(destination-(&db[0]+so_unsigned));	// destination does not have header
+				const unsigned first = index.groups[g], end = index.groups[g+1];
+				if(_wcsicmp(record_filename(&db[0]+index.records[first]), filename) != 0)
+					continue;
 
-						memmove(destination, source, shift_bytes);
+				// NOTE : a filename alone matches the whole group
+				for(unsigned i=first; i<end; ++i) {
+					const unsigned offset = index.records[i];
+					if(filename == path || fullname_ends_with(&db[0]+offset, path, length))
+						matched.push_back(offset);
+				}
+				break;
+			}
 
-						rh.record_size -= (unsigned short)diff_len_bytes;
-						rh.filename_offset -= (unsigned char)diff_len;
+			return (unsigned)matched.size();
+		}
 
-						//! Bookkeeping
-						current_dbsize -= diff_len_bytes;
-						deallocated_bytes += diff_len_bytes;
+		namespace {
+			void rewrite_begin(RewriteJob &job, unsigned type, const std::vector<char> &db)
+			{
+				job.type = type;
 
-						record_size = rh.record_size;
-					} else if(allocate) {
-						//! Make room
-						db.resize(db.size()+diff_len_bytes);
-						current_dbsize = (unsigned)db.size()-so_unsigned; // remove header part
+				job.b = &db[0];
+				job.num_b = npp::stream::unpack<unsigned>(job.b);
+				job.i = 0;
 
-						//! Fetch once again
-						b = (&db[0]+current_offset)+so_unsigned; // fetch b again and add header back!!
+				job.c = 0;
+				job.num_c = 0;
+				job.j = 0;
 
-						RecordHeader &record_header = *(RecordHeader*)b;
-						const wchar_t *record_start = (const wchar_t *)(b+sizeof(RecordHeader));
+				job.num_result = 0;
+				job.result.clear();
+				job.result.reserve(db.size()+job.delta.size());
+				npp::stream::pack(job.result, job.num_result); // patched when done
+			}
 
-						//! Move first
-						const char *source = (const char*)(record_start+strlen_from);
-						char *destination = (char*)(source+diff_len_bytes);
+			void use_delta(RewriteJob &job)
+			{
+				job.c = &job.delta[0];
+				job.num_c = npp::stream::unpack<unsigned>(job.c);
+			}
 
-						const unsigned shift_bytes = current_dbsize - (unsigned)(destination-(&db[0]+so_unsigned));	// destination does not have header
-						memmove(destination, source, shift_bytes);
+			inline void emit(RewriteJob &job, const char *r)
+			{
+				npp::stream::pack_bytes(job.result, r, record_size(r));
+				job.num_result += 1;
+			}
+
+			void emit_renamed(RewriteJob &job, const char *r)
+			{
+				using namespace npp;
+				const unsigned sow = sizeof(wchar_t);
 
-						//! All moved, copy in replacement
-						memcpy((void*)record_start, (const char*)to, strlen_to*sizeof(wchar_t));
+				const RecordHeader &rh = *(const RecordHeader*)r;
+				const unsigned strlen_from = (unsigned)job.from.length();
+				const unsigned strlen_to = (unsigned)job.to.length();
 
-						//! Update record data
-						record_header.record_size += (unsigned short)diff_len_bytes;
-						record_header.filename_offset += (unsigned char)diff_len;
+				// NOTE : the path starts with 'from' (see 'fullname_in_directory'), written any case
+				RecordHeader renamed = rh;
+				renamed.record_size = (unsigned short)(rh.record_size + (strlen_to*sow) - (strlen_from*sow));
+				renamed.filename_offset = (unsigned char)(rh.filename_offset + strlen_to - strlen_from);
 
-						record_size = record_header.record_size;
+				const char *rest = r+sizeof(RecordHeader)+strlen_from*sow;
+				const unsigned rest_bytes = rh.record_size-sizeof(RecordHeader)-strlen_from*sow;
+
+				stream::pack(job.result, renamed);
+				stream::pack_bytes(job.result, job.to.c_str(), strlen_to*sow);
+				stream::pack_bytes(job.result, rest, rest_bytes);
+				job.num_result += 1;
+			}
+
+			// 'r' in the run of 'delta' records with its filename, starting at 'job.c'
+			// the record of 'delta' with the full name of 'r', among those from 'c' on with its filename
+			const char *find_delta(const RewriteJob &job, const char *r)
+			{
+				const wchar_t *filename = record_filename(r);
+				const wchar_t *fullname = record_fullname(r);
+
+				const char *c = job.c;
+				for(unsigned j=job.j; j<job.num_c && 0 == _wcsicmp(record_filename(c), filename); ++j) {
+					if(0 == _wcsicmp(record_fullname(c), fullname))
+						return c;
+					c += record_size(c);
+				}
+				return 0;
+			}
+
+			// a record added by a merge, or the update that waited for it
+			void emit_merged(RewriteJob &job, const char *r, std::wstring &key)
+			{
+				if(!job.updates.empty()) {
+					make_update_key(record_fullname(r), key);
+
+					PendingUpdates::iterator u = job.updates.find(key);
+					if(u != job.updates.end()) {
+						npp::stream::pack_bytes(job.result, &u->second[0], (unsigned)u->second.size());
+						job.num_result += 1;
+						job.updates.erase(u);
+						return;
 					}
 				}
+				emit(job, r);
+			}
+
+			inline void advance_b(RewriteJob &job)
+			{
+				job.b += record_size(job.b);
+				++job.i;
+			}
+
+			inline void advance_c(RewriteJob &job)
+			{
+				job.c += record_size(job.c);
+				++job.j;
+			}
+		}
+
+		void rewrite_begin_merge(RewriteJob &job, const std::vector<char> &db, std::vector<char> &delta, PendingUpdates &unmatched)
+		{
+			job.delta.swap(delta);
+			job.updates.swap(unmatched);
+			rewrite_begin(job, RewriteJob::MERGE, db);
+			use_delta(job);
+		}
+
+		void rewrite_begin_exclude(RewriteJob &job, const std::vector<char> &db, std::vector<char> &delta)
+		{
+			job.delta.swap(delta);
+			rewrite_begin(job, RewriteJob::EXCLUDE, db);
+			use_delta(job);
+		}
+
+		void rewrite_begin_update(RewriteJob &job, const std::vector<char> &db, PendingUpdates &pending, PendingUpdates &unmatched)
+		{
+			// NOTE : 'insert' keeps what is there, the newer update of a record
+			job.updates.swap(pending);
+			job.updates.insert(unmatched.begin(), unmatched.end());
+			PendingUpdates().swap(unmatched);
+
+			std::vector<const char*> updates;
+			sort_updates(job.updates, updates);
+
+			job.delta.clear();
+			npp::stream::pack(job.delta, (unsigned)updates.size());
+			for(unsigned k=0; k<updates.size(); ++k)
+				npp::stream::pack_bytes(job.delta, updates[k], record_size(updates[k]));
+
+			rewrite_begin(job, RewriteJob::UPDATE, db);
+			use_delta(job);
+		}
+
+		void rewrite_begin_rename(RewriteJob &job, const std::vector<char> &db, const wchar_t *from, const wchar_t *to)
+		{
+			job.from = from;
+			job.to = to;
+			rewrite_begin(job, RewriteJob::RENAME, db);
+		}
+
+		void rewrite_begin_remove_directory(RewriteJob &job, const std::vector<char> &db, const wchar_t *directory)
+		{
+			job.from = directory;
+			rewrite_begin(job, RewriteJob::REMOVE_DIRECTORY, db);
+		}
 
-				current_offset += record_size;
-				stream::advance(b, record_size);
+		bool rewrite_step(RewriteJob &job, unsigned max_records)
+		{
+			std::wstring key;
+
+			while(max_records--) {
+				const bool has_b = job.i < job.num_b;
+				const bool has_c = job.j < job.num_c;
+
+				switch(job.type) {
+				case RewriteJob::MERGE:
+					if(!has_b && !has_c)
+						return true;
+
+					// NOTE : equal names keep the db record first, like 'merge_dbs'
+					if(has_c && (!has_b || _wcsicmp(record_filename(job.b), record_filename(job.c)) > 0)) {
+						emit_merged(job, job.c, key);
+						advance_c(job);
+					} else {
+						emit(job, job.b);
+						advance_b(job);
+					}
+					break;
+				case RewriteJob::EXCLUDE:
+					if(!has_b)
+						return true;
+
+					// NOTE : not in the db (ex. created and removed while the monitor overflowed), would hold up the rest
+					if(has_c && _wcsicmp(record_filename(job.c), record_filename(job.b)) < 0) {
+						advance_c(job);
+						break;
+					}
+
+					// records with the same filename are in no particular order, 'b' is looked for in all of them
+					if(!has_c || !find_delta(job, job.b))
+						emit(job, job.b);
+					advance_b(job);
+					break;
+				case RewriteJob::UPDATE:
+					if(!has_b)
+						return true;
+
+					// NOTE : no record with that name (yet), the update stays in 'updates'
+					if(has_c && _wcsicmp(record_filename(job.c), record_filename(job.b)) < 0) {
+						advance_c(job);
+						break;
+					}
+
+					{
+						const char *u = (has_c ? find_delta(job, job.b) : 0);
+						if(u) {
+							emit(job, u);
+							make_update_key(record_fullname(u), key);
+							job.updates.erase(key);
+						} else {
+							emit(job, job.b);
+						}
+					}
+					advance_b(job);
+					break;
+				case RewriteJob::RENAME:
+					if(!has_b)
+						return true;
+
+					if(fullname_in_directory(job.b, job.from))
+						emit_renamed(job, job.b);
+					else
+						emit(job, job.b);
+
+					advance_b(job);
+					break;
+				case RewriteJob::REMOVE_DIRECTORY:
+					if(!has_b)
+						return true;
+
+					if(!fullname_in_directory(job.b, job.from))
+						emit(job, job.b);
+
+					advance_b(job);
+					break;
+				default:
+					return true;
+				}
 			}
 
-			db.resize(db.size()-deallocated_bytes);
+			// out of budget, done if that was the last record
+			if(job.type == RewriteJob::MERGE)
+				return (job.i == job.num_b && job.j == job.num_c);
+
+			return (job.i == job.num_b);
+		}
+
+		void rewrite_finish(RewriteJob &job, std::vector<char> &db, PendingUpdates &unmatched)
+		{
+			*((unsigned*)&job.result[0]) = job.num_result;
+			db.swap(job.result);
+
+			// NOTE : copied, the table of the job is sized for all updates it started with
+			if(job.type == RewriteJob::MERGE || job.type == RewriteJob::UPDATE)
+				unmatched.insert(job.updates.begin(), job.updates.end());
+
+			// NOTE : release the memory of the old db, and whatever the job held on to
+			std::vector<char>().swap(job.result);
+			std::vector<char>().swap(job.delta);
+			PendingUpdates().swap(job.updates);
+			job.from.clear();
+			job.to.clear();
 
-			DEBUG_PRINT("Rename end: current_size(%d)", db.size());
+			job.type = RewriteJob::NONE;
 		}
 	}
 }
@@ -1,6 +1,12 @@
 #pragma once
 
 #include <vector>
+#include <string>
+#include <unordered_map>
+
+namespace npp {
+	struct CancellationToken;
+}
 
 struct filerepo_headers {
 	enum {
@@ -14,7 +20,32 @@ struct filerepo_headers {
 
 		// INTERNAL BELOW!
 		PARSER_DONE,
-		DIRECTORIES
+		DIRECTORIES,
+
+		// every record below a directory, laid out like CHANGE_DIRECTORY_RENAME with only 'from' (folder monitor rescans)
+		CHANGE_DIRECTORY_REMOVE,
+
+		// several QUERY_FILES packets answered together (see 'filerepo::search_batch')
+		QUERY_FILES_BATCH,
+
+		// laid out like QUERY_FILES, one include token : the filename or path suffix (see 'filerepo::search_exact')
+		QUERY_FILES_EXACT
+	};
+};
+
+/*
+ *	Field qualified clauses of a query (see 'filerepo::aux::SearchQuery'), each packed as
+ *	field, negated (0/1) and the number of values, then the values (null terminated).
+ *	A clause holds when any of its values does.
+ */
+struct filerepo_clauses {
+	enum {
+		EXT = 1,			// "ext:cpp,h", the filename ends with '.' and the value
+		IN,					// "in:engine/render", the directories of the path include these (whole names)
+		NAME,				// "name:x", the filename contains the value
+		PATH,				// "path:x", the full path contains the value
+		MODIFIED_AFTER,		// "modified:<7d", the date (see 'filerepo::aux::date_key') is after the value (decimal)
+		MODIFIED_BEFORE		// "modified:>7d"
 	};
 };
 
@@ -47,14 +78,141 @@ struct RecordHeader {
 };
 
 namespace filerepo {
+	// pending 'CHANGE_UPDATE' records keyed by (case-folded) full filename, which identifies a record
+	typedef std::unordered_map<std::wstring, std::vector<char> > PendingUpdates;
+
+	/*
+	 *	Out of place rewrite of a db, done in bounded steps so other (more urgent)
+	 *	work can run in between. The source db is only read, and must be left
+	 *	untouched, until the job is finished and the result swapped in.
+	 */
+	struct RewriteJob {
+		enum {
+			NONE = 0,
+			MERGE,		// merge 'delta' (sorted db), applying the 'updates' of records it adds
+			EXCLUDE,	// remove all records with a full name in 'delta' (sorted db)
+			UPDATE,		// replace records with 'updates' (also in 'delta', sorted db)
+			RENAME,		// replace directory 'from' with 'to'
+			REMOVE_DIRECTORY	// remove all records below directory 'from'
+		};
+
+		RewriteJob() : type(NONE) {}
+
+		bool active() const { return type != NONE; }
+
+		unsigned type;
+
+		std::vector<char> result;
+		std::vector<char> delta;
+		PendingUpdates updates;	// MERGE/UPDATE, those without a record (yet) when done
+		std::wstring from, to;
+
+		// read positions in the source db and 'delta'
+		const char *b; unsigned i, num_b;
+		const char *c; unsigned j, num_c;
+
+		unsigned num_result;
+	};
+
+	/*
+	 *	Exact lookups of a db (see 'aux::find_exact'). The db is sorted by filename, records
+	 *	with the same filename (case-insensitive) are one group, hashed by the folded
+	 *	filename. A path suffix ('dir\file.ext') takes the group of its filename and
+	 *	compares the full paths from the end.
+	 *
+	 *	Offsets into the db, so only valid for the db it was built from.
+	 */
+	struct ExactIndex {
+		std::vector<unsigned> records;	// offset of every record, db order
+		std::vector<unsigned> groups;	// first record of every group, then the number of records
+		std::vector<unsigned> hashes;	// of every group
+		std::vector<unsigned> slots;	// open addressing (power of two), group+1, 0 : empty
+
+		unsigned long long bytes() const { return (records.capacity()+groups.capacity()+hashes.capacity()+slots.capacity())*sizeof(unsigned); }
+	};
+
+	// the records of a db ordered by date, for "modified:" clauses
+	struct DateIndex {
+		std::vector<unsigned> keys;		// 'aux::date_key' of every record, ascending
+		std::vector<unsigned> records;	// offset of the record of every key
+
+		unsigned long long bytes() const { return (keys.capacity()+records.capacity())*sizeof(unsigned); }
+	};
+
+	/*
+	 *	The records of a db by extension (folded, after the last '.' of the filename), for
+	 *	"ext:" clauses. Records are numbered in db order, the set of every extension is
+	 *	split in containers of 65536 numbers (roaring) : a sorted array of the low 16 bits
+	 *	while it is small, a bitmap once that takes less room.
+	 *
+	 *	Offsets into the db, so only valid for the db it was built from.
+	 */
+	struct ExtensionIndex {
+		enum {
+			ARRAY_MAX = 4096,			// values of an array container, a bitmap is as big
+			BITMAP_WORDS = 65536/16
+		};
+
+		struct Container {
+			unsigned key;		// number >> 16
+			unsigned count;		// records
+			unsigned values;	// first of 'values', 'count' values or 'BITMAP_WORDS' words
+		};
+
+		std::vector<unsigned> records;		// offset of every record, db order
+		std::vector<std::wstring> names;	// of every extension, sorted
+		std::vector<unsigned> counts;		// records of every extension
+		std::vector<unsigned> containers;	// first container of every extension, then the end
+		std::vector<Container> sets;
+		std::vector<unsigned short> values;
+
+		unsigned long long bytes() const;
+	};
+
+	/*
+	 *	The records of a db ordered by directory (folded, any separator equals any other),
+	 *	a directory before the ones below it, so the records below a directory are one
+	 *	range. Every directory of a path has its range, in the same order, for "in:" clauses.
+	 *
+	 *	Offsets into the db, so only valid for the db it was built from.
+	 */
+	struct PathIndex {
+		struct Directory {
+			unsigned first, end;	// range of 'records', the first one's full path starts with the directory
+			unsigned next;			// first directory not below this one
+			unsigned length;		// characters, with the separator it ends with
+		};
+
+		std::vector<unsigned> records;		// offset of every record, by directory then db order
+		std::vector<Directory> directories;	// by path
+
+		unsigned long long bytes() const { return records.capacity()*sizeof(unsigned)+directories.capacity()*sizeof(Directory); }
+	};
+
+	// what a query can be answered from besides a scan (0 : not built), see 'aux::search_db_shared'
+	struct QueryIndexes {
+		const DateIndex *dates;
+		const ExtensionIndex *extensions;
+		const PathIndex *paths;
+	};
+
 	namespace aux {
 		RecordHeader make_recordheader(const wchar_t *fullname, unsigned datestring_len);
 
 		void pack_changeheader(std::vector<char> &s, unsigned changetype, const wchar_t *fullname, unsigned datestring_len, const wchar_t *datestring);
 
+		// CHANGE_DIRECTORY_RENAME/CHANGE_DIRECTORY_REMOVE, directories end with a separator
+		void pack_directory_rename(std::vector<char> &s, const std::wstring &from, const std::wstring &to);
+		void pack_directory_remove(std::vector<char> &s, const std::wstring &directory);
+
 		// will keep db sorted
 		void insert_filerecord(std::vector<char> &db, const wchar_t *filename, const wchar_t *date);
 
+		// appends, leaves db unsorted until 'sort_db'
+		void append_filerecord(std::vector<char> &db, const wchar_t *filename, const wchar_t *date);
+
+		void sort_db(std::vector<char> &db);
+
 		// merge two SORTED db's
 		void merge_dbs(std::vector<char> &db, const char *db2, unsigned db2_size);
 
@@ -64,6 +222,19 @@ namespace filerepo {
 		// add (or if existing replace) to db from db2
 		void add_replace_db(std::vector<char> &db, const char *db2, unsigned db2_size);
 
+		// store updates in db2 (replacing already pending updates for the same record)
+		void queue_updates(PendingUpdates &pending, const char *db2, unsigned db2_size);
+
+		// forget pending updates for all records in db2
+		void discard_updates(PendingUpdates &pending, const char *db2, unsigned db2_size);
+
+		// forget pending updates for all records below 'directory'
+		void discard_directory_updates(PendingUpdates &pending, const wchar_t *directory);
+
+		// apply pending updates to db in one pass, updates without a record in db are left in 'pending'
+		unsigned apply_updates(std::vector<char> &db, PendingUpdates &pending);
+
+		// NOTE : does not modify db, stops early (partial result) when 'cancel' is cancelled
 		unsigned search_db(std::vector<char> &result,
 							const std::vector<char> &db,
 							unsigned search_all,
@@ -71,12 +242,92 @@ namespace filerepo {
 							unsigned char num_exclude,
 							const wchar_t *include,
 							const wchar_t *exclude,
-							std::vector<char> &delayed_events);
+							const npp::CancellationToken *cancel = 0);
+
+		// one query of 'search_db_shared', tokens are null terminated one after the other
+		struct SearchQuery {
+			unsigned search_all;
+			unsigned char num_include;
+			unsigned char num_exclude;
+			const wchar_t *include;
+			const wchar_t *exclude;
 
-		void rename_directory(std::vector<char> &db, const wchar_t *from, const wchar_t *to, std::vector<char> &temp_buffer);
+			// see 'filerepo_clauses', all of them hold
+			unsigned char num_clauses;
+			unsigned clauses_length;	// characters
+			const wchar_t *clauses;
+		};
+
+		// bit (1 << field) of every field the clauses of 'q' use
+		unsigned clause_fields(const SearchQuery &q);
+
+		/*
+		 *	One pass over db for all 'queries', 'matched[i]' gets the offsets of the records
+		 *	matching 'queries[i]' (see 'pack_results'). Like 'search_db' stops early when
+		 *	'cancel' is cancelled.
+		 *
+		 *	Every query is planned first : its clauses are evaluated cheapest first, and a
+		 *	query that selects few enough records of one of 'indexes' is answered from
+		 *	those instead of joining the pass.
+		 */
+		void search_db_shared(const std::vector<char> &db,
+								const SearchQuery *queries,
+								unsigned num_queries,
+								std::vector<unsigned> *matched,
+								const QueryIndexes *indexes = 0,
+								const npp::CancellationToken *cancel = 0);
+
+		// minutes since 1970 of a date string of a record ("DD/MM/YYYY HH:MM", local), 0 if it is not one
+		unsigned date_key(const wchar_t *datestring);
+
+		// NOTE : reuses the buffers of 'index'
+		void build_date_index(DateIndex &index, const std::vector<char> &db);
+
+		// NOTE : reuses the buffers of 'index'
+		void build_extension_index(ExtensionIndex &index, const std::vector<char> &db);
+
+		// the number of records with 'extension' (case-insensitive, no leading '.'), no lookup of the records
+		unsigned extension_count(const ExtensionIndex &index, const wchar_t *extension);
+
+		// NOTE : reuses the buffers of 'index'
+		void build_path_index(PathIndex &index, const std::vector<char> &db);
+
+		// the result 'search_db' gives for 'matched' (offsets of records in db), without searching
+		unsigned pack_results(std::vector<char> &result, const std::vector<char> &db, const unsigned *matched, unsigned num_matched);
+
+		// NOTE : reuses the buffers of 'index'
+		void build_exact_index(ExactIndex &index, const std::vector<char> &db);
+
+		/*
+		 *	'matched' gets the offsets of the records named 'path' ("file.ext"), or with a
+		 *	full path ending in it from a directory on ("dir\file.ext", '/' works too,
+		 *	leading separators are ignored). Case-insensitive, returns the number found.
+		 */
+		unsigned find_exact(const ExactIndex &index, const std::vector<char> &db, const wchar_t *path, std::vector<unsigned> &matched);
+
+		/*
+		 *	NOTE :	'rewrite_begin_*' take over the content of 'delta'/'pending'/'unmatched'. 'unmatched'
+		 *			are updates that found no record before, applied once it is there (newer updates
+		 *			in 'pending' replace them), 'rewrite_finish' hands back those still without one.
+		 */
+		void rewrite_begin_merge(RewriteJob &job, const std::vector<char> &db, std::vector<char> &delta, PendingUpdates &unmatched);
+		void rewrite_begin_exclude(RewriteJob &job, const std::vector<char> &db, std::vector<char> &delta);
+		void rewrite_begin_update(RewriteJob &job, const std::vector<char> &db, PendingUpdates &pending, PendingUpdates &unmatched);
+		void rewrite_begin_rename(RewriteJob &job, const std::vector<char> &db, const wchar_t *from, const wchar_t *to);
+		void rewrite_begin_remove_directory(RewriteJob &job, const std::vector<char> &db, const wchar_t *directory);
+
+		// processes at most 'max_records' source records, returns true when done
+		bool rewrite_step(RewriteJob &job, unsigned max_records);
+
+		// swaps the result into db (which must be the db the job was started on)
+		void rewrite_finish(RewriteJob &job, std::vector<char> &db, PendingUpdates &unmatched);
 	}
 
 
+	// Windows only, from a SYSTEMTIME (local) and a FILETIME (utc)
 	void make_internal_datestring_st(wchar_t *res,const void *stin);
 	void make_internal_datestring_ft(wchar_t *res, const void *ft);
+
+	// seconds since the unix epoch (utc)
+	void make_internal_datestring_time(wchar_t *res, long long seconds);
 }
@@ -1,74 +1,60 @@
 #include "folder_monitor.h"
 
+// ReadDirectoryChangesW backend, see 'folder_monitor_posix.cpp' for other platforms
+#if defined(_WIN32)
+
 #include "string/string_utils.h"
 #include "thread/thread.h"
-#include "thread/critical_section.h"
+#include "thread/thread_pool.h"
+#include "thread/wait_group.h"
+#include "trace/trace.h"
 
 #include "json_aux/json_aux.h"
 #include "win32/win_aux.h"
-#include "debug.h"
+#include "log/log.h"
 
 #include "stream.h"
 #include "file_repository_common.h"
+#include "directory_trie.h"
+#include "stats.h"
 
+#include <Windows.h> // ReadDirectoryChangesW, IOCP
 #include <vector>
 #include <string>
 #include <map>
+#include <set>
 #include <algorithm> // std::find
 #include <assert.h>
+#include <wctype.h> // towlower
+#include <atomic>
 
 typedef std::wstring String;
 
-typedef std::map<String, bool> DirectoryMap;
-
 namespace internal {
-	npp::CriticalSection cs_global_directorymap;
-	DirectoryMap global_directorymap;
+	// shared by all monitors and repositories
+	DirectoryTrie global_directories;
 
 	bool seen_directory(const String &d)
 	{
-		npp::CriticalSectionScope holder(cs_global_directorymap);
-		return global_directorymap[d];
+		return global_directories.contains(d.c_str());
 	}
 
 	void add_directory(const String &d)
 	{
-		DEBUG_PRINT("[FolderMonitor] internal::add_directory(%S)", d.c_str());
-		npp::CriticalSectionScope holder(cs_global_directorymap);
-		global_directorymap[d] = true;
+		LOG_TRACE(npp::log::CATEGORY_MONITOR, "add_directory(%S)", d);
+		global_directories.insert(d.c_str());
 	}
 
 	void remove_directory(const String &d)
 	{
-		DEBUG_PRINT("[FolderMonitor] internal::remove_directory(%S)", d.c_str());
-		npp::CriticalSectionScope holder(cs_global_directorymap);
-		global_directorymap[d] = false;
+		LOG_TRACE(npp::log::CATEGORY_MONITOR, "remove_directory(%S)", d);
+		global_directories.remove(d.c_str());
 	}
 
 	void rename_directory(const String &from, const String &to)
 	{
-		DEBUG_PRINT("[FolderMonitor] internal::rename_directory(%S, %S)", from.c_str(), to.c_str());
-		const unsigned from_length = (unsigned)from.length();
-
-		npp::CriticalSectionScope holder(cs_global_directorymap);
-		DirectoryMap::iterator i(global_directorymap.begin()), end(global_directorymap.end());
-		while(i!=end)
-		{
-			if(i->second) {
-				const String &dir = i->first;
-				unsigned found = (unsigned)dir.find(from);
-
-				if(found == 0) {
-					String temp=dir;
-
-					temp.replace(0, from_length, to);
-					global_directorymap.insert(DirectoryMap::value_type(temp, true));
-
-					i->second = false;
-				}
-			}
-			++i;
-		}
+		LOG_TRACE(npp::log::CATEGORY_MONITOR, "rename_directory(%S, %S)", from, to);
+		global_directories.rename(from.c_str(), to.c_str());
 	}
 }
 
@@ -99,10 +85,15 @@ namespace {
 		std::vector<String> rename_cache;
 	};
 
+	struct FolderMonitor;
+
 	struct DirectoryInformation {
-		DirectoryInformation(MonitorDirectoryData const &mdd)
-			:handle(INVALID_HANDLE_VALUE)
+		DirectoryInformation(FolderMonitor *fm, MonitorDirectoryData const &mdd)
+			:monitor(fm)
+			,handle(INVALID_HANDLE_VALUE)
 			,buffer_length(0)
+			,completed_bytes(0)
+			,completion_ok(false)
 			,directory_data(mdd)
 		{
 			buffer[0] = 0;
@@ -119,10 +110,16 @@ namespace {
 			MAX_BUFFER = FM_MAX_BUFFER
 		};
 
+		FolderMonitor *monitor;
+
 		HANDLE handle;
 		DWORD buffer_length;
 		OVERLAPPED overlapped;
 
+		// result of the last completion, read by the monitor strand
+		DWORD completed_bytes;
+		bool completion_ok;
+
 		char buffer[FM_MAX_BUFFER];
 
 		MonitorDirectoryData directory_data;
@@ -143,103 +140,311 @@ namespace {
 		return (res != 0);
 	}
 
-	void extract_changedata(FILE_NOTIFY_INFORMATION *fni, DirectoryInformation *di, std::vector<char> &buffer);
+	// NOTE : datestrings only have minute resolution so a second old record is good enough
+	const DWORD STAT_CACHE_TTL_MS = 1000;
+	const unsigned STAT_CACHE_MAX_RECORDS = (16*1024);
+
+	// number of entries (in one notification batch) sharing a parent before the
+	// parent is enumerated once instead of querying every entry by itself
+	const unsigned STAT_BATCH_ENUMERATE_THRESHOLD = 4;
+
+	struct StatRecord {
+		DWORD timestamp;
+		DWORD attributes;
+		FILETIME creation_time;
+		FILETIME last_write_time;
+		bool exists;
+	};
+
+	/*
+	 *	Time-bounded cache of file metadata, only touched by the monitor thread.
+	 *
+	 *	'prefetch' is called with all paths of a notification batch before the
+	 *	batch is processed, paths sharing a parent are then resolved with one
+	 *	directory enumeration. 'lookup' falls back to a single query on a miss.
+	 *	The paths of a batch are invalidated before the prefetch, a second write
+	 *	to a file within the TTL is not answered with the first one's metadata.
+	 */
+	struct StatCache {
+		typedef std::map<String, StatRecord> Records;
+
+		void prefetch(const std::vector<String> &fullnames)
+		{
+			const DWORD now = ::GetTickCount();
+			expire(now);
+
+			// folded parent -> folded filenames in parent
+			typedef std::map<String, std::set<String> > ParentMap;
+			ParentMap by_parent;
+
+			for(unsigned i=0, n=(unsigned)fullnames.size(); i<n; ++i) {
+				const String key = make_key(fullnames[i]);
+				if(_records.find(key) != _records.end())
+					continue; // fresh enough
+
+				const unsigned path_len = file_util::pathlength(key.c_str());
+				if(!path_len)
+					continue;
+
+				by_parent[key.substr(0, path_len)].insert(key.substr(path_len));
+			}
+
+			WIN32_FIND_DATAW fd;
+			ParentMap::const_iterator i(by_parent.begin()), end(by_parent.end());
+			for(; i!=end; ++i) {
+				const String &parent = i->first;
+				const std::set<String> &wanted = i->second;
+
+				if(wanted.size() < STAT_BATCH_ENUMERATE_THRESHOLD) {
+					std::set<String>::const_iterator w(wanted.begin()), wend(wanted.end());
+					for(; w!=wend; ++w)
+						fetch(parent+(*w), now);
+
+					continue;
+				}
+
+				unsigned num_found = 0;
+				const String spec = parent+L"*";
+				HANDLE h = ::FindFirstFileW(spec.c_str(), &fd);
+				if(h != INVALID_HANDLE_VALUE) {
+					do {
+						String fn(fd.cFileName);
+						fold(fn);
+						if(wanted.find(fn) != wanted.end()) {
+							store(parent+fn, &fd, now);
+							++num_found;
+						}
+					} while(num_found != wanted.size() && ::FindNextFileW(h, &fd) != 0);
+					::FindClose(h);
+				}
+
+				if(num_found != wanted.size()) {
+					// not present (anymore), remember that too
+					std::set<String>::const_iterator w(wanted.begin()), wend(wanted.end());
+					for(; w!=wend; ++w) {
+						const String key = parent+(*w);
+						if(_records.find(key) == _records.end())
+							store(key, 0, now);
+					}
+				}
+			}
+		}
+
+		const StatRecord &lookup(const String &fullname)
+		{
+			const String key = make_key(fullname);
+			Records::const_iterator i = _records.find(key);
+			if(i != _records.end())
+				return i->second;
+
+			return fetch(key, ::GetTickCount());
+		}
+
+		void invalidate(const String &fullname)
+		{
+			_records.erase(make_key(fullname));
+		}
 
+	private:
+		static void fold(String &s)
+		{
+			for(unsigned i=0, n=(unsigned)s.length(); i<n; ++i)
+				s[i] = (wchar_t)towlower(s[i]);
+		}
+
+		static String make_key(const String &fullname)
+		{
+			String key(fullname);
+			fold(key);
+			return key;
+		}
+
+		const StatRecord &fetch(const String &key, DWORD now)
+		{
+			WIN32_FIND_DATAW fd;
+			HANDLE h = ::FindFirstFileW(key.c_str(), &fd);
+			if(h == INVALID_HANDLE_VALUE)
+				return store(key, 0, now);
+
+			::FindClose(h);
+			return store(key, &fd, now);
+		}
+
+		const StatRecord &store(const String &key, const WIN32_FIND_DATAW *fd, DWORD now)
+		{
+			StatRecord &sr = _records[key];
+			memset(&sr, 0, sizeof(sr));
+			sr.timestamp = now;
+			if(fd) {
+				sr.exists = true;
+				sr.attributes = fd->dwFileAttributes;
+				sr.creation_time = fd->ftCreationTime;
+				sr.last_write_time = fd->ftLastWriteTime;
+			}
+			return sr;
+		}
+
+		void expire(DWORD now)
+		{
+			Records::iterator i(_records.begin());
+			while(i != _records.end()) {
+				if((now - i->second.timestamp) >= STAT_CACHE_TTL_MS)
+					i = _records.erase(i);
+				else
+					++i;
+			}
+
+			if(_records.size() > STAT_CACHE_MAX_RECORDS)
+				_records.clear();
+		}
+
+		Records _records;
+	};
+
+	void extract_changedata(FILE_NOTIFY_INFORMATION *fni, DirectoryInformation *di, StatCache &stat_cache, std::vector<char> &buffer);
+
+	HANDLE shared_completion_port();
+
+	/*
+	 *	Every monitor in the process shares one completion port and the thread
+	 *	waiting on it, completions are processed on the monitor's strand (thread pool).
+	 *
+	 *	Reference counted : the owner and every outstanding directory watch hold
+	 *	a reference, the last one to let go deletes the monitor. Stopping closes
+	 *	the directory handles, the aborted watches complete within milliseconds.
+	 */
 	struct FolderMonitor {
 		FolderMonitor(folder_monitor::RegisterContext *ctx)
-			:_exit_requested(false)
-			,_thread(0)
-			,_context(*ctx)
-			,io_completion_port(0)
-		{}
+			:_context(*ctx)
+			,_exit_requested(false)
+			,_started(false)
+			,_strand(npp::strand_create())
+			,_references(1) // owner
+			,_update_index(0)
+			,_watched_directories(0)
+		{
+			live_monitors.add();
+		}
 
 		~FolderMonitor()
 		{
-			if(_thread) {
-				npp::thread_stop(_thread);
-				npp::thread_destroy(_thread);
-			}
+			npp::strand_destroy(_strand);
 
 			for(unsigned i=0; i<directories.size();++i)
 				delete directories[i];
+
+			if(_context.release_function)
+				_context.release_function(_context.user_data);
+
+			live_monitors.done();
 		}
 
-		void run()
+		void acquire()
 		{
-			unsigned update_index = 0;
-			std::vector<char> workbuffer;
-
-			while(true)	{
-				workbuffer.clear();
-
-				DWORD num_bytes = 0;
-				DirectoryInformation *di = 0;
-				OVERLAPPED *overlapped = 0;
-
-				// Retrieve the directory info for this directory
-				// through the completion key
-				// GetQueuedCompletionStatus will stall until something is available
-				BOOL ret = ::GetQueuedCompletionStatus(	io_completion_port,
-														&num_bytes,
-														(PULONG_PTR) &di,
-														&overlapped,
-														INFINITE
-														);
-
-				if (_exit_requested)
-					break;
-
-				if (!ret) {
-#ifdef _DEBUG
-					DWORD error = ::GetLastError();
-					if(error != WAIT_TIMEOUT) {
-						std::string s = win_aux::get_last_error();
-						DEBUG_PRINT("[FolderMonitor] GetQueuedCompletionStatus failed (%s) ret(%d)", s.c_str(), ret);
-					}
-#endif
-					continue;
-				}
+			_references.fetch_add(1, std::memory_order_relaxed);
+		}
 
-				update_index = (update_index+1)%5;
-				DEBUG_PRINT("[FolderMonitor] Update, index(%d)", update_index);
-				// apparently numBytes can come back 0
-				if (di && num_bytes > 0) {
-					FILE_NOTIFY_INFORMATION *fni;
-					fni = (FILE_NOTIFY_INFORMATION*)di->buffer;
+		void release()
+		{
+			if(_references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				delete this;
+		}
 
-					DWORD offset;
-					do {
-						extract_changedata(fni, di, workbuffer);
-						offset = fni->NextEntryOffset;
-						fni = (FILE_NOTIFY_INFORMATION*)((LPBYTE) fni + offset);
-					} while(offset);
-				} else {
-					DEBUG_PRINT("[FolderMonitor] missing DirectoryInformation(%i), num_bytes (%u)", (di ? 0 : 1), (unsigned)num_bytes);
+		// on the strand
+		void on_completion(DirectoryInformation *di)
+		{
+			std::vector<char> &workbuffer = _workbuffer;
+			workbuffer.clear();
+
+			if(_exit_requested || !di->completion_ok) {
+				if(!_exit_requested) {
+					LOG_WARNING(npp::log::CATEGORY_MONITOR, "watch failed for %S, no longer monitored", di->directory_data.foldername);
+					_watch_failures.add();
+					_watched_directories.fetch_sub(1, std::memory_order_relaxed);
 				}
+				release(); // the watch
+				return;
+			}
 
-				if (di)	{
-					if(!issue_async_watch(di, DEFAULT_NOTIFY_FLAGS)) {
-#ifdef _DEBUG
-						std::string s = win_aux::get_last_error();
-						DEBUG_PRINT("[FolderMonitor] issue_async_watch failed (%s)", s.c_str());
-#endif
-					}
-				} else {
-					DEBUG_PRINT("[FolderMonitor] no DirectoryInformation");
-				}
+			const DWORD num_bytes = di->completed_bytes;
+			TRACE_SCOPE_ARG("monitor completion", "bytes", num_bytes);
 
-				if(!workbuffer.empty()) {
-					void *ud = _context.user_data;
+			_update_index = (_update_index+1)%5;
+			LOG_TRACE(npp::log::CATEGORY_MONITOR, "update, index(%u) %u bytes", _update_index, (unsigned)num_bytes);
+			// NOTE : 0 bytes, the changes did not fit the buffer and are lost
+			if(num_bytes == 0) {
+				_overflows.add();
+				LOG_WARNING(npp::log::CATEGORY_MONITOR, "changes in %S overflowed the buffer, lost", di->directory_data.foldername);
+			}
 
-					_context.notify_function(ud, &workbuffer[0], (unsigned)workbuffer.size());
-				}
+			if (num_bytes > 0) {
+				FILE_NOTIFY_INFORMATION *fni;
+				fni = (FILE_NOTIFY_INFORMATION*)di->buffer;
+
+				prefetch_metadata(fni, di);
+
+				TRACE_SCOPE("extract_changedata");
+				DWORD offset;
+				do {
+					extract_changedata(fni, di, _stat_cache, workbuffer);
+					offset = fni->NextEntryOffset;
+					fni = (FILE_NOTIFY_INFORMATION*)((LPBYTE) fni + offset);
+				} while(offset);
+			}
+
+			if(!issue_async_watch(di, DEFAULT_NOTIFY_FLAGS)) {
+				LOG_WARNING(npp::log::CATEGORY_MONITOR, "issue_async_watch failed (%s)", win_aux::get_last_error());
+				_watch_failures.add();
+				_watched_directories.fetch_sub(1, std::memory_order_relaxed);
+				release(); // no more completions for this directory
+			}
+
+			if(!workbuffer.empty()) {
+				void *ud = _context.user_data;
+				_notifications.add();
+
+				TRACE_SCOPE_ARG("monitor notify", "bytes", workbuffer.size());
+				_context.notify_function(ud, &workbuffer[0], (unsigned)workbuffer.size());
 			}
+		}
 
-			DEBUG_PRINT("[FolderMonitor] Exiting thread func!");
+		static void completion_task(void *d)
+		{
+			DirectoryInformation *di = (DirectoryInformation*)d;
+			di->monitor->on_completion(di);
 		}
 
+		// fetch metadata for the whole notification batch up front
+		void prefetch_metadata(FILE_NOTIFY_INFORMATION *fni, DirectoryInformation *di)
+		{
+			TRACE_SCOPE("prefetch_metadata");
+
+			const String &foldername = di->directory_data.foldername;
+			_prefetch_names.clear();
+
+			DWORD offset;
+			do {
+				const DWORD faction = fni->Action;
+				String fullname = foldername;
+				fullname.append(fni->FileName, fni->FileNameLength / sizeof(wchar_t));
+
+				// NOTE : every notification means the metadata changed, an entry of an earlier batch is stale
+				_stat_cache.invalidate(fullname);
+				if(faction != FILE_ACTION_REMOVED && faction != FILE_ACTION_RENAMED_OLD_NAME)
+					_prefetch_names.push_back(fullname);
+
+				offset = fni->NextEntryOffset;
+				fni = (FILE_NOTIFY_INFORMATION*)((LPBYTE) fni + offset);
+			} while(offset);
+
+			_stat_cache.prefetch(_prefetch_names);
+		}
+
+		// on the strand
 		void setup_filehandles()
 		{
+			HANDLE port = shared_completion_port();
+
 			for(unsigned i=0; i<directories.size();++i) {
 				DirectoryInformation *di = directories[i];
 				const wchar_t *directory = di->directory_data.foldername.c_str();
@@ -252,63 +457,83 @@ namespace {
 										FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, // FlagsAndAttributes
 										0);
 				if(h == INVALID_HANDLE_VALUE) {
-					DEBUG_PRINT("[FolderMonitor] Failed to create handle for : %S", directory);
-				} else {
-					DEBUG_PRINT("[FolderMonitor] SUCCESS to create handle for : %S", directory);
+					LOG_WARNING(npp::log::CATEGORY_MONITOR, "failed to create handle for %S", directory);
+					_watch_failures.add();
+					continue;
 				}
 
+				LOG_DEBUG(npp::log::CATEGORY_MONITOR, "watching %S", directory);
 				di->handle = h;
 
 				// fileHandle, ExistingCompletionPort,
 				// "The per-file completion key that is included in every I/O completion packet for the specified file",
 				// NumberOfConcurrentThreads
-				io_completion_port = ::CreateIoCompletionPort(h, io_completion_port, (ULONG_PTR) di, 0);
-
-				if (io_completion_port == INVALID_HANDLE_VALUE) {
-#ifdef _DEBUG
-					std::string s = win_aux::get_last_error();
-					DEBUG_PRINT("[FolderMonitor] CreateIoCompletionPort failed (%s)", s.c_str());
-#endif
+				if (!::CreateIoCompletionPort(h, port, (ULONG_PTR) di, 0)) {
+					LOG_WARNING(npp::log::CATEGORY_MONITOR, "CreateIoCompletionPort failed (%s)", win_aux::get_last_error());
 					::CloseHandle(h);
 					di->handle = INVALID_HANDLE_VALUE;
+					_watch_failures.add();
+					continue;
 				}
 
+				acquire(); // the watch
 				if(!issue_async_watch(di, DEFAULT_NOTIFY_FLAGS)) {
-#ifdef _DEBUG
-					std::string s = win_aux::get_last_error();
-					DEBUG_PRINT("[FolderMonitor] SetupFileHandles failed for %S : error(%s)", directory, s.c_str());
-#endif
+					LOG_WARNING(npp::log::CATEGORY_MONITOR, "issue_async_watch failed for %S (%s)", directory, win_aux::get_last_error());
 					::CloseHandle(h);
 					di->handle = INVALID_HANDLE_VALUE;
+					_watch_failures.add();
+					release();
+					continue;
 				}
+
+				_watched_directories.fetch_add(1, std::memory_order_relaxed);
 			}
 		}
 
+		// on the strand, pending watches complete (aborted) and let go of their references
+		void close_filehandles()
+		{
+			for(unsigned i=0; i<directories.size();++i) {
+				DirectoryInformation *di = directories[i];
+				if(di->handle != INVALID_HANDLE_VALUE) {
+					::CloseHandle(di->handle);
+					di->handle = INVALID_HANDLE_VALUE;
+				}
+			}
+			_watched_directories.store(0, std::memory_order_relaxed);
+		}
+
+		static void start_task(void *d)
+		{
+			FolderMonitor *fm = (FolderMonitor*)d;
+			if(!fm->_exit_requested)
+				fm->setup_filehandles();
+
+			fm->release();
+		}
+
+		static void stop_task(void *d)
+		{
+			FolderMonitor *fm = (FolderMonitor*)d;
+			fm->close_filehandles();
+			fm->release(); // owner
+		}
+
 		void start()
 		{
-			if(_thread)
+			if(_started)
 				return;
 
-			setup_filehandles();
+			_started = true;
 
-			_thread = npp::thread_create(FolderMonitor::run_tf, this);
-			npp::thread_start(_thread);
+			acquire(); // the task
+			npp::strand_post(_strand, FolderMonitor::start_task, this);
 		}
 
 		void stop()
 		{
 			_exit_requested = true;
-			if(_thread)
-				::PostQueuedCompletionStatus(io_completion_port, 0, 0, NULL);
-		}
-
-		static unsigned int  __stdcall run_tf(void *d)
-		{
-			FolderMonitor *fm = (FolderMonitor*)d;
-			fm->run();
-			delete fm;
-			DEBUG_PRINT("[FolderMonitor] thread exiting!");
-			return 0;
+			npp::strand_post(_strand, FolderMonitor::stop_task, this);
 		}
 
 		void add_directories(Json::Value const &dirs)
@@ -330,18 +555,86 @@ namespace {
 					mdd.include_filter = (include_filter ? string_util::to_wide(include_filter) : L"");
 					mdd.exclude_filter = (exclude_filter ? string_util::to_wide(exclude_filter) : L"");
 					mdd.recursive = recursive;
-					directories.push_back(new DirectoryInformation(mdd));
+					directories.push_back(new DirectoryInformation(this, mdd));
 				}
 			}
 		}
 
-		HANDLE io_completion_port;
+		static npp::WaitGroup live_monitors;
+
 		folder_monitor::RegisterContext _context;
-		bool _exit_requested;
-		npp::Thread *_thread;
+		std::atomic<bool> _exit_requested;
+		bool _started;
+
+		npp::Strand *_strand;
+		std::atomic<unsigned> _references;
+
+		unsigned _update_index;
+		std::vector<char> _workbuffer;
+
+		StatCache _stat_cache;
+		std::vector<String> _prefetch_names;
 
 		std::vector<DirectoryInformation *> directories;
+
+		stats::Counter _notifications;
+		stats::Counter _overflows;
+		stats::Counter _watch_failures;
+		std::atomic<unsigned> _watched_directories;
 	};
+
+	npp::WaitGroup FolderMonitor::live_monitors;
+
+	unsigned int __stdcall completion_dispatch_tf(void *p)
+	{
+		HANDLE port = (HANDLE)p;
+
+		while(true) {
+			DWORD num_bytes = 0;
+			DirectoryInformation *di = 0;
+			OVERLAPPED *overlapped = 0;
+
+			// GetQueuedCompletionStatus will stall until something is available
+			BOOL ret = ::GetQueuedCompletionStatus(	port,
+													&num_bytes,
+													(PULONG_PTR) &di,
+													&overlapped,
+													INFINITE
+													);
+
+			if(!overlapped || !di) {
+				LOG_WARNING(npp::log::CATEGORY_MONITOR, "GetQueuedCompletionStatus failed (%s) ret(%d)", win_aux::get_last_error(), ret);
+				continue;
+			}
+
+			// NOTE : a failed completion (ex. handle closed on stop) still has to reach the monitor
+			di->completed_bytes = (ret ? num_bytes : 0);
+			di->completion_ok = (ret != 0);
+
+			npp::strand_post(di->monitor->_strand, FolderMonitor::completion_task, di);
+		}
+
+		return 0;
+	}
+
+	HANDLE create_completion_dispatcher()
+	{
+		HANDLE port = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, 0, 0, 1);
+
+		// NOTE : lives as long as the process, idle once the monitors are gone
+		npp::Thread *t = npp::thread_create(completion_dispatch_tf, port);
+		npp::thread_start(t);
+		npp::thread_stop(t);
+		npp::thread_destroy(t);
+
+		return port;
+	}
+
+	HANDLE shared_completion_port()
+	{
+		static HANDLE port = create_completion_dispatcher();
+		return port;
+	}
 }
 
 namespace folder_monitor {
@@ -353,21 +646,26 @@ namespace folder_monitor {
 	void deallocate(FolderMonitorHandle h)
 	{
 		FolderMonitor *fm = (FolderMonitor*)h;
-		if(fm->_thread)
+		if(fm->_started)
 			return stop(h);
 
-		delete fm;
+		fm->release();
 	}
 
 	void stop(FolderMonitorHandle h)
 	{
 		FolderMonitor *fm = (FolderMonitor*)h;
-		if(!fm->_thread)
+		if(!fm->_started)
 			return deallocate(h);
 
 		fm->stop();
 	}
 
+	bool join(unsigned ms)
+	{
+		return FolderMonitor::live_monitors.wait(ms);
+	}
+
 	void start(FolderMonitorHandle h)
 	{
 		FolderMonitor *fm = (FolderMonitor*)h;
@@ -385,6 +683,16 @@ namespace folder_monitor {
 		internal::add_directory(d);
 	}
 
+	void get_counters(FolderMonitorHandle h, Counters &c)
+	{
+		FolderMonitor *fm = (FolderMonitor*)h;
+		c.notifications = fm->_notifications.get();
+		c.overflows = fm->_overflows.get();
+		c.rescans = 0; // NOTE : lost changes are not recovered, the next parse of the solution picks them up
+		c.watch_failures = fm->_watch_failures.get();
+		c.watched_directories = fm->_watched_directories.load(std::memory_order_relaxed);
+	}
+
 }
 
 namespace {
@@ -402,59 +710,12 @@ namespace {
 		return NOTIFY_ACTION_STRING[a];
 	}
 
-	bool last_modified_time(FILETIME &res, const wchar_t *full_path)
-	{
-		WIN32_FIND_DATAW fd;
-		HANDLE h = ::FindFirstFileW(full_path, &fd);
-		if(h == INVALID_HANDLE_VALUE) {
-#ifdef _DEBUG
-			std::string s = win_aux::get_last_error();
-#endif
-			return false;
-		}
-		res = fd.ftLastWriteTime;
-		::FindClose(h);
-		return true;
-	}
-
-	bool creation_time(FILETIME &res, const wchar_t *full_path)
-	{
-		WIN32_FIND_DATAW fd;
-		HANDLE h = ::FindFirstFileW(full_path, &fd);
-		if(h == INVALID_HANDLE_VALUE) {
-#ifdef _DEBUG
-			std::string s = win_aux::get_last_error();
-#endif
-			return false;
-		}
-		res = fd.ftCreationTime;
-		::FindClose(h);
-		return true;
-	}
-
 	void local_time(SYSTEMTIME &lt)
 	{
 		::GetLocalTime(&lt);
 	}
 
-	bool is_directory(const std::wstring &full_path)
-	{
-		WIN32_FIND_DATAW fd;
-
-		HANDLE h = FindFirstFileW(full_path.c_str(), &fd);
-		if(h == INVALID_HANDLE_VALUE) {
-#ifdef _DEBUG
-			std::string s = win_aux::get_last_error();
-			int breakpoint = 0;
-			breakpoint = 1;
-#endif
-		}
-		bool res = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-		::FindClose(h);
-		return res;
-	}
-
-	void extract_changedata(FILE_NOTIFY_INFORMATION *fni, DirectoryInformation *di, std::vector<char> &buffer)
+	void extract_changedata(FILE_NOTIFY_INFORMATION *fni, DirectoryInformation *di, StatCache &stat_cache, std::vector<char> &buffer)
 	{
 		using namespace npp;
 
@@ -490,17 +751,19 @@ namespace {
 				bool is_seen = internal::seen_directory(TEMP);
 				if(is_seen) {
 					if(removed) {
-						internal::remove_directory(TEMP);
 						if(faction == FILE_ACTION_RENAMED_OLD_NAME) {
-							// cache and wait for 'FILE_ACTION_RENAMED_NEW_NAME'
+							// cache and wait for 'FILE_ACTION_RENAMED_NEW_NAME', the
+							// subtree is kept until then and moved by 'rename_directory'
 							rc.push_back(fullname);
+						} else {
+							internal::remove_directory(TEMP);
 						}
 					}
-					DEBUG_PRINT("[FolderMonitor] Directory record(%S). Action(%s)", fullname.c_str(), fni_action_type(action));
+					LOG_TRACE(npp::log::CATEGORY_MONITOR, "directory record(%S), action(%s)", fullname, fni_action_type(action));
 					return;
 				}
 			}
-		} else if(is_directory(fullname)) {
+		} else if((stat_cache.lookup(fullname).attributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
 			if(added) {
 				String renamed_dir;
 
@@ -513,7 +776,7 @@ namespace {
 
 						while(i != rc.end()) {
 							if(string_util::wstristr(i->c_str(), tcstr) != 0) {
-								DEBUG_PRINT("FOUND CACHED DIRECTORY RENAMED FROM(%S) -> TO(%S)", i->c_str(), fullname.c_str());
+								LOG_DEBUG(npp::log::CATEGORY_MONITOR, "cached directory renamed from(%S) to(%S)", *i, fullname);
 
 								{
 									wchar_t null(0);
@@ -574,7 +837,7 @@ namespace {
 				}
 
 			}
-			DEBUG_PRINT("[FolderMonitor] Directory record(%S), dismissing!. Action(%s)", fullname.c_str(), fni_action_type(action));
+			LOG_TRACE(npp::log::CATEGORY_MONITOR, "directory record(%S) dismissed, action(%s)", fullname, fni_action_type(action));
 			return;
 		}
 
@@ -594,7 +857,7 @@ namespace {
 				}
 
 				if(!include) {
-					DEBUG_PRINT("[FolderMonitor] Filter mismatch for file(%S), bailing", file_name_wstr.c_str());
+					LOG_TRACE(npp::log::CATEGORY_MONITOR, "filter mismatch for file(%S)", file_name_wstr);
 					return;
 				}
 			}
@@ -606,13 +869,11 @@ namespace {
 
 		unsigned datestring_len = 16;
 		if(added || modified) {
-			const wchar_t *full_path = fullname.c_str();
-
 			header = (added ? filerepo_headers::CHANGE_ADD : filerepo_headers::CHANGE_UPDATE);
 
-			FILETIME ft;
-			bool r = (added ? creation_time(ft, full_path) : last_modified_time(ft, full_path));
-			if(r) {
+			const StatRecord &sr = stat_cache.lookup(fullname);
+			if(sr.exists) {
+				const FILETIME &ft = (added ? sr.creation_time : sr.last_write_time);
 				filerepo::make_internal_datestring_ft(datestring, &ft);
 			} else {
 				SYSTEMTIME lt;
@@ -627,9 +888,8 @@ namespace {
 		const wchar_t *fullname_c = fullname.c_str();
 		filerepo::aux::pack_changeheader(buffer, header, fullname_c, datestring_len, datestring);
 
-		#ifdef _DEBUG
-			const char *actionstring = fni_action_type(action);
-			DEBUG_PRINT("[FolderMonitor] Change (%s) for file (%S), date(%S)\n", actionstring, fullname.c_str(), datestring);
-		#endif
+		LOG_TRACE(npp::log::CATEGORY_MONITOR, "change (%s) for file (%S), date(%S)", fni_action_type(action), fullname, datestring);
 	}
 }
+
+#endif // _WIN32
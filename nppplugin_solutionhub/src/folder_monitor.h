@@ -6,15 +6,21 @@ namespace Json {
 
 typedef void* FolderMonitorHandle;
 typedef void (*notfify_callback)(void*, void*, unsigned);
+typedef void (*release_callback)(void*);
 
 namespace folder_monitor {
 
 	// global, help out if(folder monitor does not traverse)
 	void add_directory(const wchar_t *d);
 
+	/*
+	 *	'notify_function' is called from the thread pool (never concurrently),
+	 *	'release_function' once the monitor is gone, nothing is called after it.
+	 */
 	struct RegisterContext {
 		void *user_data;
 		notfify_callback notify_function;
+		release_callback release_function;
 	};
 
 	FolderMonitorHandle allocate(RegisterContext*);
@@ -25,4 +31,18 @@ namespace folder_monitor {
 	void start(FolderMonitorHandle);
 	void stop(FolderMonitorHandle);
 
+	// waits for every stopped monitor to be gone, returns false if 'ms' passed first
+	bool join(unsigned ms);
+
+	struct Counters {
+		unsigned long long notifications;		// batches of changes handed to 'notify_function'
+		unsigned long long overflows;			// the OS dropped changes (queue/buffer full)
+		unsigned long long rescans;				// monitored directories scanned again (after an overflow)
+		unsigned long long watch_failures;		// directories that could not be watched
+		unsigned long long watched_directories;	// currently
+	};
+
+	// callable from any thread while the monitor is not deallocated/stopped
+	void get_counters(FolderMonitorHandle, Counters&);
+
 }
@@ -0,0 +1,782 @@
+#include "folder_monitor.h"
+
+#if !defined(_WIN32)
+
+#include "directory_trie.h"
+#include "file_repository_common.h"
+#include "stats.h"
+#include "stream.h"
+
+#include "json/json.h"
+#include "log/log.h"
+#include "string/string_utils.h"
+#include "thread/critical_section.h"
+#include "thread/thread.h"
+#include "thread/thread_pool.h"
+#include "thread/wait_group.h"
+#include "trace/trace.h"
+
+#include <atomic>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <time.h>
+
+#if defined(__linux__)
+	#include <dirent.h>
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <sys/epoll.h>
+	#include <sys/inotify.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+typedef std::wstring String;
+
+namespace {
+	// shared by all monitors and repositories
+	DirectoryTrie global_directories;
+
+	npp::WaitGroup live_monitors;
+}
+
+#if defined(__linux__)
+
+/*
+ *	inotify backend.
+ *
+ *	inotify is not recursive, every directory below a monitored one gets a watch
+ *	(see /proc/sys/fs/inotify/max_user_watches). Directories created or moved in
+ *	are watched and scanned as they show up, their files are reported as added.
+ *
+ *	The monitors share one epoll instance and the thread waiting on it, a readable
+ *	inotify descriptor is read on the monitor's strand (thread pool) and armed
+ *	again (one shot) once it is drained.
+ *
+ *	When the kernel queue overflows (/proc/sys/fs/inotify/max_queued_events) the
+ *	monitored directories are removed from the index (CHANGE_DIRECTORY_REMOVE) and
+ *	scanned again. Directories moved out of the monitored tree are removed the same way.
+ */
+namespace {
+	const uint32_t WATCH_MASK =
+		IN_CREATE |
+		IN_DELETE |
+		IN_CLOSE_WRITE |
+		IN_MOVED_FROM |
+		IN_MOVED_TO |
+		IN_DONT_FOLLOW |
+		IN_EXCL_UNLINK |
+		IN_ONLYDIR;
+
+	// read per strand task, the rest is picked up by the next one
+	const unsigned READ_BUFFER_SIZE = (64*1024);
+	const unsigned MAX_READ_PER_TASK = (1024*1024);
+
+	struct MonitorDirectoryData {
+		String foldername;
+		String include_filter;
+		String exclude_filter;
+
+		bool recursive;
+	};
+
+	struct Watch {
+		String directory; // with a trailing slash
+		unsigned root;    // index in 'FolderMonitor::roots'
+	};
+
+	bool skip_directory(const char *name)
+	{
+		// NOTE : like the parser
+		return name[0] == '.' || name[0] == '$';
+	}
+
+	bool include_file(const MonitorDirectoryData &mdd, const wchar_t *file_name)
+	{
+		const wchar_t *include_filter = (mdd.include_filter.empty() ? 0 : mdd.include_filter.c_str());
+		const wchar_t *exclude_filter = (mdd.exclude_filter.empty() ? 0 : mdd.exclude_filter.c_str());
+		if(!include_filter && !exclude_filter)
+			return true;
+
+		// NOTE : like the Windows monitor, files without an extension pass
+		const wchar_t *e = file_util::fileextension(file_name, false);
+		if(!e)
+			return true;
+
+		return (include_filter ? string_util::contains_tokens(e, include_filter, false, L'.') : !string_util::contains_tokens(e, exclude_filter, false, L'.'));
+	}
+
+	void pack_file_change(std::vector<char> &buffer, unsigned header, const String &fullname, const struct stat *st)
+	{
+		if(header == filerepo_headers::CHANGE_REMOVE) {
+			filerepo::aux::pack_changeheader(buffer, header, fullname.c_str(), 0, 0);
+			return;
+		}
+
+		wchar_t datestring[17] = {};
+		filerepo::make_internal_datestring_time(datestring, st ? (long long)st->st_mtime : (long long)time(0));
+		filerepo::aux::pack_changeheader(buffer, header, fullname.c_str(), 16, datestring);
+	}
+
+	struct FolderMonitor;
+
+	/*
+	 *	epoll instance and its thread, live as long as the process.
+	 *	Monitors are registered by id, the thread never touches a monitor it can not find.
+	 */
+	struct Dispatcher {
+		Dispatcher() : epoll(-1), next_id(1) {}
+
+		npp::CriticalSection lock;
+		int epoll;
+		unsigned next_id;
+		std::map<unsigned, FolderMonitor*> monitors;
+	};
+
+	Dispatcher &shared_dispatcher();
+
+	/*
+	 *	Reference counted : the owner and every readiness posted to the strand hold
+	 *	a reference, the last one to let go deletes the monitor.
+	 */
+	struct FolderMonitor {
+		FolderMonitor(folder_monitor::RegisterContext *ctx)
+			:_context(*ctx)
+			,_exit_requested(false)
+			,_started(false)
+			,_strand(npp::strand_create())
+			,_references(1) // owner
+			,_fd(-1)
+			,_id(0)
+			,_watched_directories(0)
+		{
+			live_monitors.add();
+		}
+
+		~FolderMonitor()
+		{
+			npp::strand_destroy(_strand);
+
+			if(_context.release_function)
+				_context.release_function(_context.user_data);
+
+			live_monitors.done();
+		}
+
+		void acquire()
+		{
+			_references.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void release()
+		{
+			if(_references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				delete this;
+		}
+
+		//////////////////////////////////////////////////////////////////////////
+		// watches, on the strand
+
+		void watch_tree(const String &directory, unsigned root, bool scan, std::vector<char> &buffer)
+		{
+			const MonitorDirectoryData &mdd = roots[root];
+
+			std::vector<String> pending(1, directory);
+			while(!pending.empty()) {
+				String d = pending.back();
+				pending.pop_back();
+				file_util::append_slash(d);
+
+				const std::string narrow = string_util::from_wide(d.c_str());
+				const int wd = inotify_add_watch(_fd, narrow.c_str(), WATCH_MASK);
+				if(wd < 0) {
+					// NOTE : gone already is fine, anything else (ex. out of watches) is not
+					if(errno != ENOENT && errno != ENOTDIR) {
+						if(_watch_failures.get() == 0)
+							LOG_WARNING(npp::log::CATEGORY_MONITOR, "could not watch %S (%s), see /proc/sys/fs/inotify/max_user_watches", d, strerror(errno));
+						_watch_failures.add();
+					}
+					continue;
+				}
+
+				Watch &w = _watches[wd];
+				if(w.directory.empty())
+					_watched_directories.fetch_add(1, std::memory_order_relaxed);
+				w.directory = d;
+				w.root = root;
+
+				global_directories.insert(d.c_str());
+
+				DIR *dir = opendir(narrow.c_str());
+				if(!dir)
+					continue;
+
+				while(struct dirent *e = readdir(dir)) {
+					struct stat st;
+					if(fstatat(dirfd(dir), e->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+						continue;
+
+					if(S_ISDIR(st.st_mode)) {
+						if(mdd.recursive && !skip_directory(e->d_name))
+							pending.push_back(d+string_util::to_wide(e->d_name));
+					} else if(scan) {
+						const String name = string_util::to_wide(e->d_name);
+						if(!include_file(mdd, name.c_str()))
+							continue;
+
+						// NOTE : added by an earlier scan already (a directory created while rescanning)
+						const String fullname = d+name;
+						if(_scanned_previous.count(fullname))
+							continue;
+
+						pack_file_change(buffer, filerepo_headers::CHANGE_ADD, fullname, &st);
+						_scanned.insert(fullname);
+					}
+				}
+				closedir(dir);
+			}
+		}
+
+		void unwatch_tree(const String &directory)
+		{
+			std::map<int, Watch>::iterator i(_watches.begin());
+			while(i != _watches.end()) {
+				if(i->second.directory.compare(0, directory.length(), directory) == 0) {
+					inotify_rm_watch(_fd, i->first);
+					_watched_directories.fetch_sub(1, std::memory_order_relaxed);
+					i = _watches.erase(i);
+				} else {
+					++i;
+				}
+			}
+		}
+
+		// watches follow the directory, only their names change
+		void rename_tree(const String &from, const String &to)
+		{
+			std::map<int, Watch>::iterator i(_watches.begin()), end(_watches.end());
+			for(; i!=end; ++i) {
+				String &d = i->second.directory;
+				if(d.compare(0, from.length(), from) == 0)
+					d = to+d.substr(from.length());
+			}
+		}
+
+		// after an overflow, every monitored directory dropped from the index and its files added again
+		void rescan(std::vector<char> &buffer)
+		{
+			TRACE_SCOPE("monitor rescan");
+			_rescans.add();
+
+			_scanned.clear();
+			_scanned_previous.clear();
+			for(unsigned r=0; r<roots.size(); ++r) {
+				String root = roots[r].foldername;
+				file_util::append_slash(root);
+
+				filerepo::aux::pack_directory_remove(buffer, root);
+				watch_tree(root, r, true, buffer);
+			}
+		}
+
+		//////////////////////////////////////////////////////////////////////////
+		// events, on the strand
+
+		struct MovedDirectory {
+			String from;
+			unsigned root;
+		};
+
+		void on_event(const struct inotify_event *e, std::map<uint32_t, MovedDirectory> &moved, std::vector<char> &buffer, bool &overflow)
+		{
+			if(e->mask & IN_Q_OVERFLOW) {
+				overflow = true;
+				return;
+			}
+
+			if(e->mask & IN_IGNORED) {
+				if(_watches.erase(e->wd))
+					_watched_directories.fetch_sub(1, std::memory_order_relaxed);
+				return;
+			}
+
+			std::map<int, Watch>::const_iterator w = _watches.find(e->wd);
+			if(w == _watches.end() || !e->len)
+				return;
+
+			const Watch watch = w->second; // NOTE : '_watches' changes below
+			const MonitorDirectoryData &mdd = roots[watch.root];
+
+			const String name = string_util::to_wide(e->name);
+			String fullname = watch.directory+name;
+
+			if(e->mask & IN_ISDIR) {
+				if(skip_directory(e->name) || !mdd.recursive)
+					return;
+
+				file_util::append_slash(fullname);
+
+				if(e->mask & IN_CREATE) {
+					LOG_TRACE(npp::log::CATEGORY_MONITOR, "directory created (%S)", fullname);
+					watch_tree(fullname, watch.root, true, buffer);
+				} else if(e->mask & IN_DELETE) {
+					LOG_TRACE(npp::log::CATEGORY_MONITOR, "directory removed (%S)", fullname);
+					global_directories.remove(fullname.c_str());
+				} else if(e->mask & IN_MOVED_FROM) {
+					// NOTE : 'IN_MOVED_TO' with the same cookie follows, unless moved out
+					MovedDirectory &m = moved[e->cookie];
+					m.from = fullname;
+					m.root = watch.root;
+				} else if(e->mask & IN_MOVED_TO) {
+					std::map<uint32_t, MovedDirectory>::iterator m = moved.find(e->cookie);
+					if(m != moved.end()) {
+						LOG_DEBUG(npp::log::CATEGORY_MONITOR, "directory renamed from(%S) to(%S)", m->second.from, fullname);
+						filerepo::aux::pack_directory_rename(buffer, m->second.from, fullname);
+						rename_tree(m->second.from, fullname);
+						global_directories.rename(m->second.from.c_str(), fullname.c_str());
+						moved.erase(m);
+					} else {
+						LOG_TRACE(npp::log::CATEGORY_MONITOR, "directory moved in (%S)", fullname);
+						watch_tree(fullname, watch.root, true, buffer);
+					}
+				}
+				return;
+			}
+
+			if(!include_file(mdd, name.c_str())) {
+				LOG_TRACE(npp::log::CATEGORY_MONITOR, "filter mismatch for file(%S)", name);
+				return;
+			}
+
+			unsigned header;
+			if(e->mask & (IN_CREATE|IN_MOVED_TO)) {
+				if((e->mask & IN_CREATE) && (_scanned.erase(fullname) || _scanned_previous.erase(fullname)))
+					return; // added by the scan of its directory
+
+				header = filerepo_headers::CHANGE_ADD;
+				_added.insert(fullname);
+			} else if(e->mask & IN_CLOSE_WRITE) {
+				// NOTE : dated when added, an update in between would split the adds of the task into one rewrite each
+				if(_added.count(fullname) || _scanned.count(fullname))
+					return;
+
+				header = filerepo_headers::CHANGE_UPDATE;
+			} else {
+				header = filerepo_headers::CHANGE_REMOVE;
+				_scanned.erase(fullname); // created again later is new
+				_scanned_previous.erase(fullname);
+				_added.erase(fullname);
+			}
+
+			struct stat st;
+			const bool exists = (header != filerepo_headers::CHANGE_REMOVE && lstat(string_util::from_wide(fullname.c_str()).c_str(), &st) == 0);
+			pack_file_change(buffer, header, fullname, exists ? &st : 0);
+
+			LOG_TRACE(npp::log::CATEGORY_MONITOR, "change (%u) for file (%S)", header, fullname);
+		}
+
+		void on_readable()
+		{
+			if(_exit_requested || _fd < 0)
+				return;
+
+			std::vector<char> &workbuffer = _workbuffer;
+			workbuffer.clear();
+
+			_scanned_previous.insert(_scanned.begin(), _scanned.end());
+			_scanned.clear();
+			_added.clear();
+
+			std::map<uint32_t, MovedDirectory> moved;
+			bool overflow = false;
+
+			TRACE_SCOPE("monitor events");
+
+			bool drained = false;
+			unsigned num_read = 0;
+			alignas(struct inotify_event) char events[READ_BUFFER_SIZE];
+			while(num_read < MAX_READ_PER_TASK) {
+				const ssize_t n = read(_fd, events, sizeof(events));
+				if(n <= 0) {
+					if(n < 0 && errno != EAGAIN && errno != EINTR)
+						LOG_WARNING(npp::log::CATEGORY_MONITOR, "reading changes failed (%s)", strerror(errno));
+					drained = true;
+					break;
+				}
+
+				num_read += (unsigned)n;
+
+				const char *p = events;
+				while(p < events+n) {
+					const struct inotify_event *e = (const struct inotify_event*)p;
+					on_event(e, moved, workbuffer, overflow);
+					p += sizeof(struct inotify_event)+e->len;
+				}
+			}
+
+			// moved out of the monitored tree (or the pair was split between reads)
+			std::map<uint32_t, MovedDirectory>::const_iterator m(moved.begin()), mend(moved.end());
+			for(; m!=mend; ++m) {
+				LOG_DEBUG(npp::log::CATEGORY_MONITOR, "directory moved out (%S)", m->second.from);
+				filerepo::aux::pack_directory_remove(workbuffer, m->second.from);
+				unwatch_tree(m->second.from);
+				global_directories.remove(m->second.from.c_str());
+			}
+
+			// every change queued before the scans of earlier tasks has been seen
+			if(drained)
+				_scanned_previous.clear();
+
+			if(overflow) {
+				_overflows.add();
+				LOG_WARNING(npp::log::CATEGORY_MONITOR, "change queue overflowed, scanning the monitored directories again");
+
+				// NOTE : the changes read so far are superseded by the scan
+				workbuffer.clear();
+				rescan(workbuffer);
+			}
+
+			if(!workbuffer.empty()) {
+				_notifications.add();
+
+				TRACE_SCOPE_ARG("monitor notify", "bytes", workbuffer.size());
+				_context.notify_function(_context.user_data, &workbuffer[0], (unsigned)workbuffer.size());
+			}
+		}
+
+		//////////////////////////////////////////////////////////////////////////
+		// lifecycle
+
+		static void readable_task(void *d)
+		{
+			FolderMonitor *fm = (FolderMonitor*)d;
+			fm->on_readable();
+			fm->arm();
+			fm->release(); // the readiness
+		}
+
+		// on the strand (or before the descriptor is registered)
+		void arm()
+		{
+			if(_exit_requested || _fd < 0)
+				return;
+
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN | EPOLLONESHOT;
+			ev.data.u32 = _id;
+			if(epoll_ctl(shared_dispatcher().epoll, EPOLL_CTL_MOD, _fd, &ev) != 0)
+				LOG_WARNING(npp::log::CATEGORY_MONITOR, "could not wait for changes (%s)", strerror(errno));
+		}
+
+		void setup_watches()
+		{
+			_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if(_fd < 0) {
+				LOG_WARNING(npp::log::CATEGORY_MONITOR, "inotify_init1 failed (%s), see /proc/sys/fs/inotify/max_user_instances", strerror(errno));
+				_watch_failures.add();
+				return;
+			}
+
+			std::vector<char> ignored;
+			for(unsigned r=0; r<roots.size(); ++r) {
+				LOG_DEBUG(npp::log::CATEGORY_MONITOR, "watching %S", roots[r].foldername);
+				watch_tree(roots[r].foldername, r, false, ignored);
+			}
+
+			Dispatcher &d = shared_dispatcher();
+			{
+				npp::CriticalSectionScope s(d.lock);
+				_id = d.next_id++;
+				d.monitors[_id] = this;
+			}
+
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN | EPOLLONESHOT;
+			ev.data.u32 = _id;
+			if(epoll_ctl(d.epoll, EPOLL_CTL_ADD, _fd, &ev) != 0)
+				LOG_WARNING(npp::log::CATEGORY_MONITOR, "could not wait for changes (%s)", strerror(errno));
+		}
+
+		void close_watches()
+		{
+			if(_id) {
+				Dispatcher &d = shared_dispatcher();
+				npp::CriticalSectionScope s(d.lock);
+				d.monitors.erase(_id);
+				_id = 0;
+			}
+
+			if(_fd >= 0) {
+				epoll_ctl(shared_dispatcher().epoll, EPOLL_CTL_DEL, _fd, 0);
+				close(_fd); // the watches go with it
+				_fd = -1;
+			}
+
+			_watches.clear();
+			_watched_directories.store(0, std::memory_order_relaxed);
+		}
+
+		static void start_task(void *d)
+		{
+			FolderMonitor *fm = (FolderMonitor*)d;
+			if(!fm->_exit_requested)
+				fm->setup_watches();
+
+			fm->release();
+		}
+
+		static void stop_task(void *d)
+		{
+			FolderMonitor *fm = (FolderMonitor*)d;
+			fm->close_watches();
+			fm->release(); // owner
+		}
+
+		void start()
+		{
+			if(_started)
+				return;
+
+			_started = true;
+
+			acquire(); // the task
+			npp::strand_post(_strand, FolderMonitor::start_task, this);
+		}
+
+		void stop()
+		{
+			_exit_requested = true;
+			npp::strand_post(_strand, FolderMonitor::stop_task, this);
+		}
+
+		void add_directories(Json::Value const &dirs)
+		{
+			for(unsigned i=0; i<dirs.size(); ++i) {
+				const Json::Value &dir = dirs[i];
+				const bool monitored = (dir["monitored"].isBool() ? dir["monitored"].asBool() : false);
+				if(!monitored || !dir["path"].isString())
+					continue;
+
+				MonitorDirectoryData mdd;
+				mdd.foldername = string_util::to_wide(dir["path"].asCString());
+				file_util::append_slash(mdd.foldername);
+
+				mdd.include_filter = (dir["include_filter"].isString() ? string_util::to_wide(dir["include_filter"].asCString()) : L"");
+				mdd.exclude_filter = (dir["exclude_filter"].isString() ? string_util::to_wide(dir["exclude_filter"].asCString()) : L"");
+				mdd.recursive = (dir["recursive"].isBool() ? dir["recursive"].asBool() : false);
+				roots.push_back(mdd);
+			}
+		}
+
+		folder_monitor::RegisterContext _context;
+		std::atomic<bool> _exit_requested;
+		bool _started;
+
+		npp::Strand *_strand;
+		std::atomic<unsigned> _references;
+
+		int _fd;
+		unsigned _id; // in the dispatcher
+
+		std::vector<MonitorDirectoryData> roots;
+		std::map<int, Watch> _watches;
+		std::vector<char> _workbuffer;
+
+		// files reported by the scan of a new directory, their creation can be queued still (once)
+		std::set<String> _scanned;			// scans of this task
+		std::set<String> _scanned_previous;	// until the queue is drained
+
+		std::set<String> _added; // by the changes of this task
+
+		stats::Counter _notifications;
+		stats::Counter _overflows;
+		stats::Counter _rescans;
+		stats::Counter _watch_failures;
+		std::atomic<unsigned> _watched_directories;
+	};
+
+	unsigned int __stdcall dispatch_tf(void *p)
+	{
+		Dispatcher &d = *(Dispatcher*)p;
+
+		struct epoll_event events[64];
+		while(true) {
+			const int n = epoll_wait(d.epoll, events, 64, -1);
+			if(n < 0) {
+				if(errno != EINTR)
+					LOG_WARNING(npp::log::CATEGORY_MONITOR, "epoll_wait failed (%s)", strerror(errno));
+				continue;
+			}
+
+			for(int i=0; i<n; ++i) {
+				FolderMonitor *fm = 0;
+				{
+					npp::CriticalSectionScope s(d.lock);
+					std::map<unsigned, FolderMonitor*>::const_iterator m = d.monitors.find(events[i].data.u32);
+					if(m != d.monitors.end()) {
+						fm = m->second;
+						fm->acquire(); // the readiness
+					}
+				}
+
+				if(fm)
+					npp::strand_post(fm->_strand, FolderMonitor::readable_task, fm);
+			}
+		}
+
+		return 0;
+	}
+
+	Dispatcher *create_dispatcher()
+	{
+		Dispatcher *d = new Dispatcher;
+		d->epoll = epoll_create1(EPOLL_CLOEXEC);
+
+		// NOTE : lives as long as the process, idle once the monitors are gone
+		npp::Thread *t = npp::thread_create(dispatch_tf, d);
+		npp::thread_start(t);
+		npp::thread_stop(t);
+		npp::thread_destroy(t);
+
+		return d;
+	}
+
+	Dispatcher &shared_dispatcher()
+	{
+		static Dispatcher *d = create_dispatcher();
+		return *d;
+	}
+}
+
+namespace folder_monitor {
+	FolderMonitorHandle allocate(RegisterContext *rc)
+	{
+		return new FolderMonitor(rc);
+	}
+
+	void deallocate(FolderMonitorHandle h)
+	{
+		FolderMonitor *fm = (FolderMonitor*)h;
+		if(fm->_started)
+			return stop(h);
+
+		fm->release();
+	}
+
+	void stop(FolderMonitorHandle h)
+	{
+		FolderMonitor *fm = (FolderMonitor*)h;
+		if(!fm->_started)
+			return deallocate(h);
+
+		fm->stop();
+	}
+
+	bool join(unsigned ms)
+	{
+		return live_monitors.wait(ms);
+	}
+
+	void start(FolderMonitorHandle h)
+	{
+		FolderMonitor *fm = (FolderMonitor*)h;
+		fm->start();
+	}
+
+	void add_solutions(FolderMonitorHandle h, Json::Value const &dirs)
+	{
+		FolderMonitor *fm = (FolderMonitor*)h;
+		fm->add_directories(dirs);
+	}
+
+	void add_directory(const wchar_t *d)
+	{
+		global_directories.insert(d);
+	}
+
+	void get_counters(FolderMonitorHandle h, Counters &c)
+	{
+		FolderMonitor *fm = (FolderMonitor*)h;
+		c.notifications = fm->_notifications.get();
+		c.overflows = fm->_overflows.get();
+		c.rescans = fm->_rescans.get();
+		c.watch_failures = fm->_watch_failures.get();
+		c.watched_directories = fm->_watched_directories.load(std::memory_order_relaxed);
+	}
+}
+
+#else // __linux__
+
+/*
+ *	Change notification is not implemented on other platforms, a monitor keeps the
+ *	contract of the others (the release callback runs once it is stopped) so the
+ *	file repository works unchanged, it just never sees changes.
+ */
+namespace {
+	struct FolderMonitor {
+		folder_monitor::RegisterContext context;
+	};
+
+	void destroy(FolderMonitor *fm)
+	{
+		if(fm->context.release_function)
+			fm->context.release_function(fm->context.user_data);
+
+		delete fm;
+		live_monitors.done();
+	}
+}
+
+namespace folder_monitor {
+	FolderMonitorHandle allocate(RegisterContext *rc)
+	{
+		live_monitors.add();
+
+		FolderMonitor *fm = new FolderMonitor();
+		fm->context = *rc;
+		return fm;
+	}
+
+	void deallocate(FolderMonitorHandle h)
+	{
+		destroy((FolderMonitor*)h);
+	}
+
+	void stop(FolderMonitorHandle h)
+	{
+		destroy((FolderMonitor*)h);
+	}
+
+	bool join(unsigned ms)
+	{
+		return live_monitors.wait(ms);
+	}
+
+	void start(FolderMonitorHandle)
+	{
+		LOG_INFO(npp::log::CATEGORY_MONITOR, "folder monitoring is not available on this platform");
+	}
+
+	void add_solutions(FolderMonitorHandle, Json::Value const&)
+	{
+	}
+
+	void add_directory(const wchar_t *d)
+	{
+		global_directories.insert(d);
+	}
+
+	void get_counters(FolderMonitorHandle, Counters &c)
+	{
+		memset(&c, 0, sizeof(c));
+	}
+}
+
+#endif // __linux__
+
+#endif // !_WIN32
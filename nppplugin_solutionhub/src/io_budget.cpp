@@ -0,0 +1,156 @@
+#include "io_budget.h"
+
+#include "json/json.h"
+
+namespace {
+	const double LATENCY_WEIGHT = 0.2;			// of a new sample in the running average
+	const double LATENCY_FLOOR_SECONDS = 10.0;	// the floor follows slower reads over about this long (ex. a slow network share is not congestion)
+	const double CONGESTION_FACTOR = 2.0;		// slower than this times the floor (plus slack) is congested
+	const double CONGESTION_SLACK_MS = 2.0;
+
+	const double SLOWDOWN_FIRST_INTERVAL = 0.001;	// seconds, first step when not paced yet
+	const double SLOWDOWN_MAX_INTERVAL = 0.25;
+	const double SLOWDOWN_SETTLE = 0.1;				// seconds before slowing down again, give the last one time to show
+	const double RECOVERY_FACTOR = 0.95;			// per fast read
+	const double RECOVERY_STOP = 0.0001;			// below this pacing is dropped
+
+	const double MAX_BURST_SECONDS = 1.0;		// byte budget saved up while idle
+
+	inline double seconds(std::chrono::steady_clock::duration d)
+	{
+		return std::chrono::duration<double>(d).count();
+	}
+
+	// 0 when missing or negative
+	unsigned setting_uint(const Json::Value &v)
+	{
+		if(v.isUInt())
+			return v.asUInt();
+
+		if(v.isInt())
+			return (v.asInt() > 0 ? (unsigned)v.asInt() : 0);
+
+		return 0;
+	}
+
+	inline unsigned wait_ms(double s)
+	{
+		const unsigned ms = (unsigned)(s*1000.0+0.999);
+		return (ms ? ms : 1);
+	}
+}
+
+IOBudget::IOBudget() :
+_min_interval(0),
+_bytes_per_second(0),
+_adaptive(true),
+_interval(0),
+_next_read(Clock::now()),
+_bytes_available(0),
+_bytes_updated(Clock::now()),
+_latency_average(-1),
+_latency_floor(-1),
+_latency_floor_updated(Clock::now()),
+_next_slowdown(Clock::now())
+{
+}
+
+void IOBudget::configure(Json::Value const &settings)
+{
+	npp::CriticalSectionScope s(_lock);
+
+	unsigned directories_per_second = 0;
+	unsigned bytes_per_second = 0;
+	bool adaptive = true;
+
+	if(settings.isObject()) {
+		directories_per_second = setting_uint(settings["directories_per_second"]);
+		bytes_per_second = setting_uint(settings["bytes_per_second"]);
+		adaptive = (settings["adaptive"].isBool() ? settings["adaptive"].asBool() : true);
+	}
+
+	_min_interval = (directories_per_second ? 1.0/directories_per_second : 0);
+	_bytes_per_second = bytes_per_second;
+	_adaptive = adaptive;
+
+	_interval = _min_interval;
+	_bytes_available = _bytes_per_second*MAX_BURST_SECONDS;
+	_bytes_updated = Clock::now();
+}
+
+unsigned IOBudget::acquire_directory()
+{
+	npp::CriticalSectionScope s(_lock);
+
+	const Clock::time_point now = Clock::now();
+	double wait = 0;
+
+	if(_bytes_per_second > 0) {
+		_bytes_available += seconds(now-_bytes_updated)*_bytes_per_second;
+		_bytes_updated = now;
+
+		const double burst = _bytes_per_second*MAX_BURST_SECONDS;
+		_bytes_available = (_bytes_available > burst ? burst : _bytes_available);
+
+		if(_bytes_available < 0)
+			wait = -_bytes_available/_bytes_per_second;
+	}
+
+	if(now < _next_read) {
+		const double w = seconds(_next_read-now);
+		wait = (w > wait ? w : wait);
+	}
+
+	if(wait > 0)
+		return wait_ms(wait);
+
+	_next_read = now+std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(_interval));
+	return 0;
+}
+
+void IOBudget::directory_read(unsigned bytes, double ms)
+{
+	npp::CriticalSectionScope s(_lock);
+
+	if(_bytes_per_second > 0)
+		_bytes_available -= bytes;
+
+	if(_adaptive)
+		adapt(ms, Clock::now());
+}
+
+void IOBudget::adapt(double ms, Clock::time_point now)
+{
+	if(_latency_average < 0) {
+		_latency_average = ms;
+		_latency_floor = ms;
+		_latency_floor_updated = now;
+		return;
+	}
+
+	_latency_average += (ms-_latency_average)*LATENCY_WEIGHT;
+
+	const double since = seconds(now-_latency_floor_updated);
+	_latency_floor_updated = now;
+
+	if(ms < _latency_floor) {
+		_latency_floor = ms;
+	} else {
+		const double drift = since/LATENCY_FLOOR_SECONDS;
+		_latency_floor += (ms-_latency_floor)*(drift < 1 ? drift : 1);
+	}
+
+	const bool congested = _latency_average > (_latency_floor*CONGESTION_FACTOR+CONGESTION_SLACK_MS);
+	if(congested) {
+		if(now < _next_slowdown)
+			return;
+
+		double interval = (_interval > 0 ? _interval*2 : SLOWDOWN_FIRST_INTERVAL);
+		_interval = (interval > SLOWDOWN_MAX_INTERVAL ? SLOWDOWN_MAX_INTERVAL : interval);
+		_next_slowdown = now+std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(SLOWDOWN_SETTLE));
+	} else if(_interval > _min_interval) {
+		_interval *= RECOVERY_FACTOR;
+		if(_interval < RECOVERY_STOP || _interval < _min_interval)
+			_interval = _min_interval;
+	}
+}
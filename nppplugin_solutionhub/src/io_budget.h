@@ -0,0 +1,62 @@
+#pragma once
+
+#include "thread/critical_section.h"
+
+#include <chrono>
+
+namespace Json {
+	class Value;
+}
+
+/*
+ *	Pace of background directory traversal, shared by every walker of a solution.
+ *
+ *	- 'directories_per_second' and 'bytes_per_second' are hard caps (0 : no cap),
+ *	  bytes are directory data as handed out by the OS (entries * the size of an entry, see 'DirectoryReader')
+ *	- 'adaptive' : read latency is compared to the lowest seen, when it climbs (the
+ *	  disk or the metadata cache is busy) the pace is halved, it recovers a little
+ *	  with every fast read
+ *
+ *	Per solution : "io_budget" : { "directories_per_second" : 500, "bytes_per_second" : 4194304, "adaptive" : true }
+ *	Without settings reads are only paced when they turn slow.
+ */
+struct IOBudget {
+	IOBudget();
+
+	void configure(Json::Value const &settings);
+
+	// ms to wait before reading the next directory, 0 : go ahead (the read is counted)
+	unsigned acquire_directory();
+
+	// a directory was read, 'bytes' of directory data in 'ms'
+	void directory_read(unsigned bytes, double ms);
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	IOBudget(const IOBudget&);
+	IOBudget &operator=(const IOBudget&);
+
+	void adapt(double ms, Clock::time_point now);
+
+	npp::CriticalSection _lock;
+
+	// configuration
+	double _min_interval;		// seconds between reads, from 'directories_per_second'
+	double _bytes_per_second;	// 0 : no cap
+	bool _adaptive;
+
+	// pacing
+	double _interval;
+	Clock::time_point _next_read;
+
+	// byte bucket, negative while in debt
+	double _bytes_available;
+	Clock::time_point _bytes_updated;
+
+	// latency
+	double _latency_average;
+	double _latency_floor;
+	Clock::time_point _latency_floor_updated;
+	Clock::time_point _next_slowdown;
+};
@@ -0,0 +1,87 @@
+#include "memory.h"
+
+namespace memory {
+	namespace {
+		std::atomic<u64> process_total(0);
+		std::atomic<u64> process_budget(0);
+
+		const char *kind_names[NUM_KINDS] = {
+			"index",
+			"rewrite",
+			"deltas",
+			"input",
+			"results",
+			"parser",
+			"query_cache",
+			"exact_index",
+			"date_index",
+			"extension_index",
+			"path_index"
+		};
+	}
+
+	const char *kind_name(Kind k)
+	{
+		return kind_names[k];
+	}
+
+	Account::Account()
+	{
+		for(unsigned i=0; i<NUM_KINDS; ++i)
+			_bytes[i].store(0, std::memory_order_relaxed);
+	}
+
+	Account::~Account()
+	{
+		process_total.fetch_sub(total(), std::memory_order_relaxed);
+	}
+
+	void Account::add(Kind k, u64 n)
+	{
+		_bytes[k].fetch_add(n, std::memory_order_relaxed);
+		process_total.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	void Account::sub(Kind k, u64 n)
+	{
+		_bytes[k].fetch_sub(n, std::memory_order_relaxed);
+		process_total.fetch_sub(n, std::memory_order_relaxed);
+	}
+
+	void Account::set(Kind k, u64 n)
+	{
+		const u64 before = _bytes[k].exchange(n, std::memory_order_relaxed);
+
+		// NOTE : unsigned wrap around, adds the difference either way
+		process_total.fetch_add(n-before, std::memory_order_relaxed);
+	}
+
+	u64 Account::total() const
+	{
+		u64 n = 0;
+		for(unsigned i=0; i<NUM_KINDS; ++i)
+			n += _bytes[i].load(std::memory_order_relaxed);
+		return n;
+	}
+
+	u64 total()
+	{
+		return process_total.load(std::memory_order_relaxed);
+	}
+
+	void set_budget(u64 bytes)
+	{
+		process_budget.store(bytes, std::memory_order_relaxed);
+	}
+
+	u64 budget()
+	{
+		return process_budget.load(std::memory_order_relaxed);
+	}
+
+	bool over_budget()
+	{
+		const u64 b = budget();
+		return b && total() > b;
+	}
+}
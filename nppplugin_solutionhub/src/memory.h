@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+
+/*
+ *	Memory held by the file repositories, per repo and kind, summed for the process.
+ *
+ *	Sizes are capacities of the buffers, reported by their owners whenever they
+ *	change ('set' for buffers owned by one thread, 'add'/'sub' otherwise). Every
+ *	change is applied to the process total as well, which is compared to the
+ *	budget ('set_budget').
+ */
+namespace memory {
+	typedef unsigned long long u64;
+
+	enum Kind {
+		INDEX = 0,	// the db
+		REWRITE,	// result of the rewrite in progress
+		DELTAS,		// records to merge/exclude, pending date updates
+		INPUT,		// queued changes and parser chunks, not yet taken by the strand
+		RESULTS,	// search result buffer
+		PARSER,		// records found by the parsers, not yet published
+		QUERY_CACHE,	// results of recent queries
+		EXACT_INDEX,	// filename hash for exact lookups
+		DATE_INDEX,		// records by date, for "modified:" clauses
+		EXTENSION_INDEX,	// records by extension, for "ext:" clauses
+		PATH_INDEX,		// records by full path, for "in:" clauses
+
+		NUM_KINDS
+	};
+
+	const char *kind_name(Kind k);
+
+	struct Account {
+		Account();
+		~Account(); // gives back what is left to the total
+
+		void add(Kind k, u64 n);
+		void sub(Kind k, u64 n);
+
+		// NOTE : only for kinds with a single writer
+		void set(Kind k, u64 n);
+
+		u64 get(Kind k) const { return _bytes[k].load(std::memory_order_relaxed); }
+		u64 total() const;
+
+	private:
+		Account(const Account&);
+		Account &operator=(const Account&);
+
+		std::atomic<u64> _bytes[NUM_KINDS];
+	};
+
+	// every account
+	u64 total();
+
+	// 0 : no budget
+	void set_budget(u64 bytes);
+	u64 budget();
+
+	bool over_budget();
+}
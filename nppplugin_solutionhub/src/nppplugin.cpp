@@ -15,6 +15,9 @@ BOOL APIENTRY DllMain(HANDLE hModule, DWORD reason, LPVOID /*lpReserved*/)
 			npp_plugin::init(TEXT("SolutionHub"), hModule);
 			npp_plugin::set_help_filename(TEXT("nppplugin_solutionhub_help.txt"));
 			npp_plugin::function_add(TEXT("SolutionHub - About"), npp_plugin::about_func);
+#ifdef NPP_TRACE
+			npp_plugin::function_add(TEXT("SolutionHub - Save trace"), npp_plugin_solutionhub::save_trace);
+#endif
 
 			npp_plugin_solutionhub::init();
 		}
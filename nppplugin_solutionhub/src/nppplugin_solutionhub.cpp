@@ -4,19 +4,27 @@
 #include "npp/plugin/npp_plugin_interface.h"
 
 #include "file_repository.h"
+#include "query_trace.h"
+#include "stats.h"
 #include "filerecords.h"
 
 #include "json_aux/json_aux.h"
+#include "trace/trace.h"
 
 #include <map>
 #include <xutility> // min ?
 #include <algorithm>
 #include <functional>
 #include <cctype> // isspace ?
+#ifdef NPP_TRACE
+#include <fstream>
+#endif
 #include "stream.h"
 #include "string/string_utils.h"
 
-#include "debug.h"
+#include "log/log.h"
+#include "thread/critical_section.h"
+#include "thread/thread_pool.h"
 
 typedef std::wstring String;
 #include <Shlwapi.h>
@@ -53,6 +61,9 @@ namespace {
 }
 
 namespace {
+	// longest Notepad++ waits for the file repositories on exit
+	const unsigned SHUTDOWN_TIMEOUT_MS = 2000;
+
 	String settings_base_path;
 
 	String solution_settings_file;
@@ -151,65 +162,116 @@ namespace {
 		}
 	}
 
+	/*
+	 *	A search in flight. Wrappers are reused per requester (plugin) and keep the capacity
+	 *	of the name and userdata, a search allocates nothing once warm. Made on the UI thread,
+	 *	given back from the repo strand.
+	 */
 	struct SearchWrapper {
-		wchar_t *plugin;
+		std::wstring plugin;
 		unsigned int response_code;
 
-		char *userdata;
-		unsigned userdata_size;
+		std::vector<char> userdata;
+
+		query_trace::u64 trace_id; // 0 when not recording
+		std::vector<query_trace::u64> batch_trace_ids; // per search of a batch, when recording
+		stats::u64 posted_us;
+
+		SearchWrapper **free_list; // of the requester
+		SearchWrapper *next_free;
 	};
 
+	npp::CriticalSection searchwrappers_lock;
+	std::map<std::wstring, SearchWrapper*, std::less<> > free_searchwrappers; // per requester
+
 	SearchWrapper *searchwrapper_make(const wchar_t *p, unsigned code, void *userdata, unsigned userdata_size)
 	{
-		unsigned l = (unsigned)wcslen(p);
-		SearchWrapper *sw = new SearchWrapper; memset(sw, 0, sizeof(*sw));
-		sw->plugin = new wchar_t[l+1];
-		memcpy(sw->plugin, p, sizeof(wchar_t)*l);
-		sw->plugin[l] = 0;
-		sw->response_code = code;
+		SearchWrapper *sw = 0;
+		{
+			npp::CriticalSectionScope s(searchwrappers_lock);
+
+			std::map<std::wstring, SearchWrapper*, std::less<> >::iterator i = free_searchwrappers.find(p);
+			if(i == free_searchwrappers.end())
+				i = free_searchwrappers.insert(std::make_pair(std::wstring(p), (SearchWrapper*)0)).first;
 
-		if(userdata_size) {
-			sw->userdata_size = userdata_size;
-			sw->userdata = new char[userdata_size];
-			memcpy(sw->userdata, userdata, userdata_size);
+			if((sw = i->second) != 0)
+				i->second = sw->next_free;
+			else {
+				sw = new SearchWrapper();
+				sw->free_list = &i->second;
+			}
 		}
+
+		sw->plugin.assign(p);
+		sw->response_code = code;
+		sw->userdata.assign((const char*)userdata, (const char*)userdata+userdata_size);
+		sw->trace_id = 0;
+		sw->batch_trace_ids.clear();
+		sw->posted_us = 0;
+		sw->next_free = 0;
 		return sw;
 	}
 
 	void searchwrapper_delete(SearchWrapper *&sw)
 	{
-		delete [] sw->plugin;
-		delete [] sw->userdata;
-
-		delete sw;
+		npp::CriticalSectionScope s(searchwrappers_lock);
+		sw->next_free = *sw->free_list;
+		*sw->free_list = sw;
 		sw = 0;
 	}
 
-	void notify_searchresponse(const SearchWrapper *sw, void *buffer, unsigned buffersize)
+	void notify_searchresponse(const SearchWrapper *sw, void *buffer, unsigned buffersize, const filerepo::SearchStatus &status)
 	{
-		const wchar_t *plugin = sw->plugin;
+		const wchar_t *plugin = sw->plugin.c_str();
 		long internal_msg = sw->response_code;
-		void *userdata = sw->userdata;
-		unsigned userdata_size = sw->userdata_size;
+		const unsigned userdata_size = (unsigned)sw->userdata.size();
+		void *userdata = (userdata_size ? (void*)&sw->userdata[0] : 0);
 
 		SearchResponse sr; memset(&sr, 0, sizeof(sr));
 		sr.data = (const char*) buffer;
 		sr.data_size = buffersize;
 		sr.userdata = userdata;
 		sr.userdata_size = userdata_size;
+		sr.indexing = (status.indexing ? 1 : 0);
+		sr.indexing_progress = status.progress;
 
 		CommunicationInfo comm;
 		comm.internalMsg = internal_msg;
 		comm.srcModuleName = npp_plugin::module_name();
 		comm.info = &sr;
 
+		TRACE_SCOPE_ARG("search response", "size", buffersize);
 		::SendMessage(npp_plugin::npp(), NPPM_MSGTOPLUGIN, (WPARAM)plugin, (LPARAM)&comm);
 	}
 
-	void filerepo_search_callback(void *userdata, void *buffer, unsigned buffersize)
+	void filerepo_search_callback(void *userdata, void *buffer, unsigned buffersize, const filerepo::SearchStatus &status)
 	{
 		SearchWrapper *sw = (SearchWrapper *)userdata;
-		notify_searchresponse(sw, buffer, buffersize);
+		if(sw->trace_id) {
+			const unsigned num_results = (buffersize >= sizeof(unsigned) ? *(const unsigned*)buffer : 0);
+			query_trace::result(sw->trace_id, num_results, stats::now_us()-sw->posted_us, status.indexing);
+		}
+
+		notify_searchresponse(sw, buffer, buffersize, status);
+		searchwrapper_delete(sw);
+	}
+
+	void filerepo_search_batch_callback(void *userdata, void *buffer, unsigned buffersize, const filerepo::SearchStatus &status)
+	{
+		SearchWrapper *sw = (SearchWrapper *)userdata;
+		if(!sw->batch_trace_ids.empty()) {
+			// count, sizes, results (see 'filerepo::search_batch')
+			const unsigned *sizes = (const unsigned*)buffer+1;
+			const char *result = (const char*)(sizes+sw->batch_trace_ids.size());
+			const stats::u64 latency_us = stats::now_us()-sw->posted_us;
+
+			for(unsigned i=0; i<sw->batch_trace_ids.size(); ++i) {
+				query_trace::result(sw->batch_trace_ids[i], *(const unsigned*)result, latency_us, status.indexing);
+				result += sizes[i];
+			}
+		}
+
+		notify_searchresponse(sw, buffer, buffersize, status);
 		searchwrapper_delete(sw);
 	}
 
@@ -223,7 +285,9 @@ namespace {
 	 */
 
 	std::map<std::string, FileRepositoryHandle> solution_to_repo_map;
-	std::map<std::wstring, std::string> receiver_to_alias;
+	// NOTE : transparent, found by a plugin name as it is (no temporary string)
+	typedef std::map<std::wstring, std::string, std::less<> > ReceiverToAlias;
+	ReceiverToAlias receiver_to_alias;
 	std::map<std::string, std::string> alias_to_solutionname;	// Parse me, on load and then on save again...
 
 	//! Indexed aliases is plugins thats needs indexing (ex. ofis)
@@ -242,6 +306,88 @@ namespace {
 		return true;
 	}
 
+	/*
+	 *	Optional "log" in the settings, ex.
+	 *		"log" : { "level" : "info", "categories" : { "monitor" : "trace" }, "file" : "nppplugin_solutionhub.log" }
+	 *	A relative file is placed next to the settings.
+	 */
+	void configure_log()
+	{
+		Json::Value settings;
+		if(!get_settings(settings) || !settings["log"].isObject())
+			return;
+
+		const Json::Value &log = settings["log"];
+
+		npp::log::Level level;
+		if(log["level"].isString() && npp::log::level_from_string(log["level"].asCString(), level))
+			npp::log::set_level(level);
+
+		const Json::Value &categories = log["categories"];
+		if(categories.isObject()) {
+			std::vector<std::string> names = categories.getMemberNames();
+			for(unsigned i=0; i<names.size(); ++i) {
+				npp::log::Category category;
+				const Json::Value &l = categories[names[i]];
+				if(npp::log::category_from_string(names[i].c_str(), category) && l.isString() && npp::log::level_from_string(l.asCString(), level))
+					npp::log::set_level(category, level);
+			}
+		}
+
+		if(log["file"].isString()) {
+			String f = string_util::to_wide(log["file"].asCString());
+			if(::PathIsRelative(f.c_str()))
+				f = settings_base_path+f;
+
+			npp::log::set_file(f.c_str());
+		}
+	}
+
+	/*
+	 *	Optional "memory" in the settings, ex.
+	 *		"memory" : { "budget_mb" : 512, "evict_idle_seconds" : 300 }
+	 *	Over the budget idle solutions are evicted to a snapshot next to the settings.
+	 */
+	void configure_memory()
+	{
+		Json::Value settings;
+		if(!get_settings(settings) || !settings["memory"].isObject())
+			return;
+
+		const Json::Value &memory = settings["memory"];
+		const Json::Value &budget = memory["budget_mb"];
+		const Json::Value &idle = memory["evict_idle_seconds"];
+
+		const unsigned budget_mb = ((budget.isInt() && budget.asInt() > 0) ? (unsigned)budget.asInt() : 0);
+		const unsigned idle_seconds = ((idle.isInt() && idle.asInt() >= 0) ? (unsigned)idle.asInt() : 300);
+
+		filerepo::set_memory_budget((unsigned long long)budget_mb << 20, idle_seconds, settings_base_path.c_str());
+	}
+
+	/*
+	 *	Optional "query_trace" in the settings, ex.
+	 *		"query_trace" : { "file" : "queries.jsonl", "anonymize" : true }
+	 *	Records searches and index changes for 'replay_queries', a relative file is placed next to the settings.
+	 */
+	void configure_query_trace()
+	{
+		Json::Value settings;
+		if(!get_settings(settings) || !settings["query_trace"].isObject())
+			return;
+
+		const Json::Value &trace = settings["query_trace"];
+		if(!trace["file"].isString())
+			return;
+
+		String f = string_util::to_wide(trace["file"].asCString());
+		if(::PathIsRelative(f.c_str()))
+			f = settings_base_path+f;
+
+		// NOTE : anonymized unless asked not to, traces are meant to be shared
+		const bool anonymize = (trace["anonymize"].isBool() ? trace["anonymize"].asBool() : true);
+		query_trace::start(f.c_str(), anonymize);
+	}
+
 	bool get_solutions(Json::Value &r)
 	{
 		Json::Value settings;
@@ -324,7 +470,7 @@ namespace {
 				// notify deletion of connection
 				if(strlen(solution) > 0)
 				{
-					DEBUG_PRINT("Deleted connection for alias(%s), solution(%s)", alias, solution);
+					LOG_INFO(npp::log::CATEGORY_HUB, "deleted connection for alias(%s), solution(%s)", alias, solution);
 					if(get_key(receiver_to_alias, i->first, receiver))
 					{
 						stream::pack(notifications, (unsigned)(NPPN_SOLUTIONHUB_CONNECTION_DELETED));
@@ -339,7 +485,7 @@ namespace {
 				if(f->second != solution)
 				{
 					const char *new_solution = f->second.c_str();
-					DEBUG_PRINT("Changed solution for alias(%s), from(%s), to(%s)", alias, solution, new_solution);
+					LOG_INFO(npp::log::CATEGORY_HUB, "changed solution for alias(%s), from(%s), to(%s)", alias, solution, new_solution);
 					// notify change
 					if(get_key(receiver_to_alias, i->first, receiver))
 					{
@@ -368,11 +514,10 @@ namespace {
 				stream::pack_string_wide(notifications, receiver.c_str());
 				stream::pack_string(notifications, solution);
 			}
-			DEBUG_PRINT("New connection, from alias(%s) to solution(%s)", alias, solution);
+			LOG_INFO(npp::log::CATEGORY_HUB, "new connection, from alias(%s) to solution(%s)", alias, solution);
 			++i;
 		}
 
-		DEBUG_PRINT("## END ##");
 		unsigned N = (unsigned)notifications.size();
 		const char *b = (N ? &notifications[0] : 0);
 
@@ -489,6 +634,21 @@ namespace {
 		return alias_to_solutionname[alias];
 	}
 
+	// the repo of the solution 'plugin' is hooked to, 0 if none (lookups only, nothing is allocated)
+	FileRepositoryHandle find_repo_by_receiver(const wchar_t *plugin)
+	{
+		ReceiverToAlias::const_iterator r = receiver_to_alias.find(plugin);
+		if(r == receiver_to_alias.end() || r->second.empty())
+			return 0;
+
+		std::map<std::string, std::string>::const_iterator s = alias_to_solutionname.find(r->second);
+		if(s == alias_to_solutionname.end())
+			return 0;
+
+		std::map<std::string, FileRepositoryHandle>::const_iterator h = solution_to_repo_map.find(s->second);
+		return (h != solution_to_repo_map.end() ? h->second : 0);
+	}
+
 	Json::Value get_named_solution(const std::string &sn)
 	{
 		Json::Value solutions(Json::objectValue);
@@ -543,6 +703,7 @@ namespace {
 					if(!handle)
 					{
 						handle = filerepo::allocate_handle();
+						query_trace::name_repo(handle, solution_name.c_str());
 						filerepo::add_solution(handle, solution);
 						solution_to_repo_map[solution_name] = handle;
 					}
@@ -558,7 +719,7 @@ namespace {
 	{
 		std::string res("");
 
-		std::map<std::wstring, std::string>::const_iterator i(receiver_to_alias.begin()), end(receiver_to_alias.end());
+		ReceiverToAlias::const_iterator i(receiver_to_alias.begin()), end(receiver_to_alias.end());
 		while(i!=end)
 		{
 			const std::string &alias = i->second;
@@ -986,24 +1147,94 @@ namespace {
 		else if(msg == NPPM_SOLUTIONHUB_SEARCH_SOLUTION)
 		{
 			SearchRequest &sr = *((SearchRequest*)(info));
-			std::string alias = receiver_to_alias[plugin];
 
-			if(alias.empty()) {
+			FileRepositoryHandle handle = find_repo_by_receiver(plugin);
+			if(!handle) {
 				sr.result = SolutionHubResults::SH_ERROR_NO_CONNECTION;
 				return;
 			}
 
-			std::string solution_name = get_solutionname_by_alias(alias.c_str());
-			FileRepositoryHandle handle = solution_to_repo_map[solution_name];
+			SearchWrapper *sw = searchwrapper_make(plugin, sr.result_notification, sr.userdata, sr.userdata_size);
+			if(query_trace::recording()) {
+				sw->trace_id = query_trace::query(handle, plugin, sr.searchstring);
+				sw->posted_us = stats::now_us();
+			}
+
+			sr.result = SolutionHubResults::SH_NO_ERROR; // just in case the search will respond BEFORE check...
+			filerepo::search(handle, sr.searchstring, (void*)sw, filerepo_search_callback);
+		}
+		else if(msg == NPPM_SOLUTIONHUB_SEARCH_SOLUTION_EXACT)
+		{
+			SearchRequest &sr = *((SearchRequest*)(info));
+
+			FileRepositoryHandle handle = find_repo_by_receiver(plugin);
 			if(!handle) {
 				sr.result = SolutionHubResults::SH_ERROR_NO_CONNECTION;
 				return;
 			}
 
+			// NOTE : not traced, a replay searches what it reads
 			SearchWrapper *sw = searchwrapper_make(plugin, sr.result_notification, sr.userdata, sr.userdata_size);
 
-			sr.result = SolutionHubResults::SH_NO_ERROR; // just in case the search will respond BEFORE check...
-			filerepo::search(handle, sr.searchstring, (void*)sw, filerepo_search_callback);
+			sr.result = SolutionHubResults::SH_NO_ERROR;
+			filerepo::search_exact(handle, sr.searchstring, (void*)sw, filerepo_search_callback);
+		}
+		else if(msg == NPPM_SOLUTIONHUB_SEARCH_SOLUTION_BATCH)
+		{
+			SearchBatchRequest &sr = *((SearchBatchRequest*)(info));
+
+			FileRepositoryHandle handle = find_repo_by_receiver(plugin);
+			if(!handle) {
+				sr.result = SolutionHubResults::SH_ERROR_NO_CONNECTION;
+				return;
+			}
+
+			SearchWrapper *sw = searchwrapper_make(plugin, sr.result_notification, sr.userdata, sr.userdata_size);
+			if(query_trace::recording()) {
+				for(unsigned i=0; i<sr.num_searchstrings; ++i)
+					sw->batch_trace_ids.push_back(query_trace::query(handle, plugin, sr.searchstrings[i]));
+				sw->posted_us = stats::now_us();
+			}
+
+			sr.result = SolutionHubResults::SH_NO_ERROR;
+			filerepo::search_batch(handle, sr.searchstrings, sr.num_searchstrings, (void*)sw, filerepo_search_batch_callback);
+		}
+		else if(msg == NPPM_SOLUTIONHUB_GET_STATS)
+		{
+			GetStatsRequest &gs = *((GetStatsRequest*)info);
+
+			Json::Value all(Json::objectValue);
+
+			std::map<std::string, FileRepositoryHandle>::const_iterator i(solution_to_repo_map.begin()), end(solution_to_repo_map.end());
+			for(; i!=end; ++i) {
+				if(!i->second)
+					continue;
+
+				if(gs.solution_name && i->first != gs.solution_name)
+					continue;
+
+				filerepo::get_stats(i->second, all[i->first]);
+			}
+
+			if(gs.solution_name && all.empty()) {
+				if(gs.result_buffer && gs.result_buffersize)
+					*gs.result_buffer = 0;
+
+				gs.result = SolutionHubResults::SH_ERROR_NO_SOLUTION;
+				return;
+			}
+
+			const std::string as = json_aux::json_to_string(all);
+			const unsigned required = (unsigned)as.length()+1;
+
+			if(!gs.result_buffer || required > gs.result_buffersize) {
+				gs.result_buffersize = required;
+				gs.result = SolutionHubResults::SH_ERROR_BUFFER_TO_SMALL;
+				return;
+			}
+
+			strcpy(gs.result_buffer, as.c_str());
+			gs.result = SolutionHubResults::SH_NO_ERROR;
 		}
 	}
 }
@@ -1013,6 +1244,9 @@ namespace npp_plugin_solutionhub {
 	void init()
 	{
 		init_settingsfile();
+		configure_log();
+		configure_memory();
+		configure_query_trace();
 
 		alias_to_solutionname.clear();
 		setup_alias_mappings();
@@ -1027,7 +1261,31 @@ namespace npp_plugin_solutionhub {
 
 			++i;
 		}
+
+		// parsers/merges are cancelled, this is over within milliseconds unless something is stuck (ex. a slow network share)
+		if(!filerepo::join(SHUTDOWN_TIMEOUT_MS))
+			LOG_WARNING(npp::log::CATEGORY_HUB, "file repositories still running after %u ms, leaving them behind", SHUTDOWN_TIMEOUT_MS);
+		else if(!npp::threadpool_shutdown(SHUTDOWN_TIMEOUT_MS))
+			LOG_WARNING(npp::log::CATEGORY_HUB, "thread pool still running after %u ms, leaving it behind", SHUTDOWN_TIMEOUT_MS);
+
+		query_trace::stop();
+		npp::log::shutdown();
+	}
+
+#ifdef NPP_TRACE
+	// the recent spans of every thread, open in chrome://tracing (or ui.perfetto.dev)
+	void save_trace()
+	{
+		std::string trace;
+		npp::trace::export_chrome_json(trace);
+
+		String f = settings_base_path;
+		f.append(L"nppplugin_solutionhub_trace.json");
+
+		std::ofstream out(f.c_str(), std::ios::binary);
+		out.write(trace.c_str(), trace.length());
 	}
+#endif
 
 	void on_message(const PluginMessage &pm)
 	{
@@ -1035,6 +1293,8 @@ namespace npp_plugin_solutionhub {
 		const wchar_t *plugin = pm.src_module;
 		void *info = pm.info;
 
+		TRACE_SCOPE_ARG("hub message", "msg", msg);
+
 		if(msg >= NPPM_SOLUTIONHUB_CONFIG_START)
 			on_config_message(msg, plugin, info);
 		else
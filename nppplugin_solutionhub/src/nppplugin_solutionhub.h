@@ -7,4 +7,8 @@ namespace npp_plugin_solutionhub {
 	void terminate();
 
 	void on_message(const PluginMessage&);
+
+#ifdef NPP_TRACE
+	void save_trace();
+#endif
 }
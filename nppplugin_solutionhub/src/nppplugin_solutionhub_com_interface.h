@@ -91,10 +91,45 @@ struct SearchResponse
 
 	void *userdata;
 	unsigned int userdata_size;
+
+	unsigned int indexing;			//! Non-zero while the solution is (still) being indexed, results are partial
+	unsigned int indexing_progress;	//! Percent (0-100) of the solution indexed
 };
 
 #define NPPM_SOLUTIONHUB_SEARCH_SOLUTION				NPPM_SOLUTIONHUB_START+7
 
+//! Json with statistics of the indexed solutions, { "solution name" : { "index", "queries", "latency", "parser", "monitor" }, ... }
+//! On 'SH_ERROR_BUFFER_TO_SMALL' 'result_buffersize' is set to the required size (terminator included)
+struct GetStatsRequest
+{
+	const char *solution_name;	//! Null for all solutions
+
+	char *result_buffer;
+	unsigned int result_buffersize;
+
+	int result;
+};
+#define NPPM_SOLUTIONHUB_GET_STATS						NPPM_SOLUTIONHUB_START+8
+
+//! Several searches answered by one 'SearchResponse' (the index is read once for all of them), its data is :
+//! unsigned count, count*unsigned size, then every result (laid out like the result of a single search) back to back
+struct SearchBatchRequest
+{
+	const wchar_t *const *searchstrings;
+	unsigned int num_searchstrings;
+	unsigned int result_notification;
+
+	void *userdata;
+	unsigned int userdata_size;
+
+	int result;
+};
+#define NPPM_SOLUTIONHUB_SEARCH_SOLUTION_BATCH			NPPM_SOLUTIONHUB_START+9
+
+//! 'SearchRequest' for the records named exactly 'searchstring' ("file.ext"), or with a full path ending in it
+//! from a folder on ("folder\file.ext", '/' works too). Case-insensitive, no tokens, answered like a search
+#define NPPM_SOLUTIONHUB_SEARCH_SOLUTION_EXACT			NPPM_SOLUTIONHUB_START+10
+
 //! Config/Settings messages START
 #define NPPM_SOLUTIONHUB_CONFIG_START					500
 
@@ -0,0 +1,251 @@
+#include "query_cache.h"
+
+#include <algorithm> // sort
+#include <ctype.h> // toupper
+#include <functional> // hash
+#include <string.h> // wcslen
+
+namespace {
+	// per entry, besides the key and the offsets (node, bucket, vector)
+	const unsigned ENTRY_OVERHEAD_BYTES = 96;
+
+	const unsigned MIN_BUCKETS = 64;
+
+	// free entries looked at for the one with the best fitting buffers
+	const unsigned FREE_ENTRIES_SCANNED = 16;
+
+	// NOTE : 'wstristr' compares 'toupper' of both, tokens equal to it are equal here
+	void append_folded(std::wstring &s, const wchar_t *token, unsigned length)
+	{
+		for(unsigned i=0; i<length; ++i)
+			s.push_back((wchar_t)toupper(token[i]));
+		s.push_back(0);
+	}
+
+	struct TokenLess {
+		const wchar_t *tokens;
+		bool operator()(unsigned a, unsigned b) const { return wcscmp(tokens+a, tokens+b) < 0; }
+	};
+}
+
+QueryCache::QueryCache(unsigned capacity) : _capacity(capacity), _bytes(0), _free_bytes(0), _generation(0), _num_entries(0), _first(0), _last(0), _free(0)
+{
+}
+
+QueryCache::~QueryCache()
+{
+	clear();
+}
+
+void QueryCache::set_query(const filerepo::aux::SearchQuery &q)
+{
+	// exclude tokens, folded
+	const wchar_t *exclude = q.exclude;
+	_excludes.clear();
+	_exclude_offsets.clear();
+	for(unsigned i=0; i<q.num_exclude; ++i) {
+		const unsigned length = (unsigned)wcslen(exclude);
+		_exclude_offsets.push_back((unsigned)_excludes.length());
+		append_folded(_excludes, exclude, length);
+		exclude += length+1;
+	}
+
+	TokenLess less = { _excludes.c_str() };
+	std::sort(_exclude_offsets.begin(), _exclude_offsets.end(), less);
+
+	unsigned num_unique = 0;
+	for(unsigned i=0; i<_exclude_offsets.size(); ++i) {
+		if(!num_unique || less(_exclude_offsets[num_unique-1], _exclude_offsets[i]))
+			_exclude_offsets[num_unique++] = _exclude_offsets[i];
+	}
+
+	// NOTE : without tokens every record matches, 'search_all' makes no difference
+	_key.clear();
+	_key.push_back((wchar_t)((q.num_include+num_unique) ? (q.search_all ? 1 : 0) : 0));
+	_key.push_back((wchar_t)q.num_include);
+	_key.push_back((wchar_t)num_unique);
+	_key.push_back((wchar_t)q.num_clauses);
+
+	const wchar_t *include = q.include;
+	for(unsigned i=0; i<q.num_include; ++i) {
+		const unsigned length = (unsigned)wcslen(include);
+		append_folded(_key, include, length);
+		include += length+1;
+	}
+
+	for(unsigned i=0; i<num_unique; ++i) {
+		const wchar_t *token = _excludes.c_str()+_exclude_offsets[i];
+		_key.append(token, wcslen(token)+1);
+	}
+
+	if(q.num_clauses)
+		_key.append(q.clauses, q.clauses_length);
+}
+
+const std::vector<unsigned> *QueryCache::find(u64 generation)
+{
+	set_generation(generation);
+	if(!_num_entries)
+		return 0;
+
+	const size_t hash = std::hash<std::wstring>()(_key);
+	for(Entry *e = bucket(hash); e; e = e->bucket_next) {
+		if(e->hash != hash || e->key != _key)
+			continue;
+
+		if(e != _first) {
+			unlink(e);
+			push_front(e);
+		}
+		return &e->matched;
+	}
+	return 0;
+}
+
+void QueryCache::insert(u64 generation, const std::vector<unsigned> &matched)
+{
+	set_generation(generation);
+
+	const unsigned bytes = (unsigned)(_key.length()*sizeof(wchar_t)+matched.size()*sizeof(unsigned))+ENTRY_OVERHEAD_BYTES;
+	if(bytes > _capacity/4)
+		return;
+
+	if(find(generation))
+		return; // NOTE : same generation, same result
+
+	if(_num_entries >= _buckets.size())
+		grow_buckets();
+
+	Entry *e = take_free(_key.length(), matched.size());
+	if(!e)
+		e = new Entry();
+
+	// NOTE : 'assign' keeps the buffers of a reused entry when they are big enough
+	e->key.assign(_key);
+	e->hash = std::hash<std::wstring>()(_key);
+	e->matched.assign(matched.begin(), matched.end());
+	e->bytes = (unsigned)(e->key.capacity()*sizeof(wchar_t)+e->matched.capacity()*sizeof(unsigned))+ENTRY_OVERHEAD_BYTES;
+
+	Entry *&b = bucket(e->hash);
+	e->bucket_next = b;
+	b = e;
+	++_num_entries;
+
+	push_front(e);
+	_bytes += e->bytes;
+
+	while(_bytes > _capacity) {
+		Entry *lru = _last;
+		unlink(lru);
+		_bytes -= lru->bytes;
+
+		Entry **link = &bucket(lru->hash);
+		while(*link != lru)
+			link = &(*link)->bucket_next;
+		*link = lru->bucket_next;
+		--_num_entries;
+
+		release(lru);
+	}
+}
+
+void QueryCache::clear()
+{
+	// NOTE : gives the memory back, the scratch buffers are small
+	while(Entry *e = _first) {
+		_first = e->next;
+		delete e;
+	}
+	while(Entry *e = _free) {
+		_free = e->next;
+		delete e;
+	}
+
+	std::vector<Entry*>().swap(_buckets);
+	_num_entries = 0;
+	_first = _last = 0;
+	_bytes = 0;
+	_free_bytes = 0;
+}
+
+void QueryCache::set_generation(u64 generation)
+{
+	if(generation == _generation)
+		return;
+
+	// the entries go to '_free', the buckets are kept
+	while(Entry *e = _first) {
+		_first = e->next;
+		release(e);
+	}
+	std::fill(_buckets.begin(), _buckets.end(), (Entry*)0);
+	_num_entries = 0;
+	_last = 0;
+	_bytes = 0;
+
+	_generation = generation;
+}
+
+void QueryCache::grow_buckets()
+{
+	std::vector<Entry*> buckets(_buckets.empty() ? MIN_BUCKETS : _buckets.size()*2, (Entry*)0);
+	_buckets.swap(buckets);
+
+	for(size_t i=0; i<buckets.size(); ++i) {
+		while(Entry *e = buckets[i]) {
+			buckets[i] = e->bucket_next;
+
+			Entry *&b = bucket(e->hash);
+			e->bucket_next = b;
+			b = e;
+		}
+	}
+}
+
+// the free entry (of those scanned) with the smallest buffers that fit, else the first one
+QueryCache::Entry *QueryCache::take_free(size_t key_length, size_t num_matched)
+{
+	Entry **found = &_free;
+	bool fits = false;
+
+	Entry **link = &_free;
+	for(unsigned i=0; *link && i<FREE_ENTRIES_SCANNED; ++i, link = &(*link)->next) {
+		const Entry *e = *link;
+		if(e->key.capacity() < key_length || e->matched.capacity() < num_matched)
+			continue;
+
+		if(!fits || e->matched.capacity() < (*found)->matched.capacity()) {
+			found = link;
+			fits = true;
+		}
+	}
+
+	Entry *e = *found;
+	if(e) {
+		*found = e->next;
+		_free_bytes -= e->bytes;
+	}
+	return e;
+}
+
+void QueryCache::release(Entry *e)
+{
+	_free_bytes += e->bytes;
+
+	e->next = _free;
+	_free = e;
+}
+
+void QueryCache::unlink(Entry *e)
+{
+	(e->prev ? e->prev->next : _first) = e->next;
+	(e->next ? e->next->prev : _last) = e->prev;
+}
+
+void QueryCache::push_front(Entry *e)
+{
+	e->prev = 0;
+	e->next = _first;
+	(_first ? _first->prev : _last) = e;
+	_first = e;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "file_repository_common.h"
+
+#include <string>
+#include <vector>
+
+/*
+ *	Results of recent queries of one repo, kept as the offsets of the matching
+ *	records in the db (see 'filerepo::aux::pack_results'). Over 'capacity' bytes
+ *	the least recently used are dropped.
+ *
+ *	Entries belong to one generation of the db (the repo bumps it with every change
+ *	to the db), asking with another generation drops them all. Strand only, no
+ *	locking. Dropped entries keep their buffers for the next inserts, neither a hit
+ *	nor an insert allocates once warm (until 'clear').
+ */
+struct QueryCache {
+	typedef unsigned long long u64;
+
+	explicit QueryCache(unsigned capacity);
+	~QueryCache();
+
+	/*
+	 *	The query for 'find'/'insert'. Tokens are folded the way 'wstristr' compares,
+	 *	include tokens keep their order (they match in sequence), exclude tokens are
+	 *	sorted and duplicates dropped. Clauses are taken as they are.
+	 */
+	void set_query(const filerepo::aux::SearchQuery &q);
+
+	// 0 if not cached
+	const std::vector<unsigned> *find(u64 generation);
+
+	// NOTE : results above a quarter of the capacity are not kept
+	void insert(u64 generation, const std::vector<unsigned> &matched);
+
+	// drops the entries and gives their memory back
+	void clear();
+
+	// NOTE : with the buffers kept for reuse
+	u64 bytes() const { return _bytes+_free_bytes; }
+	unsigned entries() const { return _num_entries; }
+
+private:
+	QueryCache(const QueryCache&);
+	QueryCache &operator=(const QueryCache&);
+
+	struct Entry {
+		std::wstring key;
+		size_t hash;
+		std::vector<unsigned> matched;
+		unsigned bytes; // of its buffers, a reused entry may hold more than it needs
+
+		// most recently used first, 'next' links '_free' too
+		Entry *prev;
+		Entry *next;
+
+		Entry *bucket_next;
+	};
+
+	void set_generation(u64 generation);
+	void unlink(Entry *e);
+	void push_front(Entry *e);
+
+	Entry *&bucket(size_t hash) { return _buckets[hash & (_buckets.size()-1)]; }
+	void grow_buckets();
+	Entry *take_free(size_t key_length, size_t num_matched);
+	void release(Entry *e);
+
+	const unsigned _capacity;
+	u64 _bytes;
+	u64 _free_bytes;
+	u64 _generation;
+
+	std::vector<Entry*> _buckets; // size is a power of two, chained through 'bucket_next'
+	unsigned _num_entries;
+	Entry *_first;
+	Entry *_last;
+	Entry *_free; // dropped, with their buffers
+
+	// kept for the next query
+	std::wstring _key;
+	std::wstring _excludes;
+	std::vector<unsigned> _exclude_offsets;
+};
@@ -0,0 +1,230 @@
+#include "query_trace.h"
+
+#include "stats.h"
+
+#include "json/json.h"
+#include "log/log.h"
+#include "string/string_utils.h"
+#include "thread/critical_section.h"
+
+#include <map>
+#include <random>
+#include <string>
+#include <stdio.h>
+#include <time.h>
+#include <wctype.h>
+
+namespace query_trace {
+	namespace detail {
+		std::atomic<bool> active(false);
+	}
+
+	namespace {
+		struct Recorder {
+			Recorder() : file(0), anonymize(false), start_us(0), next_id(1), key(0) {}
+
+			npp::CriticalSection lock;
+
+			FILE *file;
+			bool anonymize;
+			u64 start_us;
+			u64 next_id;
+			u64 key; // anonymization, never written
+
+			std::map<const void*, std::string> solutions; // repo -> solution name
+			std::map<std::string, std::string> anonymized_names; // solution name -> "s<n>", for this recording
+		};
+
+		Recorder recorder;
+
+		inline u64 fnv1a(u64 h, unsigned c)
+		{
+			for(unsigned i=0; i<4; ++i) {
+				h ^= (c >> (i*8)) & 0xff;
+				h *= 0x100000001b3ull;
+			}
+			return h;
+		}
+
+		/*
+		 *	Every letter/digit is replaced by one picked by the hash of the key and the letters/digits
+		 *	of the token so far (case folded), the rest ('-', '\', '.' and such) is kept.
+		 */
+		std::wstring anonymize_query(const wchar_t *q, u64 key)
+		{
+			std::wstring res;
+
+			u64 h = key;
+			for(; *q; ++q) {
+				const wchar_t c = *q;
+				if(c == L' ' || c == L'\t') {
+					h = key; // tokens are mapped independently
+					res += c;
+					continue;
+				}
+
+				if(!iswalnum(c)) {
+					res += c;
+					continue;
+				}
+
+				h = fnv1a(h, (unsigned)towlower(c));
+				res += (iswdigit(c) ? (wchar_t)(L'0'+(h >> 32) % 10) : (wchar_t)(L'a'+(h >> 32) % 26));
+			}
+			return res;
+		}
+
+		void write_event(const Json::Value &e)
+		{
+			Json::FastWriter writer;
+			const std::string line = writer.write(e); // ends with a newline
+
+			fwrite(line.c_str(), 1, line.length(), recorder.file);
+			fflush(recorder.file);
+		}
+
+		// NOTE : lock held
+		std::string solution_of(const void *repo)
+		{
+			std::map<const void*, std::string>::const_iterator i = recorder.solutions.find(repo);
+			if(i == recorder.solutions.end())
+				return "?";
+			if(!recorder.anonymize)
+				return i->second;
+
+			std::string &anonymized = recorder.anonymized_names[i->second];
+			if(anonymized.empty()) {
+				char name[32];
+				snprintf(name, sizeof(name), "s%u", (unsigned)recorder.anonymized_names.size());
+				anonymized = name;
+			}
+			return anonymized;
+		}
+
+		std::string local_time_string()
+		{
+			const time_t now = time(0);
+			struct tm t;
+#if defined(_WIN32)
+			localtime_s(&t, &now);
+#else
+			localtime_r(&now, &t);
+#endif
+			char buffer[32];
+			strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &t);
+			return buffer;
+		}
+	}
+
+	bool start(const wchar_t *path, bool anonymize)
+	{
+		stop();
+
+		npp::CriticalSectionScope s(recorder.lock);
+
+#if defined(_WIN32)
+		recorder.file = _wfopen(path, L"ab");
+#else
+		recorder.file = fopen(string_util::from_wide(path).c_str(), "ab");
+#endif
+		if(!recorder.file) {
+			LOG_WARNING(npp::log::CATEGORY_HUB, "could not open query trace %S", path);
+			return false;
+		}
+
+		std::random_device rd;
+		recorder.key = ((u64)rd() << 32) ^ rd() ^ stats::now_us();
+		recorder.anonymize = anonymize;
+		recorder.start_us = stats::now_us();
+		recorder.anonymized_names.clear();
+
+		Json::Value header(Json::objectValue);
+		header["type"] = "header";
+		header["version"] = 1;
+		header["anonymized"] = anonymize;
+		header["started"] = local_time_string();
+		write_event(header);
+
+		detail::active.store(true, std::memory_order_relaxed);
+
+		LOG_INFO(npp::log::CATEGORY_HUB, "recording queries to %S%s", path, anonymize ? " (anonymized)" : "");
+		return true;
+	}
+
+	void stop()
+	{
+		npp::CriticalSectionScope s(recorder.lock);
+
+		detail::active.store(false, std::memory_order_relaxed);
+		if(recorder.file)
+			fclose(recorder.file);
+		recorder.file = 0;
+	}
+
+	void name_repo(const void *repo, const char *solution_name)
+	{
+		// NOTE : also when not recording, repos are named before a recording is started
+		npp::CriticalSectionScope s(recorder.lock);
+		recorder.solutions[repo] = solution_name;
+	}
+
+	u64 query(const void *repo, const wchar_t *plugin, const wchar_t *query)
+	{
+		if(!recording())
+			return 0;
+
+		npp::CriticalSectionScope s(recorder.lock);
+		if(!recorder.file)
+			return 0;
+
+		const u64 id = recorder.next_id++;
+
+		Json::Value e(Json::objectValue);
+		e["type"] = "query";
+		e["t_us"] = (double)(stats::now_us()-recorder.start_us);
+		e["id"] = (double)id;
+		e["solution"] = solution_of(repo);
+		e["plugin"] = string_util::wstr_to_utf8(plugin);
+		e["query"] = string_util::wstr_to_utf8(recorder.anonymize ? anonymize_query(query, recorder.key).c_str() : query);
+		write_event(e);
+
+		return id;
+	}
+
+	void result(u64 id, unsigned num_results, u64 latency_us, bool indexing)
+	{
+		if(!id || !recording())
+			return;
+
+		npp::CriticalSectionScope s(recorder.lock);
+		if(!recorder.file)
+			return;
+
+		Json::Value e(Json::objectValue);
+		e["type"] = "result";
+		e["t_us"] = (double)(stats::now_us()-recorder.start_us);
+		e["id"] = (double)id;
+		e["latency_us"] = (double)latency_us;
+		e["results"] = num_results;
+		e["indexing"] = indexing;
+		write_event(e);
+	}
+
+	void change(const void *repo, const char *change, unsigned num_records)
+	{
+		if(!recording())
+			return;
+
+		npp::CriticalSectionScope s(recorder.lock);
+		if(!recorder.file)
+			return;
+
+		Json::Value e(Json::objectValue);
+		e["type"] = "change";
+		e["t_us"] = (double)(stats::now_us()-recorder.start_us);
+		e["solution"] = solution_of(repo);
+		e["change"] = change;
+		e["records"] = num_records;
+		write_event(e);
+	}
+}
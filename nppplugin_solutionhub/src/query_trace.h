@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+
+/*
+ *	Opt-in recording of how the index is used, replayed by 'replay_queries'
+ *	(see the 'bench' folder).
+ *
+ *	The trace is json lines, one event per line, times are microseconds since
+ *	the recording started :
+ *		{ "type" : "header", "version" : 1, "anonymized" : true, "started" : "2024-01-31 12:00:00" }
+ *		{ "type" : "query", "t_us" : 1200, "id" : 1, "solution" : "s1", "plugin" : "nppplugin_ofis2.dll", "query" : "ren" }
+ *		{ "type" : "result", "t_us" : 1900, "id" : 1, "latency_us" : 700, "results" : 12, "indexing" : false }
+ *		{ "type" : "change", "t_us" : 5000, "solution" : "s1", "change" : "add", "records" : 3 }
+ *
+ *	Changes are "add", "remove", "update", "rename" (folder monitor) and "index" (a
+ *	chunk of parsed directories). Anonymized traces name solutions "s<n>" and map
+ *	every query token to letters and digits, prefix preserving (typing "r", "re",
+ *	"ren" stays a sequence of extensions) with a key that is never written.
+ */
+namespace query_trace {
+	typedef unsigned long long u64;
+
+	namespace detail {
+		extern std::atomic<bool> active;
+	}
+
+	// appends to 'path', false if it can not be opened
+	bool start(const wchar_t *path, bool anonymize);
+	void stop();
+
+	inline bool recording() { return detail::active.load(std::memory_order_relaxed); }
+
+	// events of 'repo' name the solution (set again when a solution gets a new repo)
+	void name_repo(const void *repo, const char *solution_name);
+
+	// returns the id for 'result', 0 when not recording
+	u64 query(const void *repo, const wchar_t *plugin, const wchar_t *query);
+	void result(u64 id, unsigned num_results, u64 latency_us, bool indexing);
+
+	void change(const void *repo, const char *change, unsigned num_records);
+}
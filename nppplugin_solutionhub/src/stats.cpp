@@ -0,0 +1,93 @@
+#include "stats.h"
+
+#include "json/json.h"
+
+namespace stats {
+	namespace {
+		unsigned bucket_index(u64 us)
+		{
+			unsigned i = 0;
+			while(us) {
+				us >>= 1;
+				++i;
+			}
+			return (i < Histogram::NUM_BUCKETS ? i : Histogram::NUM_BUCKETS-1);
+		}
+
+		inline u64 bucket_upper_us(unsigned i)
+		{
+			return (i ? ((u64)1 << i)-1 : 0);
+		}
+
+		// NOTE : json values are (at most) doubles, fine for counters
+		inline Json::Value json_number(u64 n)
+		{
+			return Json::Value((double)n);
+		}
+	}
+
+	Histogram::Histogram() : _sum_us(0), _max_us(0)
+	{
+		for(unsigned i=0; i<NUM_BUCKETS; ++i)
+			_buckets[i].store(0, std::memory_order_relaxed);
+	}
+
+	void Histogram::record(u64 us)
+	{
+		_buckets[bucket_index(us)].fetch_add(1, std::memory_order_relaxed);
+		_sum_us.fetch_add(us, std::memory_order_relaxed);
+
+		u64 m = _max_us.load(std::memory_order_relaxed);
+		while(us > m && !_max_us.compare_exchange_weak(m, us, std::memory_order_relaxed))
+			;
+	}
+
+	void Histogram::to_json(Json::Value &out) const
+	{
+		u64 buckets[NUM_BUCKETS];
+		u64 total = 0;
+		for(unsigned i=0; i<NUM_BUCKETS; ++i) {
+			buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+			total += buckets[i];
+		}
+
+		const u64 sum = _sum_us.load(std::memory_order_relaxed);
+
+		out = Json::Value(Json::objectValue);
+		out["count"] = json_number(total);
+		out["mean_us"] = json_number(total ? sum/total : 0);
+		out["max_us"] = json_number(_max_us.load(std::memory_order_relaxed));
+
+		static const struct { const char *name; unsigned permille; } percentiles[] = {
+			{ "p50_us", 500 }, { "p90_us", 900 }, { "p99_us", 990 }
+		};
+
+		for(unsigned p=0; p<sizeof(percentiles)/sizeof(percentiles[0]); ++p) {
+			// rank of the percentile, 1-based
+			const u64 rank = (total*percentiles[p].permille+999)/1000;
+
+			u64 seen = 0;
+			u64 value = 0;
+			for(unsigned i=0; i<NUM_BUCKETS && total; ++i) {
+				seen += buckets[i];
+				if(seen >= rank) {
+					value = bucket_upper_us(i);
+					break;
+				}
+			}
+			out[percentiles[p].name] = json_number(value);
+		}
+
+		Json::Value &b = out["buckets"];
+		b = Json::Value(Json::arrayValue);
+		for(unsigned i=0; i<NUM_BUCKETS; ++i) {
+			if(!buckets[i])
+				continue;
+
+			Json::Value bucket(Json::arrayValue);
+			bucket.append(json_number(bucket_upper_us(i)));
+			bucket.append(json_number(buckets[i]));
+			b.append(bucket);
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+namespace Json {
+	class Value;
+}
+
+/*
+ *	Counters for the statistics api (NPPM_SOLUTIONHUB_GET_STATS).
+ *
+ *	Updates are relaxed atomics, nothing on the hot paths waits for a reader.
+ *	Readers get a snapshot that can be slightly torn (ex. a histogram count
+ *	one ahead of its buckets), good enough for monitoring.
+ */
+namespace stats {
+	typedef unsigned long long u64;
+
+	// monotonic microseconds, for timing
+	inline u64 now_us()
+	{
+		return (u64)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	struct Counter {
+		Counter() : _value(0) {}
+
+		void add(u64 n = 1) { _value.fetch_add(n, std::memory_order_relaxed); }
+		void set(u64 n) { _value.store(n, std::memory_order_relaxed); }
+		u64 get() const { return _value.load(std::memory_order_relaxed); }
+
+	private:
+		Counter(const Counter&);
+		Counter &operator=(const Counter&);
+
+		std::atomic<u64> _value;
+	};
+
+	/*
+	 *	Latency histogram in microseconds, bucket i holds [2^(i-1), 2^i) (bucket 0 : zero).
+	 *	Percentiles are reported as the upper bound of their bucket.
+	 */
+	struct Histogram {
+		enum { NUM_BUCKETS = 40 };
+
+		Histogram();
+
+		void record(u64 us);
+
+		// { "count", "mean_us", "max_us", "p50_us", "p90_us", "p99_us", "buckets" : [[upper_us, count], ...] }
+		void to_json(Json::Value &out) const;
+
+	private:
+		Histogram(const Histogram&);
+		Histogram &operator=(const Histogram&);
+
+		std::atomic<u64> _buckets[NUM_BUCKETS];
+		std::atomic<u64> _sum_us;
+		std::atomic<u64> _max_us;
+	};
+}
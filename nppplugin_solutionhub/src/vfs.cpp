@@ -0,0 +1,172 @@
+#include "vfs.h"
+
+#include "file_repository_common.h"
+
+#include "string/string_utils.h"
+
+#if defined(_WIN32)
+	#include <Windows.h> // FindFirstFile
+#else
+	#include <dirent.h>
+	#include <errno.h>
+	#include <fcntl.h> // AT_SYMLINK_NOFOLLOW
+	#include <sys/stat.h>
+#endif
+
+namespace vfs {
+	namespace {
+		/*
+		 *	The entries of one directory, 'FindFirstFile'/'FindNextFile' on Windows, 'readdir'
+		 *	elsewhere.
+		 */
+		struct DirectoryReader {
+#if defined(_WIN32)
+			enum { ENTRY_BYTES = sizeof(WIN32_FIND_DATA) };
+
+			DirectoryReader() : _find(INVALID_HANDLE_VALUE), _first(false), _failed(false) {}
+			~DirectoryReader() { if(_find != INVALID_HANDLE_VALUE) FindClose(_find); }
+
+			bool open(const wchar_t *directory)
+			{
+				const String spec = String(directory)+L"*.*";
+				_find = FindFirstFile(spec.c_str(), &_ffd);
+
+				_first = (_find != INVALID_HANDLE_VALUE);
+				return _first;
+			}
+
+			bool next(Entry &e)
+			{
+				if(_first) {
+					_first = false;
+				} else if(!FindNextFile(_find, &_ffd)) {
+					_failed = (GetLastError() != ERROR_NO_MORE_FILES);
+					return false;
+				}
+
+				e.name = _ffd.cFileName;
+				e.is_directory = (_ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+				if(!e.is_directory)
+					filerepo::make_internal_datestring_ft(e.date, &_ffd.ftLastWriteTime);
+				return true;
+			}
+
+		private:
+			HANDLE _find;
+			WIN32_FIND_DATA _ffd;
+			bool _first;
+#else
+			enum { ENTRY_BYTES = sizeof(struct dirent)+sizeof(struct stat) };
+
+			DirectoryReader() : _dir(0), _failed(false) {}
+			~DirectoryReader() { if(_dir) closedir(_dir); }
+
+			bool open(const wchar_t *directory)
+			{
+				_dir = opendir(string_util::from_wide(directory).c_str());
+				return _dir != 0;
+			}
+
+			bool next(Entry &e)
+			{
+				while(true) {
+					errno = 0;
+					struct dirent *d = readdir(_dir);
+					if(!d) {
+						_failed = (errno != 0);
+						return false;
+					}
+
+					// NOTE : an entry that is gone by now (or can not be stat'ed) is skipped
+					struct stat st;
+					if(fstatat(dirfd(_dir), d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+						e.name = string_util::to_wide(d->d_name);
+						e.is_directory = S_ISDIR(st.st_mode);
+						if(!e.is_directory)
+							filerepo::make_internal_datestring_time(e.date, (long long)st.st_mtime);
+						return true;
+					}
+				}
+			}
+
+		private:
+			DIR *_dir;
+#endif
+		public:
+			bool _failed;
+		};
+
+		DirectoryHandle os_open_directory(void*, const wchar_t *directory)
+		{
+			DirectoryReader *r = new DirectoryReader();
+			if(!r->open(directory)) {
+				delete r;
+				return 0;
+			}
+			return r;
+		}
+
+		bool os_next_entry(DirectoryHandle h, Entry &e)
+		{
+			return ((DirectoryReader*)h)->next(e);
+		}
+
+		bool os_directory_failed(DirectoryHandle h)
+		{
+			return ((DirectoryReader*)h)->_failed;
+		}
+
+		void os_close_directory(DirectoryHandle h)
+		{
+			delete (DirectoryReader*)h;
+		}
+
+		bool os_stat(void*, const wchar_t *path, Entry &e)
+		{
+			e.name = path+file_util::pathlength(path);
+#if defined(_WIN32)
+			WIN32_FILE_ATTRIBUTE_DATA data;
+			if(!GetFileAttributesEx(path, GetFileExInfoStandard, &data))
+				return false;
+
+			e.is_directory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+			if(!e.is_directory)
+				filerepo::make_internal_datestring_ft(e.date, &data.ftLastWriteTime);
+#else
+			struct stat st;
+			if(lstat(string_util::from_wide(path).c_str(), &st) != 0)
+				return false;
+
+			e.is_directory = S_ISDIR(st.st_mode);
+			if(!e.is_directory)
+				filerepo::make_internal_datestring_time(e.date, (long long)st.st_mtime);
+#endif
+			return true;
+		}
+
+		FolderMonitorHandle os_watch_allocate(void*, folder_monitor::RegisterContext *ctx)
+		{
+			return folder_monitor::allocate(ctx);
+		}
+
+		const Provider os_provider = {
+			0,
+			os_open_directory,
+			os_next_entry,
+			os_directory_failed,
+			os_close_directory,
+			os_stat,
+			os_watch_allocate,
+			folder_monitor::add_solutions,
+			folder_monitor::start,
+			folder_monitor::stop,
+			folder_monitor::get_counters,
+			DirectoryReader::ENTRY_BYTES
+		};
+	}
+
+	const Provider *os()
+	{
+		return &os_provider;
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "folder_monitor.h"
+
+#include <string>
+#include <vector>
+
+/*
+ *	The file system as the file repository sees it : directory entries for the
+ *	parsers, file state, and change notification (a folder monitor).
+ *
+ *	'os' is the real one (the folder monitor of the platform). 'memory_create' gives
+ *	a synthetic tree that only exists in memory : directory contents are derived from
+ *	a seed as they are read (nothing is stored until it is changed), so the parsers,
+ *	the monitor path and the repo can be run against millions of files, the same
+ *	files every run. Changes are made through 'memory_*' and reach the watchers like
+ *	folder monitor changes would, with optional latency.
+ */
+namespace vfs {
+	typedef std::wstring String;
+	typedef void* DirectoryHandle;
+
+	struct Entry {
+		String name;			// without the path
+		bool is_directory;
+		wchar_t date[17];		// files only, see 'filerepo::make_internal_datestring_time'
+	};
+
+	/*
+	 *	A table of functions, like the folder monitor 'RegisterContext'. Directories
+	 *	passed in end with a separator.
+	 */
+	struct Provider {
+		void *user_data;
+
+		// 0 if 'directory' can not be read, the entries are read with 'next_entry' (symbolic links are not followed)
+		DirectoryHandle (*open_directory)(void *user_data, const wchar_t *directory);
+
+		// false when done, or on failure (see 'directory_failed')
+		bool (*next_entry)(DirectoryHandle, Entry&);
+		bool (*directory_failed)(DirectoryHandle);
+		void (*close_directory)(DirectoryHandle);
+
+		// false if 'path' (file or directory, without a trailing separator) does not exist
+		bool (*stat)(void *user_data, const wchar_t *path, Entry&);
+
+		// watching, see 'folder_monitor.h' (the same contract)
+		FolderMonitorHandle (*watch_allocate)(void *user_data, folder_monitor::RegisterContext*);
+		void (*watch_add_solutions)(FolderMonitorHandle, Json::Value const&);
+		void (*watch_start)(FolderMonitorHandle);
+		void (*watch_stop)(FolderMonitorHandle);
+		void (*watch_counters)(FolderMonitorHandle, folder_monitor::Counters&);
+
+		// bytes of directory data the OS hands out per entry (see 'IOBudget')
+		unsigned entry_bytes;
+	};
+
+	const Provider *os();
+
+	//////////////////////////////////////////////////////////////////////////
+	// in memory
+
+	struct MemoryShape {
+		MemoryShape();
+
+		unsigned seed;
+		unsigned long long num_files;
+
+		unsigned subdirectories;		// per directory (all but the deepest level)
+		unsigned files;					// per directory (all but the last one)
+
+		unsigned read_latency_us;		// per directory opened
+		unsigned change_latency_ms;		// before watchers see a change
+	};
+
+	// 'root' is where the tree is (a path that looks like the platform's), see 'MemoryShape'
+	Provider *memory_create(const wchar_t *root, const MemoryShape&);
+
+	// NOTE : every repo using it must be gone (see 'filerepo::join')
+	void memory_destroy(Provider*);
+
+	// files in the tree (changes included), walks it
+	unsigned long long memory_count_files(Provider*);
+
+	// full paths of a few files that exist, picked by 'seed' (for changes)
+	void memory_pick_files(Provider*, unsigned seed, unsigned n, std::vector<String> &files);
+
+	// false if the parent does not exist (or, when removing/renaming, the path itself)
+	bool memory_add_file(Provider*, const wchar_t *fullname);
+	bool memory_modify_file(Provider*, const wchar_t *fullname);
+	bool memory_remove_file(Provider*, const wchar_t *fullname);
+	bool memory_add_directory(Provider*, const wchar_t *directory);
+	bool memory_remove_directory(Provider*, const wchar_t *directory);
+	bool memory_rename_directory(Provider*, const wchar_t *from, const wchar_t *to);
+
+	// waits until every change has reached the watchers
+	void memory_flush(Provider*);
+}
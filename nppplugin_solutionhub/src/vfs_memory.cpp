@@ -0,0 +1,895 @@
+#include "vfs.h"
+
+#include "file_repository_common.h"
+#include "stats.h"
+
+#include "json/json.h"
+#include "string/string_utils.h"
+#include "thread/critical_section.h"
+#include "thread/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <set>
+#include <thread>
+#include <wchar.h>
+
+/*
+ *	The synthetic tree : 'num_files' files, 'files' per directory, in a complete tree of
+ *	'subdirectories' per directory filled level by level (the last level only partially,
+ *	left to right). A directory is its level and its index in the level, the children
+ *	of (l, k) are (l+1, k*subdirectories+j). Names carry the index so they can be parsed
+ *	back, everything else (words, extensions, dates) is hashed from the seed.
+ *
+ *	Changes live in an overlay per directory : entries added (or renamed in, a directory
+ *	of the tree keeps its node) and entries of the tree that are gone.
+ */
+namespace vfs {
+	MemoryShape::MemoryShape() :
+	seed(1), num_files(100000), subdirectories(8), files(32), read_latency_us(0), change_latency_ms(0) {}
+
+	namespace {
+		typedef unsigned long long u64;
+
+#if defined(_WIN32)
+		const wchar_t SEPARATOR = L'\\';
+#else
+		const wchar_t SEPARATOR = L'/';
+#endif
+
+		const wchar_t *WORDS[] = {
+			L"alpha", L"buffer", L"cache", L"dialog", L"engine", L"filter", L"graph", L"handler",
+			L"index", L"journal", L"kernel", L"layout", L"matrix", L"network", L"object", L"parser",
+			L"query", L"render", L"stream", L"thread", L"utility", L"vector", L"window", L"widget",
+			L"archive", L"bitmap", L"config", L"driver", L"event", L"font", L"glyph", L"hash"
+		};
+		const unsigned NUM_WORDS = sizeof(WORDS)/sizeof(WORDS[0]);
+
+		const wchar_t *EXTENSIONS[] = {
+			L".cpp", L".h", L".cpp", L".h", L".c", L".hpp", L".inl", L".txt", L".xml", L".lua", L".py", L".json"
+		};
+		const unsigned NUM_EXTENSIONS = sizeof(EXTENSIONS)/sizeof(EXTENSIONS[0]);
+
+		// dates of the tree are within three years of this, changes are dated after it
+		const long long BASE_TIME = 1500000000;
+		const long long DATE_RANGE = 3*365*24*3600;
+
+		u64 mix(u64 x)
+		{
+			// splitmix64 finalizer
+			x += 0x9e3779b97f4a7c15ull;
+			x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+			x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+			return x ^ (x >> 31);
+		}
+
+		struct Node {
+			unsigned level;
+			u64 index;
+		};
+
+		struct Layout {
+			void init(const MemoryShape &shape)
+			{
+				seed = shape.seed;
+				fanout = (shape.subdirectories < 2 ? 2 : shape.subdirectories);
+				per_directory = (shape.files ? shape.files : 1);
+				num_files = shape.num_files;
+
+				num_nodes = (num_files+per_directory-1)/per_directory;
+				if(!num_nodes)
+					num_nodes = 1;
+
+				u64 total = 0, width = 1;
+				while(total < num_nodes) {
+					const u64 n = std::min(width, num_nodes-total);
+					first.push_back(total);
+					size.push_back(n);
+
+					total += n;
+					width = n*fanout;
+				}
+			}
+
+			u64 num_children(const Node &n) const
+			{
+				const unsigned l = n.level+1;
+				if(l >= size.size() || size[l] <= n.index*fanout)
+					return 0;
+				return std::min<u64>(fanout, size[l]-n.index*fanout);
+			}
+
+			u64 num_files_in(const Node &n) const
+			{
+				const u64 ordinal = first[n.level]+n.index;
+				return (ordinal+1 < num_nodes ? per_directory : num_files-(num_nodes-1)*per_directory);
+			}
+
+			String directory_name(unsigned level, u64 index) const
+			{
+				const u64 h = mix(seed ^ mix(((u64)level << 48) ^ index));
+				return String(WORDS[h % NUM_WORDS]) + std::to_wstring(index);
+			}
+
+			String file_name(const Node &n, u64 i) const
+			{
+				const u64 h = mix(seed ^ mix((first[n.level]+n.index) ^ (i << 40) ^ 0x5bd1e995ull));
+				return String(WORDS[h % NUM_WORDS]) + L"_" + std::to_wstring(i) + EXTENSIONS[(h >> 32) % NUM_EXTENSIONS];
+			}
+
+			void file_date(const Node &n, u64 i, wchar_t *date) const
+			{
+				const u64 h = mix(seed ^ mix((first[n.level]+n.index) ^ (i << 40) ^ 0x27d4eb2full));
+				filerepo::make_internal_datestring_time(date, BASE_TIME+(long long)(h % DATE_RANGE));
+			}
+
+			unsigned seed;
+			unsigned fanout;
+			unsigned per_directory;
+			u64 num_files;
+			u64 num_nodes;
+
+			std::vector<u64> first;	// ordinal of the first node, per level
+			std::vector<u64> size;	// nodes, per level
+		};
+
+		// trailing digits of 'name', false if there are none
+		bool parse_index(const String &name, size_t end, size_t &begin, u64 &index)
+		{
+			begin = end;
+			while(begin > 0 && name[begin-1] >= L'0' && name[begin-1] <= L'9')
+				--begin;
+			if(begin == end || end-begin > 18)
+				return false;
+
+			index = 0;
+			for(size_t i=begin; i<end; ++i)
+				index = index*10+(name[i]-L'0');
+			return true;
+		}
+
+		// an entry as the overlay (or the tree) has it
+		struct Item {
+			Item() : is_directory(false), synthetic(false) { node.level = 0; node.index = 0; date[0] = 0; }
+
+			bool is_directory;
+			bool synthetic; // a directory of the tree, its contents are 'node'
+			Node node;
+			wchar_t date[17];
+		};
+
+		struct Overlay {
+			std::map<String, Item> added;
+			std::set<String> removed; // of the tree
+		};
+		typedef std::map<String, Overlay> Overlays;
+
+		// what a directory is, see 'resolve'
+		struct Resolved {
+			bool synthetic;
+			Node node;
+		};
+
+		struct MemoryWatcher;
+
+		struct Change {
+			String path;			// file, or directory (with a separator)
+			String to;				// CHANGE_DIRECTORY_RENAME
+			unsigned type;
+			std::vector<char> packet;
+		};
+
+		struct MemoryFileSystem {
+			Provider provider;
+
+			String root; // with a separator
+			MemoryShape shape;
+			Layout layout;
+
+			npp::CriticalSection lock;
+			Overlays overlays; // by directory (with a separator)
+			u64 modifications;
+
+			std::vector<MemoryWatcher*> watchers;
+			std::deque<Change> changes;
+			std::atomic<unsigned> outstanding;
+		};
+
+		struct MemoryDirectory {
+			std::vector<Entry> entries;
+			size_t next;
+		};
+
+		//////////////////////////////////////////////////////////////////////////
+		// the tree and its overlay, under 'lock'
+
+		bool find_synthetic(const MemoryFileSystem &fs, const Node &parent, const String &name, Item &item)
+		{
+			const Layout &layout = fs.layout;
+
+			size_t begin; u64 index;
+			const size_t dot = name.rfind(L'.');
+			const size_t underscore = name.rfind(L'_', dot);
+			if(dot != String::npos && underscore != String::npos && parse_index(name, dot, begin, index) && begin == underscore+1) {
+				if(index < layout.num_files_in(parent) && name == layout.file_name(parent, index)) {
+					item = Item();
+					layout.file_date(parent, index, item.date);
+					return true;
+				}
+				return false;
+			}
+
+			if(!parse_index(name, name.length(), begin, index))
+				return false;
+
+			const u64 first = parent.index*layout.fanout;
+			if(index < first || index-first >= layout.num_children(parent) || name != layout.directory_name(parent.level+1, index))
+				return false;
+
+			item = Item();
+			item.is_directory = true;
+			item.synthetic = true;
+			item.node.level = parent.level+1;
+			item.node.index = index;
+			return true;
+		}
+
+		// 'name' in 'directory' (resolved as 'r'), the overlay first
+		bool find_entry(const MemoryFileSystem &fs, const String &directory, const Resolved &r, const String &name, Item &item)
+		{
+			Overlays::const_iterator o = fs.overlays.find(directory);
+			if(o != fs.overlays.end()) {
+				std::map<String, Item>::const_iterator a = o->second.added.find(name);
+				if(a != o->second.added.end()) {
+					item = a->second;
+					return true;
+				}
+				if(o->second.removed.count(name))
+					return false;
+			}
+
+			return r.synthetic && find_synthetic(fs, r.node, name, item);
+		}
+
+		// false if 'directory' (with a separator) does not exist
+		bool resolve(const MemoryFileSystem &fs, const String &directory, Resolved &r)
+		{
+			if(directory.compare(0, fs.root.length(), fs.root) != 0)
+				return false;
+
+			r.synthetic = true;
+			r.node.level = 0;
+			r.node.index = 0;
+
+			String current = fs.root;
+			size_t at = fs.root.length();
+			while(at < directory.length()) {
+				size_t end = directory.find(SEPARATOR, at);
+				if(end == String::npos)
+					end = directory.length();
+
+				const String name = directory.substr(at, end-at);
+				Item item;
+				if(name.empty() || !find_entry(fs, current, r, name, item) || !item.is_directory)
+					return false;
+
+				r.synthetic = item.synthetic;
+				r.node = item.node;
+
+				current += name;
+				current += SEPARATOR;
+				at = end+1;
+			}
+			return true;
+		}
+
+		void list(const MemoryFileSystem &fs, const String &directory, const Resolved &r, std::vector<Entry> &entries)
+		{
+			const Layout &layout = fs.layout;
+
+			Overlays::const_iterator o = fs.overlays.find(directory);
+			const Overlay *overlay = (o != fs.overlays.end() ? &o->second : 0);
+
+			Entry e;
+			if(r.synthetic) {
+				const u64 first = r.node.index*layout.fanout, num_children = layout.num_children(r.node);
+				for(u64 i=0; i<num_children; ++i) {
+					e.name = layout.directory_name(r.node.level+1, first+i);
+					if(overlay && (overlay->added.count(e.name) || overlay->removed.count(e.name)))
+						continue;
+
+					e.is_directory = true;
+					e.date[0] = 0;
+					entries.push_back(e);
+				}
+
+				const u64 num_files = layout.num_files_in(r.node);
+				for(u64 i=0; i<num_files; ++i) {
+					e.name = layout.file_name(r.node, i);
+					if(overlay && (overlay->added.count(e.name) || overlay->removed.count(e.name)))
+						continue;
+
+					e.is_directory = false;
+					layout.file_date(r.node, i, e.date);
+					entries.push_back(e);
+				}
+			}
+
+			if(overlay) {
+				for(std::map<String, Item>::const_iterator a = overlay->added.begin(); a != overlay->added.end(); ++a) {
+					e.name = a->first;
+					e.is_directory = a->second.is_directory;
+					wcscpy(e.date, a->second.date);
+					entries.push_back(e);
+				}
+			}
+		}
+
+		// 'path' (without a trailing separator) as its directory (with one) and name
+		bool split(const wchar_t *path, String &directory, String &name)
+		{
+			String p(path);
+			while(!p.empty() && p[p.length()-1] == SEPARATOR)
+				p.erase(p.length()-1);
+
+			const size_t s = p.rfind(SEPARATOR);
+			if(s == String::npos || s+1 == p.length())
+				return false;
+
+			directory = p.substr(0, s+1);
+			name = p.substr(s+1);
+			return true;
+		}
+
+		// removes 'name' from 'directory', a name of the tree is remembered as removed
+		void remove_entry(MemoryFileSystem &fs, const String &directory, const Resolved &r, const String &name)
+		{
+			Overlay &o = fs.overlays[directory];
+			o.added.erase(name);
+
+			Item item;
+			if(r.synthetic && find_synthetic(fs, r.node, name, item))
+				o.removed.insert(name);
+		}
+
+		void next_date(MemoryFileSystem &fs, wchar_t *date)
+		{
+			// NOTE : a minute per change, dates only have minutes
+			filerepo::make_internal_datestring_time(date, BASE_TIME+DATE_RANGE+(long long)(++fs.modifications)*60);
+		}
+
+		//////////////////////////////////////////////////////////////////////////
+		// watching
+
+		struct MemoryRoot {
+			String foldername; // with a separator
+			String include_filter;
+			String exclude_filter;
+			bool recursive;
+		};
+
+		struct MemoryWatcher {
+			MemoryFileSystem *fs;
+			folder_monitor::RegisterContext context;
+			std::vector<MemoryRoot> roots;
+			bool started;
+
+			stats::Counter notifications;
+		};
+
+		bool include_file(const MemoryRoot &root, const wchar_t *file_name)
+		{
+			// NOTE : like the folder monitors
+			if(root.include_filter.empty() && root.exclude_filter.empty())
+				return true;
+
+			const wchar_t *e = file_util::fileextension(file_name, false);
+			if(!e)
+				return true;
+
+			return (!root.include_filter.empty() ? string_util::contains_tokens(e, root.include_filter.c_str(), false, L'.') : !string_util::contains_tokens(e, root.exclude_filter.c_str(), false, L'.'));
+		}
+
+		bool below(const MemoryRoot &root, const String &path, bool directory)
+		{
+			if(path.length() <= root.foldername.length() || path.compare(0, root.foldername.length(), root.foldername) != 0)
+				return false;
+			if(root.recursive)
+				return true;
+
+			// NOTE : directories below a root that is not recursive have nothing indexed
+			return !directory && path.find(SEPARATOR, root.foldername.length()) == String::npos;
+		}
+
+		// what 'w' sees of 'c', nothing if the change is not below one of its roots
+		bool watcher_packet(const MemoryWatcher &w, const Change &c, std::vector<char> &buffer)
+		{
+			const bool directory = (c.type == filerepo_headers::CHANGE_DIRECTORY_RENAME || c.type == filerepo_headers::CHANGE_DIRECTORY_REMOVE);
+
+			for(size_t i=0; i<w.roots.size(); ++i) {
+				const MemoryRoot &root = w.roots[i];
+				if(!below(root, c.path, directory))
+					continue;
+
+				if(!directory && !include_file(root, c.path.c_str()+file_util::pathlength(c.path.c_str())))
+					continue;
+
+				// NOTE : moved out of the root, moved in from elsewhere is not reported (nothing to rename)
+				if(c.type == filerepo_headers::CHANGE_DIRECTORY_RENAME && !below(root, c.to, true))
+					filerepo::aux::pack_directory_remove(buffer, c.path);
+				else
+					buffer = c.packet;
+				return true;
+			}
+			return false;
+		}
+
+		void deliver_task(void *p)
+		{
+			MemoryFileSystem &fs = *(MemoryFileSystem*)p;
+
+			std::vector<char> buffer;
+			{
+				npp::CriticalSectionScope scope(fs.lock);
+
+				const Change c = fs.changes.front();
+				fs.changes.pop_front();
+
+				for(size_t i=0; i<fs.watchers.size(); ++i) {
+					MemoryWatcher &w = *fs.watchers[i];
+
+					buffer.clear();
+					if(!w.started || !watcher_packet(w, c, buffer))
+						continue;
+
+					w.notifications.add();
+					w.context.notify_function(w.context.user_data, &buffer[0], (unsigned)buffer.size());
+				}
+			}
+
+			--fs.outstanding;
+		}
+
+		// NOTE : in order, the changes are queued and every task delivers the oldest
+		void post_change(MemoryFileSystem &fs, Change &c)
+		{
+			fs.changes.push_back(Change());
+			fs.changes.back().path.swap(c.path);
+			fs.changes.back().to.swap(c.to);
+			fs.changes.back().type = c.type;
+			fs.changes.back().packet.swap(c.packet);
+
+			++fs.outstanding;
+			if(fs.shape.change_latency_ms)
+				npp::threadpool_submit_after(fs.shape.change_latency_ms, deliver_task, &fs);
+			else
+				npp::threadpool_submit(deliver_task, &fs);
+		}
+
+		void post_file_change(MemoryFileSystem &fs, unsigned type, const String &fullname, const wchar_t *date)
+		{
+			Change c;
+			c.path = fullname;
+			c.type = type;
+			filerepo::aux::pack_changeheader(c.packet, type, fullname.c_str(), (date ? 16 : 0), date);
+			post_change(fs, c);
+		}
+
+		//////////////////////////////////////////////////////////////////////////
+		// Provider
+
+		DirectoryHandle memory_open_directory(void *user_data, const wchar_t *directory)
+		{
+			MemoryFileSystem &fs = *(MemoryFileSystem*)user_data;
+
+			if(fs.shape.read_latency_us)
+				std::this_thread::sleep_for(std::chrono::microseconds(fs.shape.read_latency_us));
+
+			MemoryDirectory *d = new MemoryDirectory();
+			d->next = 0;
+
+			npp::CriticalSectionScope scope(fs.lock);
+
+			Resolved r;
+			if(!resolve(fs, directory, r)) {
+				delete d;
+				return 0;
+			}
+
+			list(fs, directory, r, d->entries);
+			return d;
+		}
+
+		bool memory_next_entry(DirectoryHandle h, Entry &e)
+		{
+			MemoryDirectory &d = *(MemoryDirectory*)h;
+			if(d.next == d.entries.size())
+				return false;
+
+			e = d.entries[d.next++];
+			return true;
+		}
+
+		bool memory_directory_failed(DirectoryHandle)
+		{
+			return false;
+		}
+
+		void memory_close_directory(DirectoryHandle h)
+		{
+			delete (MemoryDirectory*)h;
+		}
+
+		bool memory_stat(void *user_data, const wchar_t *path, Entry &e)
+		{
+			MemoryFileSystem &fs = *(MemoryFileSystem*)user_data;
+
+			String directory, name;
+			if(!split(path, directory, name))
+				return false;
+
+			npp::CriticalSectionScope scope(fs.lock);
+
+			Resolved r; Item item;
+			if(!resolve(fs, directory, r) || !find_entry(fs, directory, r, name, item))
+				return false;
+
+			e.name = name;
+			e.is_directory = item.is_directory;
+			wcscpy(e.date, item.date);
+			return true;
+		}
+
+		FolderMonitorHandle memory_watch_allocate(void *user_data, folder_monitor::RegisterContext *ctx)
+		{
+			MemoryFileSystem &fs = *(MemoryFileSystem*)user_data;
+
+			MemoryWatcher *w = new MemoryWatcher();
+			w->fs = &fs;
+			w->context = *ctx;
+			w->started = false;
+
+			npp::CriticalSectionScope scope(fs.lock);
+			fs.watchers.push_back(w);
+			return w;
+		}
+
+		void memory_watch_add_solutions(FolderMonitorHandle h, Json::Value const &dirs)
+		{
+			MemoryWatcher &w = *(MemoryWatcher*)h;
+
+			std::vector<MemoryRoot> roots;
+			for(unsigned i=0; i<dirs.size(); ++i) {
+				const Json::Value &dir = dirs[i];
+				const bool monitored = (dir["monitored"].isBool() ? dir["monitored"].asBool() : false);
+				if(!monitored || !dir["path"].isString())
+					continue;
+
+				MemoryRoot root;
+				root.foldername = string_util::to_wide(dir["path"].asCString());
+				file_util::append_slash(root.foldername);
+
+				root.include_filter = (dir["include_filter"].isString() ? string_util::to_wide(dir["include_filter"].asCString()) : L"");
+				root.exclude_filter = (dir["exclude_filter"].isString() ? string_util::to_wide(dir["exclude_filter"].asCString()) : L"");
+				root.recursive = (dir["recursive"].isBool() ? dir["recursive"].asBool() : false);
+				roots.push_back(root);
+			}
+
+			npp::CriticalSectionScope scope(w.fs->lock);
+			w.roots.insert(w.roots.end(), roots.begin(), roots.end());
+		}
+
+		void memory_watch_start(FolderMonitorHandle h)
+		{
+			MemoryWatcher &w = *(MemoryWatcher*)h;
+
+			npp::CriticalSectionScope scope(w.fs->lock);
+			w.started = true;
+		}
+
+		void memory_watch_stop(FolderMonitorHandle h)
+		{
+			MemoryWatcher *w = (MemoryWatcher*)h;
+			MemoryFileSystem &fs = *w->fs;
+			{
+				// NOTE : a delivery holds the lock while notifying, nothing is delivered after this
+				npp::CriticalSectionScope scope(fs.lock);
+				fs.watchers.erase(std::find(fs.watchers.begin(), fs.watchers.end(), w));
+			}
+
+			w->context.release_function(w->context.user_data);
+			delete w;
+		}
+
+		void memory_watch_counters(FolderMonitorHandle h, folder_monitor::Counters &c)
+		{
+			MemoryWatcher &w = *(MemoryWatcher*)h;
+
+			c.notifications = w.notifications.get();
+			c.overflows = 0;
+			c.rescans = 0;
+			c.watch_failures = 0;
+
+			// NOTE : the roots, once started
+			npp::CriticalSectionScope scope(w.fs->lock);
+			c.watched_directories = (w.started ? w.roots.size() : 0);
+		}
+
+		MemoryFileSystem &memory(Provider *p)
+		{
+			return *(MemoryFileSystem*)p->user_data;
+		}
+	}
+
+	Provider *memory_create(const wchar_t *root, const MemoryShape &shape)
+	{
+		MemoryFileSystem *fs = new MemoryFileSystem();
+		fs->root = root;
+		file_util::append_slash(fs->root);
+		fs->shape = shape;
+		fs->layout.init(shape);
+		fs->modifications = 0;
+		fs->outstanding = 0;
+
+		const Provider p = {
+			fs,
+			memory_open_directory,
+			memory_next_entry,
+			memory_directory_failed,
+			memory_close_directory,
+			memory_stat,
+			memory_watch_allocate,
+			memory_watch_add_solutions,
+			memory_watch_start,
+			memory_watch_stop,
+			memory_watch_counters,
+			(unsigned)(sizeof(Entry)+64*sizeof(wchar_t)) // about what a directory listing costs
+		};
+		fs->provider = p;
+		return &fs->provider;
+	}
+
+	void memory_destroy(Provider *p)
+	{
+		memory_flush(p);
+		delete &memory(p);
+	}
+
+	unsigned long long memory_count_files(Provider *p)
+	{
+		MemoryFileSystem &fs = memory(p);
+		npp::CriticalSectionScope scope(fs.lock);
+
+		u64 num_files = 0;
+
+		std::vector<String> directories(1, fs.root);
+		std::vector<Entry> entries;
+		while(!directories.empty()) {
+			const String directory = directories.back();
+			directories.pop_back();
+
+			Resolved r;
+			if(!resolve(fs, directory, r))
+				continue;
+
+			entries.clear();
+			list(fs, directory, r, entries);
+			for(size_t i=0; i<entries.size(); ++i) {
+				if(entries[i].is_directory)
+					directories.push_back(directory+entries[i].name+SEPARATOR);
+				else
+					++num_files;
+			}
+		}
+		return num_files;
+	}
+
+	void memory_pick_files(Provider *p, unsigned seed, unsigned n, std::vector<String> &files)
+	{
+		MemoryFileSystem &fs = memory(p);
+		npp::CriticalSectionScope scope(fs.lock);
+
+		// NOTE : random walks from the root, a walk ending in a directory without files is retried (a few times)
+		std::vector<Entry> entries;
+		u64 state = mix(seed);
+		for(unsigned attempts=0; files.size() < n && attempts < 64*n; ++attempts) {
+			String directory = fs.root;
+			while(true) {
+				Resolved r;
+				if(!resolve(fs, directory, r))
+					break;
+
+				entries.clear();
+				list(fs, directory, r, entries);
+				if(entries.empty())
+					break;
+
+				state = mix(state);
+				const Entry &e = entries[state % entries.size()];
+				if(!e.is_directory) {
+					const String fullname = directory+e.name;
+					if(std::find(files.begin(), files.end(), fullname) == files.end())
+						files.push_back(fullname);
+					break;
+				}
+				directory += e.name;
+				directory += SEPARATOR;
+			}
+		}
+	}
+
+	bool memory_add_file(Provider *p, const wchar_t *fullname)
+	{
+		MemoryFileSystem &fs = memory(p);
+
+		String directory, name;
+		if(!split(fullname, directory, name))
+			return false;
+
+		npp::CriticalSectionScope scope(fs.lock);
+
+		Resolved r; Item item;
+		if(!resolve(fs, directory, r))
+			return false;
+
+		const bool exists = find_entry(fs, directory, r, name, item);
+		if(exists && item.is_directory)
+			return false;
+
+		item = Item();
+		next_date(fs, item.date);
+		fs.overlays[directory].added[name] = item;
+
+		post_file_change(fs, (exists ? filerepo_headers::CHANGE_UPDATE : filerepo_headers::CHANGE_ADD), directory+name, item.date);
+		return true;
+	}
+
+	bool memory_modify_file(Provider *p, const wchar_t *fullname)
+	{
+		MemoryFileSystem &fs = memory(p);
+
+		String directory, name;
+		if(!split(fullname, directory, name))
+			return false;
+
+		npp::CriticalSectionScope scope(fs.lock);
+
+		Resolved r; Item item;
+		if(!resolve(fs, directory, r) || !find_entry(fs, directory, r, name, item) || item.is_directory)
+			return false;
+
+		next_date(fs, item.date);
+		fs.overlays[directory].added[name] = item;
+
+		post_file_change(fs, filerepo_headers::CHANGE_UPDATE, directory+name, item.date);
+		return true;
+	}
+
+	bool memory_remove_file(Provider *p, const wchar_t *fullname)
+	{
+		MemoryFileSystem &fs = memory(p);
+
+		String directory, name;
+		if(!split(fullname, directory, name))
+			return false;
+
+		npp::CriticalSectionScope scope(fs.lock);
+
+		Resolved r; Item item;
+		if(!resolve(fs, directory, r) || !find_entry(fs, directory, r, name, item) || item.is_directory)
+			return false;
+
+		remove_entry(fs, directory, r, name);
+
+		post_file_change(fs, filerepo_headers::CHANGE_REMOVE, directory+name, 0);
+		return true;
+	}
+
+	bool memory_add_directory(Provider *p, const wchar_t *path)
+	{
+		MemoryFileSystem &fs = memory(p);
+
+		String directory, name;
+		if(!split(path, directory, name))
+			return false;
+
+		npp::CriticalSectionScope scope(fs.lock);
+
+		Resolved r; Item item;
+		if(!resolve(fs, directory, r) || find_entry(fs, directory, r, name, item))
+			return false;
+
+		// NOTE : empty, nothing to report
+		item.is_directory = true;
+		fs.overlays[directory].added[name] = item;
+		return true;
+	}
+
+	bool memory_remove_directory(Provider *p, const wchar_t *path)
+	{
+		MemoryFileSystem &fs = memory(p);
+
+		String directory, name;
+		if(!split(path, directory, name))
+			return false;
+
+		npp::CriticalSectionScope scope(fs.lock);
+
+		Resolved r; Item item;
+		if(!resolve(fs, directory, r) || !find_entry(fs, directory, r, name, item) || !item.is_directory)
+			return false;
+
+		remove_entry(fs, directory, r, name);
+
+		// the overlays below it go with it
+		const String removed = directory+name+SEPARATOR;
+		Overlays::iterator o = fs.overlays.lower_bound(removed);
+		while(o != fs.overlays.end() && o->first.compare(0, removed.length(), removed) == 0)
+			fs.overlays.erase(o++);
+
+		Change c;
+		c.path = removed;
+		c.type = filerepo_headers::CHANGE_DIRECTORY_REMOVE;
+		filerepo::aux::pack_directory_remove(c.packet, removed);
+		post_change(fs, c);
+		return true;
+	}
+
+	bool memory_rename_directory(Provider *p, const wchar_t *from, const wchar_t *to)
+	{
+		MemoryFileSystem &fs = memory(p);
+
+		String from_directory, from_name, to_directory, to_name;
+		if(!split(from, from_directory, from_name) || !split(to, to_directory, to_name))
+			return false;
+
+		const String from_path = from_directory+from_name+SEPARATOR;
+		const String to_path = to_directory+to_name+SEPARATOR;
+		if(to_path.compare(0, from_path.length(), from_path) == 0)
+			return false; // into itself
+
+		npp::CriticalSectionScope scope(fs.lock);
+
+		Resolved from_r, to_r; Item item, existing;
+		if(!resolve(fs, from_directory, from_r) || !find_entry(fs, from_directory, from_r, from_name, item) || !item.is_directory)
+			return false;
+		if(!resolve(fs, to_directory, to_r) || find_entry(fs, to_directory, to_r, to_name, existing))
+			return false;
+
+		remove_entry(fs, from_directory, from_r, from_name);
+		fs.overlays[to_directory].added[to_name] = item;
+
+		// the overlays below it move with it
+		std::vector<std::pair<String, Overlay> > moved;
+		Overlays::iterator o = fs.overlays.lower_bound(from_path);
+		while(o != fs.overlays.end() && o->first.compare(0, from_path.length(), from_path) == 0) {
+			moved.push_back(std::make_pair(to_path+o->first.substr(from_path.length()), Overlay()));
+			moved.back().second.added.swap(o->second.added);
+			moved.back().second.removed.swap(o->second.removed);
+			fs.overlays.erase(o++);
+		}
+		for(size_t i=0; i<moved.size(); ++i) {
+			Overlay &overlay = fs.overlays[moved[i].first];
+			overlay.added.swap(moved[i].second.added);
+			overlay.removed.swap(moved[i].second.removed);
+		}
+
+		Change c;
+		c.path = from_path;
+		c.to = to_path;
+		c.type = filerepo_headers::CHANGE_DIRECTORY_RENAME;
+		filerepo::aux::pack_directory_rename(c.packet, from_path, to_path);
+		post_change(fs, c);
+		return true;
+	}
+
+	void memory_flush(Provider *p)
+	{
+		MemoryFileSystem &fs = memory(p);
+		while(fs.outstanding.load() != 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
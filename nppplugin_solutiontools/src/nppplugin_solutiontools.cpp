@@ -32,6 +32,7 @@ namespace {
 	const unsigned HEADER_SWITCH = 0;
 	const unsigned HEADER_SEARCH = 1;
 	const unsigned HEADER_GOTO_FILELINE = 2;
+	const unsigned HEADER_SEARCH_EXACT = 3;
 
 	void nppaux_document_open(const wchar_t *full, int line)
 	{
@@ -436,7 +437,8 @@ namespace {
 		::SendMessage(npp_plugin::npp(), NPPM_GETEXTPART, (WPARAM) out_size, (LPARAM)out);
 	}
 
-	void search(const wchar_t *search_name, void *userdata, unsigned userdata_size)
+	// 'exact' : the records named 'search_name' (or with a full path ending in it), no substring search
+	void search(const wchar_t *search_name, void *userdata, unsigned userdata_size, bool exact = false)
 	{
 		SearchRequest sr; memset(&sr, 0, sizeof(sr));
 		sr.result_notification = NPPM_ST_ON_SEARCH_RESPONSE;
@@ -445,20 +447,20 @@ namespace {
 		sr.userdata_size = userdata_size;
 
 		CommunicationInfo comm;
-		comm.internalMsg = NPPM_SOLUTIONHUB_SEARCH_SOLUTION;
+		comm.internalMsg = (exact ? NPPM_SOLUTIONHUB_SEARCH_SOLUTION_EXACT : NPPM_SOLUTIONHUB_SEARCH_SOLUTION);
 		comm.srcModuleName = npp_plugin::module_name();
 		comm.info = &sr;
 
 		::SendMessage(npp_plugin::npp(), NPPM_MSGTOPLUGIN, (WPARAM)SOLUTIONHUB_DLL_FILE_NAME, (LPARAM)&comm);
 	}
 
-	void sh_search_for(const wchar_t *search_name)
+	void sh_search_for(const wchar_t *search_name, bool exact)
 	{
 		std::vector<char> search_data;
 
-		npp::stream::pack(search_data, HEADER_SEARCH);
+		npp::stream::pack(search_data, exact ? HEADER_SEARCH_EXACT : HEADER_SEARCH);
 		npp::stream::pack_string_wide(search_data, search_name);
-		search(search_name, &search_data[0], (unsigned)search_data.size()); // send to SolutionHub
+		search(search_name, &search_data[0], (unsigned)search_data.size(), exact); // send to SolutionHub
 	}
 
 	String path(const wchar_t *p, bool keep_sep)
@@ -592,7 +594,8 @@ namespace {
 							}
 						}
 
-						sh_search_for(B);
+						// NOTE : with an extension the name is complete, without one the substring search picks 'name.*' (see 'on_searchresponse')
+						sh_search_for(B, tag_ext != 0);
 					}
 				}
 			}
@@ -1074,7 +1077,7 @@ namespace {
 			npp::stream::pack_string_wide(search_data, r.c_str());
 			npp::stream::pack_bytes(search_data, &line, sizeof line);
 
-			search(r.c_str(), &search_data[0], (unsigned)search_data.size()); // send to SolutionHub
+			search(r.c_str(), &search_data[0], (unsigned)search_data.size(), true); // send to SolutionHub
 		}
 	}
 }
@@ -1388,6 +1391,21 @@ namespace npp_plugin_st {
 					}
 				}
 			}
+			else if(header == HEADER_SEARCH_EXACT)
+			{
+				//! every record is named like the tag, the first one still there
+				for(unsigned i=0; i != frs.num_records; ++i)
+				{
+					FileRecord fr = frs.filerecord(i);
+
+					String temp(fr.path);
+					temp += fr.filename;
+					if(::PathFileExists(temp.c_str())) {
+						npp_open_file(temp.c_str());
+						break;
+					}
+				}
+			}
 			else if(header == HEADER_SWITCH)
 			{
 				//! searchfile
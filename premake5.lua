@@ -113,6 +113,11 @@ newoption {
 	default		= "git.exe"
 }
 
+newoption {
+	trigger		= "trace",
+	description	= [[Compile in span tracing (SolutionHub menu 'Save trace' writes a Chrome trace json)]]
+}
+
 newoption {
 	trigger		= "sevenzippath",
 	value		= "FILEPATH",
@@ -435,6 +440,10 @@ solution "nppplugins"
 
 	configuration {}
 
+	if _OPTIONS["trace"] then
+		defines { "NPP_TRACE" }
+	end
+
 	external "notepadPlus"
 		location "PowerEditor/visual.net"
 		uuid "FCF60E65-1B78-4D1D-AB59-4FC00AC8C248"
@@ -613,6 +622,33 @@ function make_plugin(name, project_settings)
 		end
 end
 
+-- console tools (benchmarks etc.), built with the solution but never deployed
+function make_tool(name, tool_settings)
+	project (name)
+		uuid (os.uuid(name))
+		location ".build"
+		kind "ConsoleApp"
+		language "C++"
+
+		configuration { "Release", "vs*" }
+			buildoptions { "/MT" }
+
+		configuration { "Debug", "vs*" }
+			buildoptions { "/MTd" }
+
+		configuration { "windows" }
+			files { table.unpack(tool_settings.windows_files or {}) }
+
+		configuration { "not windows" }
+			buildoptions { "-std=c++14" }
+			links { "pthread" }
+
+		configuration {}
+
+		files { table.unpack(tool_settings.files) }
+		includedirs { table.unpack(tool_settings.includedirs) }
+end
+
 local function wrootdir(s) return ROOT_DIR..s end
 
 local solutionhub_postbuild_commands = {
@@ -627,6 +663,77 @@ make_plugin("nppplugin_solutionhub_ui",{dependson={"nppplugin_solutionhub"}})
 make_plugin("nppplugin_solutiontools", {config=true, doc=true, dependson={"nppplugin_solutionhub"}})
 make_plugin("nppplugin_svn", {config=true, doc=true, dependson={"nppplugin_solutionhub"}})
 
+-- the input pipeline of the file repository (MPSC queue and strand) under many producers
+make_tool("bench_input", {
+	files = { "nppplugin_shared/thread/**", "nppplugin_shared/trace/**", "nppplugin_solutionhub/bench/bench_input.cpp" },
+	includedirs = { "nppplugin_shared/" },
+})
+
+-- the file repository without the plugin (and Notepad++) around it
+local solutionhub_core_files = {
+	"nppplugin_shared/stream.h",
+	"nppplugin_shared/file/**",
+	"nppplugin_shared/json/**",
+	"nppplugin_shared/log/**",
+	"nppplugin_shared/string/**",
+	"nppplugin_shared/thread/**",
+	"nppplugin_shared/trace/**",
+	"nppplugin_solutionhub/src/directory_trie.*",
+	"nppplugin_solutionhub/src/file_repository*",
+	"nppplugin_solutionhub/src/folder_monitor*",
+	"nppplugin_solutionhub/src/io_budget.*",
+	"nppplugin_solutionhub/src/memory.*",
+	"nppplugin_solutionhub/src/query_cache.*",
+	"nppplugin_solutionhub/src/query_trace.*",
+	"nppplugin_solutionhub/src/stats.*",
+	"nppplugin_solutionhub/src/vfs*",
+}
+
+-- used by the Windows folder monitor only
+local solutionhub_core_windows_files = {
+	"nppplugin_shared/json_aux/**",
+	"nppplugin_shared/win32/win_aux.*",
+}
+
+local function with_core_files(t)
+	local files = table_copy(solutionhub_core_files)
+	for _, f in ipairs(t) do files[#files+1] = f end
+	return files
+end
+
+make_tool("bench_repository", {
+	files = with_core_files { "nppplugin_solutionhub/bench/corpus.*", "nppplugin_solutionhub/bench/bench_repository.cpp" },
+	windows_files = solutionhub_core_windows_files,
+	includedirs = { "nppplugin_shared/", "nppplugin_solutionhub/src" },
+})
+
+make_tool("replay_queries", {
+	files = with_core_files { "nppplugin_solutionhub/bench/corpus.*", "nppplugin_solutionhub/bench/replay_queries.cpp" },
+	windows_files = solutionhub_core_windows_files,
+	includedirs = { "nppplugin_shared/", "nppplugin_solutionhub/src" },
+})
+
+-- inotify, a stub elsewhere
+make_tool("bench_monitor", {
+	files = with_core_files { "nppplugin_solutionhub/bench/corpus.*", "nppplugin_solutionhub/bench/bench_monitor.cpp" },
+	windows_files = solutionhub_core_windows_files,
+	includedirs = { "nppplugin_shared/", "nppplugin_solutionhub/src" },
+})
+
+-- strand teardown racing posts from other threads, best run under a memory checker
+make_tool("stress_strand", {
+	files = with_core_files { "nppplugin_solutionhub/bench/stress_strand.cpp" },
+	windows_files = solutionhub_core_windows_files,
+	includedirs = { "nppplugin_shared/", "nppplugin_solutionhub/src" },
+})
+
+-- checks of the index functions, exits with 1 on a failure
+make_tool("test_repository", {
+	files = with_core_files { "nppplugin_solutionhub/bench/test_repository.cpp" },
+	windows_files = solutionhub_core_windows_files,
+	includedirs = { "nppplugin_shared/", "nppplugin_solutionhub/src" },
+})
+
 local function deploy_npp_setup_files()
 	printf("Copying setup files (langs/stylers/misc xml files)")
 	for _, config in ipairs { "debug", "release" } do